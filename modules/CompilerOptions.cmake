@@ -141,6 +141,7 @@ check_include_files(unistd.h HAVE_UNISTD_H)
 
 check_include_files(memory.h HAVE_MEMORY_H)
 check_include_files(pthread.h HAVE_PTHREAD_H)
+check_include_files(sys/eventfd.h HAVE_SYS_EVENTFD_H)
 check_function_exists(getpwuid_r HAVE_GETPWUID_R)
 
 # Find Botan Crypto Backend
@@ -143,3 +143,17 @@ void unloadLibrary(void* moduleHandle)
 #endif
 	}
 }
+
+// Look up a function of the loaded library that is not in the function list
+void* getLibrarySymbol(void* moduleHandle, const char* name)
+{
+	if (moduleHandle == NULL) return NULL;
+
+#if defined(HAVE_LOADLIBRARY)
+	return (void*) GetProcAddress((HMODULE) moduleHandle, name);
+#elif defined(HAVE_DLOPEN)
+	return dlsym(moduleHandle, name);
+#else
+	return NULL;
+#endif
+}
@@ -38,5 +38,6 @@
 CK_C_GetFunctionList loadLibrary(char* module, void** moduleHandle,
 				char **pErrMsg);
 void unloadLibrary(void* moduleHandle);
+void* getLibrarySymbol(void* moduleHandle, const char* name);
 
 #endif // !_SOFTHSM_V2_BIN_LIBRARY_H
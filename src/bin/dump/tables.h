@@ -150,6 +150,7 @@ void fill_CKA_table(std::map<unsigned long, std::string> &t)
 	t[CKA_OS_TOKENFLAGS] = "CKA_OS_TOKENFLAGS";
 	t[CKA_OS_SOPIN] = "CKA_OS_SOPIN";
 	t[CKA_OS_USERPIN] = "CKA_OS_USERPIN";
+	t[CKA_OS_ENVELOPE] = "CKA_OS_ENVELOPE";
 }
 
 void fill_CKM_table(std::map<unsigned long, std::string> &t)
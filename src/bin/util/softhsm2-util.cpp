@@ -36,12 +36,14 @@
 #include "findslot.h"
 #include "getpw.h"
 #include "library.h"
+#include "softhsm2_vendor.h"
 #include "log.h"
 #include "Configuration.h"
 #include "SimpleConfigLoader.h"
 #include "Directory.h"
 #include "MutexFactory.h"
 #include "ObjectStoreToken.h"
+#include "ImageToken.h"
 #include "OSPathSep.h"
 
 #if defined(WITH_OPENSSL)
@@ -54,6 +56,7 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
 #ifndef _WIN32
 #include <unistd.h>
 #include <sys/types.h>
@@ -96,6 +99,9 @@ void usage()
 	printf("Support tool for PKCS#11\n");
 	printf("Usage: softhsm2-util [ACTION] [OPTIONS]\n");
 	printf("Action:\n");
+	printf("  --build-image     Build a read-only image of the token at a given slot.\n");
+	printf("                    Use with --token or --serial.\n");
+	printf("                    The token can not be modified while the image exists.\n");
 	printf("  --delete-token    Delete the token at a given slot.\n");
 	printf("                    Use with --token or --serial.\n");
 	printf("                    WARNING: Any content in token will be erased.\n");
@@ -110,6 +116,9 @@ void usage()
 	printf("                    --label, --so-pin, and --pin.\n");
 	printf("                    WARNING: Any content in token will be erased.\n");
 	printf("  --show-slots      Display all the available slots.\n");
+	printf("  --show-usage      Display the most used keys of the token at a given slot.\n");
+	printf("                    Use with --slot or --token or --serial, --pin,\n");
+	printf("                    --top, and --least-used.\n");
 	printf("  -v                Show version info.\n");
 	printf("  --version         Show version info.\n");
 	printf("Options:\n");
@@ -121,6 +130,7 @@ void usage()
 	printf("                    Use with --force if multiple key pairs may share\n");
 	printf("                    the same ID.\n");
 	printf("  --label <text>    Defines the label of the object or the token.\n");
+	printf("  --least-used      Display the least used keys instead, including unused ones.\n");
 	printf("  --module <path>   Use another PKCS#11 library than SoftHSM.\n");
 	printf("  --no-public-key   Do not import the public key.\n");
 	printf("  --pin <PIN>       The PIN for the normal user.\n");
@@ -128,11 +138,13 @@ void usage()
 	printf("  --slot <number>   The slot where the token is located.\n");
 	printf("  --so-pin <PIN>    The PIN for the Security Officer (SO).\n");
 	printf("  --token <label>   Will use the token with a matching token label.\n");
+	printf("  --top <number>    The number of keys to display. Default is 10.\n");
 }
 
 // Enumeration of the long options
 enum {
-	OPT_DELETE_TOKEN = 0x100,
+	OPT_BUILD_IMAGE = 0x100,
+	OPT_DELETE_TOKEN,
 	OPT_FILE_PIN,
 	OPT_FORCE,
 	OPT_FREE,
@@ -141,20 +153,24 @@ enum {
 	OPT_IMPORT,
 	OPT_INIT_TOKEN,
 	OPT_LABEL,
+	OPT_LEAST_USED,
 	OPT_MODULE,
 	OPT_NO_PUBLIC_KEY,
 	OPT_PIN,
 	OPT_SERIAL,
 	OPT_SHOW_SLOTS,
+	OPT_SHOW_USAGE,
 	OPT_SLOT,
 	OPT_SO_PIN,
 	OPT_TOKEN,
+	OPT_TOP,
 	OPT_VERSION,
 	OPT_AES
 };
 
 // Text representation of the long options
 static const struct option long_options[] = {
+	{ "build-image",     0, NULL, OPT_BUILD_IMAGE },
 	{ "delete-token",    0, NULL, OPT_DELETE_TOKEN },
 	{ "file-pin",        1, NULL, OPT_FILE_PIN },
 	{ "force",           0, NULL, OPT_FORCE },
@@ -164,14 +180,17 @@ static const struct option long_options[] = {
 	{ "import",          1, NULL, OPT_IMPORT },
 	{ "init-token",      0, NULL, OPT_INIT_TOKEN },
 	{ "label",           1, NULL, OPT_LABEL },
+	{ "least-used",      0, NULL, OPT_LEAST_USED },
 	{ "module",          1, NULL, OPT_MODULE },
 	{ "no-public-key",   0, NULL, OPT_NO_PUBLIC_KEY },
 	{ "pin",             1, NULL, OPT_PIN },
 	{ "serial",          1, NULL, OPT_SERIAL },
 	{ "show-slots",      0, NULL, OPT_SHOW_SLOTS },
+	{ "show-usage",      0, NULL, OPT_SHOW_USAGE },
 	{ "slot",            1, NULL, OPT_SLOT },
 	{ "so-pin",          1, NULL, OPT_SO_PIN },
 	{ "token",           1, NULL, OPT_TOKEN },
+	{ "top",             1, NULL, OPT_TOP },
 	{ "version",         0, NULL, OPT_VERSION },
 	{ "aes",             0, NULL, OPT_AES },
 	{ NULL,              0, NULL, 0 }
@@ -195,16 +214,20 @@ int main(int argc, char* argv[])
 	char* slot = NULL;
 	char* serial = NULL;
 	char* token = NULL;
+	char* top = NULL;
 	char* errMsg = NULL;
 	int forceExec = 0;
 	bool freeToken = false;
 	int noPublicKey = 0;
 	bool importAES = false;
+	bool leastUsed = false;
 
 	int doInitToken = 0;
 	int doShowSlots = 0;
+	int doShowUsage = 0;
 	int doImport = 0;
 	int doDeleteToken = 0;
+	int doBuildImage = 0;
 	int action = 0;
 	bool needP11 = false;
 	int rv = 0;
@@ -222,6 +245,11 @@ int main(int argc, char* argv[])
 				action++;
 				needP11 = true;
 				break;
+			case OPT_SHOW_USAGE:
+				doShowUsage = 1;
+				action++;
+				needP11 = true;
+				break;
 			case OPT_INIT_TOKEN:
 				doInitToken = 1;
 				action++;
@@ -240,6 +268,10 @@ int main(int argc, char* argv[])
 				doDeleteToken = 1;
 				action++;
 				break;
+			case OPT_BUILD_IMAGE:
+				doBuildImage = 1;
+				action++;
+				break;
 			case OPT_SLOT:
 				slot = optarg;
 				break;
@@ -252,6 +284,12 @@ int main(int argc, char* argv[])
 			case OPT_TOKEN:
 				token = optarg;
 				break;
+			case OPT_TOP:
+				top = optarg;
+				break;
+			case OPT_LEAST_USED:
+				leastUsed = true;
+				break;
 			case OPT_MODULE:
 				module = optarg;
 				break;
@@ -345,6 +383,17 @@ int main(int argc, char* argv[])
 		rv = showSlots();
 	}
 
+	// Show the most or least used keys
+	if (!rv && doShowUsage)
+	{
+		// Get the slotID
+		rv = findSlot(slot, serial, token, slotID);
+		if (!rv)
+		{
+			rv = showUsage(slotID, userPIN, top, leastUsed);
+		}
+	}
+
 	// Import a key pair from the given path
 	if (!rv && doImport)
 	{
@@ -370,6 +419,19 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	// We should build a token image.
+	if (!rv && doBuildImage)
+	{
+		if (buildImage(serial, token))
+		{
+			rv = 0;
+		}
+		else
+		{
+			rv = 1;
+		}
+	}
+
 	// Finalize the library
 	if (needP11)
 	{
@@ -575,6 +637,56 @@ bool deleteToken(char* serial, char* token)
 	return rv;
 }
 
+// Build a read-only image of the token
+bool buildImage(char* serial, char* token)
+{
+	if (serial == NULL && token == NULL)
+	{
+		fprintf(stderr, "ERROR: A token must be supplied. "
+				"Use --serial <serial> or --token <label>\n");
+		return false;
+	}
+
+	// Initialize the SoftHSM internal functions
+	if (!initSoftHSM())
+	{
+		finalizeSoftHSM();
+		return false;
+	}
+
+	bool rv = true;
+	std::string basedir = Configuration::i()->getString("directories.tokendir", DEFAULT_TOKENDIR);
+	std::string tokendir;
+
+	rv = findTokenDirectory(basedir, tokendir, serial, token);
+
+	if (rv)
+	{
+		// Always build the image from the token in the backend
+		ObjectStoreToken* source = ObjectStoreToken::accessBackendToken(basedir, tokendir);
+		ByteString image;
+
+		rv = source->isValid() &&
+		     ImageToken::buildImage(source, image) &&
+		     ImageToken::writeImage(basedir, tokendir, image);
+
+		delete source;
+
+		if (rv)
+		{
+			printf("The image of the token (%s) has been built.\n", tokendir.c_str());
+		}
+		else
+		{
+			fprintf(stderr, "ERROR: Could not build the image of the token (%s).\n", tokendir.c_str());
+		}
+	}
+
+	finalizeSoftHSM();
+
+	return rv;
+}
+
 bool initSoftHSM()
 {
 	// Not using threading
@@ -1022,6 +1134,116 @@ int showSlots()
 	return 0;
 }
 
+// Show the most or least used keys of the token in the given slot
+int showUsage(CK_SLOT_ID slotID, char* userPIN, char* top, bool leastUsed)
+{
+	char user_pin_copy[MAX_PIN_LEN+1];
+	CK_ULONG ulTop = 10;
+
+	if (top != NULL)
+	{
+		char* end = NULL;
+		ulTop = strtoul(top, &end, 10);
+		if (end == top || *end != '\0' || ulTop == 0)
+		{
+			fprintf(stderr, "ERROR: The number of keys must be a positive number. "
+					"Use --top <number>\n");
+			return 1;
+		}
+	}
+
+	// The usage is a SoftHSM extension
+	CK_C_SoftHSM_GetKeyUsage pGetKeyUsage =
+		(CK_C_SoftHSM_GetKeyUsage) getLibrarySymbol(moduleHandle, "C_SoftHSM_GetKeyUsage");
+	if (pGetKeyUsage == NULL)
+	{
+		fprintf(stderr, "ERROR: The PKCS#11 library does not count the key usage.\n");
+		return 1;
+	}
+
+	// Get the password
+	if (getPW(userPIN, user_pin_copy, CKU_USER) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not get user PIN\n");
+		return 1;
+	}
+
+	CK_SESSION_HANDLE hSession;
+	CK_RV rv = p11->C_OpenSession(slotID, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSession);
+	if (rv != CKR_OK)
+	{
+		if (rv == CKR_SLOT_ID_INVALID)
+		{
+			fprintf(stderr, "ERROR: The given slot does not exist.\n");
+		}
+		else
+		{
+			fprintf(stderr, "ERROR: Could not open a session on the given slot.\n");
+		}
+		return 1;
+	}
+
+	rv = p11->C_Login(hSession, CKU_USER, (CK_UTF8CHAR_PTR)user_pin_copy, strlen(user_pin_copy));
+	if (rv != CKR_OK)
+	{
+		if (rv == CKR_PIN_INCORRECT) {
+			fprintf(stderr, "ERROR: The given user PIN does not match the one in the token.\n");
+		}
+		else
+		{
+			fprintf(stderr, "ERROR: Could not log in on the token.\n");
+		}
+		return 1;
+	}
+
+	CK_SOFTHSM_KEY_USAGE_PTR pUsage = (CK_SOFTHSM_KEY_USAGE_PTR) malloc(ulTop*sizeof(CK_SOFTHSM_KEY_USAGE));
+	if (!pUsage)
+	{
+		fprintf(stderr, "ERROR: Could not allocate memory.\n");
+		return 1;
+	}
+
+	CK_ULONG ulCount = ulTop;
+	rv = pGetKeyUsage(hSession, leastUsed ? CKF_SOFTHSM_USAGE_LEAST_USED : 0, pUsage, &ulCount);
+	if (rv != CKR_OK)
+	{
+		fprintf(stderr, "ERROR: Could not get the key usage.\n");
+		free(pUsage);
+		return 1;
+	}
+
+	printf("%-32s %10s %10s %10s %10s %10s %10s %10s  %s\n", "Label",
+	       "Sign", "Verify", "Encrypt", "Decrypt", "Derive", "Wrap", "Unwrap", "Last used");
+
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		char label[33];
+		CK_ATTRIBUTE labelAttr = { CKA_LABEL, label, sizeof(label) - 1 };
+		if (p11->C_GetAttributeValue(hSession, pUsage[i].hKey, &labelAttr, 1) != CKR_OK)
+		{
+			labelAttr.ulValueLen = 0;
+		}
+		label[labelAttr.ulValueLen] = '\0';
+
+		char lastUsed[32] = "never";
+		time_t when = (time_t) pUsage[i].ulLastUsed;
+		struct tm* tm = localtime(&when);
+		if (pUsage[i].ulLastUsed != 0 && tm != NULL)
+		{
+			strftime(lastUsed, sizeof(lastUsed), "%Y-%m-%d %H:%M:%S", tm);
+		}
+
+		printf("%-32s %10lu %10lu %10lu %10lu %10lu %10lu %10lu  %s\n", label,
+		       pUsage[i].ulSign, pUsage[i].ulVerify, pUsage[i].ulEncrypt,
+		       pUsage[i].ulDecrypt, pUsage[i].ulDerive, pUsage[i].ulWrap,
+		       pUsage[i].ulUnwrap, lastUsed);
+	}
+
+	free(pUsage);
+
+	return 0;
+}
+
 // Import a key pair from given path
 int importKeyPair
 (
@@ -43,10 +43,12 @@ void usage();
 bool checkSetup();
 int initToken(CK_SLOT_ID slotID, char* label, char* soPIN, char* userPIN);
 bool deleteToken(char* serial, char* token);
+bool buildImage(char* serial, char* token);
 bool findTokenDirectory(std::string basedir, std::string& tokendir, char* serial, char* label);
 bool rmdir(std::string path);
 bool rm(std::string path);
 int showSlots();
+int showUsage(CK_SLOT_ID slotID, char* userPIN, char* top, bool leastUsed);
 int importKeyPair(char* filePath, char* filePIN, CK_SLOT_ID slotID, char* userPIN, char* objectLabel, char* objectID, int forceExec, int noPublicKey);
 int importSecretKey(char* filePath, CK_SLOT_ID slotID, char* userPIN, char* label, char* objectID);
 int crypto_import_key_pair(CK_SESSION_HANDLE hSession, char* filePath, char* filePIN, char* label, char* objID, size_t objIDLen, int noPublicKey);
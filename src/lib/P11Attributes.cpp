@@ -36,6 +36,7 @@
 #include "CryptoFactory.h"
 #include "DESKey.h"
 #include "AESKey.h"
+#include "ObjectEnvelope.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -262,6 +263,7 @@ CK_RV P11Attribute::retrieve(Token *token, bool isPrivate, CK_VOID_PTR pValue, C
 		return CKR_GENERAL_ERROR;
 	}
 	OSAttribute attr = osobject->getAttribute(type);
+	ObjectEnvelope envelope(token, osobject);
 
 	// Get the actual attribute size.
 	CK_ULONG attrSize = size;
@@ -273,10 +275,10 @@ CK_RV P11Attribute::retrieve(Token *token, bool isPrivate, CK_VOID_PTR pValue, C
 		// Lower level attribute has to be variable sized.
 		if (attr.isByteStringAttribute())
 		{
-			if (isPrivate && attr.getByteStringValue().size() != 0)
+			if (isPrivate)
 			{
 				ByteString value;
-				if (!token->decrypt(attr.getByteStringValue(),value))
+				if (!envelope.decrypt(type,value))
 				{
 					ERROR_MSG("Internal error: failed to decrypt private attribute value");
 					return CKR_GENERAL_ERROR;
@@ -332,16 +334,19 @@ CK_RV P11Attribute::retrieve(Token *token, bool isPrivate, CK_VOID_PTR pValue, C
 		}
 		else if (attr.isByteStringAttribute())
 		{
-			if (isPrivate && attr.getByteStringValue().size() != 0)
+			if (isPrivate)
 			{
 				ByteString value;
-				if (!token->decrypt(attr.getByteStringValue(),value))
+				if (!envelope.decrypt(type,value))
 				{
 					ERROR_MSG("Internal error: failed to decrypt private attribute value");
 					return CKR_GENERAL_ERROR;
 				}
-				const unsigned char* attrPtr = value.const_byte_str();
-				memcpy(pValue,attrPtr,attrSize);
+				if (value.size() != 0)
+				{
+					const unsigned char* attrPtr = value.const_byte_str();
+					memcpy(pValue,attrPtr,attrSize);
+				}
 			}
 			else if (attr.getByteStringValue().size() != 0)
 			{
@@ -842,7 +847,8 @@ CK_RV P11AttrCheckValue::updateAttr(Token *token, bool isPrivate, CK_VOID_PTR pV
 		ByteString keybits;
 		if (isPrivate)
 		{
-			if (!token->decrypt(osobject->getByteStringValue(CKA_VALUE), keybits))
+			ObjectEnvelope envelope(token, osobject);
+			if (!envelope.decrypt(CKA_VALUE, keybits))
 				return CKR_GENERAL_ERROR;
 		}
 		else
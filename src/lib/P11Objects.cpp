@@ -194,11 +194,31 @@ CK_RV P11Object::saveTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTe
 	if (osobject->startTransaction() == false)
 		return CKR_GENERAL_ERROR;
 
+	CK_RV rv = applyTemplate(token, isPrivate, pTemplate, ulAttributeCount, op);
+	if (rv != CKR_OK)
+	{
+		osobject->abortTransaction();
+		return rv;
+	}
+
+	if (osobject->commitTransaction() == false)
+	{
+		return CKR_GENERAL_ERROR;
+	}
+
+	return CKR_OK;
+}
+
+// Apply the template within the transaction of the caller
+CK_RV P11Object::applyTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulAttributeCount, int op)
+{
+	if (osobject == NULL)
+		return CKR_GENERAL_ERROR;
+
 	if (op == OBJECT_OP_SET)
 	{
 		if (!isModifiable())
 		{
-			osobject->abortTransaction();
 			return CKR_ACTION_PROHIBITED;
 		}
 	}
@@ -210,7 +230,6 @@ CK_RV P11Object::saveTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTe
 	{
 		if (!isCopyable())
 		{
-			osobject->abortTransaction();
 			return CKR_ACTION_PROHIBITED;
 		}
 	}
@@ -226,7 +245,6 @@ CK_RV P11Object::saveTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTe
 
 		if (attr == NULL)
 		{
-			osobject->abortTransaction();
 			return CKR_ATTRIBUTE_TYPE_INVALID;
 		}
 
@@ -234,7 +252,6 @@ CK_RV P11Object::saveTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTe
 		CK_RV rv = attr->update(token,isPrivate, pTemplate[i].pValue, pTemplate[i].ulValueLen, op);
 		if (rv != CKR_OK)
 		{
-			osobject->abortTransaction();
 			return rv;
 		}
 	}
@@ -292,11 +309,6 @@ CK_RV P11Object::saveTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTe
 	//    specific requirement. Note that this final example of an inconsistent template is
 	//    token-dependent—on a different token, such a template might not be inconsistent.
 
-	if (osobject->commitTransaction() == false)
-	{
-		return CKR_GENERAL_ERROR;
-	}
-
 	return CKR_OK;
 }
 
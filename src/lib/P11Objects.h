@@ -68,6 +68,9 @@ public:
 	// Save template
 	CK_RV saveTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulAttributeCount, int op);
 
+	// Apply template within a transaction that is already started
+	CK_RV applyTemplate(Token *token, bool isPrivate, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulAttributeCount, int op);
+
 protected:
 	bool isPrivate();
 	bool isCopyable();
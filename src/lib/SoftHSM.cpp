@@ -66,6 +66,14 @@
 #include "osmutex.h"
 #include "SessionManager.h"
 #include "SessionObjectStore.h"
+#include "MemToken.h"
+#include "FileSyncer.h"
+#include "ObjectIndex.h"
+#include "OSToken.h"
+#include "ObjectFile.h"
+#include "ObjectEnvelope.h"
+#include "OSAttributes.h"
+#include "AttributePool.h"
 #include "HandleManager.h"
 #include "P11Objects.h"
 #include "odd.h"
@@ -76,12 +84,23 @@
 #include "BotanCryptoFactory.h"
 #endif
 
+#include <limits.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#ifdef HAVE_CXX11
+#include <new>
+#include <thread>
+#endif
 
 #include <dlfcn.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 // Initialise the one-and-only instance
 
@@ -95,6 +114,7 @@ std::unique_ptr<OSSLCryptoFactory> OSSLCryptoFactory::instance(nullptr);
 std::unique_ptr<BotanCryptoFactory> BotanCryptoFactory::instance(nullptr);
 #endif
 std::unique_ptr<SoftHSM> SoftHSM::instance(nullptr);
+std::unique_ptr<AsyncQueue> SoftHSM::stoppedQueue(nullptr);
 
 #else
 
@@ -335,6 +355,17 @@ static void resetMutexFactoryCallbacks()
 	MutexFactory::i()->setUnlockMutex(OSUnlockMutex);
 }
 
+// The number of times the process has forked. It is only changed in the
+// child, when there are no other threads yet, so it is never raced.
+static unsigned long forks = 0;
+
+#ifdef HAVE_PTHREAD_H
+static void countFork()
+{
+	forks++;
+}
+#endif
+
 
 // Return the one-and-only instance
 SoftHSM* SoftHSM::i()
@@ -358,17 +389,40 @@ SoftHSM::SoftHSM()
 {
 	isInitialised = false;
 	isRemovable = false;
+	isStateSaveable = false;
 	sessionObjectStore = NULL;
 	objectStore = NULL;
 	slotManager = NULL;
 	sessionManager = NULL;
 	handleManager = NULL;
+	usageStore = NULL;
+#ifdef HAVE_CXX11
+	asyncQueue = NULL;
+	asyncWorkers = 0;
+	opScheduler = NULL;
+#endif
+	initForks = 0;
 	resetMutexFactoryCallbacks();
+
+#ifdef HAVE_PTHREAD_H
+	// A child of a fork must be able to tell that it is not the parent
+	static bool forkHandlerSet = false;
+
+	if (!forkHandlerSet)
+	{
+		forkHandlerSet = (pthread_atfork(NULL, NULL, countFork) == 0);
+	}
+#endif
 }
 
 // Destructor
 SoftHSM::~SoftHSM()
 {
+#ifdef HAVE_CXX11
+	if (asyncQueue != NULL) delete asyncQueue;
+	if (opScheduler != NULL) delete opScheduler;
+#endif
+	if (usageStore != NULL) delete usageStore;
 	if (handleManager != NULL) delete handleManager;
 	if (sessionManager != NULL) delete sessionManager;
 	if (slotManager != NULL) delete slotManager;
@@ -389,8 +443,15 @@ CK_RV SoftHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 	// Check if PKCS#11 is already initialized
 	if (isInitialised)
 	{
-		ERROR_MSG("SoftHSM is already initialized");
-		return CKR_CRYPTOKI_ALREADY_INITIALIZED;
+		// Unless this is the child of a fork, which must initialise again
+		if (forks == initForks)
+		{
+			ERROR_MSG("SoftHSM is already initialized");
+			return CKR_CRYPTOKI_ALREADY_INITIALIZED;
+		}
+
+		DEBUG_MSG("Initialising the child of a fork again");
+		releaseParent();
 	}
 
 	// Do we have any arguments?
@@ -512,6 +573,25 @@ CK_RV SoftHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 		return CKR_GENERAL_ERROR;
 	}
 
+	// The snapshot file is only used by the memory backend
+	MemToken::setSnapshotFile(Configuration::i()->getString("objectstore.snapshot", ""));
+
+	// Serve all tokens read-only
+	ObjectStoreToken::setReadOnly(Configuration::i()->getBool("objectstore.readonly", false));
+
+	// Make the changes to file tokens durable
+	FileSyncer::i()->setEnabled(Configuration::i()->getBool("objectstore.fsync", false));
+
+	// Spread the objects of file tokens over subdirectories
+	OSToken::setSharding(Configuration::i()->getBool("objectstore.sharding", false));
+
+	// Index the objects by the attributes certificates are searched by
+	ObjectIndex::setEnabled(Configuration::i()->getBool("objectstore.index", false));
+
+	// Keep large values of file token objects in blob files
+	int blobSize = Configuration::i()->getInt("objectstore.blobsize", 0);
+	ObjectFile::setBlobSize(blobSize > 0 ? blobSize : 0);
+
 	sessionObjectStore = new SessionObjectStore();
 
 	// Load the object store
@@ -528,6 +608,10 @@ CK_RV SoftHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 
 	isRemovable = Configuration::i()->getBool("slots.removable", false);
 
+	// Digest and HMAC operations can only be saved by C_GetOperationState
+	// if they run on the plain contexts instead of the EVP ones
+	isStateSaveable = Configuration::i()->getBool("operationstate.saveable", false);
+
 	// Load the slot manager
 	slotManager = new SlotManager(objectStore);
 
@@ -535,7 +619,44 @@ CK_RV SoftHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 	sessionManager = new SessionManager();
 
 	// Load the handle manager
-	handleManager = new HandleManager();
+	handleManager = new HandleManager(Configuration::i()->getBool("handles.stable", false));
+
+	// Save the usage counters of the keys to a side file, if enabled
+	std::string usageFile = Configuration::i()->getString("usage.file", "");
+	if (!usageFile.empty())
+	{
+		int usageInterval = Configuration::i()->getInt("usage.interval", 300);
+		usageStore = new UsageStore(usageFile, objectStore, usageInterval > 0 ? usageInterval : 0);
+		if (!usageStore->load())
+		{
+			ERROR_MSG("Could not load the usage file, the usage counters are not saved");
+			delete usageStore;
+			usageStore = NULL;
+		}
+	}
+
+#ifdef HAVE_CXX11
+	// The workers of the asynchronous operations; 0 is one per CPU
+	int workers = Configuration::i()->getInt("async.workers", 0);
+	asyncWorkers = workers > 0 ? workers : 0;
+
+	// Run the expensive operations on a bounded pool, if enabled
+	int heavyWorkers = Configuration::i()->getInt("scheduler.workers", 0);
+	int slotLimit = Configuration::i()->getInt("scheduler.slotlimit", 0);
+	if (heavyWorkers > 0)
+	{
+		opScheduler = new OpScheduler(heavyWorkers, slotLimit > 0 ? slotLimit : 0);
+		if (!opScheduler->isValid())
+		{
+			ERROR_MSG("Could not start the scheduler of expensive operations");
+			delete opScheduler;
+			opScheduler = NULL;
+		}
+	}
+#endif
+
+	// A child of a fork has to initialise again
+	initForks = forks;
 
 	// Set the state to initialised
 	isInitialised = true;
@@ -543,6 +664,62 @@ CK_RV SoftHSM::C_Initialize(CK_VOID_PTR pInitArgs)
 	return CKR_OK;
 }
 
+// Release the state of the parent process in a child of a fork. Threads of
+// the parent may have held any of its mutexes at the fork, and they stay
+// locked in the child. The child has a single thread, so locking is switched
+// off while the sessions and tokens of the parent are freed; this also closes
+// the descriptors they hold. The tokens are then loaded again.
+void SoftHSM::releaseParent()
+{
+	bool locking = MutexFactory::i()->isEnabled();
+
+	MutexFactory::i()->disable();
+
+#ifdef HAVE_CXX11
+	// The workers were not forked along, so the queue and the scheduler
+	// cannot be stopped; only the event descriptor of the queue is closed
+	if (asyncQueue != NULL) asyncQueue->abandon();
+	asyncQueue = NULL;
+	opScheduler = NULL;
+
+	// The workers of a stopped queue have finished, and its completions
+	// belong to the parent
+	stoppedQueue.reset();
+
+	new (&asyncMutex) std::mutex();
+#endif
+	// Neither was the thread that saves the usage counters
+	usageStore = NULL;
+
+	// The tokens of the parent are not saved on behalf of the child
+	MemToken::setSnapshotFile("");
+
+	delete handleManager;
+	handleManager = NULL;
+	delete sessionManager;
+	sessionManager = NULL;
+	delete slotManager;
+	slotManager = NULL;
+	delete objectStore;
+	objectStore = NULL;
+	delete sessionObjectStore;
+	sessionObjectStore = NULL;
+
+	if (locking) MutexFactory::i()->enable();
+
+	// Do not continue the random stream of the parent
+	struct
+	{
+		pid_t pid;
+		time_t now;
+		unsigned long forks;
+	} child = { getpid(), time(NULL), forks };
+	ByteString seed((const unsigned char*)&child, sizeof(child));
+	CryptoFactory::i()->getRNG()->seed(seed);
+
+	isInitialised = false;
+}
+
 // PKCS #11 finalisation function
 CK_RV SoftHSM::C_Finalize(CK_VOID_PTR pReserved)
 {
@@ -553,6 +730,20 @@ CK_RV SoftHSM::C_Finalize(CK_VOID_PTR pReserved)
 	// Must be set to NULL_PTR in this version of PKCS#11
 	if (pReserved != NULL_PTR) return CKR_ARGUMENTS_BAD;
 
+#ifdef HAVE_CXX11
+	// Let the running asynchronous operations finish first; they may be
+	// waiting for the scheduler. The others complete with
+	// CKR_CRYPTOKI_NOT_INITIALIZED, and all completions can still be
+	// harvested.
+	if (asyncQueue != NULL) asyncQueue->stop(CKR_CRYPTOKI_NOT_INITIALIZED);
+	stoppedQueue.reset(asyncQueue);
+	asyncQueue = NULL;
+	if (opScheduler != NULL) delete opScheduler;
+	opScheduler = NULL;
+#endif
+	// Save the usage counters while the tokens are still there
+	if (usageStore != NULL) delete usageStore;
+	usageStore = NULL;
 	if (handleManager != NULL) delete handleManager;
 	handleManager = NULL;
 	if (sessionManager != NULL) delete sessionManager;
@@ -563,6 +754,7 @@ CK_RV SoftHSM::C_Finalize(CK_VOID_PTR pReserved)
 	objectStore = NULL;
 	if (sessionObjectStore != NULL) delete sessionObjectStore;
 	sessionObjectStore = NULL;
+	AttributePool::reset();
 	CryptoFactory::reset();
 	SecureMemoryRegistry::reset();
 
@@ -1220,7 +1412,15 @@ CK_RV SoftHSM::C_InitToken(CK_SLOT_ID slotID, CK_UTF8CHAR_PTR pPin, CK_ULONG ulP
 
 	ByteString soPIN(pPin, ulPinLen);
 
-	return slot->initToken(soPIN, pLabel);
+	CK_RV rv = slot->initToken(soPIN, pLabel);
+
+	// Handles to the objects of the previous token are no longer valid
+	if (rv == CKR_OK)
+	{
+		handleManager->tokenInitialized(slotID);
+	}
+
+	return rv;
 }
 
 // Initialise the user PIN
@@ -1315,6 +1515,12 @@ CK_RV SoftHSM::C_CloseSession(CK_SESSION_HANDLE hSession)
 	Session* session = (Session*)handleManager->getSession(hSession);
 	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
 
+#ifdef HAVE_CXX11
+	// Cancel the queued asynchronous operations of the session
+	AsyncQueue* queue = getAsyncQueue(false);
+	if (queue != NULL) queue->closeSession(hSession);
+#endif
+
 	// Tell the handle manager the session has been closed.
 	handleManager->sessionClosed(hSession);
 
@@ -1339,6 +1545,12 @@ CK_RV SoftHSM::C_CloseAllSessions(CK_SLOT_ID slotID)
 	Token* token = slot->getToken();
 	if (token == NULL) return CKR_TOKEN_NOT_PRESENT;
 
+#ifdef HAVE_CXX11
+	// Cancel the queued asynchronous operations of the sessions
+	AsyncQueue* queue = getAsyncQueue(false);
+	if (queue != NULL) queue->closeSessions(slotID);
+#endif
+
 	// Tell the handle manager all sessions were closed for the given slotID.
 	// The handle manager should then remove all session and object handles for this slot.
 	handleManager->allSessionsClosed(slotID);
@@ -1364,28 +1576,227 @@ CK_RV SoftHSM::C_GetSessionInfo(CK_SESSION_HANDLE hSession, CK_SESSION_INFO_PTR
 	return session->getInfo(pInfo);
 }
 
+// Version of the saved operation state format
+#define OPERATION_STATE_VERSION	1
+
+// Additional authenticated data binding sealed blobs to their purpose
+#define OPERATION_STATE_AAD	ByteString((const unsigned char*)"operation state", 15)
+
+// Get the mechanism used to restart a saved digest operation
+static CK_MECHANISM_TYPE hashAlgoToMechanism(HashAlgo::Type algo)
+{
+	switch (algo)
+	{
+#ifndef WITH_FIPS
+		case HashAlgo::MD5:
+			return CKM_MD5;
+#endif
+		case HashAlgo::SHA1:
+			return CKM_SHA_1;
+		case HashAlgo::SHA224:
+			return CKM_SHA224;
+		case HashAlgo::SHA256:
+			return CKM_SHA256;
+		case HashAlgo::SHA384:
+			return CKM_SHA384;
+		case HashAlgo::SHA512:
+			return CKM_SHA512;
+		default:
+			return CKM_VENDOR_DEFINED;
+	}
+}
+
+// Get the mechanism used to restart a saved MAC operation
+static CK_MECHANISM_TYPE macAlgoToMechanism(MacAlgo::Type algo)
+{
+	switch (algo)
+	{
+#ifndef WITH_FIPS
+		case MacAlgo::HMAC_MD5:
+			return CKM_MD5_HMAC;
+#endif
+		case MacAlgo::HMAC_SHA1:
+			return CKM_SHA_1_HMAC;
+		case MacAlgo::HMAC_SHA224:
+			return CKM_SHA224_HMAC;
+		case MacAlgo::HMAC_SHA256:
+			return CKM_SHA256_HMAC;
+		case MacAlgo::HMAC_SHA384:
+			return CKM_SHA384_HMAC;
+		case MacAlgo::HMAC_SHA512:
+			return CKM_SHA512_HMAC;
+		default:
+			return CKM_VENDOR_DEFINED;
+	}
+}
+
 // Determine the state of a running operation in a session
-CK_RV SoftHSM::C_GetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR /*pOperationState*/, CK_ULONG_PTR /*pulOperationStateLen*/)
+//
+// Only digest and HMAC operations can be saved, and only if they were
+// started with operationstate.saveable set. The state is sealed under
+// the token key, so a user needs to be logged in and the state can only be
+// restored on the same token.
+CK_RV SoftHSM::C_GetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pOperationState, CK_ULONG_PTR pulOperationStateLen)
 {
 	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
 
+	if (pulOperationStateLen == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
 	// Get the session
 	Session* session = (Session*)handleManager->getSession(hSession);
 	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
 
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	CK_MECHANISM_TYPE mechanism = CKM_VENDOR_DEFINED;
+	ByteString kcv;
+	ByteString state;
+
+	switch (session->getOpType())
+	{
+		case SESSION_OP_NONE:
+			return CKR_OPERATION_NOT_INITIALIZED;
+		case SESSION_OP_DIGEST:
+			if (session->getDigestOp() == NULL) return CKR_STATE_UNSAVEABLE;
+
+			mechanism = hashAlgoToMechanism(session->getHashAlgo());
+			if (mechanism == CKM_VENDOR_DEFINED ||
+			    !session->getDigestOp()->getState(state))
+				return CKR_STATE_UNSAVEABLE;
+			break;
+		case SESSION_OP_SIGN:
+		case SESSION_OP_VERIFY:
+			if (session->getMacOp() == NULL || session->getSymmetricKey() == NULL)
+				return CKR_STATE_UNSAVEABLE;
+
+			mechanism = macAlgoToMechanism(session->getMacAlgo());
+			if (mechanism == CKM_VENDOR_DEFINED ||
+			    !session->getMacOp()->getState(state))
+				return CKR_STATE_UNSAVEABLE;
+
+			// Remember which key was used
+			kcv = session->getSymmetricKey()->getKeyCheckValue();
+			break;
+		default:
+			return CKR_STATE_UNSAVEABLE;
+	}
+
+	ByteString plaintext;
+	plaintext += ByteString((unsigned long)OPERATION_STATE_VERSION);
+	plaintext += ByteString((unsigned long)session->getOpType());
+	plaintext += ByteString((unsigned long)mechanism);
+	plaintext += ByteString((unsigned long)(session->getAllowSinglePartOp() ? 1 : 0));
+	plaintext += kcv.serialise();
+	plaintext += state.serialise();
+
+	ByteString sealed;
+	if (!token->seal(plaintext, OPERATION_STATE_AAD, sealed)) return CKR_STATE_UNSAVEABLE;
+
+	if (pOperationState == NULL_PTR)
+	{
+		*pulOperationStateLen = sealed.size();
+		return CKR_OK;
+	}
+
+	if (*pulOperationStateLen < sealed.size())
+	{
+		*pulOperationStateLen = sealed.size();
+		return CKR_BUFFER_TOO_SMALL;
+	}
+
+	memcpy(pOperationState, sealed.const_byte_str(), sealed.size());
+	*pulOperationStateLen = sealed.size();
+
+	return CKR_OK;
 }
 
 // Set the operation sate in a session
-CK_RV SoftHSM::C_SetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR /*pOperationState*/, CK_ULONG /*ulOperationStateLen*/, CK_OBJECT_HANDLE /*hEncryptionKey*/, CK_OBJECT_HANDLE /*hAuthenticationKey*/)
+CK_RV SoftHSM::C_SetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pOperationState, CK_ULONG ulOperationStateLen, CK_OBJECT_HANDLE hEncryptionKey, CK_OBJECT_HANDLE hAuthenticationKey)
 {
 	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
 
+	if (pOperationState == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
 	// Get the session
 	Session* session = (Session*)handleManager->getSession(hSession);
 	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
 
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	ByteString plaintext;
+	if (!token->unseal(ByteString(pOperationState, ulOperationStateLen), OPERATION_STATE_AAD, plaintext))
+		return CKR_SAVED_STATE_INVALID;
+
+	if (plaintext.size() < 4 * 8) return CKR_SAVED_STATE_INVALID;
+
+	unsigned long version = plaintext.firstLong();
+	unsigned long opType = plaintext.firstLong();
+	CK_MECHANISM mechanism = { plaintext.firstLong(), NULL_PTR, 0 };
+	bool allowSinglePartOp = plaintext.firstLong() != 0;
+	ByteString kcv = ByteString::chainDeserialise(plaintext);
+	ByteString state = ByteString::chainDeserialise(plaintext);
+
+	if (version != OPERATION_STATE_VERSION) return CKR_SAVED_STATE_INVALID;
+
+	// No saveable operation uses an encryption key
+	if (hEncryptionKey != CK_INVALID_HANDLE) return CKR_KEY_NOT_NEEDED;
+
+	CK_RV rv;
+
+	switch (opType)
+	{
+		case SESSION_OP_DIGEST:
+			if (hAuthenticationKey != CK_INVALID_HANDLE) return CKR_KEY_NOT_NEEDED;
+
+			// Abandon any running operation
+			session->resetOp();
+
+			rv = C_DigestInit(hSession, &mechanism);
+			if (rv != CKR_OK) return CKR_SAVED_STATE_INVALID;
+
+			if (!session->getDigestOp()->setState(state))
+			{
+				session->resetOp();
+				return CKR_SAVED_STATE_INVALID;
+			}
+			break;
+		case SESSION_OP_SIGN:
+		case SESSION_OP_VERIFY:
+			if (hAuthenticationKey == CK_INVALID_HANDLE) return CKR_KEY_NEEDED;
+
+			// Abandon any running operation
+			session->resetOp();
+
+			if (opType == SESSION_OP_SIGN)
+				rv = MacSignInit(hSession, &mechanism, hAuthenticationKey);
+			else
+				rv = MacVerifyInit(hSession, &mechanism, hAuthenticationKey);
+			if (rv != CKR_OK) return rv;
+
+			// The state must be restored with the key it was saved with
+			if (session->getSymmetricKey()->getKeyCheckValue() != kcv)
+			{
+				session->resetOp();
+				return CKR_KEY_CHANGED;
+			}
+
+			if (!session->getMacOp()->setState(state))
+			{
+				session->resetOp();
+				return CKR_SAVED_STATE_INVALID;
+			}
+			break;
+		default:
+			return CKR_SAVED_STATE_INVALID;
+	}
+
+	session->setAllowSinglePartOp(allowSinglePartOp);
+
+	return CKR_OK;
 }
 
 // Login on the token in the specified session
@@ -1467,7 +1878,11 @@ CK_RV SoftHSM::C_Logout(CK_SESSION_HANDLE hSession)
 // Create a new object on the token in the specified session using the given attribute template
 CK_RV SoftHSM::C_CreateObject(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phObject)
 {
-	return this->CreateObject(hSession,pTemplate,ulCount,phObject,OBJECT_OP_CREATE);
+	CK_RV rv = this->CreateObject(hSession,pTemplate,ulCount,phObject,OBJECT_OP_CREATE);
+	if (rv == CKR_OK)
+		sealObject(hSession, *phObject);
+
+	return rv;
 }
 
 // Create a copy of the object with the specified handle
@@ -1557,7 +1972,9 @@ CK_RV SoftHSM::C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject
 	}
 	if (newobject == NULL) return CKR_GENERAL_ERROR;
 
-	// Copy attributes from object class (CKA_CLASS=0 so the first)
+	// Copy the attributes and apply the template in one transaction, so
+	// the new object is only written once; the copied attributes share
+	// their values with the source object, encrypted values included
 	if (!newobject->startTransaction())
 	{
 		newobject->destroyObject();
@@ -1573,6 +1990,13 @@ CK_RV SoftHSM::C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject
 			break;
 		}
 
+		// The envelope is sealed again for the new object below
+		if (attrType == CKA_OS_ENVELOPE || attrType == CKA_OS_ENVELOPEID)
+		{
+			attrType = object->nextAttributeType(attrType);
+			continue;
+		}
+
 		OSAttribute attr = object->getAttribute(attrType);
 
 		// Upgrade privacy has to encrypt byte strings
@@ -1600,33 +2024,31 @@ CK_RV SoftHSM::C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject
 	}
 	while (attrType != CKA_CLASS);
 
-	if (rv != CKR_OK)
-	{
-		newobject->abortTransaction();
-	}
-	else if (!newobject->commitTransaction())
+	if (rv == CKR_OK && !ObjectEnvelope::copy(token, object, newobject))
 	{
 		rv = CKR_FUNCTION_FAILED;
 	}
 
-	if (rv != CKR_OK)
+	// Get the new P11 object and apply the template
+	P11Object* newp11object = NULL;
+	if (rv == CKR_OK)
 	{
-		newobject->destroyObject();
-		return rv;
+		rv = newP11Object(newobject,&newp11object);
 	}
+	if (rv == CKR_OK)
+	{
+		rv = newp11object->applyTemplate(token, isPrivate != CK_FALSE, pTemplate, ulCount, OBJECT_OP_COPY);
+	}
+	if (newp11object != NULL) delete newp11object;
 
-	// Get the new P11 object
-	P11Object* newp11object = NULL;
-	rv = newP11Object(newobject,&newp11object);
 	if (rv != CKR_OK)
 	{
-		newobject->destroyObject();
-		return rv;
+		newobject->abortTransaction();
+	}
+	else if (!newobject->commitTransaction())
+	{
+		rv = CKR_FUNCTION_FAILED;
 	}
-
-	// Apply the template
-	rv = newp11object->saveTemplate(token, isPrivate != CK_FALSE, pTemplate, ulCount, OBJECT_OP_COPY);
-	delete newp11object;
 
 	if (rv != CKR_OK)
 	{
@@ -1644,6 +2066,8 @@ CK_RV SoftHSM::C_CopyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject
 		*phNewObject = handleManager->addSessionObject(slot->getSlotID(), hSession, isPrivate != CK_FALSE, newobject);
 	}
 
+	sealObject(hSession, *phNewObject);
+
 	return CKR_OK;
 }
 
@@ -1812,6 +2236,9 @@ CK_RV SoftHSM::C_SetAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE
 	// Ask the P11Object to save the template with attribute values.
 	rv = p11object->saveTemplate(token, isPrivate != CK_FALSE, pTemplate,ulCount,OBJECT_OP_SET);
 	delete p11object;
+	if (rv == CKR_OK)
+		sealObject(hSession, hObject);
+
 	return rv;
 }
 
@@ -1852,9 +2279,10 @@ CK_RV SoftHSM::C_FindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pT
 	// Check if we are out of memory
 	if (findOp == NULL_PTR) return CKR_HOST_MEMORY;
 
+	// Only the objects that may match are returned if there is an index
 	std::set<OSObject*> allObjects;
-	token->getObjects(allObjects);
-	sessionObjectStore->getObjects(slot->getSlotID(),allObjects);
+	token->findObjects(pTemplate, ulCount, allObjects);
+	sessionObjectStore->findObjects(slot->getSlotID(), pTemplate, ulCount, allObjects);
 
 	std::set<CK_OBJECT_HANDLE> handles;
 	std::set<OSObject*>::iterator it;
@@ -1873,6 +2301,8 @@ CK_RV SoftHSM::C_FindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pT
 		if (isPublicSession && isPrivateObject)
 			continue; // skip object
 
+		ObjectEnvelope envelope(token, *it);
+
 		// Perform the actual attribute matching.
 		bool bAttrMatch = true; // We let an empty template match everything.
 		for (CK_ULONG i=0; i<ulCount; ++i)
@@ -1907,9 +2337,9 @@ CK_RV SoftHSM::C_FindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pT
 					if (attr.isByteStringAttribute())
 					{
 						ByteString bsAttrValue;
-						if (isPrivateObject && attr.getByteStringValue().size() != 0)
+						if (isPrivateObject)
 						{
-							if (!token->decrypt(attr.getByteStringValue(), bsAttrValue))
+							if (!envelope.decrypt(pTemplate[i].type, bsAttrValue))
 							{
 								delete findOp;
 								return CKR_GENERAL_ERROR;
@@ -2251,6 +2681,8 @@ CK_RV SoftHSM::SymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMech
 	session->setAllowSinglePartOp(true);
 	session->setSymmetricKey(secretkey);
 
+	countUsage(token, key, KeyUsage::Encrypt);
+
 	return CKR_OK;
 }
 
@@ -2350,6 +2782,8 @@ CK_RV SoftHSM::AsymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMec
 	session->setAllowSinglePartOp(true);
 	session->setPublicKey(publicKey);
 
+	countUsage(token, key, KeyUsage::Encrypt);
+
 	return CKR_OK;
 }
 
@@ -2524,8 +2958,8 @@ CK_RV SoftHSM::C_Encrypt(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG
 				   pEncryptedData, pulEncryptedDataLen);
 }
 
-// SymAlgorithm version of C_EncryptUpdate
-static CK_RV SymEncryptUpdate(Session* session, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
+// SymAlgorithm version of C_EncryptUpdate, for data given in one or more segments
+static CK_RV SymEncryptUpdate(Session* session, const DataSegment* segments, size_t count, CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
 {
 	SymmetricAlgorithm* cipher = session->getSymmetricCryptoOp();
 	if (cipher == NULL || !session->getAllowMultiPartOp())
@@ -2534,6 +2968,12 @@ static CK_RV SymEncryptUpdate(Session* session, CK_BYTE_PTR pData, CK_ULONG ulDa
 		return CKR_OPERATION_NOT_INITIALIZED;
 	}
 
+	CK_ULONG ulDataLen = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		ulDataLen += segments[i].size;
+	}
+
 	// Check data size
 	size_t blockSize = cipher->getBlockSize();
 	size_t remainingSize = cipher->getBufferSize();
@@ -2565,12 +3005,10 @@ static CK_RV SymEncryptUpdate(Session* session, CK_BYTE_PTR pData, CK_ULONG ulDa
 		return CKR_BUFFER_TOO_SMALL;
 	}
 
-	// Get the data
-	ByteString data(pData, ulDataLen);
 	ByteString encryptedData;
 
 	// Encrypt the data
-	if (!cipher->encryptUpdate(data, encryptedData))
+	if (!cipher->encryptUpdateSegments(segments, count, encryptedData))
 	{
 		session->resetOp();
 		return CKR_GENERAL_ERROR;
@@ -2613,8 +3051,12 @@ CK_RV SoftHSM::C_EncryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK
 		return CKR_OPERATION_NOT_INITIALIZED;
 
 	if (session->getSymmetricCryptoOp() != NULL)
-		return SymEncryptUpdate(session, pData, ulDataLen,
+	{
+		DataSegment segment = { pData, ulDataLen };
+
+		return SymEncryptUpdate(session, &segment, 1,
 				  pEncryptedData, pulEncryptedDataLen);
+	}
 	else
 		return CKR_FUNCTION_NOT_SUPPORTED;
 }
@@ -2932,6 +3374,8 @@ CK_RV SoftHSM::SymDecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMech
 	session->setAllowSinglePartOp(true);
 	session->setSymmetricKey(secretkey);
 
+	countUsage(token, key, KeyUsage::Decrypt);
+
 	return CKR_OK;
 }
 
@@ -3054,6 +3498,8 @@ CK_RV SoftHSM::AsymDecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMec
 	session->setAllowSinglePartOp(true);
 	session->setPrivateKey(privateKey);
 
+	countUsage(token, key, KeyUsage::Decrypt);
+
 	return CKR_OK;
 }
 
@@ -3412,6 +3858,34 @@ CK_RV SoftHSM::C_DecryptFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_
 		return CKR_FUNCTION_NOT_SUPPORTED;
 }
 
+// Internal: Hash algorithm used by a digest mechanism
+static HashAlgo::Type digestAlgo(CK_MECHANISM_TYPE mechanism)
+{
+	switch (mechanism)
+	{
+#ifndef WITH_FIPS
+		case CKM_MD5:
+			return HashAlgo::MD5;
+#endif
+		case CKM_SHA_1:
+			return HashAlgo::SHA1;
+		case CKM_SHA224:
+			return HashAlgo::SHA224;
+		case CKM_SHA256:
+			return HashAlgo::SHA256;
+		case CKM_SHA384:
+			return HashAlgo::SHA384;
+		case CKM_SHA512:
+			return HashAlgo::SHA512;
+#ifdef WITH_GOST
+		case CKM_GOSTR3411:
+			return HashAlgo::GOST;
+#endif
+		default:
+			return HashAlgo::Unknown;
+	}
+}
+
 // Initialise digesting using the specified mechanism in the specified session
 CK_RV SoftHSM::C_DigestInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism)
 {
@@ -3427,38 +3901,11 @@ CK_RV SoftHSM::C_DigestInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechan
 	if (session->getOpType() != SESSION_OP_NONE) return CKR_OPERATION_ACTIVE;
 
 	// Get the mechanism
-	HashAlgo::Type algo = HashAlgo::Unknown;
-	switch(pMechanism->mechanism) {
-#ifndef WITH_FIPS
-		case CKM_MD5:
-			algo = HashAlgo::MD5;
-			break;
-#endif
-		case CKM_SHA_1:
-			algo = HashAlgo::SHA1;
-			break;
-		case CKM_SHA224:
-			algo = HashAlgo::SHA224;
-			break;
-		case CKM_SHA256:
-			algo = HashAlgo::SHA256;
-			break;
-		case CKM_SHA384:
-			algo = HashAlgo::SHA384;
-			break;
-		case CKM_SHA512:
-			algo = HashAlgo::SHA512;
-			break;
-#ifdef WITH_GOST
-		case CKM_GOSTR3411:
-			algo = HashAlgo::GOST;
-			break;
-#endif
-		default:
-			return CKR_MECHANISM_INVALID;
-	}
+	HashAlgo::Type algo = digestAlgo(pMechanism->mechanism);
+	if (algo == HashAlgo::Unknown) return CKR_MECHANISM_INVALID;
 	HashAlgorithm* hash = CryptoFactory::i()->getHashAlgorithm(algo);
 	if (hash == NULL) return CKR_MECHANISM_INVALID;
+	if (isStateSaveable) hash->setSaveable();
 
 	// Initialize hashing
 	if (hash->hashInit() == false)
@@ -3620,7 +4067,8 @@ CK_RV SoftHSM::C_DigestKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject)
 	ByteString keybits;
 	if (isPrivate)
 	{
-		if (!token->decrypt(key->getByteStringValue(CKA_VALUE), keybits))
+		ObjectEnvelope envelope(token, key);
+		if (!envelope.decrypt(CKA_VALUE, keybits))
 			return CKR_GENERAL_ERROR;
 	}
 	else
@@ -3827,6 +4275,7 @@ CK_RV SoftHSM::MacSignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechani
 	}
 	MacAlgorithm* mac = CryptoFactory::i()->getMacAlgorithm(algo);
 	if (mac == NULL) return CKR_MECHANISM_INVALID;
+	if (isStateSaveable) mac->setSaveable();
 
 	SymmetricKey* privkey = new SymmetricKey();
 
@@ -3858,10 +4307,13 @@ CK_RV SoftHSM::MacSignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechani
 
 	session->setOpType(SESSION_OP_SIGN);
 	session->setMacOp(mac);
+	session->setMacAlgo(algo);
 	session->setAllowMultiPartOp(true);
 	session->setAllowSinglePartOp(true);
 	session->setSymmetricKey(privkey);
 
+	countUsage(token, key, KeyUsage::Sign);
+
 	return CKR_OK;
 }
 
@@ -4295,6 +4747,8 @@ CK_RV SoftHSM::AsymSignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechan
 	session->setAllowSinglePartOp(true);
 	session->setPrivateKey(privateKey);
 
+	countUsage(token, key, KeyUsage::Sign);
+
 	return CKR_OK;
 }
 
@@ -4805,6 +5259,7 @@ CK_RV SoftHSM::MacVerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMecha
 	}
 	MacAlgorithm* mac = CryptoFactory::i()->getMacAlgorithm(algo);
 	if (mac == NULL) return CKR_MECHANISM_INVALID;
+	if (isStateSaveable) mac->setSaveable();
 
 	SymmetricKey* pubkey = new SymmetricKey();
 
@@ -4836,10 +5291,13 @@ CK_RV SoftHSM::MacVerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMecha
 
 	session->setOpType(SESSION_OP_VERIFY);
 	session->setMacOp(mac);
+	session->setMacAlgo(algo);
 	session->setAllowMultiPartOp(true);
 	session->setAllowSinglePartOp(true);
 	session->setSymmetricKey(pubkey);
 
+	countUsage(token, key, KeyUsage::Verify);
+
 	return CKR_OK;
 }
 
@@ -5265,6 +5723,8 @@ CK_RV SoftHSM::AsymVerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMech
 	session->setAllowSinglePartOp(true);
 	session->setPublicKey(publicKey);
 
+	countUsage(token, key, KeyUsage::Verify);
+
 	return CKR_OK;
 }
 
@@ -5642,6 +6102,15 @@ CK_RV SoftHSM::C_DecryptVerifyUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR /*p
 
 // Generate a secret key or a domain parameter set using the specified mechanism
 CK_RV SoftHSM::C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phKey)
+{
+	CK_RV rv = this->GenerateKey(hSession, pMechanism, pTemplate, ulCount, phKey);
+	if (rv == CKR_OK)
+		sealObject(hSession, *phKey);
+
+	return rv;
+}
+
+CK_RV SoftHSM::GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phKey)
 {
 	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
 
@@ -5739,12 +6208,26 @@ CK_RV SoftHSM::C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMecha
 	// Generate DSA domain parameters
 	if (pMechanism->mechanism == CKM_DSA_PARAMETER_GEN)
 	{
-		return this->generateDSAParameters(hSession, pTemplate, ulCount, phKey, isOnToken, isPrivate);
+#ifdef HAVE_CXX11
+		if (opScheduler != NULL)
+			return opScheduler->run(session->getSlot()->getSlotID(), hSession, [&]
+			{
+				return this->generateDSAParameters(hSession, pTemplate, ulCount, phKey, isOnToken, isPrivate);
+			});
+#endif
+		return this->generateDSAParameters(hSession, pTemplate, ulCount, phKey, isOnToken, isPrivate);
 	}
 
 	// Generate DH domain parameters
 	if (pMechanism->mechanism == CKM_DH_PKCS_PARAMETER_GEN)
 	{
+#ifdef HAVE_CXX11
+		if (opScheduler != NULL)
+			return opScheduler->run(session->getSlot()->getSlotID(), hSession, [&]
+			{
+				return this->generateDHParameters(hSession, pTemplate, ulCount, phKey, isOnToken, isPrivate);
+			});
+#endif
 		return this->generateDHParameters(hSession, pTemplate, ulCount, phKey, isOnToken, isPrivate);
 	}
 
@@ -5793,6 +6276,31 @@ CK_RV SoftHSM::C_GenerateKeyPair
 	CK_OBJECT_HANDLE_PTR phPublicKey,
 	CK_OBJECT_HANDLE_PTR phPrivateKey
 )
+{
+	CK_RV rv = this->GenerateKeyPair(hSession, pMechanism,
+					 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+					 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+					 phPublicKey, phPrivateKey);
+	if (rv == CKR_OK)
+	{
+		sealObject(hSession, *phPublicKey);
+		sealObject(hSession, *phPrivateKey);
+	}
+
+	return rv;
+}
+
+CK_RV SoftHSM::GenerateKeyPair
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_OBJECT_HANDLE_PTR phPublicKey,
+	CK_OBJECT_HANDLE_PTR phPrivateKey
+)
 {
 	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
 
@@ -5804,6 +6312,108 @@ CK_RV SoftHSM::C_GenerateKeyPair
 	Session* session = (Session*)handleManager->getSession(hSession);
 	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
 
+	// Check the mechanism and the templates
+	CK_BBOOL ispublicKeyToken = CK_FALSE;
+	CK_BBOOL ispublicKeyPrivate = CK_FALSE;
+	CK_BBOOL isprivateKeyToken = CK_FALSE;
+	CK_BBOOL isprivateKeyPrivate = CK_TRUE;
+	CK_RV rv = checkKeyPairTemplates(session, pMechanism,
+					 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+					 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+					 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	if (rv != CKR_OK)
+		return rv;
+
+	// Generate RSA keys
+	if (pMechanism->mechanism == CKM_RSA_PKCS_KEY_PAIR_GEN)
+	{
+#ifdef HAVE_CXX11
+		if (opScheduler != NULL)
+			return opScheduler->run(session->getSlot()->getSlotID(), hSession, [&]
+			{
+				return this->generateRSA(hSession,
+							 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+							 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+							 phPublicKey, phPrivateKey,
+							 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+			});
+#endif
+			return this->generateRSA(hSession,
+									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+									 phPublicKey, phPrivateKey,
+									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	}
+
+	// Generate DSA keys
+	if (pMechanism->mechanism == CKM_DSA_KEY_PAIR_GEN)
+	{
+			return this->generateDSA(hSession,
+									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+									 phPublicKey, phPrivateKey,
+									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	}
+
+	// Generate EC keys
+	if (pMechanism->mechanism == CKM_EC_KEY_PAIR_GEN)
+	{
+			return this->generateEC(hSession,
+									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+									 phPublicKey, phPrivateKey,
+									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	}
+
+	// Generate DH keys
+	if (pMechanism->mechanism == CKM_DH_PKCS_KEY_PAIR_GEN)
+	{
+			return this->generateDH(hSession,
+									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+									 phPublicKey, phPrivateKey,
+									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	}
+
+	// Generate GOST keys
+	if (pMechanism->mechanism == CKM_GOSTR3410_KEY_PAIR_GEN)
+	{
+			return this->generateGOST(hSession,
+									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+									 phPublicKey, phPrivateKey,
+									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	}
+
+	// Generate EDDSA keys
+	if (pMechanism->mechanism == CKM_EC_EDWARDS_KEY_PAIR_GEN)
+	{
+			return this->generateED(hSession,
+									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+									 phPublicKey, phPrivateKey,
+									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	}
+
+	return CKR_GENERAL_ERROR;
+}
+
+// Check the mechanism and the templates of a key pair generation, and return
+// where the keys are stored
+CK_RV SoftHSM::checkKeyPairTemplates
+(
+	Session* session,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_BBOOL& ispublicKeyToken,
+	CK_BBOOL& ispublicKeyPrivate,
+	CK_BBOOL& isprivateKeyToken,
+	CK_BBOOL& isprivateKeyPrivate
+)
+{
 	// Check the mechanism, only accept RSA, DSA, EC and DH key pair generation.
 	CK_KEY_TYPE keyType;
 	switch (pMechanism->mechanism)
@@ -5839,8 +6449,8 @@ CK_RV SoftHSM::C_GenerateKeyPair
 
 	// Extract information from the public key template that is needed to create the object.
 	CK_OBJECT_CLASS publicKeyClass = CKO_PUBLIC_KEY;
-	CK_BBOOL ispublicKeyToken = CK_FALSE;
-	CK_BBOOL ispublicKeyPrivate = CK_FALSE;
+	ispublicKeyToken = CK_FALSE;
+	ispublicKeyPrivate = CK_FALSE;
 	bool isPublicKeyImplicit = true;
 	extractObjectInformation(pPublicKeyTemplate, ulPublicKeyAttributeCount, publicKeyClass, keyType, dummy, ispublicKeyToken, ispublicKeyPrivate, isPublicKeyImplicit);
 
@@ -5862,8 +6472,8 @@ CK_RV SoftHSM::C_GenerateKeyPair
 
 	// Extract information from the private key template that is needed to create the object.
 	CK_OBJECT_CLASS privateKeyClass = CKO_PRIVATE_KEY;
-	CK_BBOOL isprivateKeyToken = CK_FALSE;
-	CK_BBOOL isprivateKeyPrivate = CK_TRUE;
+	isprivateKeyToken = CK_FALSE;
+	isprivateKeyPrivate = CK_TRUE;
 	bool isPrivateKeyImplicit = true;
 	extractObjectInformation(pPrivateKeyTemplate, ulPrivateKeyAttributeCount, privateKeyClass, keyType, dummy, isprivateKeyToken, isprivateKeyPrivate, isPrivateKeyImplicit);
 
@@ -5895,67 +6505,114 @@ CK_RV SoftHSM::C_GenerateKeyPair
 		return rv;
 	}
 
-	// Generate RSA keys
-	if (pMechanism->mechanism == CKM_RSA_PKCS_KEY_PAIR_GEN)
-	{
-			return this->generateRSA(hSession,
-									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
-									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
-									 phPublicKey, phPrivateKey,
-									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
-	}
+	return CKR_OK;
+}
 
-	// Generate DSA keys
-	if (pMechanism->mechanism == CKM_DSA_KEY_PAIR_GEN)
+// Internal: Symmetric algorithm used by a key wrapping mechanism
+static SymAlgo::Type symWrapAlgo(CK_MECHANISM_TYPE mechanism)
+{
+	switch (mechanism)
 	{
-			return this->generateDSA(hSession,
-									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
-									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
-									 phPublicKey, phPrivateKey,
-									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+#ifdef HAVE_AES_KEY_WRAP
+		case CKM_AES_KEY_WRAP:
+			return SymAlgo::AES;
+#endif
+#ifdef HAVE_AES_KEY_WRAP_PAD
+		case CKM_AES_KEY_WRAP_PAD:
+			return SymAlgo::AES;
+#endif
+		default:
+			return SymAlgo::Unknown;
 	}
+}
 
-	// Generate EC keys
-	if (pMechanism->mechanism == CKM_EC_KEY_PAIR_GEN)
-	{
-			return this->generateEC(hSession,
-									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
-									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
-									 phPublicKey, phPrivateKey,
-									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
-	}
+// Internal: A batch operation of which slices of items can run in parallel
+class SlicedTask
+{
+public:
+	virtual ~SlicedTask() { }
 
-	// Generate DH keys
-	if (pMechanism->mechanism == CKM_DH_PKCS_KEY_PAIR_GEN)
+	// Process the items from begin to end; worker 0 runs on the calling
+	// thread, the other workers need algorithm instances of their own
+	virtual CK_RV run(size_t worker, size_t begin, size_t end) = 0;
+};
+
+// Internal: Split count items over worker threads, each with a slice of at
+// least minSlice items, and return the first error of the slices
+static CK_RV runSliced(size_t count, size_t minSlice, SlicedTask& task)
+{
+	// Only spread the batch over threads when each gets a useful share
+	size_t workers = 1;
+#ifdef HAVE_CXX11
+	workers = std::thread::hardware_concurrency();
+	if (workers > count / minSlice)
+		workers = count / minSlice;
+	if (workers < 1)
+		workers = 1;
+#endif
+
+	size_t slice = (count + workers - 1) / workers;
+	std::vector<CK_RV> results(workers, CKR_OK);
+#ifdef HAVE_CXX11
+	std::vector<std::thread> threads;
+	for (size_t w = 1; w < workers; w++)
 	{
-			return this->generateDH(hSession,
-									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
-									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
-									 phPublicKey, phPrivateKey,
-									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+		size_t begin = std::min(w * slice, count);
+		size_t end = std::min(begin + slice, count);
+		threads.push_back(std::thread([=, &task, &results]
+		{
+			results[w] = task.run(w, begin, end);
+		}));
 	}
+#endif
+	results[0] = task.run(0, 0, std::min(slice, count));
+#ifdef HAVE_CXX11
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+#endif
 
-	// Generate GOST keys
-	if (pMechanism->mechanism == CKM_GOSTR3410_KEY_PAIR_GEN)
+	for (size_t w = 0; w < workers; w++)
 	{
-			return this->generateGOST(hSession,
-									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
-									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
-									 phPublicKey, phPrivateKey,
-									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+		if (results[w] != CKR_OK)
+			return results[w];
 	}
 
-	// Generate EDDSA keys
-	if (pMechanism->mechanism == CKM_EC_EDWARDS_KEY_PAIR_GEN)
+	return CKR_OK;
+}
+
+// Internal: Get the cipher and the key for symmetric key (un)wrapping
+CK_RV SoftHSM::getSymWrapKey
+(
+	CK_MECHANISM_PTR pMechanism,
+	Token* token,
+	OSObject* wrapKey,
+	SymmetricAlgorithm*& cipher,
+	SymmetricKey*& wrappingkey
+)
+{
+	// Get the symmetric algorithm matching the mechanism
+	SymAlgo::Type algo = symWrapAlgo(pMechanism->mechanism);
+	size_t bb = 8;
+	if (algo == SymAlgo::Unknown) return CKR_MECHANISM_INVALID;
+
+	cipher = CryptoFactory::i()->getSymmetricAlgorithm(algo);
+	if (cipher == NULL) return CKR_MECHANISM_INVALID;
+
+	wrappingkey = new SymmetricKey();
+
+	if (getSymmetricKey(wrappingkey, token, wrapKey) != CKR_OK)
 	{
-			return this->generateED(hSession,
-									 pPublicKeyTemplate, ulPublicKeyAttributeCount,
-									 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
-									 phPublicKey, phPrivateKey,
-									 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+		cipher->recycleKey(wrappingkey);
+		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+		cipher = NULL;
+		wrappingkey = NULL;
+		return CKR_GENERAL_ERROR;
 	}
 
-	return CKR_GENERAL_ERROR;
+	// adjust key bit length
+	wrappingkey->setBitLen(wrappingkey->getKeyBits().size() * bb);
+
+	return CKR_OK;
 }
 
 // Internal: Wrap blob using symmetric key
@@ -5968,10 +6625,29 @@ CK_RV SoftHSM::WrapKeySym
 	ByteString& wrapped
 )
 {
-	// Get the symmetric algorithm matching the mechanism
-	SymAlgo::Type algo = SymAlgo::Unknown;
+	SymmetricAlgorithm* cipher = NULL;
+	SymmetricKey* wrappingkey = NULL;
+	CK_RV rv = getSymWrapKey(pMechanism, token, wrapKey, cipher, wrappingkey);
+	if (rv != CKR_OK) return rv;
+
+	rv = WrapKeySym(pMechanism, cipher, wrappingkey, keydata, wrapped);
+
+	cipher->recycleKey(wrappingkey);
+	CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+	return rv;
+}
+
+// Internal: Wrap blob using a symmetric key that has already been set up
+CK_RV SoftHSM::WrapKeySym
+(
+	CK_MECHANISM_PTR pMechanism,
+	SymmetricAlgorithm* cipher,
+	const SymmetricKey* wrappingkey,
+	ByteString& keydata,
+	ByteString& wrapped
+)
+{
 	SymWrap::Type mode = SymWrap::Unknown;
-	size_t bb = 8;
 #ifdef HAVE_AES_KEY_WRAP
 	CK_ULONG wrappedlen = keydata.size();
 
@@ -5991,44 +6667,22 @@ CK_RV SoftHSM::WrapKeySym
 		case CKM_AES_KEY_WRAP:
 			if ((wrappedlen < 16) || ((wrappedlen % 8) != 0))
 				return CKR_KEY_SIZE_RANGE;
-			algo = SymAlgo::AES;
 			mode = SymWrap::AES_KEYWRAP;
 			break;
 #endif
 #ifdef HAVE_AES_KEY_WRAP_PAD
 		case CKM_AES_KEY_WRAP_PAD:
-			algo = SymAlgo::AES;
 			mode = SymWrap::AES_KEYWRAP_PAD;
 			break;
 #endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
-	SymmetricAlgorithm* cipher = CryptoFactory::i()->getSymmetricAlgorithm(algo);
-	if (cipher == NULL) return CKR_MECHANISM_INVALID;
-
-	SymmetricKey* wrappingkey = new SymmetricKey();
-
-	if (getSymmetricKey(wrappingkey, token, wrapKey) != CKR_OK)
-	{
-		cipher->recycleKey(wrappingkey);
-		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
-		return CKR_GENERAL_ERROR;
-	}
-
-	// adjust key bit length
-	wrappingkey->setBitLen(wrappingkey->getKeyBits().size() * bb);
 
 	// Wrap the key
 	if (!cipher->wrapKey(wrappingkey, mode, keydata, wrapped))
-	{
-		cipher->recycleKey(wrappingkey);
-		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
 		return CKR_GENERAL_ERROR;
-	}
 
-	cipher->recycleKey(wrappingkey);
-	CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
 	return CKR_OK;
 }
 
@@ -6121,26 +6775,15 @@ CK_RV SoftHSM::WrapKeyAsym
 }
 
 
-// Wrap the specified key using the specified wrapping key and mechanism
-CK_RV SoftHSM::C_WrapKey
+// Internal: Check the mechanism and the wrapping key of a key wrap
+CK_RV SoftHSM::getWrappingKey
 (
-	CK_SESSION_HANDLE hSession,
+	Session* session,
 	CK_MECHANISM_PTR pMechanism,
 	CK_OBJECT_HANDLE hWrappingKey,
-	CK_OBJECT_HANDLE hKey,
-	CK_BYTE_PTR pWrappedKey,
-	CK_ULONG_PTR pulWrappedKeyLen
+	OSObject*& wrapKey
 )
 {
-	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
-
-	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
-	if (pulWrappedKeyLen == NULL_PTR) return CKR_ARGUMENTS_BAD;
-
-	// Get the session
-	Session* session = (Session*)handleManager->getSession(hSession);
-	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
-
 	CK_RV rv;
 	// Check the mechanism, only accept advanced AES key wrapping and RSA
 	switch(pMechanism->mechanism)
@@ -6167,12 +6810,8 @@ CK_RV SoftHSM::C_WrapKey
 			return CKR_MECHANISM_INVALID;
 	}
 
-	// Get the token
-	Token* token = session->getToken();
-	if (token == NULL) return CKR_GENERAL_ERROR;
-
 	// Check the wrapping key handle.
-	OSObject *wrapKey = (OSObject *)handleManager->getObject(hWrappingKey);
+	wrapKey = (OSObject *)handleManager->getObject(hWrappingKey);
 	if (wrapKey == NULL_PTR || !wrapKey->isValid()) return CKR_WRAPPING_KEY_HANDLE_INVALID;
 
 	CK_BBOOL isWrapKeyOnToken = wrapKey->getBooleanValue(CKA_TOKEN, false);
@@ -6208,6 +6847,22 @@ CK_RV SoftHSM::C_WrapKey
     if (!isMechanismPermitted(wrapKey, pMechanism))
 		return CKR_MECHANISM_INVALID;
 
+	return CKR_OK;
+}
+
+// Internal: Check a key that is to be wrapped and get its key data
+CK_RV SoftHSM::getKeyToWrap
+(
+	Session* session,
+	Token* token,
+	CK_MECHANISM_PTR pMechanism,
+	OSObject* wrapKey,
+	CK_OBJECT_HANDLE hKey,
+	ByteString& keydata
+)
+{
+	CK_RV rv;
+
 	// Check the to be wrapped key handle.
 	OSObject *key = (OSObject *)handleManager->getObject(hKey);
 	if (key == NULL_PTR || !key->isValid()) return CKR_KEY_HANDLE_INVALID;
@@ -6268,12 +6923,12 @@ CK_RV SoftHSM::C_WrapKey
 	}
 
 	// Get the key data to encrypt
-	ByteString keydata;
 	if (keyClass == CKO_SECRET_KEY)
 	{
 		if (isKeyPrivate)
 		{
-			bool bOK = token->decrypt(key->getByteStringValue(CKA_VALUE), keydata);
+			ObjectEnvelope envelope(token, key);
+			bool bOK = envelope.decrypt(CKA_VALUE, keydata);
 			if (!bOK) return CKR_GENERAL_ERROR;
 		}
 		else
@@ -6357,7 +7012,46 @@ CK_RV SoftHSM::C_WrapKey
 	if (keydata.size() == 0)
 		return CKR_KEY_NOT_WRAPPABLE;
 
-	keyClass = wrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED);
+	return CKR_OK;
+}
+
+// Wrap the specified key using the specified wrapping key and mechanism
+CK_RV SoftHSM::C_WrapKey
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hWrappingKey,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pWrappedKey,
+	CK_ULONG_PTR pulWrappedKeyLen
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pulWrappedKeyLen == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Check the mechanism and the wrapping key
+	OSObject* wrapKey = NULL;
+	CK_RV rv = getWrappingKey(session, pMechanism, hWrappingKey, wrapKey);
+	if (rv != CKR_OK)
+		return rv;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	// Get the key data to encrypt
+	ByteString keydata;
+	rv = getKeyToWrap(session, token, pMechanism, wrapKey, hKey, keydata);
+	if (rv != CKR_OK)
+		return rv;
+
+	CK_OBJECT_CLASS keyClass = wrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED);
 	ByteString wrapped;
 	if (keyClass == CKO_SECRET_KEY)
 		rv = SoftHSM::WrapKeySym(pMechanism, token, wrapKey, keydata, wrapped);
@@ -6371,12 +7065,99 @@ CK_RV SoftHSM::C_WrapKey
 			memcpy(pWrappedKey, wrapped.byte_str(), wrapped.size());
 		else
 			rv = CKR_BUFFER_TOO_SMALL;
+
+		// A call that only returns the length is not counted
+		if (rv == CKR_OK)
+			countUsage(token, wrapKey, KeyUsage::Wrap);
 	}
 
 	*pulWrappedKeyLen = wrapped.size();
 	return rv;
 }
 
+// Wrap a batch of keys using one wrapping key and mechanism
+CK_RV SoftHSM::C_SoftHSM_WrapKeyBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hWrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_OBJECT_HANDLE_PTR phKeys,
+	CK_BYTE_PTR* ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (ulKeyCount == 0) return CKR_ARGUMENTS_BAD;
+	if (phKeys == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pulWrappedKeyLens == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (ppWrappedKeys != NULL_PTR)
+	{
+		for (CK_ULONG i = 0; i < ulKeyCount; i++)
+		{
+			if (ppWrappedKeys[i] == NULL_PTR) return CKR_ARGUMENTS_BAD;
+		}
+	}
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Check the mechanism and the wrapping key once for the whole batch
+	OSObject* wrapKey = NULL;
+	CK_RV rv = getWrappingKey(session, pMechanism, hWrappingKey, wrapKey);
+	if (rv != CKR_OK)
+		return rv;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	// Check all keys before wrapping any of them
+	std::vector<ByteString> keydata(ulKeyCount);
+	for (CK_ULONG i = 0; i < ulKeyCount; i++)
+	{
+		rv = getKeyToWrap(session, token, pMechanism, wrapKey, phKeys[i], keydata[i]);
+		if (rv != CKR_OK)
+			return rv;
+	}
+
+	std::vector<ByteString> wrapped(ulKeyCount);
+	if (wrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) == CKO_SECRET_KEY)
+	{
+		rv = SymWrapBatch(pMechanism, token, wrapKey, true, keydata, wrapped);
+	}
+	else
+	{
+		for (CK_ULONG i = 0; i < ulKeyCount && rv == CKR_OK; i++)
+			rv = WrapKeyAsym(pMechanism, token, wrapKey, keydata[i], wrapped[i]);
+	}
+	if (rv != CKR_OK)
+		return rv;
+
+	// Return the wrapped keys, or only their lengths when there are no buffers
+	for (CK_ULONG i = 0; i < ulKeyCount; i++)
+	{
+		if (ppWrappedKeys != NULL_PTR)
+		{
+			if (pulWrappedKeyLens[i] >= wrapped[i].size())
+				memcpy(ppWrappedKeys[i], wrapped[i].byte_str(), wrapped[i].size());
+			else
+				rv = CKR_BUFFER_TOO_SMALL;
+		}
+
+		pulWrappedKeyLens[i] = wrapped[i].size();
+	}
+
+	// A call that only returns the lengths is not counted
+	if (ppWrappedKeys != NULL_PTR && rv == CKR_OK)
+		countUsage(token, wrapKey, KeyUsage::Wrap, ulKeyCount);
+
+	return rv;
+}
+
 // Internal: Unwrap blob using symmetric key
 CK_RV SoftHSM::UnwrapKeySym
 (
@@ -6387,47 +7168,117 @@ CK_RV SoftHSM::UnwrapKeySym
 	ByteString& keydata
 )
 {
-	// Get the symmetric algorithm matching the mechanism
-	SymAlgo::Type algo = SymAlgo::Unknown;
+	SymmetricAlgorithm* cipher = NULL;
+	SymmetricKey* unwrappingkey = NULL;
+	CK_RV rv = getSymWrapKey(pMechanism, token, unwrapKey, cipher, unwrappingkey);
+	if (rv != CKR_OK) return rv;
+
+	rv = UnwrapKeySym(pMechanism, wrapped, cipher, unwrappingkey, keydata);
+
+	cipher->recycleKey(unwrappingkey);
+	CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+	return rv;
+}
+
+// Internal: Unwrap blob using a symmetric key that has already been set up
+CK_RV SoftHSM::UnwrapKeySym
+(
+	CK_MECHANISM_PTR pMechanism,
+	ByteString& wrapped,
+	SymmetricAlgorithm* cipher,
+	const SymmetricKey* unwrappingkey,
+	ByteString& keydata
+)
+{
 	SymWrap::Type mode = SymWrap::Unknown;
-	size_t bb = 8;
 	switch(pMechanism->mechanism) {
 #ifdef HAVE_AES_KEY_WRAP
 		case CKM_AES_KEY_WRAP:
-			algo = SymAlgo::AES;
 			mode = SymWrap::AES_KEYWRAP;
 			break;
 #endif
 #ifdef HAVE_AES_KEY_WRAP_PAD
 		case CKM_AES_KEY_WRAP_PAD:
-			algo = SymAlgo::AES;
 			mode = SymWrap::AES_KEYWRAP_PAD;
 			break;
 #endif
 		default:
 			return CKR_MECHANISM_INVALID;
 	}
-	SymmetricAlgorithm* cipher = CryptoFactory::i()->getSymmetricAlgorithm(algo);
-	if (cipher == NULL) return CKR_MECHANISM_INVALID;
 
-	SymmetricKey* unwrappingkey = new SymmetricKey();
+	// Unwrap the key
+	if (!cipher->unwrapKey(unwrappingkey, mode, wrapped, keydata))
+		return CKR_GENERAL_ERROR;
+
+	return CKR_OK;
+}
+
+// Internal: Wrap or unwrap the blobs of a slice of a batch
+class SoftHSM::SymWrapTask : public SlicedTask
+{
+public:
+	SymWrapTask(SoftHSM* inSoftHSM, CK_MECHANISM_PTR inMechanism, SymmetricAlgorithm* inCipher, const SymmetricKey* inKey, bool inWrap, std::vector<ByteString>& inIn, std::vector<ByteString>& inOut) :
+		softHSM(inSoftHSM), pMechanism(inMechanism), cipher(inCipher), key(inKey), wrap(inWrap), in(inIn), out(inOut)
+	{
+	}
 
-	if (getSymmetricKey(unwrappingkey, token, unwrapKey) != CKR_OK)
+	virtual CK_RV run(size_t worker, size_t begin, size_t end)
 	{
-		cipher->recycleKey(unwrappingkey);
-		CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
-		return CKR_GENERAL_ERROR;
+		SymmetricAlgorithm* own = cipher;
+		if (worker > 0)
+		{
+			own = CryptoFactory::i()->getSymmetricAlgorithm(symWrapAlgo(pMechanism->mechanism));
+			if (own == NULL) return CKR_HOST_MEMORY;
+		}
+
+		CK_RV rv = CKR_OK;
+		for (size_t i = begin; rv == CKR_OK && i < end; i++)
+		{
+			if (wrap)
+				rv = softHSM->WrapKeySym(pMechanism, own, key, in[i], out[i]);
+			else
+				rv = softHSM->UnwrapKeySym(pMechanism, in[i], own, key, out[i]);
+		}
+
+		if (worker > 0)
+			CryptoFactory::i()->recycleSymmetricAlgorithm(own);
+
+		return rv;
 	}
 
-	// adjust key bit length
-	unwrappingkey->setBitLen(unwrappingkey->getKeyBits().size() * bb);
+private:
+	SoftHSM* softHSM;
+	CK_MECHANISM_PTR pMechanism;
+	SymmetricAlgorithm* cipher;
+	const SymmetricKey* key;
+	bool wrap;
+	std::vector<ByteString>& in;
+	std::vector<ByteString>& out;
+};
 
-	// Unwrap the key
-	CK_RV rv = CKR_OK;
-	if (!cipher->unwrapKey(unwrappingkey, mode, wrapped, keydata))
-		rv = CKR_GENERAL_ERROR;
-	cipher->recycleKey(unwrappingkey);
+// Internal: Wrap or unwrap a batch of blobs using one symmetric key
+CK_RV SoftHSM::SymWrapBatch
+(
+	CK_MECHANISM_PTR pMechanism,
+	Token* token,
+	OSObject* key,
+	bool wrap,
+	std::vector<ByteString>& in,
+	std::vector<ByteString>& out
+)
+{
+	// The key is reconstructed once and shared read-only by all workers
+	SymmetricAlgorithm* cipher = NULL;
+	SymmetricKey* symKey = NULL;
+	CK_RV rv = getSymWrapKey(pMechanism, token, key, cipher, symKey);
+	if (rv != CKR_OK) return rv;
+
+	SymWrapTask task(this, pMechanism, cipher, symKey, wrap, in, out);
+	rv = runSliced(in.size(), 256, task);
+
+	cipher->recycleKey(symKey);
 	CryptoFactory::i()->recycleSymmetricAlgorithm(cipher);
+
 	return rv;
 }
 
@@ -6492,30 +7343,13 @@ CK_RV SoftHSM::UnwrapKeyAsym
 	return rv;
 }
 
-// Unwrap the specified key using the specified unwrapping key
-CK_RV SoftHSM::C_UnwrapKey
+// Internal: Check the mechanism of a key unwrap against a wrapped key length
+CK_RV SoftHSM::checkUnwrapMechanism
 (
-	CK_SESSION_HANDLE hSession,
 	CK_MECHANISM_PTR pMechanism,
-	CK_OBJECT_HANDLE hUnwrappingKey,
-	CK_BYTE_PTR pWrappedKey,
-	CK_ULONG ulWrappedKeyLen,
-	CK_ATTRIBUTE_PTR pTemplate,
-	CK_ULONG ulCount,
-	CK_OBJECT_HANDLE_PTR hKey
+	CK_ULONG ulWrappedKeyLen
 )
 {
-	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
-
-	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
-	if (pWrappedKey == NULL_PTR) return CKR_ARGUMENTS_BAD;
-	if (pTemplate == NULL_PTR) return CKR_ARGUMENTS_BAD;
-	if (hKey == NULL_PTR) return CKR_ARGUMENTS_BAD;
-
-	// Get the session
-	Session* session = (Session*)handleManager->getSession(hSession);
-	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
-
 	CK_RV rv;
 	// Check the mechanism
 	switch(pMechanism->mechanism)
@@ -6553,12 +7387,22 @@ CK_RV SoftHSM::C_UnwrapKey
 			return CKR_MECHANISM_INVALID;
 	}
 
-	// Get the token
-	Token* token = session->getToken();
-	if (token == NULL) return CKR_GENERAL_ERROR;
+	return CKR_OK;
+}
+
+// Internal: Check the unwrapping key of a key unwrap
+CK_RV SoftHSM::getUnwrappingKey
+(
+	Session* session,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hUnwrappingKey,
+	OSObject*& unwrapKey
+)
+{
+	CK_RV rv;
 
 	// Check the unwrapping key handle.
-	OSObject *unwrapKey = (OSObject *)handleManager->getObject(hUnwrappingKey);
+	unwrapKey = (OSObject *)handleManager->getObject(hUnwrappingKey);
 	if (unwrapKey == NULL_PTR || !unwrapKey->isValid()) return CKR_UNWRAPPING_KEY_HANDLE_INVALID;
 
 	CK_BBOOL isUnwrapKeyOnToken = unwrapKey->getBooleanValue(CKA_TOKEN, false);
@@ -6594,13 +7438,30 @@ CK_RV SoftHSM::C_UnwrapKey
 	if (!isMechanismPermitted(unwrapKey, pMechanism))
 		return CKR_MECHANISM_INVALID;
 
+	return CKR_OK;
+}
+
+// Internal: Check the template of a key that is to be unwrapped
+CK_RV SoftHSM::getUnwrapTemplate
+(
+	Session* session,
+	OSObject* unwrapKey,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	UnwrapTemplate& unwrapTemplate
+)
+{
+	CK_RV rv;
+
 	// Extract information from the template that is needed to create the object.
-	CK_OBJECT_CLASS objClass;
-	CK_KEY_TYPE keyType;
-	CK_BBOOL isOnToken = CK_FALSE;
-	CK_BBOOL isPrivate = CK_TRUE;
+	CK_OBJECT_CLASS& objClass = unwrapTemplate.objClass;
+	CK_KEY_TYPE& keyType = unwrapTemplate.keyType;
+	CK_BBOOL& isOnToken = unwrapTemplate.isOnToken;
+	CK_BBOOL& isPrivate = unwrapTemplate.isPrivate;
 	CK_CERTIFICATE_TYPE dummy;
 	bool isImplicit = false;
+	isOnToken = CK_FALSE;
+	isPrivate = CK_TRUE;
 	rv = extractObjectInformation(pTemplate, ulCount, objClass, keyType, dummy, isOnToken, isPrivate, isImplicit);
 	if (rv != CKR_OK)
 	{
@@ -6626,14 +7487,18 @@ CK_RV SoftHSM::C_UnwrapKey
 	}
 
 	// Build unwrapped key template
-	const CK_ULONG maxAttribs = 32;
-	CK_ATTRIBUTE secretAttribs[maxAttribs] = {
+	const CK_ULONG maxAttribs = UnwrapTemplate::maxAttribs;
+	CK_ATTRIBUTE* secretAttribs = unwrapTemplate.attribs;
+	CK_ULONG& secretAttribsCount = unwrapTemplate.count;
+	CK_ATTRIBUTE keyAttribs[] = {
 		{ CKA_CLASS, &objClass, sizeof(objClass) },
 		{ CKA_TOKEN, &isOnToken, sizeof(isOnToken) },
 		{ CKA_PRIVATE, &isPrivate, sizeof(isPrivate) },
 		{ CKA_KEY_TYPE, &keyType, sizeof(keyType) }
 	};
-	CK_ULONG secretAttribsCount = 4;
+	secretAttribsCount = 0;
+	for (CK_ULONG i = 0; i < sizeof(keyAttribs) / sizeof(keyAttribs[0]); ++i)
+		secretAttribs[secretAttribsCount++] = keyAttribs[i];
 
 	// Add the additional
 	if (ulCount > (maxAttribs - secretAttribsCount))
@@ -6695,22 +7560,25 @@ CK_RV SoftHSM::C_UnwrapKey
 		}
 	}
 
-	*hKey = CK_INVALID_HANDLE;
+	return CKR_OK;
+}
 
-	// Unwrap the key
-	ByteString wrapped(pWrappedKey, ulWrappedKeyLen);
-	ByteString keydata;
-	if (unwrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) == CKO_SECRET_KEY)
-		rv = UnwrapKeySym(pMechanism, wrapped, token, unwrapKey, keydata);
-	else if (unwrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) == CKO_PRIVATE_KEY)
-		rv = UnwrapKeyAsym(pMechanism, wrapped, token, unwrapKey, keydata);
-	else
-		rv = CKR_UNWRAPPING_KEY_TYPE_INCONSISTENT;
-	if (rv != CKR_OK)
-		return rv;
+// Internal: Create an unwrapped key object holding the given key data
+CK_RV SoftHSM::createUnwrappedKey
+(
+	CK_SESSION_HANDLE hSession,
+	Token* token,
+	UnwrapTemplate& unwrapTemplate,
+	ByteString& keydata,
+	CK_OBJECT_HANDLE_PTR hKey
+)
+{
+	CK_RV rv;
+
+	*hKey = CK_INVALID_HANDLE;
 
 	// Create the secret object using C_CreateObject
-	rv = this->CreateObject(hSession, secretAttribs, secretAttribsCount, hKey, OBJECT_OP_UNWRAP);
+	rv = this->CreateObject(hSession, unwrapTemplate.attribs, unwrapTemplate.count, hKey, OBJECT_OP_UNWRAP);
 
 	// Store the attributes that are being supplied
 	if (rv == CKR_OK)
@@ -6718,7 +7586,7 @@ CK_RV SoftHSM::C_UnwrapKey
 		OSObject* osobject = (OSObject*)handleManager->getObject(*hKey);
 		if (osobject == NULL_PTR || !osobject->isValid())
 			rv = CKR_FUNCTION_FAILED;
-		if (osobject->startTransaction())
+		else if (osobject->startTransaction())
 		{
 			bool bOK = true;
 
@@ -6730,69 +7598,1097 @@ CK_RV SoftHSM::C_UnwrapKey
 			bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, false);
 
 			// Secret Attributes
-			if (objClass == CKO_SECRET_KEY)
+			if (unwrapTemplate.objClass == CKO_SECRET_KEY)
 			{
 				ByteString value;
-				if (isPrivate)
+				if (unwrapTemplate.isPrivate)
 					token->encrypt(keydata, value);
 				else
 					value = keydata;
 				bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
 			}
-			else if (keyType == CKK_RSA)
+			else if (unwrapTemplate.keyType == CKK_RSA)
 			{
-				bOK = bOK && setRSAPrivateKey(osobject, keydata, token, isPrivate != CK_FALSE);
+				bOK = bOK && setRSAPrivateKey(osobject, keydata, token, unwrapTemplate.isPrivate != CK_FALSE);
 			}
-			else if (keyType == CKK_DSA)
+			else if (unwrapTemplate.keyType == CKK_DSA)
 			{
-				bOK = bOK && setDSAPrivateKey(osobject, keydata, token, isPrivate != CK_FALSE);
+				bOK = bOK && setDSAPrivateKey(osobject, keydata, token, unwrapTemplate.isPrivate != CK_FALSE);
 			}
-			else if (keyType == CKK_DH)
+			else if (unwrapTemplate.keyType == CKK_DH)
 			{
-				bOK = bOK && setDHPrivateKey(osobject, keydata, token, isPrivate != CK_FALSE);
+				bOK = bOK && setDHPrivateKey(osobject, keydata, token, unwrapTemplate.isPrivate != CK_FALSE);
 			}
 #ifdef WITH_ECC
-			else if (keyType == CKK_EC)
+			else if (unwrapTemplate.keyType == CKK_EC)
 			{
-				bOK = bOK && setECPrivateKey(osobject, keydata, token, isPrivate != CK_FALSE);
+				bOK = bOK && setECPrivateKey(osobject, keydata, token, unwrapTemplate.isPrivate != CK_FALSE);
 			}
 #endif
 #ifdef WITH_GOST
-			else if (keyType == CKK_GOSTR3410)
+			else if (unwrapTemplate.keyType == CKK_GOSTR3410)
 			{
-				bOK = bOK && setGOSTPrivateKey(osobject, keydata, token, isPrivate != CK_FALSE);
+				bOK = bOK && setGOSTPrivateKey(osobject, keydata, token, unwrapTemplate.isPrivate != CK_FALSE);
 			}
 #endif
 			else
 				bOK = false;
 
-			if (bOK)
-				bOK = osobject->commitTransaction();
-			else
-				osobject->abortTransaction();
+			if (bOK)
+				bOK = osobject->commitTransaction();
+			else
+				osobject->abortTransaction();
+
+			if (!bOK)
+				rv = CKR_FUNCTION_FAILED;
+		}
+		else
+			rv = CKR_FUNCTION_FAILED;
+	}
+
+	// Remove secret that may have been created already when the function fails.
+	if (rv != CKR_OK)
+	{
+		if (*hKey != CK_INVALID_HANDLE)
+		{
+			OSObject* obj = (OSObject*)handleManager->getObject(*hKey);
+			handleManager->destroyObject(*hKey);
+			if (obj) obj->destroyObject();
+			*hKey = CK_INVALID_HANDLE;
+		}
+
+	}
+	else
+	{
+		sealObject(hSession, *hKey);
+	}
+
+	return rv;
+}
+
+// Unwrap the specified key using the specified unwrapping key
+CK_RV SoftHSM::C_UnwrapKey
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hUnwrappingKey,
+	CK_BYTE_PTR pWrappedKey,
+	CK_ULONG ulWrappedKeyLen,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR hKey
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pWrappedKey == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pTemplate == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (hKey == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Check the mechanism
+	CK_RV rv = checkUnwrapMechanism(pMechanism, ulWrappedKeyLen);
+	if (rv != CKR_OK)
+		return rv;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	// Check the unwrapping key
+	OSObject* unwrapKey = NULL;
+	rv = getUnwrappingKey(session, pMechanism, hUnwrappingKey, unwrapKey);
+	if (rv != CKR_OK)
+		return rv;
+
+	// Check the template and build the one of the unwrapped key
+	UnwrapTemplate unwrapTemplate;
+	rv = getUnwrapTemplate(session, unwrapKey, pTemplate, ulCount, unwrapTemplate);
+	if (rv != CKR_OK)
+		return rv;
+
+	*hKey = CK_INVALID_HANDLE;
+
+	// Unwrap the key
+	ByteString wrapped(pWrappedKey, ulWrappedKeyLen);
+	ByteString keydata;
+	if (unwrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) == CKO_SECRET_KEY)
+		rv = UnwrapKeySym(pMechanism, wrapped, token, unwrapKey, keydata);
+	else if (unwrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) == CKO_PRIVATE_KEY)
+		rv = UnwrapKeyAsym(pMechanism, wrapped, token, unwrapKey, keydata);
+	else
+		rv = CKR_UNWRAPPING_KEY_TYPE_INCONSISTENT;
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = createUnwrappedKey(hSession, token, unwrapTemplate, keydata, hKey);
+	if (rv == CKR_OK)
+		countUsage(token, unwrapKey, KeyUsage::Unwrap);
+
+	return rv;
+}
+
+// Unwrap a batch of keys using one unwrapping key and mechanism
+CK_RV SoftHSM::C_SoftHSM_UnwrapKeyBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hUnwrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_BYTE_PTR* ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens,
+	CK_ATTRIBUTE_PTR* ppTemplates,
+	CK_ULONG_PTR pulCounts,
+	CK_OBJECT_HANDLE_PTR phKeys
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (ulKeyCount == 0) return CKR_ARGUMENTS_BAD;
+	if (ppWrappedKeys == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pulWrappedKeyLens == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (ppTemplates == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pulCounts == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (phKeys == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	for (CK_ULONG i = 0; i < ulKeyCount; i++)
+	{
+		if (ppWrappedKeys[i] == NULL_PTR) return CKR_ARGUMENTS_BAD;
+		if (ppTemplates[i] == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	}
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Check the mechanism
+	CK_RV rv;
+	for (CK_ULONG i = 0; i < ulKeyCount; i++)
+	{
+		rv = checkUnwrapMechanism(pMechanism, pulWrappedKeyLens[i]);
+		if (rv != CKR_OK)
+			return rv;
+	}
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	// Check the unwrapping key once for the whole batch
+	OSObject* unwrapKey = NULL;
+	rv = getUnwrappingKey(session, pMechanism, hUnwrappingKey, unwrapKey);
+	if (rv != CKR_OK)
+		return rv;
+
+	// Check all templates before unwrapping any of the keys. The templates
+	// point into themselves, so the vector must not be resized from here on.
+	std::vector<UnwrapTemplate> unwrapTemplates(ulKeyCount);
+	for (CK_ULONG i = 0; i < ulKeyCount; i++)
+	{
+		rv = getUnwrapTemplate(session, unwrapKey, ppTemplates[i], pulCounts[i], unwrapTemplates[i]);
+		if (rv != CKR_OK)
+			return rv;
+	}
+
+	for (CK_ULONG i = 0; i < ulKeyCount; i++)
+		phKeys[i] = CK_INVALID_HANDLE;
+
+	// Unwrap the keys
+	std::vector<ByteString> wrapped(ulKeyCount);
+	std::vector<ByteString> keydata(ulKeyCount);
+	for (CK_ULONG i = 0; i < ulKeyCount; i++)
+		wrapped[i] = ByteString(ppWrappedKeys[i], pulWrappedKeyLens[i]);
+	if (unwrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) == CKO_SECRET_KEY)
+	{
+		rv = SymWrapBatch(pMechanism, token, unwrapKey, false, wrapped, keydata);
+	}
+	else if (unwrapKey->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED) == CKO_PRIVATE_KEY)
+	{
+		for (CK_ULONG i = 0; i < ulKeyCount && rv == CKR_OK; i++)
+			rv = UnwrapKeyAsym(pMechanism, wrapped[i], token, unwrapKey, keydata[i]);
+	}
+	else
+		rv = CKR_UNWRAPPING_KEY_TYPE_INCONSISTENT;
+	if (rv != CKR_OK)
+		return rv;
+
+	// Create the objects only once every key has been unwrapped; the token
+	// announces them together at the end
+	token->beginBatch();
+
+	CK_ULONG created = 0;
+	for (; created < ulKeyCount; created++)
+	{
+		rv = createUnwrappedKey(hSession, token, unwrapTemplates[created], keydata[created], &phKeys[created]);
+		if (rv != CKR_OK)
+			break;
+	}
+
+	// Either all keys are created or none of them
+	if (rv != CKR_OK)
+	{
+		for (CK_ULONG i = 0; i < created; i++)
+		{
+			OSObject* obj = (OSObject*)handleManager->getObject(phKeys[i]);
+			handleManager->destroyObject(phKeys[i]);
+			if (obj) obj->destroyObject();
+			phKeys[i] = CK_INVALID_HANDLE;
+		}
+	}
+
+	token->endBatch();
+
+	if (rv == CKR_OK)
+	{
+		countUsage(token, unwrapKey, KeyUsage::Unwrap, ulKeyCount);
+	}
+
+	return rv;
+}
+
+// Queue a single-part signing operation
+CK_RV SoftHSM::C_SoftHSM_SignAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_BYTE_PTR pSignature,
+	CK_ULONG_PTR pulSignatureLen,
+	CK_VOID_PTR pTag
+)
+{
+#ifdef HAVE_CXX11
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	CK_MECHANISM mechanism = *pMechanism;
+
+	return submitAsync(hSession, pTag, [=]() mutable -> CK_RV
+	{
+		return runOnInternalSession(hSession, [&](CK_SESSION_HANDLE hInternal) -> CK_RV
+		{
+			CK_RV rv = C_SignInit(hInternal, &mechanism, hKey);
+			if (rv != CKR_OK) return rv;
+
+			return C_Sign(hInternal, pData, ulDataLen, pSignature, pulSignatureLen);
+		});
+	});
+#else
+	(void)hSession; (void)pMechanism; (void)hKey; (void)pData; (void)ulDataLen;
+	(void)pSignature; (void)pulSignatureLen; (void)pTag;
+
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Queue a single-part decryption operation
+CK_RV SoftHSM::C_SoftHSM_DecryptAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pEncryptedData,
+	CK_ULONG ulEncryptedDataLen,
+	CK_BYTE_PTR pData,
+	CK_ULONG_PTR pulDataLen,
+	CK_VOID_PTR pTag
+)
+{
+#ifdef HAVE_CXX11
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	CK_MECHANISM mechanism = *pMechanism;
+
+	return submitAsync(hSession, pTag, [=]() mutable -> CK_RV
+	{
+		return runOnInternalSession(hSession, [&](CK_SESSION_HANDLE hInternal) -> CK_RV
+		{
+			CK_RV rv = C_DecryptInit(hInternal, &mechanism, hKey);
+			if (rv != CKR_OK) return rv;
+
+			return C_Decrypt(hInternal, pEncryptedData, ulEncryptedDataLen, pData, pulDataLen);
+		});
+	});
+#else
+	(void)hSession; (void)pMechanism; (void)hKey; (void)pEncryptedData; (void)ulEncryptedDataLen;
+	(void)pData; (void)pulDataLen; (void)pTag;
+
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Queue the derivation of a key
+CK_RV SoftHSM::C_SoftHSM_DeriveKeyAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hBaseKey,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+)
+{
+#ifdef HAVE_CXX11
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	CK_MECHANISM mechanism = *pMechanism;
+
+	return submitAsync(hSession, pTag, [=]() mutable -> CK_RV
+	{
+		return C_DeriveKey(hSession, &mechanism, hBaseKey, pTemplate, ulCount, phKey);
+	});
+#else
+	(void)hSession; (void)pMechanism; (void)hBaseKey; (void)pTemplate; (void)ulCount;
+	(void)phKey; (void)pTag;
+
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Queue the generation of a secret key
+CK_RV SoftHSM::C_SoftHSM_GenerateKeyAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+)
+{
+#ifdef HAVE_CXX11
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	CK_MECHANISM mechanism = *pMechanism;
+
+	return submitAsync(hSession, pTag, [=]() mutable -> CK_RV
+	{
+		return C_GenerateKey(hSession, &mechanism, pTemplate, ulCount, phKey);
+	});
+#else
+	(void)hSession; (void)pMechanism; (void)pTemplate; (void)ulCount; (void)phKey; (void)pTag;
+
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Queue the generation of a key pair
+CK_RV SoftHSM::C_SoftHSM_GenerateKeyPairAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_OBJECT_HANDLE_PTR phPublicKey,
+	CK_OBJECT_HANDLE_PTR phPrivateKey,
+	CK_VOID_PTR pTag
+)
+{
+#ifdef HAVE_CXX11
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	CK_MECHANISM mechanism = *pMechanism;
+
+	return submitAsync(hSession, pTag, [=]() mutable -> CK_RV
+	{
+		return C_GenerateKeyPair(hSession, &mechanism,
+					 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+					 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+					 phPublicKey, phPrivateKey);
+	});
+#else
+	(void)hSession; (void)pMechanism; (void)pPublicKeyTemplate; (void)ulPublicKeyAttributeCount;
+	(void)pPrivateKeyTemplate; (void)ulPrivateKeyAttributeCount; (void)phPublicKey; (void)phPrivateKey;
+	(void)pTag;
+
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Return the descriptor that signals waiting completions
+CK_RV SoftHSM::C_SoftHSM_GetAsyncEventFd(int* pFd)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pFd == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+#ifdef HAVE_CXX11
+	if (!MutexFactory::i()->isEnabled()) return CKR_CANT_LOCK;
+
+	AsyncQueue* queue = getAsyncQueue(true);
+	if (queue == NULL) return CKR_GENERAL_ERROR;
+
+	*pFd = queue->getEventFd();
+	if (*pFd == -1) return CKR_FUNCTION_NOT_SUPPORTED;
+
+	return CKR_OK;
+#else
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Take the results of finished asynchronous operations
+CK_RV SoftHSM::C_SoftHSM_HarvestCompletions
+(
+	CK_SOFTHSM_COMPLETION_PTR pCompletions,
+	CK_ULONG ulMaxCount,
+	CK_ULONG_PTR pulCount
+)
+{
+#ifdef HAVE_CXX11
+	// The completions of the operations that C_Finalize ended remain
+	AsyncQueue* queue = getAsyncQueue(false);
+
+	if (!isInitialised && queue == NULL) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pCompletions == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pulCount == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	*pulCount = 0;
+
+	// Nothing has been submitted if there is no queue yet
+	if (queue != NULL) *pulCount = queue->harvest(pCompletions, ulMaxCount);
+
+	return CKR_OK;
+#else
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	(void)pCompletions; (void)ulMaxCount; (void)pulCount;
+
+	return CKR_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
+// Point the crypto segments at the segments of the caller; only an empty
+// segment may come without data
+static bool getDataSegments(CK_SOFTHSM_SEGMENT_PTR pSegments, CK_ULONG ulSegmentCount, std::vector<DataSegment>& segments)
+{
+	segments.resize(ulSegmentCount);
+
+	for (CK_ULONG i = 0; i < ulSegmentCount; i++)
+	{
+		if (pSegments[i].pData == NULL_PTR && pSegments[i].ulLen != 0) return false;
+
+		segments[i].data = pSegments[i].pData;
+		segments[i].size = pSegments[i].ulLen;
+	}
+
+	return true;
+}
+
+// Feed data in one or more segments to the running encryption operation
+CK_RV SoftHSM::C_SoftHSM_EncryptUpdateV
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount,
+	CK_BYTE_PTR pEncryptedPart,
+	CK_ULONG_PTR pulEncryptedPartLen
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pSegments == NULL_PTR || ulSegmentCount == 0) return CKR_ARGUMENTS_BAD;
+	if (pulEncryptedPartLen == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	std::vector<DataSegment> segments;
+	if (!getDataSegments(pSegments, ulSegmentCount, segments)) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Check if we are doing the correct operation
+	if (session->getOpType() != SESSION_OP_ENCRYPT)
+		return CKR_OPERATION_NOT_INITIALIZED;
+
+	if (session->getSymmetricCryptoOp() != NULL)
+		return SymEncryptUpdate(session, &segments[0], segments.size(),
+				  pEncryptedPart, pulEncryptedPartLen);
+	else
+		return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+// Feed data in one or more segments to the running digest operation
+CK_RV SoftHSM::C_SoftHSM_DigestUpdateV
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pSegments == NULL_PTR || ulSegmentCount == 0) return CKR_ARGUMENTS_BAD;
+
+	std::vector<DataSegment> segments;
+	if (!getDataSegments(pSegments, ulSegmentCount, segments)) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Check if we are doing the correct operation
+	if (session->getOpType() != SESSION_OP_DIGEST) return CKR_OPERATION_NOT_INITIALIZED;
+
+	// Digest the data
+	if (session->getDigestOp()->hashUpdateSegments(&segments[0], segments.size()) == false)
+	{
+		session->resetOp();
+		return CKR_GENERAL_ERROR;
+	}
+
+	return CKR_OK;
+}
+
+// Internal: Digest the messages of a slice of a batch
+class DigestTask : public SlicedTask
+{
+public:
+	DigestTask(HashAlgo::Type inAlgo, HashAlgorithm* inHash, CK_BYTE_PTR* inData, CK_ULONG_PTR inDataLens, CK_BYTE_PTR inDigests, size_t inDigestLen) :
+		algo(inAlgo), hash(inHash), ppData(inData), pulDataLens(inDataLens), pDigests(inDigests), digestLen(inDigestLen)
+	{
+	}
+
+	virtual CK_RV run(size_t worker, size_t begin, size_t end)
+	{
+		HashAlgorithm* own = hash;
+		if (worker > 0)
+		{
+			own = CryptoFactory::i()->getHashAlgorithm(algo);
+			if (own == NULL) return CKR_HOST_MEMORY;
+		}
+
+		CK_RV rv = CKR_OK;
+		ByteString digest;
+
+		for (size_t i = begin; rv == CKR_OK && i < end; i++)
+		{
+			DataSegment segment = { ppData[i], pulDataLens[i] };
+
+			if (!own->hashInit() ||
+			    !own->hashUpdateSegments(&segment, 1) ||
+			    !own->hashFinal(digest) ||
+			    digest.size() != digestLen)
+				rv = CKR_GENERAL_ERROR;
+			else
+				memcpy(pDigests + i * digestLen, digest.const_byte_str(), digestLen);
+		}
+
+		if (worker > 0)
+			CryptoFactory::i()->recycleHashAlgorithm(own);
+
+		return rv;
+	}
+
+private:
+	HashAlgo::Type algo;
+	HashAlgorithm* hash;
+	CK_BYTE_PTR* ppData;
+	CK_ULONG_PTR pulDataLens;
+	CK_BYTE_PTR pDigests;
+	size_t digestLen;
+};
+
+// Digest a batch of independent messages with one mechanism
+CK_RV SoftHSM::C_SoftHSM_DigestBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ULONG ulCount,
+	CK_BYTE_PTR* ppData,
+	CK_ULONG_PTR pulDataLens,
+	CK_BYTE_PTR pDigests,
+	CK_ULONG_PTR pulDigestsLen
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (ulCount == 0 || ppData == NULL_PTR || pulDataLens == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pulDigestsLen == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Get the mechanism
+	HashAlgo::Type algo = digestAlgo(pMechanism->mechanism);
+	if (algo == HashAlgo::Unknown) return CKR_MECHANISM_INVALID;
+	HashAlgorithm* hash = CryptoFactory::i()->getHashAlgorithm(algo);
+	if (hash == NULL) return CKR_MECHANISM_INVALID;
+
+	// The digests must fit in one buffer
+	size_t digestLen = hash->getHashSize();
+	if (ulCount > ULONG_MAX / digestLen)
+	{
+		CryptoFactory::i()->recycleHashAlgorithm(hash);
+		return CKR_ARGUMENTS_BAD;
+	}
+
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		if (ppData[i] == NULL_PTR && pulDataLens[i] != 0)
+		{
+			CryptoFactory::i()->recycleHashAlgorithm(hash);
+			return CKR_ARGUMENTS_BAD;
+		}
+	}
+
+	// Return size
+	CK_ULONG size = ulCount * digestLen;
+	if (pDigests == NULL_PTR)
+	{
+		CryptoFactory::i()->recycleHashAlgorithm(hash);
+		*pulDigestsLen = size;
+		return CKR_OK;
+	}
+
+	// Check buffer size
+	if (*pulDigestsLen < size)
+	{
+		CryptoFactory::i()->recycleHashAlgorithm(hash);
+		*pulDigestsLen = size;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+
+	DigestTask task(algo, hash, ppData, pulDataLens, pDigests, digestLen);
+	CK_RV rv = runSliced(ulCount, 1024, task);
+
+	CryptoFactory::i()->recycleHashAlgorithm(hash);
+
+	if (rv == CKR_OK)
+		*pulDigestsLen = size;
+
+	return rv;
+}
+
+// Return the state of the scheduler of expensive operations
+CK_RV SoftHSM::C_SoftHSM_GetSchedulerInfo(CK_SOFTHSM_SCHEDULER_INFO_PTR pInfo)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pInfo == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	memset(pInfo, 0, sizeof(*pInfo));
+
+#ifdef HAVE_CXX11
+	if (opScheduler != NULL) opScheduler->getInfo(pInfo);
+#endif
+
+	return CKR_OK;
+}
+
+// Internal: Generate the key pairs of a slice of a batch
+class KeyPairTask : public SlicedTask
+{
+public:
+	KeyPairTask(AsymAlgo::Type inAlgo, AsymmetricAlgorithm* inAsym, AsymmetricKeyPair** inKeyPairs, AsymmetricParameters* inParameters) :
+		algo(inAlgo), asym(inAsym), kps(inKeyPairs), parameters(inParameters)
+	{
+	}
+
+	virtual CK_RV run(size_t worker, size_t begin, size_t end)
+	{
+		AsymmetricAlgorithm* own = asym;
+		if (worker > 0)
+		{
+			own = CryptoFactory::i()->getAsymmetricAlgorithm(algo);
+			if (own == NULL) return CKR_HOST_MEMORY;
+		}
+
+		bool generated = own->generateKeyPairs(&kps[begin], end - begin, parameters);
+
+		if (worker > 0)
+			CryptoFactory::i()->recycleAsymmetricAlgorithm(own);
+
+		return generated ? CKR_OK : CKR_GENERAL_ERROR;
+	}
+
+private:
+	AsymAlgo::Type algo;
+	AsymmetricAlgorithm* asym;
+	AsymmetricKeyPair** kps;
+	AsymmetricParameters* parameters;
+};
+
+// Generate several EC or EDDSA key pairs from one pair of templates
+CK_RV SoftHSM::C_SoftHSM_GenerateKeyPairBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phPublicKeys,
+	CK_OBJECT_HANDLE_PTR phPrivateKeys
+)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pMechanism == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (pPublicKeyTemplate == NULL_PTR && ulPublicKeyAttributeCount != 0) return CKR_ARGUMENTS_BAD;
+	if (pPrivateKeyTemplate == NULL_PTR && ulPrivateKeyAttributeCount != 0) return CKR_ARGUMENTS_BAD;
+	if (ulCount == 0) return CKR_ARGUMENTS_BAD;
+	if (phPublicKeys == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if (phPrivateKeys == NULL_PTR) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Only EC and EDDSA key pairs are generated in batches
+	AsymAlgo::Type algo;
+	switch (pMechanism->mechanism)
+	{
+#ifdef WITH_ECC
+		case CKM_EC_KEY_PAIR_GEN:
+			algo = AsymAlgo::ECDSA;
+			break;
+#endif
+#ifdef WITH_EDDSA
+		case CKM_EC_EDWARDS_KEY_PAIR_GEN:
+			algo = AsymAlgo::EDDSA;
+			break;
+#endif
+		default:
+			return CKR_MECHANISM_INVALID;
+	}
+
+	// Check the templates once for the whole batch
+	CK_BBOOL ispublicKeyToken = CK_FALSE;
+	CK_BBOOL ispublicKeyPrivate = CK_FALSE;
+	CK_BBOOL isprivateKeyToken = CK_FALSE;
+	CK_BBOOL isprivateKeyPrivate = CK_TRUE;
+	CK_RV rv = checkKeyPairTemplates(session, pMechanism,
+					 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+					 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+					 ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+	if (rv != CKR_OK)
+		return rv;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL) return CKR_GENERAL_ERROR;
+
+	// Extract desired key information
+	ByteString params;
+	for (CK_ULONG i = 0; i < ulPublicKeyAttributeCount; i++)
+	{
+		if (pPublicKeyTemplate[i].type == CKA_EC_PARAMS)
+			params = ByteString((unsigned char*)pPublicKeyTemplate[i].pValue, pPublicKeyTemplate[i].ulValueLen);
+	}
+
+	// The parameters must be specified to be able to generate a key pair.
+	if (params.size() == 0) {
+		INFO_MSG("Missing parameter(s) in pPublicKeyTemplate");
+		return CKR_TEMPLATE_INCOMPLETE;
+	}
+
+	// Set the parameters
+	ECParameters p;
+	p.setEC(params);
+
+	AsymmetricAlgorithm* asym = CryptoFactory::i()->getAsymmetricAlgorithm(algo);
+	if (asym == NULL) return CKR_GENERAL_ERROR;
+
+	// Generate the key pairs; each worker sets up the curve once
+	std::vector<AsymmetricKeyPair*> kps(ulCount, NULL);
+	KeyPairTask task(algo, asym, &kps[0], &p);
+	rv = runSliced(ulCount, 16, task);
+	if (rv != CKR_OK)
+		ERROR_MSG("Could not generate key pair");
+
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		phPublicKeys[i] = CK_INVALID_HANDLE;
+		phPrivateKeys[i] = CK_INVALID_HANDLE;
+	}
+
+	// Store the key pairs; the token announces them together at the end
+	if (rv == CKR_OK)
+	{
+		token->beginBatch();
+
+		CK_ULONG created = 0;
+		for (; created < ulCount; created++)
+		{
+			rv = this->createECKeyPair(hSession, token, pMechanism->mechanism, kps[created],
+						   pPublicKeyTemplate, ulPublicKeyAttributeCount,
+						   pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+						   &phPublicKeys[created], &phPrivateKeys[created],
+						   ispublicKeyToken, ispublicKeyPrivate, isprivateKeyToken, isprivateKeyPrivate);
+			if (rv != CKR_OK)
+				break;
+
+			sealObject(hSession, phPublicKeys[created]);
+			sealObject(hSession, phPrivateKeys[created]);
+		}
+
+		// Either all key pairs are created or none of them
+		if (rv != CKR_OK)
+		{
+			for (CK_ULONG i = 0; i < created; i++)
+			{
+				OSObject* ospriv = (OSObject*)handleManager->getObject(phPrivateKeys[i]);
+				handleManager->destroyObject(phPrivateKeys[i]);
+				if (ospriv) ospriv->destroyObject();
+				phPrivateKeys[i] = CK_INVALID_HANDLE;
+
+				OSObject* ospub = (OSObject*)handleManager->getObject(phPublicKeys[i]);
+				handleManager->destroyObject(phPublicKeys[i]);
+				if (ospub) ospub->destroyObject();
+				phPublicKeys[i] = CK_INVALID_HANDLE;
+			}
+		}
+
+		token->endBatch();
+	}
+
+	// Clean up
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		if (kps[i] != NULL) asym->recycleKeyPair(kps[i]);
+	}
+	CryptoFactory::i()->recycleAsymmetricAlgorithm(asym);
+
+	return rv;
+}
+
+// A key ranked by C_SoftHSM_GetKeyUsage; the counters are read once, as they
+// may change while the keys are sorted
+struct KeyRank
+{
+	OSObject* key;
+	unsigned long long total;
+	time_t lastUsed;
+};
+
+static bool moreUsed(const KeyRank& a, const KeyRank& b)
+{
+	if (a.total != b.total) return a.total > b.total;
+
+	return a.lastUsed > b.lastUsed;
+}
+
+static bool lessUsed(const KeyRank& a, const KeyRank& b)
+{
+	if (a.total != b.total) return a.total < b.total;
+
+	return a.lastUsed < b.lastUsed;
+}
+
+// Return the usage counters of the most or least used keys
+CK_RV SoftHSM::C_SoftHSM_GetKeyUsage(CK_SESSION_HANDLE hSession, CK_FLAGS flags, CK_SOFTHSM_KEY_USAGE_PTR pUsage, CK_ULONG_PTR pulCount)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	if (pulCount == NULL_PTR) return CKR_ARGUMENTS_BAD;
+	if ((flags & ~CKF_SOFTHSM_USAGE_LEAST_USED) != 0) return CKR_ARGUMENTS_BAD;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	// Get the slot
+	Slot* slot = session->getSlot();
+	if (slot == NULL_PTR) return CKR_GENERAL_ERROR;
+
+	// Get the token
+	Token* token = session->getToken();
+	if (token == NULL_PTR) return CKR_GENERAL_ERROR;
+
+	// Private keys are only seen by the user
+	bool isPublicSession;
+	switch (session->getState()) {
+		case CKS_RO_USER_FUNCTIONS:
+		case CKS_RW_USER_FUNCTIONS:
+			isPublicSession = false;
+			break;
+		default:
+			isPublicSession = true;
+	}
+
+	bool leastUsed = (flags & CKF_SOFTHSM_USAGE_LEAST_USED) != 0;
+
+	// The counters saved by earlier runs count as well
+	ByteString serial;
+	bool seed = usageStore != NULL && token->getTokenSerial(serial);
+
+	std::set<OSObject*> allObjects;
+	token->getObjects(allObjects);
+	sessionObjectStore->getObjects(slot->getSlotID(), allObjects);
+
+	std::vector<KeyRank> ranked;
+	for (std::set<OSObject*>::iterator it = allObjects.begin(); it != allObjects.end(); ++it)
+	{
+		if (!(*it)->isValid()) continue;
+
+		CK_OBJECT_CLASS objClass = (*it)->getUnsignedLongValue(CKA_CLASS, CKO_VENDOR_DEFINED);
+		if (objClass != CKO_SECRET_KEY && objClass != CKO_PRIVATE_KEY && objClass != CKO_PUBLIC_KEY)
+			continue;
+
+		if (isPublicSession && (*it)->getBooleanValue(CKA_PRIVATE, true))
+			continue;
+
+		if (seed) usageStore->seed(serial, *it);
+
+		KeyRank rank;
+		rank.key = *it;
+		rank.total = (*it)->getUsage()->getTotal();
+		rank.lastUsed = (*it)->getUsage()->getLastUsed();
+
+		if (rank.total == 0 && !leastUsed) continue;
+
+		ranked.push_back(rank);
+	}
+
+	// Only the number of keys is wanted
+	if (pUsage == NULL_PTR)
+	{
+		*pulCount = ranked.size();
+
+		return CKR_OK;
+	}
+
+	// Only the keys that are returned need to be in order
+	size_t count = std::min((size_t)*pulCount, ranked.size());
+	std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(), leastUsed ? lessUsed : moreUsed);
+
+	CK_SLOT_ID slotID = slot->getSlotID();
+	for (size_t i = 0; i < count; i++)
+	{
+		OSObject* key = ranked[i].key;
+		KeyUsage* usage = key->getUsage();
+
+		bool isOnToken = key->getBooleanValue(CKA_TOKEN, false);
+		bool isPrivate = key->getBooleanValue(CKA_PRIVATE, true);
+		CK_OBJECT_HANDLE hKey;
+		if (isOnToken)
+			hKey = handleManager->addTokenObject(slotID, isPrivate, key);
+		else
+			hKey = handleManager->addSessionObject(slotID, hSession, isPrivate, key);
+		if (hKey == CK_INVALID_HANDLE) return CKR_GENERAL_ERROR;
+
+		pUsage[i].hKey = hKey;
+		pUsage[i].ulSign = (CK_ULONG)usage->getCount(KeyUsage::Sign);
+		pUsage[i].ulVerify = (CK_ULONG)usage->getCount(KeyUsage::Verify);
+		pUsage[i].ulEncrypt = (CK_ULONG)usage->getCount(KeyUsage::Encrypt);
+		pUsage[i].ulDecrypt = (CK_ULONG)usage->getCount(KeyUsage::Decrypt);
+		pUsage[i].ulDerive = (CK_ULONG)usage->getCount(KeyUsage::Derive);
+		pUsage[i].ulWrap = (CK_ULONG)usage->getCount(KeyUsage::Wrap);
+		pUsage[i].ulUnwrap = (CK_ULONG)usage->getCount(KeyUsage::Unwrap);
+		pUsage[i].ulLastUsed = (CK_ULONG)usage->getLastUsed();
+	}
+
+	*pulCount = count;
+
+	return CKR_OK;
+}
+
+// Count uses of a key in cryptographic operations
+void SoftHSM::countUsage(Token* token, OSObject* key, KeyUsage::Operation op, unsigned long n)
+{
+	KeyUsage* usage = key->getUsage();
+
+	// Add the counters saved by earlier runs on first use
+	if (usageStore != NULL && !usage->isSeeded())
+	{
+		ByteString serial;
+		if (token != NULL && token->getTokenSerial(serial))
+			usageStore->seed(serial, key);
+	}
+
+	usage->count(op, n);
+
+	if (usageStore != NULL) usageStore->setChanged();
+}
+
+#ifdef HAVE_CXX11
+// Return the queue of the asynchronous operations, optionally starting it
+AsyncQueue* SoftHSM::getAsyncQueue(bool create)
+{
+	std::lock_guard<std::mutex> lock(asyncMutex);
+
+	// The queue of a previous initialisation is replaced on first use
+	if (asyncQueue == NULL && stoppedQueue.get() != NULL)
+	{
+		asyncQueue = stoppedQueue.release();
+	}
+
+	if (asyncQueue != NULL && create && asyncQueue->isStopped())
+	{
+		delete asyncQueue;
+		asyncQueue = NULL;
+	}
+
+	if (asyncQueue == NULL && create)
+	{
+		asyncQueue = new AsyncQueue(asyncWorkers);
+		if (!asyncQueue->isValid())
+		{
+			ERROR_MSG("Could not start the asynchronous workers");
+			delete asyncQueue;
+			asyncQueue = NULL;
+		}
+	}
+
+	return asyncQueue;
+}
+
+// Queue a job on the session; the job runs the synchronous functions
+CK_RV SoftHSM::submitAsync(CK_SESSION_HANDLE hSession, CK_VOID_PTR pTag, const std::function<CK_RV()>& run)
+{
+	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	// The workers call into the library concurrently with the application
+	if (!MutexFactory::i()->isEnabled()) return CKR_CANT_LOCK;
+
+	// Get the session
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	AsyncQueue* queue = getAsyncQueue(true);
+	if (queue == NULL) return CKR_GENERAL_ERROR;
+
+	return queue->submit(session->getSlot()->getSlotID(), hSession, pTag, run);
+}
+
+// Run a job on an internal session of the slot of the session, so that it
+// neither uses nor disturbs the operation of the session; an operation that
+// the job leaves active (e.g. after only returning the length) ends with the
+// internal session
+CK_RV SoftHSM::runOnInternalSession(CK_SESSION_HANDLE hSession, const std::function<CK_RV(CK_SESSION_HANDLE)>& run)
+{
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return CKR_SESSION_HANDLE_INVALID;
+
+	CK_FLAGS flags = CKF_SERIAL_SESSION;
+	if (session->isRW()) flags |= CKF_RW_SESSION;
 
-			if (!bOK)
-				rv = CKR_FUNCTION_FAILED;
-		}
-		else
-			rv = CKR_FUNCTION_FAILED;
-	}
+	CK_SESSION_HANDLE hInternal;
+	CK_RV rv = C_OpenSession(session->getSlot()->getSlotID(), flags, NULL_PTR, NULL_PTR, &hInternal);
+	if (rv != CKR_OK) return rv;
 
-	// Remove secret that may have been created already when the function fails.
-	if (rv != CKR_OK)
-	{
-		if (*hKey != CK_INVALID_HANDLE)
-		{
-			OSObject* obj = (OSObject*)handleManager->getObject(*hKey);
-			handleManager->destroyObject(*hKey);
-			if (obj) obj->destroyObject();
-			*hKey = CK_INVALID_HANDLE;
-		}
+	rv = run(hInternal);
 
-	}
+	// The session of the application is still open, so this does not log
+	// out the token
+	C_CloseSession(hInternal);
 
 	return rv;
 }
+#endif
 
 // Derive a key from the specified base key
 CK_RV SoftHSM::C_DeriveKey
@@ -6804,6 +8700,31 @@ CK_RV SoftHSM::C_DeriveKey
 	CK_ULONG ulCount,
 	CK_OBJECT_HANDLE_PTR phKey
 )
+{
+	CK_RV rv = this->DeriveKey(hSession, pMechanism, hBaseKey, pTemplate, ulCount, phKey);
+	if (rv == CKR_OK)
+	{
+		sealObject(hSession, *phKey);
+
+		// Count the use of the base key
+		Session* session = (Session*)handleManager->getSession(hSession);
+		OSObject* key = (OSObject*)handleManager->getObject(hBaseKey);
+		if (session != NULL && key != NULL)
+			countUsage(session->getToken(), key, KeyUsage::Derive);
+	}
+
+	return rv;
+}
+
+CK_RV SoftHSM::DeriveKey
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hBaseKey,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey
+)
 {
 	if (!isInitialised) return CKR_CRYPTOKI_NOT_INITIALIZED;
 
@@ -8700,8 +10621,61 @@ CK_RV SoftHSM::generateEC
 		return CKR_GENERAL_ERROR;
 	}
 
-	ECPublicKey* pub = (ECPublicKey*) kp->getPublicKey();
-	ECPrivateKey* priv = (ECPrivateKey*) kp->getPrivateKey();
+	CK_RV rv = this->createECKeyPair(hSession, token, CKM_EC_KEY_PAIR_GEN, kp,
+					 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+					 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+					 phPublicKey, phPrivateKey,
+					 isPublicKeyOnToken, isPublicKeyPrivate, isPrivateKeyOnToken, isPrivateKeyPrivate);
+
+	// Clean up
+	ec->recycleKeyPair(kp);
+	CryptoFactory::i()->recycleAsymmetricAlgorithm(ec);
+
+	return rv;
+}
+
+// Create the objects of a generated EC or EDDSA key pair; no object is left
+// behind when this fails
+CK_RV SoftHSM::createECKeyPair
+(
+	CK_SESSION_HANDLE hSession,
+	Token* token,
+	CK_MECHANISM_TYPE mechanism,
+	AsymmetricKeyPair* kp,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_OBJECT_HANDLE_PTR phPublicKey,
+	CK_OBJECT_HANDLE_PTR phPrivateKey,
+	CK_BBOOL isPublicKeyOnToken,
+	CK_BBOOL isPublicKeyPrivate,
+	CK_BBOOL isPrivateKeyOnToken,
+	CK_BBOOL isPrivateKeyPrivate
+)
+{
+	*phPublicKey = CK_INVALID_HANDLE;
+	*phPrivateKey = CK_INVALID_HANDLE;
+
+	// Get the key material
+	CK_KEY_TYPE keyType;
+	ByteString publicPoint;
+	ByteString privateParams;
+	ByteString privateValue;
+	if (mechanism == CKM_EC_EDWARDS_KEY_PAIR_GEN)
+	{
+		keyType = CKK_EC_EDWARDS;
+		publicPoint = ((EDPublicKey*) kp->getPublicKey())->getA();
+		privateParams = ((EDPrivateKey*) kp->getPrivateKey())->getEC();
+		privateValue = ((EDPrivateKey*) kp->getPrivateKey())->getK();
+	}
+	else
+	{
+		keyType = CKK_EC;
+		publicPoint = ((ECPublicKey*) kp->getPublicKey())->getQ();
+		privateParams = ((ECPrivateKey*) kp->getPrivateKey())->getEC();
+		privateValue = ((ECPrivateKey*) kp->getPrivateKey())->getD();
+	}
 
 	CK_RV rv = CKR_OK;
 
@@ -8710,7 +10684,7 @@ CK_RV SoftHSM::generateEC
 	{
 		const CK_ULONG maxAttribs = 32;
 		CK_OBJECT_CLASS publicKeyClass = CKO_PUBLIC_KEY;
-		CK_KEY_TYPE publicKeyType = CKK_EC;
+		CK_KEY_TYPE publicKeyType = keyType;
 		CK_ATTRIBUTE publicKeyAttribs[maxAttribs] = {
 			{ CKA_CLASS, &publicKeyClass, sizeof(publicKeyClass) },
 			{ CKA_TOKEN, &isPublicKeyOnToken, sizeof(isPublicKeyOnToken) },
@@ -8750,18 +10724,18 @@ CK_RV SoftHSM::generateEC
 
 				// Common Key Attributes
 				bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-				CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_EC_KEY_PAIR_GEN;
+				CK_ULONG ulKeyGenMechanism = (CK_ULONG)mechanism;
 				bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
 
-				// EC Public Key Attributes
+				// EC and EDDSA Public Key Attributes
 				ByteString point;
 				if (isPublicKeyPrivate)
 				{
-					token->encrypt(pub->getQ(), point);
+					token->encrypt(publicPoint, point);
 				}
 				else
 				{
-					point = pub->getQ();
+					point = publicPoint;
 				}
 				bOK = bOK && osobject->setAttribute(CKA_EC_POINT, point);
 
@@ -8782,7 +10756,7 @@ CK_RV SoftHSM::generateEC
 	{
 		const CK_ULONG maxAttribs = 32;
 		CK_OBJECT_CLASS privateKeyClass = CKO_PRIVATE_KEY;
-		CK_KEY_TYPE privateKeyType = CKK_EC;
+		CK_KEY_TYPE privateKeyType = keyType;
 		CK_ATTRIBUTE privateKeyAttribs[maxAttribs] = {
 			{ CKA_CLASS, &privateKeyClass, sizeof(privateKeyClass) },
 			{ CKA_TOKEN, &isPrivateKeyOnToken, sizeof(isPrivateKeyOnToken) },
@@ -8820,7 +10794,7 @@ CK_RV SoftHSM::generateEC
 
 				// Common Key Attributes
 				bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-				CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_EC_KEY_PAIR_GEN;
+				CK_ULONG ulKeyGenMechanism = (CK_ULONG)mechanism;
 				bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
 
 				// Common Private Key Attributes
@@ -8829,18 +10803,18 @@ CK_RV SoftHSM::generateEC
 				bool bNeverExtractable = osobject->getBooleanValue(CKA_EXTRACTABLE, false) == false;
 				bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, bNeverExtractable);
 
-				// EC Private Key Attributes
+				// EC and EDDSA Private Key Attributes
 				ByteString group;
 				ByteString value;
 				if (isPrivateKeyPrivate)
 				{
-					token->encrypt(priv->getEC(), group);
-					token->encrypt(priv->getD(), value);
+					token->encrypt(privateParams, group);
+					token->encrypt(privateValue, value);
 				}
 				else
 				{
-					group = priv->getEC();
-					value = priv->getD();
+					group = privateParams;
+					value = privateValue;
 				}
 				bOK = bOK && osobject->setAttribute(CKA_EC_PARAMS, group);
 				bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
@@ -8857,10 +10831,6 @@ CK_RV SoftHSM::generateEC
 		}
 	}
 
-	// Clean up
-	ec->recycleKeyPair(kp);
-	CryptoFactory::i()->recycleAsymmetricAlgorithm(ec);
-
 	// Remove keys that may have been created already when the function fails.
 	if (rv != CKR_OK)
 	{
@@ -8946,187 +10916,16 @@ CK_RV SoftHSM::generateED
 		return CKR_GENERAL_ERROR;
 	}
 
-	EDPublicKey* pub = (EDPublicKey*) kp->getPublicKey();
-	EDPrivateKey* priv = (EDPrivateKey*) kp->getPrivateKey();
-
-	CK_RV rv = CKR_OK;
-
-	// Create a public key using C_CreateObject
-	if (rv == CKR_OK)
-	{
-		const CK_ULONG maxAttribs = 32;
-		CK_OBJECT_CLASS publicKeyClass = CKO_PUBLIC_KEY;
-		CK_KEY_TYPE publicKeyType = CKK_EC_EDWARDS;
-		CK_ATTRIBUTE publicKeyAttribs[maxAttribs] = {
-			{ CKA_CLASS, &publicKeyClass, sizeof(publicKeyClass) },
-			{ CKA_TOKEN, &isPublicKeyOnToken, sizeof(isPublicKeyOnToken) },
-			{ CKA_PRIVATE, &isPublicKeyPrivate, sizeof(isPublicKeyPrivate) },
-			{ CKA_KEY_TYPE, &publicKeyType, sizeof(publicKeyType) },
-		};
-		CK_ULONG publicKeyAttribsCount = 4;
-
-		// Add the additional
-		if (ulPublicKeyAttributeCount > (maxAttribs - publicKeyAttribsCount))
-			rv = CKR_TEMPLATE_INCONSISTENT;
-		for (CK_ULONG i=0; i < ulPublicKeyAttributeCount && rv == CKR_OK; ++i)
-		{
-			switch (pPublicKeyTemplate[i].type)
-			{
-				case CKA_CLASS:
-				case CKA_TOKEN:
-				case CKA_PRIVATE:
-				case CKA_KEY_TYPE:
-					continue;
-				default:
-					publicKeyAttribs[publicKeyAttribsCount++] = pPublicKeyTemplate[i];
-			}
-		}
-
-		if (rv == CKR_OK)
-			rv = this->CreateObject(hSession,publicKeyAttribs,publicKeyAttribsCount,phPublicKey,OBJECT_OP_GENERATE);
-
-		// Store the attributes that are being supplied by the key generation to the object
-		if (rv == CKR_OK)
-		{
-			OSObject* osobject = (OSObject*)handleManager->getObject(*phPublicKey);
-			if (osobject == NULL_PTR || !osobject->isValid()) {
-				rv = CKR_FUNCTION_FAILED;
-			} else if (osobject->startTransaction()) {
-				bool bOK = true;
-
-				// Common Key Attributes
-				bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-				CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_EC_EDWARDS_KEY_PAIR_GEN;
-				bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
-
-				// EDDSA Public Key Attributes
-				ByteString value;
-				if (isPublicKeyPrivate)
-				{
-					token->encrypt(pub->getA(), value);
-				}
-				else
-				{
-					value = pub->getA();
-				}
-				bOK = bOK && osobject->setAttribute(CKA_EC_POINT, value);
-
-				if (bOK)
-					bOK = osobject->commitTransaction();
-				else
-					osobject->abortTransaction();
-
-				if (!bOK)
-					rv = CKR_FUNCTION_FAILED;
-			} else
-				rv = CKR_FUNCTION_FAILED;
-		}
-	}
-
-	// Create a private key using C_CreateObject
-	if (rv == CKR_OK)
-	{
-		const CK_ULONG maxAttribs = 32;
-		CK_OBJECT_CLASS privateKeyClass = CKO_PRIVATE_KEY;
-		CK_KEY_TYPE privateKeyType = CKK_EC_EDWARDS;
-		CK_ATTRIBUTE privateKeyAttribs[maxAttribs] = {
-			{ CKA_CLASS, &privateKeyClass, sizeof(privateKeyClass) },
-			{ CKA_TOKEN, &isPrivateKeyOnToken, sizeof(isPrivateKeyOnToken) },
-			{ CKA_PRIVATE, &isPrivateKeyPrivate, sizeof(isPrivateKeyPrivate) },
-			{ CKA_KEY_TYPE, &privateKeyType, sizeof(privateKeyType) },
-		};
-		CK_ULONG privateKeyAttribsCount = 4;
-		if (ulPrivateKeyAttributeCount > (maxAttribs - privateKeyAttribsCount))
-			rv = CKR_TEMPLATE_INCONSISTENT;
-		for (CK_ULONG i=0; i < ulPrivateKeyAttributeCount && rv == CKR_OK; ++i)
-		{
-			switch (pPrivateKeyTemplate[i].type)
-			{
-				case CKA_CLASS:
-				case CKA_TOKEN:
-				case CKA_PRIVATE:
-				case CKA_KEY_TYPE:
-					continue;
-				default:
-					privateKeyAttribs[privateKeyAttribsCount++] = pPrivateKeyTemplate[i];
-			}
-		}
-
-		if (rv == CKR_OK)
-			rv = this->CreateObject(hSession,privateKeyAttribs,privateKeyAttribsCount,phPrivateKey,OBJECT_OP_GENERATE);
-
-		// Store the attributes that are being supplied by the key generation to the object
-		if (rv == CKR_OK)
-		{
-			OSObject* osobject = (OSObject*)handleManager->getObject(*phPrivateKey);
-			if (osobject == NULL_PTR || !osobject->isValid()) {
-				rv = CKR_FUNCTION_FAILED;
-			} else if (osobject->startTransaction()) {
-				bool bOK = true;
-
-				// Common Key Attributes
-				bOK = bOK && osobject->setAttribute(CKA_LOCAL,true);
-				CK_ULONG ulKeyGenMechanism = (CK_ULONG)CKM_EC_EDWARDS_KEY_PAIR_GEN;
-				bOK = bOK && osobject->setAttribute(CKA_KEY_GEN_MECHANISM,ulKeyGenMechanism);
-
-				// Common Private Key Attributes
-				bool bAlwaysSensitive = osobject->getBooleanValue(CKA_SENSITIVE, false);
-				bOK = bOK && osobject->setAttribute(CKA_ALWAYS_SENSITIVE,bAlwaysSensitive);
-				bool bNeverExtractable = osobject->getBooleanValue(CKA_EXTRACTABLE, false) == false;
-				bOK = bOK && osobject->setAttribute(CKA_NEVER_EXTRACTABLE, bNeverExtractable);
-
-				// EDDSA Private Key Attributes
-				ByteString group;
-				ByteString value;
-				if (isPrivateKeyPrivate)
-				{
-					token->encrypt(priv->getEC(), group);
-					token->encrypt(priv->getK(), value);
-				}
-				else
-				{
-					group = priv->getEC();
-					value = priv->getK();
-				}
-				bOK = bOK && osobject->setAttribute(CKA_EC_PARAMS, group);
-				bOK = bOK && osobject->setAttribute(CKA_VALUE, value);
-
-				if (bOK)
-					bOK = osobject->commitTransaction();
-				else
-					osobject->abortTransaction();
-
-				if (!bOK)
-					rv = CKR_FUNCTION_FAILED;
-			} else
-				rv = CKR_FUNCTION_FAILED;
-		}
-	}
+	CK_RV rv = this->createECKeyPair(hSession, token, CKM_EC_EDWARDS_KEY_PAIR_GEN, kp,
+					 pPublicKeyTemplate, ulPublicKeyAttributeCount,
+					 pPrivateKeyTemplate, ulPrivateKeyAttributeCount,
+					 phPublicKey, phPrivateKey,
+					 isPublicKeyOnToken, isPublicKeyPrivate, isPrivateKeyOnToken, isPrivateKeyPrivate);
 
 	// Clean up
 	ec->recycleKeyPair(kp);
 	CryptoFactory::i()->recycleAsymmetricAlgorithm(ec);
 
-	// Remove keys that may have been created already when the function fails.
-	if (rv != CKR_OK)
-	{
-		if (*phPrivateKey != CK_INVALID_HANDLE)
-		{
-			OSObject* ospriv = (OSObject*)handleManager->getObject(*phPrivateKey);
-			handleManager->destroyObject(*phPrivateKey);
-			if (ospriv) ospriv->destroyObject();
-			*phPrivateKey = CK_INVALID_HANDLE;
-		}
-
-		if (*phPublicKey != CK_INVALID_HANDLE)
-		{
-			OSObject* ospub = (OSObject*)handleManager->getObject(*phPublicKey);
-			handleManager->destroyObject(*phPublicKey);
-			if (ospub) ospub->destroyObject();
-			*phPublicKey = CK_INVALID_HANDLE;
-		}
-	}
-
 	return rv;
 }
 
@@ -11397,7 +13196,11 @@ CK_RV SoftHSM::CreateObject(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTempla
 	rv = p11object->saveTemplate(token, isPrivate != CK_FALSE, attribs,attribsCount,op);
 	delete p11object;
 	if (rv != CKR_OK)
+	{
+		// Do not leave a half-initialised object behind
+		object->destroyObject();
 		return rv;
+	}
 
 	if (op == OBJECT_OP_CREATE)
 	{
@@ -11430,6 +13233,25 @@ CK_RV SoftHSM::CreateObject(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTempla
 	return CKR_OK;
 }
 
+// Seal the key material of a new or modified private object in its envelope
+void SoftHSM::sealObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject)
+{
+	Session* session = (Session*)handleManager->getSession(hSession);
+	if (session == NULL) return;
+
+	Token* token = session->getToken();
+	if (token == NULL) return;
+
+	OSObject* object = (OSObject*)handleManager->getObject(hObject);
+	if (object == NULL_PTR || !object->isValid()) return;
+
+	// The key material remains readable when it cannot be sealed
+	if (!ObjectEnvelope::seal(token, object))
+	{
+		WARNING_MSG("Could not seal the key material of the object");
+	}
+}
+
 CK_RV SoftHSM::getRSAPrivateKey(RSAPrivateKey* privateKey, Token* token, OSObject* key)
 {
 	if (privateKey == NULL) return CKR_ARGUMENTS_BAD;
@@ -11450,15 +13272,16 @@ CK_RV SoftHSM::getRSAPrivateKey(RSAPrivateKey* privateKey, Token* token, OSObjec
 	ByteString coefficient;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_MODULUS), modulus);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PUBLIC_EXPONENT), publicExponent);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PRIVATE_EXPONENT), privateExponent);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PRIME_1), prime1);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PRIME_2), prime2);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EXPONENT_1), exponent1);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EXPONENT_2), exponent2);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_COEFFICIENT), coefficient);
+		bOK = bOK && envelope.decrypt(CKA_MODULUS, modulus);
+		bOK = bOK && envelope.decrypt(CKA_PUBLIC_EXPONENT, publicExponent);
+		bOK = bOK && envelope.decrypt(CKA_PRIVATE_EXPONENT, privateExponent);
+		bOK = bOK && envelope.decrypt(CKA_PRIME_1, prime1);
+		bOK = bOK && envelope.decrypt(CKA_PRIME_2, prime2);
+		bOK = bOK && envelope.decrypt(CKA_EXPONENT_1, exponent1);
+		bOK = bOK && envelope.decrypt(CKA_EXPONENT_2, exponent2);
+		bOK = bOK && envelope.decrypt(CKA_COEFFICIENT, coefficient);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11500,9 +13323,10 @@ CK_RV SoftHSM::getRSAPublicKey(RSAPublicKey* publicKey, Token* token, OSObject*
 	ByteString publicExponent;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_MODULUS), modulus);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PUBLIC_EXPONENT), publicExponent);
+		bOK = bOK && envelope.decrypt(CKA_MODULUS, modulus);
+		bOK = bOK && envelope.decrypt(CKA_PUBLIC_EXPONENT, publicExponent);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11534,11 +13358,12 @@ CK_RV SoftHSM::getDSAPrivateKey(DSAPrivateKey* privateKey, Token* token, OSObjec
 	ByteString value;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PRIME), prime);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_SUBPRIME), subprime);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_BASE), generator);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), value);
+		bOK = bOK && envelope.decrypt(CKA_PRIME, prime);
+		bOK = bOK && envelope.decrypt(CKA_SUBPRIME, subprime);
+		bOK = bOK && envelope.decrypt(CKA_BASE, generator);
+		bOK = bOK && envelope.decrypt(CKA_VALUE, value);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11574,11 +13399,12 @@ CK_RV SoftHSM::getDSAPublicKey(DSAPublicKey* publicKey, Token* token, OSObject*
 	ByteString value;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PRIME), prime);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_SUBPRIME), subprime);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_BASE), generator);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), value);
+		bOK = bOK && envelope.decrypt(CKA_PRIME, prime);
+		bOK = bOK && envelope.decrypt(CKA_SUBPRIME, subprime);
+		bOK = bOK && envelope.decrypt(CKA_BASE, generator);
+		bOK = bOK && envelope.decrypt(CKA_VALUE, value);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11612,9 +13438,10 @@ CK_RV SoftHSM::getECPrivateKey(ECPrivateKey* privateKey, Token* token, OSObject*
 	ByteString value;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EC_PARAMS), group);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), value);
+		bOK = bOK && envelope.decrypt(CKA_EC_PARAMS, group);
+		bOK = bOK && envelope.decrypt(CKA_VALUE, value);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11644,9 +13471,10 @@ CK_RV SoftHSM::getECPublicKey(ECPublicKey* publicKey, Token* token, OSObject* ke
 	ByteString point;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EC_PARAMS), group);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EC_POINT), point);
+		bOK = bOK && envelope.decrypt(CKA_EC_PARAMS, group);
+		bOK = bOK && envelope.decrypt(CKA_EC_POINT, point);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11676,9 +13504,10 @@ CK_RV SoftHSM::getEDPrivateKey(EDPrivateKey* privateKey, Token* token, OSObject*
 	ByteString value;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EC_PARAMS), group);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), value);
+		bOK = bOK && envelope.decrypt(CKA_EC_PARAMS, group);
+		bOK = bOK && envelope.decrypt(CKA_VALUE, value);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11708,9 +13537,10 @@ CK_RV SoftHSM::getEDPublicKey(EDPublicKey* publicKey, Token* token, OSObject* ke
 	ByteString value;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EC_PARAMS), group);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_EC_POINT), value);
+		bOK = bOK && envelope.decrypt(CKA_EC_PARAMS, group);
+		bOK = bOK && envelope.decrypt(CKA_EC_POINT, value);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11741,10 +13571,11 @@ CK_RV SoftHSM::getDHPrivateKey(DHPrivateKey* privateKey, Token* token, OSObject*
 	ByteString value;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_PRIME), prime);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_BASE), generator);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), value);
+		bOK = bOK && envelope.decrypt(CKA_PRIME, prime);
+		bOK = bOK && envelope.decrypt(CKA_BASE, generator);
+		bOK = bOK && envelope.decrypt(CKA_VALUE, value);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11872,9 +13703,10 @@ CK_RV SoftHSM::getGOSTPrivateKey(GOSTPrivateKey* privateKey, Token* token, OSObj
 	ByteString param;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), value);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_GOSTR3410_PARAMS), param);
+		bOK = bOK && envelope.decrypt(CKA_VALUE, value);
+		bOK = bOK && envelope.decrypt(CKA_GOSTR3410_PARAMS, param);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11904,9 +13736,10 @@ CK_RV SoftHSM::getGOSTPublicKey(GOSTPublicKey* publicKey, Token* token, OSObject
 	ByteString param;
 	if (isKeyPrivate)
 	{
+		ObjectEnvelope envelope(token, key);
 		bool bOK = true;
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_VALUE), point);
-		bOK = bOK && token->decrypt(key->getByteStringValue(CKA_GOSTR3410_PARAMS), param);
+		bOK = bOK && envelope.decrypt(CKA_VALUE, point);
+		bOK = bOK && envelope.decrypt(CKA_GOSTR3410_PARAMS, param);
 		if (!bOK)
 			return CKR_GENERAL_ERROR;
 	}
@@ -11934,7 +13767,8 @@ CK_RV SoftHSM::getSymmetricKey(SymmetricKey* skey, Token* token, OSObject* key)
 	ByteString keybits;
 	if (isKeyPrivate)
 	{
-		if (!token->decrypt(key->getByteStringValue(CKA_VALUE), keybits))
+		ObjectEnvelope envelope(token, key);
+		if (!envelope.decrypt(CKA_VALUE, keybits))
 			return CKR_GENERAL_ERROR;
 	}
 	else
@@ -40,6 +40,9 @@
 #include "SessionManager.h"
 #include "SlotManager.h"
 #include "HandleManager.h"
+#include "AsyncQueue.h"
+#include "OpScheduler.h"
+#include "UsageStore.h"
 #include "RSAPublicKey.h"
 #include "RSAPrivateKey.h"
 #include "DSAPublicKey.h"
@@ -54,6 +57,7 @@
 #include "GOSTPrivateKey.h"
 
 #include <memory>
+#include <vector>
 
 class SoftHSM
 {
@@ -172,6 +176,128 @@ public:
 	CK_RV C_CancelFunction(CK_SESSION_HANDLE hSession);
 	CK_RV C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR pSlot, CK_VOID_PTR pReserved);
 
+	// Vendor extensions
+	CK_RV C_SoftHSM_WrapKeyBatch
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hWrappingKey,
+		CK_ULONG ulKeyCount,
+		CK_OBJECT_HANDLE_PTR phKeys,
+		CK_BYTE_PTR* ppWrappedKeys,
+		CK_ULONG_PTR pulWrappedKeyLens
+	);
+	CK_RV C_SoftHSM_UnwrapKeyBatch
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hUnwrappingKey,
+		CK_ULONG ulKeyCount,
+		CK_BYTE_PTR* ppWrappedKeys,
+		CK_ULONG_PTR pulWrappedKeyLens,
+		CK_ATTRIBUTE_PTR* ppTemplates,
+		CK_ULONG_PTR pulCounts,
+		CK_OBJECT_HANDLE_PTR phKeys
+	);
+	CK_RV C_SoftHSM_SignAsync
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hKey,
+		CK_BYTE_PTR pData,
+		CK_ULONG ulDataLen,
+		CK_BYTE_PTR pSignature,
+		CK_ULONG_PTR pulSignatureLen,
+		CK_VOID_PTR pTag
+	);
+	CK_RV C_SoftHSM_DecryptAsync
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hKey,
+		CK_BYTE_PTR pEncryptedData,
+		CK_ULONG ulEncryptedDataLen,
+		CK_BYTE_PTR pData,
+		CK_ULONG_PTR pulDataLen,
+		CK_VOID_PTR pTag
+	);
+	CK_RV C_SoftHSM_DeriveKeyAsync
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hBaseKey,
+		CK_ATTRIBUTE_PTR pTemplate,
+		CK_ULONG ulCount,
+		CK_OBJECT_HANDLE_PTR phKey,
+		CK_VOID_PTR pTag
+	);
+	CK_RV C_SoftHSM_GenerateKeyAsync
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_ATTRIBUTE_PTR pTemplate,
+		CK_ULONG ulCount,
+		CK_OBJECT_HANDLE_PTR phKey,
+		CK_VOID_PTR pTag
+	);
+	CK_RV C_SoftHSM_GenerateKeyPairAsync
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+		CK_ULONG ulPublicKeyAttributeCount,
+		CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+		CK_ULONG ulPrivateKeyAttributeCount,
+		CK_OBJECT_HANDLE_PTR phPublicKey,
+		CK_OBJECT_HANDLE_PTR phPrivateKey,
+		CK_VOID_PTR pTag
+	);
+	CK_RV C_SoftHSM_GetAsyncEventFd(int* pFd);
+	CK_RV C_SoftHSM_HarvestCompletions
+	(
+		CK_SOFTHSM_COMPLETION_PTR pCompletions,
+		CK_ULONG ulMaxCount,
+		CK_ULONG_PTR pulCount
+	);
+	CK_RV C_SoftHSM_EncryptUpdateV
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_SOFTHSM_SEGMENT_PTR pSegments,
+		CK_ULONG ulSegmentCount,
+		CK_BYTE_PTR pEncryptedPart,
+		CK_ULONG_PTR pulEncryptedPartLen
+	);
+	CK_RV C_SoftHSM_DigestUpdateV
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_SOFTHSM_SEGMENT_PTR pSegments,
+		CK_ULONG ulSegmentCount
+	);
+	CK_RV C_SoftHSM_DigestBatch
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_ULONG ulCount,
+		CK_BYTE_PTR* ppData,
+		CK_ULONG_PTR pulDataLens,
+		CK_BYTE_PTR pDigests,
+		CK_ULONG_PTR pulDigestsLen
+	);
+	CK_RV C_SoftHSM_GetSchedulerInfo(CK_SOFTHSM_SCHEDULER_INFO_PTR pInfo);
+	CK_RV C_SoftHSM_GenerateKeyPairBatch
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+		CK_ULONG ulPublicKeyAttributeCount,
+		CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+		CK_ULONG ulPrivateKeyAttributeCount,
+		CK_ULONG ulCount,
+		CK_OBJECT_HANDLE_PTR phPublicKeys,
+		CK_OBJECT_HANDLE_PTR phPrivateKeys
+	);
+	CK_RV C_SoftHSM_GetKeyUsage(CK_SESSION_HANDLE hSession, CK_FLAGS flags, CK_SOFTHSM_KEY_USAGE_PTR pUsage, CK_ULONG_PTR pulCount);
+
 private:
 	// Constructor
 	SoftHSM();
@@ -187,12 +313,44 @@ private:
 	bool isInitialised;
 	bool isRemovable;
 
+	// Do digest and HMAC operations run on contexts that can be saved?
+	bool isStateSaveable;
+
 	SessionObjectStore* sessionObjectStore;
 	ObjectStore* objectStore;
 	SlotManager* slotManager;
 	SessionManager* sessionManager;
 	HandleManager* handleManager;
 
+	// The fork count of the initialisation; a child of a fork has to
+	// initialise again
+	unsigned long initForks;
+
+	void releaseParent();
+
+	// Saves the usage counters of the token objects, if enabled
+	UsageStore* usageStore;
+
+	// Count uses of a key in cryptographic operations
+	void countUsage(Token* token, OSObject* key, KeyUsage::Operation op, unsigned long n = 1);
+
+#ifdef HAVE_CXX11
+	// The workers of the asynchronous operations, started on first use
+	AsyncQueue* asyncQueue;
+	std::mutex asyncMutex;
+	size_t asyncWorkers;
+
+	// The queue that C_Finalize stopped, kept for its completions
+	static std::unique_ptr<AsyncQueue> stoppedQueue;
+
+	AsyncQueue* getAsyncQueue(bool create);
+	CK_RV submitAsync(CK_SESSION_HANDLE hSession, CK_VOID_PTR pTag, const std::function<CK_RV()>& run);
+	CK_RV runOnInternalSession(CK_SESSION_HANDLE hSession, const std::function<CK_RV(CK_SESSION_HANDLE)>& run);
+
+	// The pool that runs the expensive operations, if enabled
+	OpScheduler* opScheduler;
+#endif
+
 	// Encrypt/Decrypt variants
 	CK_RV SymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey);
 	CK_RV AsymEncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey);
@@ -292,6 +450,23 @@ private:
 		CK_BBOOL isPrivateKeyOnToken,
 		CK_BBOOL isPrivateKeyPrivate
 	);
+	CK_RV createECKeyPair
+	(
+		CK_SESSION_HANDLE hSession,
+		Token* token,
+		CK_MECHANISM_TYPE mechanism,
+		AsymmetricKeyPair* kp,
+		CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+		CK_ULONG ulPublicKeyAttributeCount,
+		CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+		CK_ULONG ulPrivateKeyAttributeCount,
+		CK_OBJECT_HANDLE_PTR phPublicKey,
+		CK_OBJECT_HANDLE_PTR phPrivateKey,
+		CK_BBOOL isPublicKeyOnToken,
+		CK_BBOOL isPublicKeyPrivate,
+		CK_BBOOL isPrivateKeyOnToken,
+		CK_BBOOL isPrivateKeyPrivate
+	);
 	CK_RV generateED
 	(
 		CK_SESSION_HANDLE hSession,
@@ -412,6 +587,41 @@ private:
 		CK_OBJECT_HANDLE_PTR phObject,
 		int op
 	);
+	void sealObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject);
+	CK_RV GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phKey);
+	CK_RV GenerateKeyPair
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+		CK_ULONG ulPublicKeyAttributeCount,
+		CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+		CK_ULONG ulPrivateKeyAttributeCount,
+		CK_OBJECT_HANDLE_PTR phPublicKey,
+		CK_OBJECT_HANDLE_PTR phPrivateKey
+	);
+	CK_RV checkKeyPairTemplates
+	(
+		Session* session,
+		CK_MECHANISM_PTR pMechanism,
+		CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+		CK_ULONG ulPublicKeyAttributeCount,
+		CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+		CK_ULONG ulPrivateKeyAttributeCount,
+		CK_BBOOL& ispublicKeyToken,
+		CK_BBOOL& ispublicKeyPrivate,
+		CK_BBOOL& isprivateKeyToken,
+		CK_BBOOL& isprivateKeyPrivate
+	);
+	CK_RV DeriveKey
+	(
+		CK_SESSION_HANDLE hSession,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hBaseKey,
+		CK_ATTRIBUTE_PTR pTemplate,
+		CK_ULONG ulCount,
+		CK_OBJECT_HANDLE_PTR phKey
+	);
 
 	CK_RV getRSAPrivateKey(RSAPrivateKey* privateKey, Token* token, OSObject* key);
 	CK_RV getRSAPublicKey(RSAPublicKey* publicKey, Token* token, OSObject* key);
@@ -438,6 +648,79 @@ private:
 	bool setGOSTPrivateKey(OSObject* key, const ByteString &ber, Token* token, bool isPrivate) const;
 
 
+	// Template of a key that is being unwrapped. The attributes point
+	// into the structure itself, so it must not be copied once filled in.
+	struct UnwrapTemplate
+	{
+		static const CK_ULONG maxAttribs = 32;
+
+		CK_OBJECT_CLASS objClass;
+		CK_KEY_TYPE keyType;
+		CK_BBOOL isOnToken;
+		CK_BBOOL isPrivate;
+		CK_ATTRIBUTE attribs[maxAttribs];
+		CK_ULONG count;
+	};
+
+	CK_RV getWrappingKey
+	(
+		Session* session,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hWrappingKey,
+		OSObject*& wrapKey
+	);
+
+	CK_RV getKeyToWrap
+	(
+		Session* session,
+		Token* token,
+		CK_MECHANISM_PTR pMechanism,
+		OSObject* wrapKey,
+		CK_OBJECT_HANDLE hKey,
+		ByteString& keydata
+	);
+
+	CK_RV checkUnwrapMechanism
+	(
+		CK_MECHANISM_PTR pMechanism,
+		CK_ULONG ulWrappedKeyLen
+	);
+
+	CK_RV getUnwrappingKey
+	(
+		Session* session,
+		CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hUnwrappingKey,
+		OSObject*& unwrapKey
+	);
+
+	CK_RV getUnwrapTemplate
+	(
+		Session* session,
+		OSObject* unwrapKey,
+		CK_ATTRIBUTE_PTR pTemplate,
+		CK_ULONG ulCount,
+		UnwrapTemplate& unwrapTemplate
+	);
+
+	CK_RV createUnwrappedKey
+	(
+		CK_SESSION_HANDLE hSession,
+		Token* token,
+		UnwrapTemplate& unwrapTemplate,
+		ByteString& keydata,
+		CK_OBJECT_HANDLE_PTR hKey
+	);
+
+	CK_RV getSymWrapKey
+	(
+		CK_MECHANISM_PTR pMechanism,
+		Token* token,
+		OSObject* wrapKey,
+		SymmetricAlgorithm*& cipher,
+		SymmetricKey*& wrappingkey
+	);
+
 	CK_RV WrapKeyAsym
 	(
 		CK_MECHANISM_PTR pMechanism,
@@ -456,6 +739,15 @@ private:
 		ByteString &wrapped
 	);
 
+	CK_RV WrapKeySym
+	(
+		CK_MECHANISM_PTR pMechanism,
+		SymmetricAlgorithm* cipher,
+		const SymmetricKey* wrappingkey,
+		ByteString &keydata,
+		ByteString &wrapped
+	);
+
 	CK_RV UnwrapKeyAsym
 	(
 		CK_MECHANISM_PTR pMechanism,
@@ -474,6 +766,27 @@ private:
 		ByteString &keydata
 	);
 
+	CK_RV UnwrapKeySym
+	(
+		CK_MECHANISM_PTR pMechanism,
+		ByteString &wrapped,
+		SymmetricAlgorithm* cipher,
+		const SymmetricKey* unwrappingkey,
+		ByteString &keydata
+	);
+
+	class SymWrapTask;
+
+	CK_RV SymWrapBatch
+	(
+		CK_MECHANISM_PTR pMechanism,
+		Token* token,
+		OSObject* key,
+		bool wrap,
+		std::vector<ByteString>& in,
+		std::vector<ByteString>& out
+	);
+
 	CK_RV MechParamCheckRSAPKCSOAEP(CK_MECHANISM_PTR pMechanism);
 
 	static bool isMechanismPermitted(OSObject* key, CK_MECHANISM_PTR pMechanism);
@@ -46,8 +46,21 @@ std::auto_ptr<Configuration> Configuration::instance(NULL);
 const struct config Configuration::valid_config[] = {
 	{ "directories.tokendir",	CONFIG_TYPE_STRING },
 	{ "objectstore.backend",	CONFIG_TYPE_STRING },
+	{ "objectstore.snapshot",	CONFIG_TYPE_STRING },
+	{ "objectstore.readonly",	CONFIG_TYPE_BOOL },
+	{ "objectstore.fsync",		CONFIG_TYPE_BOOL },
+	{ "objectstore.sharding",	CONFIG_TYPE_BOOL },
+	{ "objectstore.index",		CONFIG_TYPE_BOOL },
+	{ "objectstore.blobsize",	CONFIG_TYPE_INT },
 	{ "log.level",			CONFIG_TYPE_STRING },
 	{ "slots.removable",		CONFIG_TYPE_BOOL },
+	{ "handles.stable",		CONFIG_TYPE_BOOL },
+	{ "operationstate.saveable",	CONFIG_TYPE_BOOL },
+	{ "async.workers",		CONFIG_TYPE_INT },
+	{ "scheduler.workers",		CONFIG_TYPE_INT },
+	{ "scheduler.slotlimit",	CONFIG_TYPE_INT },
+	{ "usage.file",			CONFIG_TYPE_STRING },
+	{ "usage.interval",		CONFIG_TYPE_INT },
 	{ "",				CONFIG_TYPE_UNSUPPORTED }
 };
 
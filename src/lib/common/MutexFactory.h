@@ -99,6 +99,7 @@ public:
 	// Enable/disable mutex handling
 	void enable();
 	void disable();
+	bool isEnabled();
 
 private:
 	// Constructor
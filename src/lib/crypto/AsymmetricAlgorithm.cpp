@@ -172,6 +172,32 @@ bool AsymmetricAlgorithm::unwrapKey(PrivateKey* privateKey, const ByteString& en
 	return decrypt(privateKey, encryptedData, data, padding);
 }
 
+// Generate count key pairs with the same parameters; either all of them are
+// returned or none. Derived classes can override this to set up the
+// parameters only once.
+bool AsymmetricAlgorithm::generateKeyPairs(AsymmetricKeyPair** ppKeyPairs, size_t count, AsymmetricParameters* parameters, RNG* rng /* = NULL */)
+{
+	if (ppKeyPairs == NULL)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!generateKeyPair(&ppKeyPairs[i], parameters, rng))
+		{
+			while (i > 0)
+			{
+				recycleKeyPair(ppKeyPairs[--i]);
+				ppKeyPairs[i] = NULL;
+			}
+
+			return false;
+		}
+	}
+
+	return true;
+}
 
 bool AsymmetricAlgorithm::generateParameters(AsymmetricParameters** /*ppParams*/, void* /*parameters = NULL*/, RNG* /*rng = NULL*/)
 {
@@ -144,6 +144,7 @@ public:
 
 	// Key factory
 	virtual bool generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParameters* parameters, RNG* rng = NULL) = 0;
+	virtual bool generateKeyPairs(AsymmetricKeyPair** ppKeyPairs, size_t count, AsymmetricParameters* parameters, RNG* rng = NULL);
 	virtual unsigned long getMinKeySize() = 0;
 	virtual unsigned long getMaxKeySize() = 0;
 	virtual bool generateParameters(AsymmetricParameters** ppParams, void* parameters = NULL, RNG* rng = NULL);
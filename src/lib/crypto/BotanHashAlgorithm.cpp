@@ -107,6 +107,37 @@ bool BotanHashAlgorithm::hashUpdate(const ByteString& data)
 	return true;
 }
 
+bool BotanHashAlgorithm::hashUpdateSegments(const DataSegment* segments, size_t count)
+{
+	if (currentOperation != HASHING)
+	{
+		return false;
+	}
+
+	// Run the digest over the segments where they are
+	try
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (segments[i].size != 0)
+			{
+				hash->update(segments[i].data, segments[i].size);
+			}
+		}
+	}
+	catch (...)
+	{
+		ERROR_MSG("Failed to buffer data");
+
+		ByteString dummy;
+		HashAlgorithm::hashFinal(dummy);
+
+		return false;
+	}
+
+	return true;
+}
+
 bool BotanHashAlgorithm::hashFinal(ByteString& hashedData)
 {
 	if (!HashAlgorithm::hashFinal(hashedData))
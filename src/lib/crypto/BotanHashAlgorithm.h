@@ -50,6 +50,7 @@ public:
 	virtual bool hashInit();
 	virtual bool hashUpdate(const ByteString& data);
 	virtual bool hashFinal(ByteString& hashedData);
+	virtual bool hashUpdateSegments(const DataSegment* segments, size_t count);
 
 	virtual int getHashSize() = 0;
 protected:
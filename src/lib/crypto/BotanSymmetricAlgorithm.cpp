@@ -243,6 +243,55 @@ bool BotanSymmetricAlgorithm::encryptUpdate(const ByteString& data, ByteString&
 		counterBytes += data.size();
 	}
 
+	return readEncrypted(encryptedData);
+}
+
+bool BotanSymmetricAlgorithm::encryptUpdateSegments(const DataSegment* segments, size_t count, ByteString& encryptedData)
+{
+	if (currentOperation != ENCRYPT)
+	{
+		delete cryption;
+		cryption = NULL;
+
+		return false;
+	}
+
+	// Write the segments where they are
+	size_t dataSize = 0;
+	try
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (segments[i].size > 0)
+				cryption->write(segments[i].data, segments[i].size);
+			dataSize += segments[i].size;
+		}
+	}
+	catch (...)
+	{
+		ERROR_MSG("Failed to write to the encryption token");
+
+		ByteString dummy;
+		SymmetricAlgorithm::encryptFinal(dummy);
+
+		delete cryption;
+		cryption = NULL;
+
+		return false;
+	}
+	currentBufferSize += dataSize;
+
+	// Count number of bytes written
+	if (maximumBytes.is_positive())
+	{
+		counterBytes += dataSize;
+	}
+
+	return readEncrypted(encryptedData);
+}
+
+bool BotanSymmetricAlgorithm::readEncrypted(ByteString& encryptedData)
+{
 	// Read data
 	int bytesRead = 0;
 	try
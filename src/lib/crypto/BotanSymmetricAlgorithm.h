@@ -54,6 +54,7 @@ public:
 	virtual bool encryptInit(const SymmetricKey* key, const SymMode::Type mode = SymMode::CBC, const ByteString& IV = ByteString(), bool padding = true, size_t counterBits = 0, const ByteString& aad = ByteString(), size_t tagBytes = 0);
 	virtual bool encryptUpdate(const ByteString& data, ByteString& encryptedData);
 	virtual bool encryptFinal(ByteString& encryptedData);
+	virtual bool encryptUpdateSegments(const DataSegment* segments, size_t count, ByteString& encryptedData);
 
 	// Decryption functions
 	virtual bool decryptInit(const SymmetricKey* key, const SymMode::Type mode = SymMode::CBC, const ByteString& IV = ByteString(), bool padding = true, size_t counterBits = 0, const ByteString& aad = ByteString(), size_t tagBytes = 0);
@@ -71,6 +72,9 @@ protected:
 	virtual std::string getCipher() const = 0;
 
 private:
+	// Read the data that the pipe has encrypted so far
+	bool readEncrypted(ByteString& encryptedData);
+
 	// The current context
 	Botan::Pipe* cryption;
 
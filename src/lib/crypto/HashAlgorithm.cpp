@@ -62,6 +62,25 @@ bool HashAlgorithm::hashUpdate(const ByteString& /*data*/)
 	return true;
 }
 
+// Implementations that cannot take the segments directly digest them one by one
+bool HashAlgorithm::hashUpdateSegments(const DataSegment* segments, size_t count)
+{
+	if (currentOperation != HASHING)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!hashUpdate(ByteString(segments[i].data, segments[i].size)))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 bool HashAlgorithm::hashFinal(ByteString& /*hashedData*/)
 {
 	if (currentOperation != HASHING)
@@ -74,3 +93,19 @@ bool HashAlgorithm::hashFinal(ByteString& /*hashedData*/)
 	return true;
 }
 
+
+// The state of a hash operation cannot be saved unless the implementation supports it
+bool HashAlgorithm::setSaveable()
+{
+	return false;
+}
+
+bool HashAlgorithm::getState(ByteString& /*state*/)
+{
+	return false;
+}
+
+bool HashAlgorithm::setState(const ByteString& /*state*/)
+{
+	return false;
+}
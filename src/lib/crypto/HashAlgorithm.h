@@ -35,6 +35,7 @@
 
 #include "config.h"
 #include "ByteString.h"
+#include "DataSegment.h"
 
 struct HashAlgo
 {
@@ -65,6 +66,17 @@ public:
 	virtual bool hashUpdate(const ByteString& data);
 	virtual bool hashFinal(ByteString& hashedData);
 
+	// Digest the segments[0..count-1] in order, as if they were one buffer
+	virtual bool hashUpdateSegments(const DataSegment* segments, size_t count);
+
+	// Run the following operations on a context of which the state can be
+	// exported; returns false if there is none for the algorithm
+	virtual bool setSaveable();
+
+	// Export/import the state of a running hash operation
+	virtual bool getState(ByteString& state);
+	virtual bool setState(const ByteString& state);
+
 	virtual int getHashSize() = 0;
 protected:
 	// The current operation
@@ -112,6 +112,22 @@ bool MacAlgorithm::verifyFinal(ByteString& /*signature*/)
 	return true;
 }
 
+// The state of a MAC operation cannot be saved unless the implementation supports it
+bool MacAlgorithm::setSaveable()
+{
+	return false;
+}
+
+bool MacAlgorithm::getState(ByteString& /*state*/)
+{
+	return false;
+}
+
+bool MacAlgorithm::setState(const ByteString& /*state*/)
+{
+	return false;
+}
+
 unsigned long MacAlgorithm::getMinKeySize()
 {
 	return 0;
@@ -74,6 +74,15 @@ public:
 	virtual bool verifyUpdate(const ByteString& originalData);
 	virtual bool verifyFinal(ByteString& signature);
 
+	// Run the following operations on a context of which the state can be
+	// exported; returns false if there is none for the algorithm
+	virtual bool setSaveable();
+
+	// Export/import the state of a running operation; the key is not part
+	// of the state and has to be set by signInit/verifyInit before setState
+	virtual bool getState(ByteString& state);
+	virtual bool setState(const ByteString& state);
+
 	// Key
 	virtual unsigned long getMinKeySize();
 	virtual unsigned long getMaxKeySize();
@@ -32,6 +32,7 @@
 
 #include "config.h"
 #include "OSSLAES.h"
+#include "OSSLCryptoFactory.h"
 #include <algorithm>
 #include <openssl/aes.h>
 #include "salloc.h"
@@ -148,7 +149,7 @@ bool OSSLAES::wrapUnwrapKey(const SymmetricKey* key, const SymWrap::Type mode, c
 		prefix = "un";
 
 	// Determine the cipher method
-	const EVP_CIPHER* cipher = getWrapCipher(mode, key);
+	const EVP_CIPHER* cipher = OSSLCryptoFactory::i()->getFetched(getWrapCipher(mode, key));
 	if (cipher == NULL)
 	{
 		ERROR_MSG("Failed to get EVP %swrap cipher", prefix);
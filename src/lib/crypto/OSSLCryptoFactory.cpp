@@ -69,6 +69,9 @@
 #ifdef WITH_GOST
 #include <openssl/objects.h>
 #endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#include <openssl/core_names.h>
+#endif
 
 #include <dlfcn.h>
 #include <syslog.h>
@@ -305,6 +308,10 @@ OSSLCryptoFactory::OSSLCryptoFactory()
 	// Initialise the one-and-only RNG
 	rng = new OSSLRNG();
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	fetchAlgorithms();
+#endif
+
 #ifdef WITH_GOST
 	// Load engines
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
@@ -392,6 +399,10 @@ OSSLCryptoFactory::~OSSLCryptoFactory()
 	}
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	freeAlgorithms();
+#endif
+
 	// Destroy the one-and-only RNG
 	delete rng;
 
@@ -558,6 +569,205 @@ MacAlgorithm* OSSLCryptoFactory::getMacAlgorithm(MacAlgo::Type algorithm)
 	return NULL;
 }
 
+// Return the explicitly fetched implementation of a digest
+const EVP_MD* OSSLCryptoFactory::getFetched(const EVP_MD* md) const
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	std::map<const EVP_MD*, EVP_MD*>::const_iterator it = fetchedMDs.find(md);
+	if (it != fetchedMDs.end())
+	{
+		return it->second;
+	}
+#endif
+
+	return md;
+}
+
+// Return the explicitly fetched implementation of a cipher
+const EVP_CIPHER* OSSLCryptoFactory::getFetched(const EVP_CIPHER* cipher) const
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	std::map<const EVP_CIPHER*, EVP_CIPHER*>::const_iterator it = fetchedCiphers.find(cipher);
+	if (it != fetchedCiphers.end())
+	{
+		return it->second;
+	}
+#endif
+
+	return cipher;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+// Return a new CMAC context for the cipher
+EVP_MAC_CTX* OSSLCryptoFactory::newCMacCTX(const EVP_CIPHER* cipher) const
+{
+	std::map<const EVP_CIPHER*, EVP_MAC_CTX*>::const_iterator it = cmacCTXs.find(cipher);
+	if (it == cmacCTXs.end())
+	{
+		return NULL;
+	}
+
+	return EVP_MAC_CTX_dup(it->second);
+}
+
+// Return a new HMAC context for the digest
+EVP_MAC_CTX* OSSLCryptoFactory::newHMacCTX(const EVP_MD* md) const
+{
+	std::map<const EVP_MD*, EVP_MAC_CTX*>::const_iterator it = hmacCTXs.find(md);
+	if (it == hmacCTXs.end())
+	{
+		return NULL;
+	}
+
+	return EVP_MAC_CTX_dup(it->second);
+}
+
+// Fetch the digests and ciphers from the default library context
+void OSSLCryptoFactory::fetchAlgorithms()
+{
+	const EVP_MD* mds[] =
+	{
+		EVP_md5(),
+		EVP_sha1(),
+		EVP_sha224(),
+		EVP_sha256(),
+		EVP_sha384(),
+		EVP_sha512()
+	};
+	const EVP_CIPHER* ciphers[] =
+	{
+		EVP_aes_128_ecb(), EVP_aes_192_ecb(), EVP_aes_256_ecb(),
+		EVP_aes_128_cbc(), EVP_aes_192_cbc(), EVP_aes_256_cbc(),
+		EVP_aes_128_ctr(), EVP_aes_192_ctr(), EVP_aes_256_ctr(),
+		EVP_aes_128_gcm(), EVP_aes_192_gcm(), EVP_aes_256_gcm(),
+		EVP_aes_128_wrap(), EVP_aes_192_wrap(), EVP_aes_256_wrap(),
+		EVP_aes_128_wrap_pad(), EVP_aes_192_wrap_pad(), EVP_aes_256_wrap_pad(),
+		EVP_des_ecb(), EVP_des_ede_ecb(), EVP_des_ede3_ecb(),
+		EVP_des_cbc(), EVP_des_ede_cbc(), EVP_des_ede3_cbc(),
+		EVP_des_ofb(), EVP_des_ede_ofb(), EVP_des_ede3_ofb(),
+		EVP_des_cfb(), EVP_des_ede_cfb(), EVP_des_ede3_cfb()
+	};
+	const EVP_CIPHER* cmacCiphers[] =
+	{
+		EVP_des_ede_cbc(), EVP_des_ede3_cbc(),
+		EVP_aes_128_cbc(), EVP_aes_192_cbc(), EVP_aes_256_cbc()
+	};
+
+	// Algorithms the providers do not offer (e.g. in FIPS mode) are
+	// left to the implicit lookup, which will report the error
+	ERR_set_mark();
+
+	for (size_t i = 0; i < sizeof(mds) / sizeof(mds[0]); i++)
+	{
+		if (mds[i] == NULL) continue;
+
+		EVP_MD* md = EVP_MD_fetch(NULL, EVP_MD_get0_name(mds[i]), NULL);
+		if (md != NULL)
+		{
+			fetchedMDs[mds[i]] = md;
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); i++)
+	{
+		if (ciphers[i] == NULL) continue;
+
+		EVP_CIPHER* cipher = EVP_CIPHER_fetch(NULL, EVP_CIPHER_get0_name(ciphers[i]), NULL);
+		if (cipher != NULL)
+		{
+			fetchedCiphers[ciphers[i]] = cipher;
+		}
+	}
+
+	EVP_MAC* cmac = EVP_MAC_fetch(NULL, OSSL_MAC_NAME_CMAC, NULL);
+	for (size_t i = 0; cmac != NULL && i < sizeof(cmacCiphers) / sizeof(cmacCiphers[0]); i++)
+	{
+		if (fetchedCiphers.find(cmacCiphers[i]) == fetchedCiphers.end()) continue;
+
+		EVP_MAC_CTX* ctx = EVP_MAC_CTX_new(cmac);
+		if (ctx == NULL) continue;
+
+		OSSL_PARAM params[2];
+		params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_CIPHER,
+							     (char*) EVP_CIPHER_get0_name(cmacCiphers[i]), 0);
+		params[1] = OSSL_PARAM_construct_end();
+
+		// A CMAC context can only be duplicated once it has a key, so
+		// the template gets a zero key that every operation replaces
+		unsigned char zeroKey[EVP_MAX_KEY_LENGTH] = { 0 };
+		size_t keyLen = EVP_CIPHER_get_key_length(cmacCiphers[i]);
+
+		if (!EVP_MAC_CTX_set_params(ctx, params) ||
+		    !EVP_MAC_init(ctx, zeroKey, keyLen, NULL))
+		{
+			EVP_MAC_CTX_free(ctx);
+			continue;
+		}
+
+		cmacCTXs[cmacCiphers[i]] = ctx;
+	}
+	EVP_MAC_free(cmac);
+
+	EVP_MAC* hmac = EVP_MAC_fetch(NULL, OSSL_MAC_NAME_HMAC, NULL);
+	for (size_t i = 0; hmac != NULL && i < sizeof(mds) / sizeof(mds[0]); i++)
+	{
+		if (fetchedMDs.find(mds[i]) == fetchedMDs.end()) continue;
+
+		EVP_MAC_CTX* ctx = EVP_MAC_CTX_new(hmac);
+		if (ctx == NULL) continue;
+
+		OSSL_PARAM params[2];
+		params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+							     (char*) EVP_MD_get0_name(mds[i]), 0);
+		params[1] = OSSL_PARAM_construct_end();
+
+		// Like CMAC, the template gets a zero key that every operation
+		// replaces
+		unsigned char zeroKey[EVP_MAX_MD_SIZE] = { 0 };
+
+		if (!EVP_MAC_CTX_set_params(ctx, params) ||
+		    !EVP_MAC_init(ctx, zeroKey, sizeof(zeroKey), NULL))
+		{
+			EVP_MAC_CTX_free(ctx);
+			continue;
+		}
+
+		hmacCTXs[mds[i]] = ctx;
+	}
+	EVP_MAC_free(hmac);
+
+	ERR_pop_to_mark();
+}
+
+// Release the fetched algorithms
+void OSSLCryptoFactory::freeAlgorithms()
+{
+	for (std::map<const EVP_CIPHER*, EVP_MAC_CTX*>::iterator it = cmacCTXs.begin(); it != cmacCTXs.end(); it++)
+	{
+		EVP_MAC_CTX_free(it->second);
+	}
+	cmacCTXs.clear();
+
+	for (std::map<const EVP_MD*, EVP_MAC_CTX*>::iterator it = hmacCTXs.begin(); it != hmacCTXs.end(); it++)
+	{
+		EVP_MAC_CTX_free(it->second);
+	}
+	hmacCTXs.clear();
+
+	for (std::map<const EVP_CIPHER*, EVP_CIPHER*>::iterator it = fetchedCiphers.begin(); it != fetchedCiphers.end(); it++)
+	{
+		EVP_CIPHER_free(it->second);
+	}
+	fetchedCiphers.clear();
+
+	for (std::map<const EVP_MD*, EVP_MD*>::iterator it = fetchedMDs.begin(); it != fetchedMDs.end(); it++)
+	{
+		EVP_MD_free(it->second);
+	}
+	fetchedMDs.clear();
+}
+#endif
+
 // Get the global RNG (may be an unique RNG per thread)
 RNG* OSSLCryptoFactory::getRNG(RNGImpl::Type name /* = RNGImpl::Default */)
 {
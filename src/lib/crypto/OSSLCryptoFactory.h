@@ -40,9 +40,11 @@
 #include "HashAlgorithm.h"
 #include "MacAlgorithm.h"
 #include "RNG.h"
+#include <map>
 #include <memory>
 #include <openssl/conf.h>
 #include <openssl/engine.h>
+#include <openssl/evp.h>
 
 #include <tss2/tss2_sys.h>
 #include <tss2/tss2_tcti.h>
@@ -80,6 +82,19 @@ public:
 	// Destructor
 	virtual ~OSSLCryptoFactory();
 
+	// Return the explicitly fetched implementation of a digest or cipher,
+	// or the given one if it has not been fetched
+	const EVP_MD* getFetched(const EVP_MD* md) const;
+	const EVP_CIPHER* getFetched(const EVP_CIPHER* cipher) const;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	// Return a new CMAC context for the cipher, or NULL if there is none
+	EVP_MAC_CTX* newCMacCTX(const EVP_CIPHER* cipher) const;
+
+	// Return a new HMAC context for the digest, or NULL if there is none
+	EVP_MAC_CTX* newHMacCTX(const EVP_MD* md) const;
+#endif
+
 #ifdef WITH_GOST
 	// The EVP_MD for GOST R 34.11-94
 	const EVP_MD *EVP_GOST_34_11;
@@ -115,6 +130,23 @@ private:
 	ENGINE *eg;
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	// Fetch the digests and ciphers once, so that the operations do not
+	// look them up in the providers on every initialisation
+	void fetchAlgorithms();
+	void freeAlgorithms();
+
+	// The fetched implementations by their implicit counterparts
+	std::map<const EVP_MD*, EVP_MD*> fetchedMDs;
+	std::map<const EVP_CIPHER*, EVP_CIPHER*> fetchedCiphers;
+
+	// CMAC contexts with the cipher set, to be duplicated
+	std::map<const EVP_CIPHER*, EVP_MAC_CTX*> cmacCTXs;
+
+	// HMAC contexts with the digest set, to be duplicated
+	std::map<const EVP_MD*, EVP_MAC_CTX*> hmacCTXs;
+#endif
+
 	TSS2_SYS_CONTEXT *context;
 	TSS2_TCTI_CONTEXT *tcti;
 };
@@ -322,6 +322,82 @@ bool OSSLECDSA::generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParamet
 	return true;
 }
 
+// Generate several key pairs on one curve, which is decoded only once
+bool OSSLECDSA::generateKeyPairs(AsymmetricKeyPair** ppKeyPairs, size_t count, AsymmetricParameters* parameters, RNG* /*rng = NULL */)
+{
+	// Check parameters
+	if ((ppKeyPairs == NULL) ||
+	    (parameters == NULL))
+	{
+		return false;
+	}
+
+	if (!parameters->areOfType(ECParameters::type))
+	{
+		ERROR_MSG("Invalid parameters supplied for ECDSA key generation");
+
+		return false;
+	}
+
+	ECParameters* params = (ECParameters*) parameters;
+
+	EC_GROUP* grp = OSSL::byteString2grp(params->getEC());
+	if (grp == NULL)
+	{
+		ERROR_MSG("Failed to decode the ECDSA curve");
+
+		return false;
+	}
+
+	size_t generated = 0;
+	for (; generated < count; generated++)
+	{
+		// Generate the key-pair
+		EC_KEY* eckey = EC_KEY_new();
+		if (eckey == NULL)
+		{
+			ERROR_MSG("Failed to instantiate OpenSSL ECDSA object");
+
+			break;
+		}
+
+		if (!EC_KEY_set_group(eckey, grp) || !EC_KEY_generate_key(eckey))
+		{
+			ERROR_MSG("ECDSA key generation failed (0x%08X)", ERR_get_error());
+
+			EC_KEY_free(eckey);
+
+			break;
+		}
+
+		// Create an asymmetric key-pair object to return
+		OSSLECKeyPair* kp = new OSSLECKeyPair();
+
+		((OSSLECPublicKey*) kp->getPublicKey())->setFromOSSL(eckey);
+		((OSSLECPrivateKey*) kp->getPrivateKey())->setFromOSSL(eckey);
+
+		ppKeyPairs[generated] = kp;
+
+		// Release the key
+		EC_KEY_free(eckey);
+	}
+
+	EC_GROUP_free(grp);
+
+	if (generated < count)
+	{
+		while (generated > 0)
+		{
+			recycleKeyPair(ppKeyPairs[--generated]);
+			ppKeyPairs[generated] = NULL;
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
 unsigned long OSSLECDSA::getMinKeySize()
 {
 	// Smallest EC group is secp112r1
@@ -63,6 +63,7 @@ public:
 
 	// Key factory
 	virtual bool generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParameters* parameters, RNG* rng = NULL);
+	virtual bool generateKeyPairs(AsymmetricKeyPair** ppKeyPairs, size_t count, AsymmetricParameters* parameters, RNG* rng = NULL);
 	virtual unsigned long getMinKeySize();
 	virtual unsigned long getMaxKeySize();
 	virtual bool reconstructKeyPair(AsymmetricKeyPair** ppKeyPair, ByteString& serialisedData);
@@ -283,6 +283,79 @@ bool OSSLEDDSA::generateKeyPair(AsymmetricKeyPair** ppKeyPair, AsymmetricParamet
 	return true;
 }
 
+// Generate several key pairs with one initialised key generation context
+bool OSSLEDDSA::generateKeyPairs(AsymmetricKeyPair** ppKeyPairs, size_t count, AsymmetricParameters* parameters, RNG* /*rng = NULL */)
+{
+	// Check parameters
+	if ((ppKeyPairs == NULL) ||
+	    (parameters == NULL))
+	{
+		return false;
+	}
+
+	if (!parameters->areOfType(ECParameters::type))
+	{
+		ERROR_MSG("Invalid parameters supplied for EDDSA key generation");
+
+		return false;
+	}
+
+	ECParameters* params = (ECParameters*) parameters;
+	int nid = OSSL::byteString2oid(params->getEC());
+
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(nid, NULL);
+	if (ctx == NULL)
+	{
+		ERROR_MSG("Failed to instantiate OpenSSL EDDSA context");
+
+		return false;
+	}
+	if (EVP_PKEY_keygen_init(ctx) != 1)
+	{
+		ERROR_MSG("EDDSA key generation init failed (0x%08X)", ERR_get_error());
+		EVP_PKEY_CTX_free(ctx);
+		return false;
+	}
+
+	size_t generated = 0;
+	for (; generated < count; generated++)
+	{
+		// Generate the key-pair
+		EVP_PKEY* pkey = NULL;
+		if (EVP_PKEY_keygen(ctx, &pkey) != 1)
+		{
+			ERROR_MSG("EDDSA key generation failed (0x%08X)", ERR_get_error());
+			break;
+		}
+
+		// Create an asymmetric key-pair object to return
+		OSSLEDKeyPair* kp = new OSSLEDKeyPair();
+
+		((OSSLEDPublicKey*) kp->getPublicKey())->setFromOSSL(pkey);
+		((OSSLEDPrivateKey*) kp->getPrivateKey())->setFromOSSL(pkey);
+
+		ppKeyPairs[generated] = kp;
+
+		// Release the key
+		EVP_PKEY_free(pkey);
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+
+	if (generated < count)
+	{
+		while (generated > 0)
+		{
+			recycleKeyPair(ppKeyPairs[--generated]);
+			ppKeyPairs[generated] = NULL;
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
 bool OSSLEDDSA::deriveKey(SymmetricKey **ppSymmetricKey, PublicKey* publicKey, PrivateKey* privateKey)
 {
 	// Check parameters
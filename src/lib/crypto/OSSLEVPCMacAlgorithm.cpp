@@ -34,14 +34,14 @@
 
 #include "config.h"
 #include "OSSLEVPCMacAlgorithm.h"
+#include "OSSLCryptoFactory.h"
 #include "OSSLComp.h"
 #include <openssl/err.h>
 
 // Destructor
 OSSLEVPCMacAlgorithm::~OSSLEVPCMacAlgorithm()
 {
-	if (curCTX != NULL)
-		CMAC_CTX_free(curCTX);
+	freeCTX();
 }
 
 // Signing functions
@@ -66,22 +66,8 @@ bool OSSLEVPCMacAlgorithm::signInit(const SymmetricKey* key)
 	}
 
 	// Initialize the context
-	curCTX = CMAC_CTX_new();
-	if (curCTX == NULL)
+	if (!initCTX(key, cipher))
 	{
-		ERROR_MSG("Failed to allocate space for CMAC_CTX");
-
-		return false;
-	}
-
-	// Initialize EVP signing
-	if (!CMAC_Init(curCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), cipher, NULL))
-	{
-		ERROR_MSG("CMAC_Init failed: %s", ERR_error_string(ERR_get_error(), NULL));
-
-		CMAC_CTX_free(curCTX);
-		curCTX = NULL;
-
 		ByteString dummy;
 		MacAlgorithm::signFinal(dummy);
 
@@ -100,13 +86,8 @@ bool OSSLEVPCMacAlgorithm::signUpdate(const ByteString& dataToSign)
 
 	if (dataToSign.size() == 0) return true;
 
-	if (!CMAC_Update(curCTX, dataToSign.const_byte_str(), dataToSign.size()))
+	if (!updateCTX(dataToSign))
 	{
-		ERROR_MSG("CMAC_Update failed");
-
-		CMAC_CTX_free(curCTX);
-		curCTX = NULL;
-
 		ByteString dummy;
 		MacAlgorithm::signFinal(dummy);
 
@@ -123,25 +104,7 @@ bool OSSLEVPCMacAlgorithm::signFinal(ByteString& signature)
 		return false;
 	}
 
-	size_t outLen = getMacSize();
-	signature.resize(outLen);
-
-	if (!CMAC_Final(curCTX, &signature[0], &outLen))
-	{
-		ERROR_MSG("CMAC_Final failed");
-
-		CMAC_CTX_free(curCTX);
-		curCTX = NULL;
-
-		return false;
-	}
-
-	signature.resize(outLen);
-
-	CMAC_CTX_free(curCTX);
-	curCTX = NULL;
-
-	return true;
+	return finalCTX(signature);
 }
 
 // Verification functions
@@ -166,22 +129,28 @@ bool OSSLEVPCMacAlgorithm::verifyInit(const SymmetricKey* key)
 	}
 
 	// Initialize the context
-	curCTX = CMAC_CTX_new();
-	if (curCTX == NULL)
+	if (!initCTX(key, cipher))
 	{
-		ERROR_MSG("Failed to allocate space for CMAC_CTX");
+		ByteString dummy;
+		MacAlgorithm::verifyFinal(dummy);
 
 		return false;
 	}
 
-	// Initialize EVP signing
-	if (!CMAC_Init(curCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), cipher, NULL))
+	return true;
+}
+
+bool OSSLEVPCMacAlgorithm::verifyUpdate(const ByteString& originalData)
+{
+	if (!MacAlgorithm::verifyUpdate(originalData))
 	{
-		ERROR_MSG("CMAC_Init failed: %s", ERR_error_string(ERR_get_error(), NULL));
+		return false;
+	}
 
-		CMAC_CTX_free(curCTX);
-		curCTX = NULL;
+	if (originalData.size() == 0) return true;
 
+	if (!updateCTX(originalData))
+	{
 		ByteString dummy;
 		MacAlgorithm::verifyFinal(dummy);
 
@@ -191,54 +160,118 @@ bool OSSLEVPCMacAlgorithm::verifyInit(const SymmetricKey* key)
 	return true;
 }
 
-bool OSSLEVPCMacAlgorithm::verifyUpdate(const ByteString& originalData)
+bool OSSLEVPCMacAlgorithm::verifyFinal(ByteString& signature)
 {
-	if (!MacAlgorithm::verifyUpdate(originalData))
+	if (!MacAlgorithm::verifyFinal(signature))
 	{
 		return false;
 	}
 
-	if (originalData.size() == 0) return true;
+	ByteString macResult;
 
-	if (!CMAC_Update(curCTX, originalData.const_byte_str(), originalData.size()))
+	if (!finalCTX(macResult))
 	{
-		ERROR_MSG("CMAC_Update failed");
+		return false;
+	}
 
-		CMAC_CTX_free(curCTX);
-		curCTX = NULL;
+	return macResult == signature;
+}
 
-		ByteString dummy;
-		MacAlgorithm::verifyFinal(dummy);
+// Set up the context for the key; OpenSSL 3 duplicates a context that
+// already has the fetched cipher set
+bool OSSLEVPCMacAlgorithm::initCTX(const SymmetricKey* key, const EVP_CIPHER* cipher)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	curCTX = OSSLCryptoFactory::i()->newCMacCTX(cipher);
+	if (curCTX == NULL)
+	{
+		ERROR_MSG("Failed to create the CMAC context");
+
+		return false;
+	}
+
+	if (!EVP_MAC_init(curCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), NULL))
+	{
+		ERROR_MSG("EVP_MAC_init failed: %s", ERR_error_string(ERR_get_error(), NULL));
+
+		freeCTX();
+
+		return false;
+	}
+#else
+	curCTX = CMAC_CTX_new();
+	if (curCTX == NULL)
+	{
+		ERROR_MSG("Failed to allocate space for CMAC_CTX");
 
 		return false;
 	}
 
+	if (!CMAC_Init(curCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), cipher, NULL))
+	{
+		ERROR_MSG("CMAC_Init failed: %s", ERR_error_string(ERR_get_error(), NULL));
+
+		freeCTX();
+
+		return false;
+	}
+#endif
+
 	return true;
 }
 
-bool OSSLEVPCMacAlgorithm::verifyFinal(ByteString& signature)
+bool OSSLEVPCMacAlgorithm::updateCTX(const ByteString& data)
 {
-	if (!MacAlgorithm::verifyFinal(signature))
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	if (!EVP_MAC_update(curCTX, data.const_byte_str(), data.size()))
+#else
+	if (!CMAC_Update(curCTX, data.const_byte_str(), data.size()))
+#endif
 	{
+		ERROR_MSG("CMAC_Update failed");
+
+		freeCTX();
+
 		return false;
 	}
 
-	ByteString macResult;
+	return true;
+}
+
+// Compute the MAC and release the context
+bool OSSLEVPCMacAlgorithm::finalCTX(ByteString& mac)
+{
 	size_t outLen = getMacSize();
-	macResult.resize(outLen);
+	mac.resize(outLen);
 
-	if (!CMAC_Final(curCTX, &macResult[0], &outLen))
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	if (!EVP_MAC_final(curCTX, &mac[0], &outLen, mac.size()))
+#else
+	if (!CMAC_Final(curCTX, &mac[0], &outLen))
+#endif
 	{
 		ERROR_MSG("CMAC_Final failed");
 
-		CMAC_CTX_free(curCTX);
-		curCTX = NULL;
+		freeCTX();
 
 		return false;
 	}
 
+	mac.resize(outLen);
+
+	freeCTX();
+
+	return true;
+}
+
+void OSSLEVPCMacAlgorithm::freeCTX()
+{
+	if (curCTX == NULL) return;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	EVP_MAC_CTX_free(curCTX);
+#else
 	CMAC_CTX_free(curCTX);
+#endif
 	curCTX = NULL;
-
-	return macResult == signature;
 }
@@ -70,7 +70,17 @@ protected:
 
 private:
 	// The current context
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	EVP_MAC_CTX* curCTX;
+#else
 	CMAC_CTX* curCTX;
+#endif
+
+	// Context helpers
+	bool initCTX(const SymmetricKey* key, const EVP_CIPHER* cipher);
+	bool updateCTX(const ByteString& data);
+	bool finalCTX(ByteString& mac);
+	void freeCTX();
 };
 
 #endif // !_SOFTHSM_V2_OSSLEVPCMACALGORITHM_H
@@ -32,12 +32,16 @@
 
 #include "config.h"
 #include "OSSLEVPHashAlgorithm.h"
+#include "OSSLCryptoFactory.h"
 #include "OSSLComp.h"
+#include <openssl/crypto.h>
+#include <string.h>
 
 // Destructor
 OSSLEVPHashAlgorithm::~OSSLEVPHashAlgorithm()
 {
 	EVP_MD_CTX_free(curCTX);
+	OPENSSL_cleanse(&rawCTX, sizeof(rawCTX));
 }
 
 // Hashing functions
@@ -48,6 +52,25 @@ bool OSSLEVPHashAlgorithm::hashInit()
 		return false;
 	}
 
+	// Use the plain context if the state may be saved
+	curRaw = saveable ? getRawDigest() : NULL;
+	if (curRaw != NULL)
+	{
+		if (!curRaw->init(&rawCTX))
+		{
+			ERROR_MSG("Digest initialisation failed");
+
+			curRaw = NULL;
+
+			ByteString dummy;
+			HashAlgorithm::hashFinal(dummy);
+
+			return false;
+		}
+
+		return true;
+	}
+
 	// Initialize the context
 	curCTX = EVP_MD_CTX_new();
 	if (curCTX == NULL)
@@ -58,7 +81,7 @@ bool OSSLEVPHashAlgorithm::hashInit()
 	}
 
 	// Initialize EVP digesting
-	if (!EVP_DigestInit_ex(curCTX, getEVPHash(), NULL))
+	if (!EVP_DigestInit_ex(curCTX, OSSLCryptoFactory::i()->getFetched(getEVPHash()), NULL))
 	{
 		ERROR_MSG("EVP_DigestInit failed");
 
@@ -87,7 +110,54 @@ bool OSSLEVPHashAlgorithm::hashUpdate(const ByteString& data)
 		return true;
 	}
 
-	if (!EVP_DigestUpdate(curCTX, (unsigned char*) data.const_byte_str(), data.size()))
+	return digestUpdate(data.const_byte_str(), data.size());
+}
+
+bool OSSLEVPHashAlgorithm::hashUpdateSegments(const DataSegment* segments, size_t count)
+{
+	if (currentOperation != HASHING)
+	{
+		return false;
+	}
+
+	// Run the digest over the segments where they are
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!digestUpdate(segments[i].data, segments[i].size))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool OSSLEVPHashAlgorithm::digestUpdate(const unsigned char* data, size_t len)
+{
+	if (len == 0)
+	{
+		return true;
+	}
+
+	if (curRaw != NULL)
+	{
+		if (!curRaw->update(&rawCTX, data, len))
+		{
+			ERROR_MSG("Digest update failed");
+
+			OPENSSL_cleanse(&rawCTX, sizeof(rawCTX));
+			curRaw = NULL;
+
+			ByteString dummy;
+			HashAlgorithm::hashFinal(dummy);
+
+			return false;
+		}
+
+		return true;
+	}
+
+	if (!EVP_DigestUpdate(curCTX, data, len))
 	{
 		ERROR_MSG("EVP_DigestUpdate failed");
 
@@ -110,6 +180,25 @@ bool OSSLEVPHashAlgorithm::hashFinal(ByteString& hashedData)
 		return false;
 	}
 
+	if (curRaw != NULL)
+	{
+		hashedData.resize(curRaw->digestSize);
+
+		bool rv = curRaw->final(&hashedData[0], &rawCTX);
+
+		OPENSSL_cleanse(&rawCTX, sizeof(rawCTX));
+		curRaw = NULL;
+
+		if (!rv)
+		{
+			ERROR_MSG("Digest finalisation failed");
+
+			return false;
+		}
+
+		return true;
+	}
+
 	hashedData.resize(EVP_MD_size(getEVPHash()));
 	unsigned int outLen = hashedData.size();
 
@@ -131,3 +220,62 @@ bool OSSLEVPHashAlgorithm::hashFinal(ByteString& hashedData)
 	return true;
 }
 
+
+// Run the following operations on the plain context
+bool OSSLEVPHashAlgorithm::setSaveable()
+{
+	saveable = getRawDigest() != NULL;
+
+	return saveable;
+}
+
+// Export the state of a running hash operation
+bool OSSLEVPHashAlgorithm::getState(ByteString& state)
+{
+	// Only a plain context can be exported
+	if (currentOperation != HASHING || curRaw == NULL)
+	{
+		return false;
+	}
+
+	return curRaw->exportState(&rawCTX, state);
+}
+
+// Continue a hash operation from an exported state; hashInit must have
+// been called first and nothing may have been digested yet
+bool OSSLEVPHashAlgorithm::setState(const ByteString& state)
+{
+	if (currentOperation != HASHING)
+	{
+		return false;
+	}
+
+	// The state can only be continued on the plain context
+	const OSSLRawDigest* raw = curRaw != NULL ? curRaw : getRawDigest();
+	if (raw == NULL)
+	{
+		return false;
+	}
+
+	OSSLRawDigestCTX imported;
+	if (!raw->init(&imported) || !raw->importState(&imported, state))
+	{
+		ERROR_MSG("Invalid digest state");
+
+		OPENSSL_cleanse(&imported, sizeof(imported));
+
+		return false;
+	}
+
+	if (curCTX != NULL)
+	{
+		EVP_MD_CTX_free(curCTX);
+		curCTX = NULL;
+	}
+
+	memcpy(&rawCTX, &imported, sizeof(rawCTX));
+	OPENSSL_cleanse(&imported, sizeof(imported));
+	curRaw = raw;
+
+	return true;
+}
@@ -35,6 +35,7 @@
 
 #include "config.h"
 #include "HashAlgorithm.h"
+#include "OSSLRawDigest.h"
 #include <openssl/evp.h>
 
 class OSSLEVPHashAlgorithm : public HashAlgorithm
@@ -43,6 +44,8 @@ public:
 	// Base constructors
 	OSSLEVPHashAlgorithm() : HashAlgorithm() {
 		curCTX = NULL;
+		curRaw = NULL;
+		saveable = false;
 	}
 
 	// Destructor
@@ -52,14 +55,35 @@ public:
 	virtual bool hashInit();
 	virtual bool hashUpdate(const ByteString& data);
 	virtual bool hashFinal(ByteString& hashedData);
+	virtual bool hashUpdateSegments(const DataSegment* segments, size_t count);
+
+	// Run the following operations on the plain context
+	virtual bool setSaveable();
+
+	// Export/import the state of a running hash operation
+	virtual bool getState(ByteString& state);
+	virtual bool setState(const ByteString& state);
 
 	virtual int getHashSize() = 0;
 protected:
 	virtual const EVP_MD* getEVPHash() const = 0;
 
+	// The plain context of the digest, if it has one
+	virtual const OSSLRawDigest* getRawDigest() const { return NULL; }
+
 private:
+	// Feed data to the running digest
+	bool digestUpdate(const unsigned char* data, size_t len);
+
 	// Current hashing context
 	EVP_MD_CTX* curCTX;
+
+	// Current plain hashing context
+	const OSSLRawDigest* curRaw;
+	OSSLRawDigestCTX rawCTX;
+
+	// Whether the operations run on the plain context
+	bool saveable;
 };
 
 #endif // !_SOFTHSM_V2_OSSLEVPHASHALGORITHM_H
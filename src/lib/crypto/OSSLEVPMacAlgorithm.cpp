@@ -34,12 +34,17 @@
 
 #include "config.h"
 #include "OSSLEVPMacAlgorithm.h"
+#include "OSSLCryptoFactory.h"
 #include "OSSLComp.h"
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <string.h>
 
 // Destructor
 OSSLEVPMacAlgorithm::~OSSLEVPMacAlgorithm()
 {
-	HMAC_CTX_free(curCTX);
+	freeCTX();
+	rawCleanup();
 }
 
 // Signing functions
@@ -51,23 +56,31 @@ bool OSSLEVPMacAlgorithm::signInit(const SymmetricKey* key)
 		return false;
 	}
 
-	// Initialize the context
-	curCTX = HMAC_CTX_new();
-	if (curCTX == NULL)
+	// Use the plain contexts if the state may be saved
+	bool rv = saveable ? rawInit(key) : initCTX(key);
+
+	if (!rv)
 	{
-		ERROR_MSG("Failed to allocate space for HMAC_CTX");
+		ByteString dummy;
+		MacAlgorithm::signFinal(dummy);
 
 		return false;
 	}
 
-	// Initialize EVP signing
-	if (!HMAC_Init_ex(curCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), getEVPHash(), NULL))
+	return true;
+}
+
+bool OSSLEVPMacAlgorithm::signUpdate(const ByteString& dataToSign)
+{
+	if (!MacAlgorithm::signUpdate(dataToSign))
 	{
-		ERROR_MSG("HMAC_Init failed");
+		return false;
+	}
 
-		HMAC_CTX_free(curCTX);
-		curCTX = NULL;
+	bool rv = (curRaw != NULL) ? rawUpdate(dataToSign) : updateCTX(dataToSign);
 
+	if (!rv)
+	{
 		ByteString dummy;
 		MacAlgorithm::signFinal(dummy);
 
@@ -77,25 +90,37 @@ bool OSSLEVPMacAlgorithm::signInit(const SymmetricKey* key)
 	return true;
 }
 
-bool OSSLEVPMacAlgorithm::signUpdate(const ByteString& dataToSign)
+bool OSSLEVPMacAlgorithm::signFinal(ByteString& signature)
 {
-	if (!MacAlgorithm::signUpdate(dataToSign))
+	if (!MacAlgorithm::signFinal(signature))
 	{
 		return false;
 	}
 
-	// The GOST implementation in OpenSSL will segfault if we update with zero length.
-	if (dataToSign.size() == 0) return true;
+	if (curRaw != NULL)
+	{
+		return rawFinal(signature);
+	}
+
+	return finalCTX(signature);
+}
 
-	if (!HMAC_Update(curCTX, dataToSign.const_byte_str(), dataToSign.size()))
+// Verification functions
+bool OSSLEVPMacAlgorithm::verifyInit(const SymmetricKey* key)
+{
+	// Call the superclass initialiser
+	if (!MacAlgorithm::verifyInit(key))
 	{
-		ERROR_MSG("HMAC_Update failed");
+		return false;
+	}
 
-		HMAC_CTX_free(curCTX);
-		curCTX = NULL;
+	// Use the plain contexts if the state may be saved
+	bool rv = saveable ? rawInit(key) : initCTX(key);
 
+	if (!rv)
+	{
 		ByteString dummy;
-		MacAlgorithm::signFinal(dummy);
+		MacAlgorithm::verifyFinal(dummy);
 
 		return false;
 	}
@@ -103,44 +128,70 @@ bool OSSLEVPMacAlgorithm::signUpdate(const ByteString& dataToSign)
 	return true;
 }
 
-bool OSSLEVPMacAlgorithm::signFinal(ByteString& signature)
+bool OSSLEVPMacAlgorithm::verifyUpdate(const ByteString& originalData)
 {
-	if (!MacAlgorithm::signFinal(signature))
+	if (!MacAlgorithm::verifyUpdate(originalData))
 	{
 		return false;
 	}
 
-	signature.resize(EVP_MD_size(getEVPHash()));
-	unsigned int outLen = signature.size();
+	bool rv = (curRaw != NULL) ? rawUpdate(originalData) : updateCTX(originalData);
 
-	if (!HMAC_Final(curCTX, &signature[0], &outLen))
+	if (!rv)
 	{
-		ERROR_MSG("HMAC_Final failed");
+		ByteString dummy;
+		MacAlgorithm::verifyFinal(dummy);
+
+		return false;
+	}
 
-		HMAC_CTX_free(curCTX);
-		curCTX = NULL;
+	return true;
+}
 
+bool OSSLEVPMacAlgorithm::verifyFinal(ByteString& signature)
+{
+	if (!MacAlgorithm::verifyFinal(signature))
+	{
 		return false;
 	}
 
-	signature.resize(outLen);
+	ByteString macResult;
 
-	HMAC_CTX_free(curCTX);
-	curCTX = NULL;
+	if (!((curRaw != NULL) ? rawFinal(macResult) : finalCTX(macResult)))
+	{
+		return false;
+	}
 
-	return true;
+	return macResult == signature;
 }
 
-// Verification functions
-bool OSSLEVPMacAlgorithm::verifyInit(const SymmetricKey* key)
+// Set up the context for the key; OpenSSL 3 duplicates a context that
+// already has the fetched digest set, other digests (e.g. GOST) and older
+// versions use an HMAC context
+bool OSSLEVPMacAlgorithm::initCTX(const SymmetricKey* key)
 {
-	// Call the superclass initialiser
-	if (!MacAlgorithm::verifyInit(key))
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	// An empty key would leave the key of the template in place
+	if (key->getKeyBits().size() > 0)
 	{
-		return false;
+		macCTX = OSSLCryptoFactory::i()->newHMacCTX(getEVPHash());
 	}
 
-	// Initialize the context
+	if (macCTX != NULL)
+	{
+		if (!EVP_MAC_init(macCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), NULL))
+		{
+			ERROR_MSG("EVP_MAC_init failed: %s", ERR_error_string(ERR_get_error(), NULL));
+
+			freeCTX();
+
+			return false;
+		}
+
+		return true;
+	}
+#endif
+
 	curCTX = HMAC_CTX_new();
 	if (curCTX == NULL)
 	{
@@ -149,16 +200,36 @@ bool OSSLEVPMacAlgorithm::verifyInit(const SymmetricKey* key)
 		return false;
 	}
 
-	// Initialize EVP signing
-	if (!HMAC_Init_ex(curCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), getEVPHash(), NULL))
+	if (!HMAC_Init_ex(curCTX, key->getKeyBits().const_byte_str(), key->getKeyBits().size(), OSSLCryptoFactory::i()->getFetched(getEVPHash()), NULL))
 	{
 		ERROR_MSG("HMAC_Init failed");
 
-		HMAC_CTX_free(curCTX);
-		curCTX = NULL;
+		freeCTX();
 
-		ByteString dummy;
-		MacAlgorithm::verifyFinal(dummy);
+		return false;
+	}
+
+	return true;
+}
+
+bool OSSLEVPMacAlgorithm::updateCTX(const ByteString& data)
+{
+	// The GOST implementation in OpenSSL will segfault if we update with zero length.
+	if (data.size() == 0) return true;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	bool rv = (macCTX != NULL) ?
+		  EVP_MAC_update(macCTX, data.const_byte_str(), data.size()) :
+		  HMAC_Update(curCTX, data.const_byte_str(), data.size());
+#else
+	bool rv = HMAC_Update(curCTX, data.const_byte_str(), data.size());
+#endif
+
+	if (!rv)
+	{
+		ERROR_MSG("HMAC_Update failed");
+
+		freeCTX();
 
 		return false;
 	}
@@ -166,55 +237,203 @@ bool OSSLEVPMacAlgorithm::verifyInit(const SymmetricKey* key)
 	return true;
 }
 
-bool OSSLEVPMacAlgorithm::verifyUpdate(const ByteString& originalData)
+// Compute the MAC and release the context
+bool OSSLEVPMacAlgorithm::finalCTX(ByteString& mac)
 {
-	if (!MacAlgorithm::verifyUpdate(originalData))
+	mac.resize(EVP_MD_size(getEVPHash()));
+
+	bool rv;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	if (macCTX != NULL)
+	{
+		size_t outLen = mac.size();
+
+		rv = EVP_MAC_final(macCTX, &mac[0], &outLen, mac.size());
+		mac.resize(outLen);
+	}
+	else
+#endif
+	{
+		unsigned int outLen = mac.size();
+
+		rv = HMAC_Final(curCTX, &mac[0], &outLen);
+		mac.resize(outLen);
+	}
+
+	freeCTX();
+
+	if (!rv)
 	{
+		ERROR_MSG("HMAC_Final failed");
+
 		return false;
 	}
 
-	// The GOST implementation in OpenSSL will segfault if we update with zero length.
-	if (originalData.size() == 0) return true;
+	return true;
+}
 
-	if (!HMAC_Update(curCTX, originalData.const_byte_str(), originalData.size()))
+void OSSLEVPMacAlgorithm::freeCTX()
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	EVP_MAC_CTX_free(macCTX);
+	macCTX = NULL;
+#endif
+	HMAC_CTX_free(curCTX);
+	curCTX = NULL;
+}
+
+// Run the following operations on the plain contexts
+bool OSSLEVPMacAlgorithm::setSaveable()
+{
+	saveable = getRawDigest() != NULL;
+
+	return saveable;
+}
+
+// Export the state of a running operation; only the inner hash context is
+// exported since the outer one is recomputed from the key
+bool OSSLEVPMacAlgorithm::getState(ByteString& state)
+{
+	if (curRaw == NULL)
 	{
-		ERROR_MSG("HMAC_Update failed");
+		return false;
+	}
 
-		HMAC_CTX_free(curCTX);
-		curCTX = NULL;
+	return curRaw->exportState(&innerCTX, state);
+}
 
-		ByteString dummy;
-		MacAlgorithm::verifyFinal(dummy);
+// Continue an operation from an exported state; signInit or verifyInit must
+// have been called first with the same key and nothing may have been
+// processed yet
+bool OSSLEVPMacAlgorithm::setState(const ByteString& state)
+{
+	if (currentKey == NULL)
+	{
+		return false;
+	}
+
+	// The state can only be continued on the plain contexts
+	if (curRaw == NULL)
+	{
+		if (getRawDigest() == NULL || !rawInit(currentKey))
+		{
+			return false;
+		}
+
+		freeCTX();
+	}
+
+	OSSLRawDigestCTX imported;
+	if (!curRaw->init(&imported) || !curRaw->importState(&imported, state))
+	{
+		ERROR_MSG("Invalid HMAC state");
+
+		OPENSSL_cleanse(&imported, sizeof(imported));
 
 		return false;
 	}
 
+	memcpy(&innerCTX, &imported, sizeof(innerCTX));
+	OPENSSL_cleanse(&imported, sizeof(imported));
+
 	return true;
 }
 
-bool OSSLEVPMacAlgorithm::verifyFinal(ByteString& signature)
+// Set up the inner and outer contexts (RFC 2104)
+bool OSSLEVPMacAlgorithm::rawInit(const SymmetricKey* key)
 {
-	if (!MacAlgorithm::verifyFinal(signature))
+	const OSSLRawDigest* raw = getRawDigest();
+
+	// Keys longer than the block size are hashed first
+	ByteString keyBlock = key->getKeyBits();
+	if (keyBlock.size() > raw->blockSize)
+	{
+		ByteString hashedKey;
+		hashedKey.resize(raw->digestSize);
+
+		if (!raw->init(&innerCTX) ||
+		    !raw->update(&innerCTX, keyBlock.const_byte_str(), keyBlock.size()) ||
+		    !raw->final(&hashedKey[0], &innerCTX))
+		{
+			ERROR_MSG("Failed to hash the HMAC key");
+
+			OPENSSL_cleanse(&innerCTX, sizeof(innerCTX));
+
+			return false;
+		}
+
+		keyBlock = hashedKey;
+	}
+	keyBlock.resize(raw->blockSize);
+
+	ByteString innerPad(keyBlock);
+	ByteString outerPad(keyBlock);
+	for (size_t i = 0; i < raw->blockSize; i++)
+	{
+		innerPad[i] ^= 0x36;
+		outerPad[i] ^= 0x5c;
+	}
+
+	if (!raw->init(&innerCTX) ||
+	    !raw->update(&innerCTX, innerPad.const_byte_str(), innerPad.size()) ||
+	    !raw->init(&outerCTX) ||
+	    !raw->update(&outerCTX, outerPad.const_byte_str(), outerPad.size()))
 	{
+		ERROR_MSG("HMAC initialisation failed");
+
+		OPENSSL_cleanse(&innerCTX, sizeof(innerCTX));
+		OPENSSL_cleanse(&outerCTX, sizeof(outerCTX));
+
 		return false;
 	}
 
-	ByteString macResult;
-	unsigned int outLen = EVP_MD_size(getEVPHash());
-	macResult.resize(outLen);
+	curRaw = raw;
+
+	return true;
+}
 
-	if (!HMAC_Final(curCTX, &macResult[0], &outLen))
+bool OSSLEVPMacAlgorithm::rawUpdate(const ByteString& data)
+{
+	if (data.size() == 0) return true;
+
+	if (!curRaw->update(&innerCTX, data.const_byte_str(), data.size()))
 	{
-		ERROR_MSG("HMAC_Final failed");
+		ERROR_MSG("HMAC update failed");
 
-		HMAC_CTX_free(curCTX);
-		curCTX = NULL;
+		rawCleanup();
 
 		return false;
 	}
 
-	HMAC_CTX_free(curCTX);
-	curCTX = NULL;
+	return true;
+}
 
-	return macResult == signature;
+bool OSSLEVPMacAlgorithm::rawFinal(ByteString& mac)
+{
+	ByteString innerHash;
+	innerHash.resize(curRaw->digestSize);
+	mac.resize(curRaw->digestSize);
+
+	bool rv = curRaw->final(&innerHash[0], &innerCTX) &&
+		  curRaw->update(&outerCTX, innerHash.const_byte_str(), innerHash.size()) &&
+		  curRaw->final(&mac[0], &outerCTX);
+
+	rawCleanup();
+
+	if (!rv)
+	{
+		ERROR_MSG("HMAC finalisation failed");
+
+		return false;
+	}
+
+	return true;
+}
+
+void OSSLEVPMacAlgorithm::rawCleanup()
+{
+	OPENSSL_cleanse(&innerCTX, sizeof(innerCTX));
+	OPENSSL_cleanse(&outerCTX, sizeof(outerCTX));
+	curRaw = NULL;
 }
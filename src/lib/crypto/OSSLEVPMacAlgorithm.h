@@ -37,6 +37,7 @@
 #include "config.h"
 #include "SymmetricKey.h"
 #include "MacAlgorithm.h"
+#include "OSSLRawDigest.h"
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 
@@ -46,6 +47,11 @@ public:
 	// Constructor
 	OSSLEVPMacAlgorithm() {
 		curCTX = NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+		macCTX = NULL;
+#endif
+		curRaw = NULL;
+		saveable = false;
 	};
 
 	// Destructor
@@ -61,6 +67,13 @@ public:
 	virtual bool verifyUpdate(const ByteString& originalData);
 	virtual bool verifyFinal(ByteString& signature);
 
+	// Run the following operations on the plain contexts
+	virtual bool setSaveable();
+
+	// Export/import the state of a running operation
+	virtual bool getState(ByteString& state);
+	virtual bool setState(const ByteString& state);
+
 	// Return the MAC size
 	virtual size_t getMacSize() const = 0;
 
@@ -68,9 +81,36 @@ protected:
 	// Return the right hash for the operation
 	virtual const EVP_MD* getEVPHash() const = 0;
 
+	// The plain context of the hash, if it has one; the HMAC is then
+	// computed on it directly when the state may be saved
+	virtual const OSSLRawDigest* getRawDigest() const { return NULL; }
+
 private:
 	// The current context
 	HMAC_CTX* curCTX;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	EVP_MAC_CTX* macCTX;
+#endif
+
+	// The current plain inner and outer contexts
+	const OSSLRawDigest* curRaw;
+	OSSLRawDigestCTX innerCTX;
+	OSSLRawDigestCTX outerCTX;
+
+	// Whether the operations run on the plain contexts
+	bool saveable;
+
+	// Context helpers
+	bool initCTX(const SymmetricKey* key);
+	bool updateCTX(const ByteString& data);
+	bool finalCTX(ByteString& mac);
+	void freeCTX();
+
+	// Plain HMAC helpers
+	bool rawInit(const SymmetricKey* key);
+	bool rawUpdate(const ByteString& data);
+	bool rawFinal(ByteString& mac);
+	void rawCleanup();
 };
 
 #endif // !_SOFTHSM_V2_OSSLEVPMACALGORITHM_H
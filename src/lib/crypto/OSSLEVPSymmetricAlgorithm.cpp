@@ -34,6 +34,7 @@
 
 #include "config.h"
 #include "OSSLEVPSymmetricAlgorithm.h"
+#include "OSSLCryptoFactory.h"
 #include "OSSLUtil.h"
 #include "salloc.h"
 #include <openssl/err.h>
@@ -122,7 +123,7 @@ bool OSSLEVPSymmetricAlgorithm::encryptInit(const SymmetricKey* key, const SymMo
 	}
 
 	// Determine the cipher class
-	const EVP_CIPHER* cipher = getCipher();
+	const EVP_CIPHER* cipher = OSSLCryptoFactory::i()->getFetched(getCipher());
 
 	if (cipher == NULL)
 	{
@@ -245,6 +246,69 @@ bool OSSLEVPSymmetricAlgorithm::encryptUpdate(const ByteString& data, ByteString
 	return true;
 }
 
+bool OSSLEVPSymmetricAlgorithm::encryptUpdateSegments(const DataSegment* segments, size_t count, ByteString& encryptedData)
+{
+	if (currentOperation != ENCRYPT)
+	{
+		EVP_CIPHER_CTX_free(pCurCTX);
+		pCurCTX = NULL;
+
+		return false;
+	}
+
+	size_t dataSize = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		dataSize += segments[i].size;
+	}
+	currentBufferSize += dataSize;
+
+	if (dataSize == 0)
+	{
+		encryptedData.resize(0);
+
+		return true;
+	}
+
+	// Count number of bytes written
+	if (!BN_is_negative(maximumBytes))
+	{
+		BN_add_word(counterBytes, dataSize);
+	}
+
+	// Prepare one output block for all segments
+	encryptedData.resize(dataSize + getBlockSize() - 1);
+
+	// Run the cipher over the segments where they are
+	int written = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (segments[i].size == 0) continue;
+
+		int outLen = encryptedData.size() - written;
+		if (!EVP_EncryptUpdate(pCurCTX, &encryptedData[written], &outLen, segments[i].data, segments[i].size))
+		{
+			ERROR_MSG("EVP_EncryptUpdate failed: %s", ERR_error_string(ERR_get_error(), NULL));
+
+			EVP_CIPHER_CTX_free(pCurCTX);
+			pCurCTX = NULL;
+
+			ByteString dummy;
+			SymmetricAlgorithm::encryptFinal(dummy);
+
+			return false;
+		}
+
+		written += outLen;
+	}
+
+	// Resize the output block
+	encryptedData.resize(written);
+	currentBufferSize -= written;
+
+	return true;
+}
+
 bool OSSLEVPSymmetricAlgorithm::encryptFinal(ByteString& encryptedData)
 {
 	SymMode::Type mode = currentCipherMode;
@@ -355,7 +419,7 @@ bool OSSLEVPSymmetricAlgorithm::decryptInit(const SymmetricKey* key, const SymMo
 	}
 
 	// Determine the cipher class
-	const EVP_CIPHER* cipher = getCipher();
+	const EVP_CIPHER* cipher = OSSLCryptoFactory::i()->getFetched(getCipher());
 
 	if (cipher == NULL)
 	{
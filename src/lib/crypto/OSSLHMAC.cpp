@@ -41,6 +41,11 @@ const EVP_MD* OSSLHMACMD5::getEVPHash() const
 	return EVP_md5();
 }
 
+const OSSLRawDigest* OSSLHMACMD5::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::MD5);
+}
+
 size_t OSSLHMACMD5::getMacSize() const
 {
 	return 16;
@@ -51,6 +56,11 @@ const EVP_MD* OSSLHMACSHA1::getEVPHash() const
 	return EVP_sha1();
 }
 
+const OSSLRawDigest* OSSLHMACSHA1::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA1);
+}
+
 size_t OSSLHMACSHA1::getMacSize() const
 {
 	return 20;
@@ -61,6 +71,11 @@ const EVP_MD* OSSLHMACSHA224::getEVPHash() const
 	return EVP_sha224();
 }
 
+const OSSLRawDigest* OSSLHMACSHA224::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA224);
+}
+
 size_t OSSLHMACSHA224::getMacSize() const
 {
 	return 28;
@@ -71,6 +86,11 @@ const EVP_MD* OSSLHMACSHA256::getEVPHash() const
 	return EVP_sha256();
 }
 
+const OSSLRawDigest* OSSLHMACSHA256::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA256);
+}
+
 size_t OSSLHMACSHA256::getMacSize() const
 {
 	return 32;
@@ -81,6 +101,11 @@ const EVP_MD* OSSLHMACSHA384::getEVPHash() const
 	return EVP_sha384();
 }
 
+const OSSLRawDigest* OSSLHMACSHA384::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA384);
+}
+
 size_t OSSLHMACSHA384::getMacSize() const
 {
 	return 48;
@@ -91,6 +116,11 @@ const EVP_MD* OSSLHMACSHA512::getEVPHash() const
 	return EVP_sha512();
 }
 
+const OSSLRawDigest* OSSLHMACSHA512::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA512);
+}
+
 size_t OSSLHMACSHA512::getMacSize() const
 {
 	return 64;
@@ -41,6 +41,7 @@ class OSSLHMACMD5 : public OSSLEVPMacAlgorithm
 {
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 	virtual size_t getMacSize() const;
 };
 
@@ -48,6 +49,7 @@ class OSSLHMACSHA1 : public OSSLEVPMacAlgorithm
 {
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 	virtual size_t getMacSize() const;
 };
 
@@ -55,6 +57,7 @@ class OSSLHMACSHA224 : public OSSLEVPMacAlgorithm
 {
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 	virtual size_t getMacSize() const;
 };
 
@@ -62,6 +65,7 @@ class OSSLHMACSHA256 : public OSSLEVPMacAlgorithm
 {
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 	virtual size_t getMacSize() const;
 };
 
@@ -69,6 +73,7 @@ class OSSLHMACSHA384 : public OSSLEVPMacAlgorithm
 {
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 	virtual size_t getMacSize() const;
 };
 
@@ -76,6 +81,7 @@ class OSSLHMACSHA512 : public OSSLEVPMacAlgorithm
 {
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 	virtual size_t getMacSize() const;
 };
 
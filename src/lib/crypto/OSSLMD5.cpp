@@ -44,3 +44,7 @@ const EVP_MD* OSSLMD5::getEVPHash() const
 	return EVP_md5();
 }
 
+const OSSLRawDigest* OSSLMD5::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::MD5);
+}
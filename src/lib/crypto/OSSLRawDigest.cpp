@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*****************************************************************************
+ OSSLRawDigest.cpp
+
+ OpenSSL digest primitives operating on a plain context structure
+ *****************************************************************************/
+
+#include "config.h"
+
+// The plain contexts are deprecated by OpenSSL 3, but they are the only way to
+// export the state of a running digest
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "OSSLRawDigest.h"
+#include <openssl/crypto.h>
+#include <string.h>
+
+#ifndef WITH_FIPS
+
+// Version of the saved state format. A state holds the version byte, the
+// number of bytes digested so far (8 bytes), the chaining value and the bytes
+// of the last partial block. All numbers are big endian.
+#define RAW_STATE_VERSION	1
+
+// The largest chaining value is that of SHA-512
+#define RAW_STATE_MAX_WORDS	8
+
+// Write a number of size bytes in big endian order
+static unsigned char* putNumber(unsigned char* p, unsigned long long value, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		p[i] = (unsigned char)(value >> ((size - 1 - i) * 8));
+	}
+
+	return p + size;
+}
+
+// Read a number of size bytes in big endian order
+static const unsigned char* getNumber(const unsigned char* p, unsigned long long& value, size_t size)
+{
+	value = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		value = (value << 8) | p[i];
+	}
+
+	return p + size;
+}
+
+// Encode the parts of a running context
+static bool encodeState(ByteString& state, unsigned long long length, const unsigned long long* chain, size_t words, size_t wordSize, const void* buffered, size_t num, size_t blockSize)
+{
+	if (length % blockSize != num) return false;
+
+	state.resize(1 + 8 + words * wordSize + num);
+
+	unsigned char* p = &state[0];
+	*p++ = RAW_STATE_VERSION;
+	p = putNumber(p, length, 8);
+	for (size_t i = 0; i < words; i++)
+	{
+		p = putNumber(p, chain[i], wordSize);
+	}
+	if (num > 0) memcpy(p, buffered, num);
+
+	return true;
+}
+
+// Decode the parts of a running context; buffered points into the state
+static bool decodeState(const ByteString& state, unsigned long long& length, unsigned long long* chain, size_t words, size_t wordSize, const unsigned char*& buffered, size_t& num, size_t blockSize)
+{
+	if (state.size() < 1 + 8 + words * wordSize) return false;
+
+	const unsigned char* p = state.const_byte_str();
+	if (*p++ != RAW_STATE_VERSION) return false;
+
+	p = getNumber(p, length, 8);
+
+	// The bit count of the context has to fit in 64 bits for MD5, SHA-1 and SHA-256
+	if (length >> 61) return false;
+
+	for (size_t i = 0; i < words; i++)
+	{
+		p = getNumber(p, chain[i], wordSize);
+	}
+
+	num = length % blockSize;
+	if (state.size() != 1 + 8 + words * wordSize + num) return false;
+
+	buffered = p;
+
+	return true;
+}
+
+// MD5
+static bool md5Init(OSSLRawDigestCTX* ctx)
+{
+	return MD5_Init(&ctx->md5) == 1;
+}
+
+static bool md5Update(OSSLRawDigestCTX* ctx, const void* data, size_t len)
+{
+	return MD5_Update(&ctx->md5, data, len) == 1;
+}
+
+static bool md5Final(unsigned char* md, OSSLRawDigestCTX* ctx)
+{
+	return MD5_Final(md, &ctx->md5) == 1;
+}
+
+static bool md5Export(const OSSLRawDigestCTX* ctx, ByteString& state)
+{
+	const MD5_CTX* c = &ctx->md5;
+	unsigned long long chain[4] = { c->A, c->B, c->C, c->D };
+	unsigned long long length = ((((unsigned long long)c->Nh) << 32) | c->Nl) >> 3;
+
+	return encodeState(state, length, chain, 4, 4, c->data, c->num, MD5_CBLOCK);
+}
+
+static bool md5Import(OSSLRawDigestCTX* ctx, const ByteString& state)
+{
+	MD5_CTX* c = &ctx->md5;
+	unsigned long long chain[4];
+	unsigned long long length;
+	const unsigned char* buffered;
+	size_t num;
+
+	if (!decodeState(state, length, chain, 4, 4, buffered, num, MD5_CBLOCK)) return false;
+
+	c->A = (MD5_LONG)chain[0];
+	c->B = (MD5_LONG)chain[1];
+	c->C = (MD5_LONG)chain[2];
+	c->D = (MD5_LONG)chain[3];
+	c->Nl = (MD5_LONG)(length << 3);
+	c->Nh = (MD5_LONG)(length >> 29);
+	memcpy(c->data, buffered, num);
+	c->num = num;
+
+	return true;
+}
+
+// SHA-1
+static bool sha1Init(OSSLRawDigestCTX* ctx)
+{
+	return SHA1_Init(&ctx->sha1) == 1;
+}
+
+static bool sha1Update(OSSLRawDigestCTX* ctx, const void* data, size_t len)
+{
+	return SHA1_Update(&ctx->sha1, data, len) == 1;
+}
+
+static bool sha1Final(unsigned char* md, OSSLRawDigestCTX* ctx)
+{
+	return SHA1_Final(md, &ctx->sha1) == 1;
+}
+
+static bool sha1Export(const OSSLRawDigestCTX* ctx, ByteString& state)
+{
+	const SHA_CTX* c = &ctx->sha1;
+	unsigned long long chain[5] = { c->h0, c->h1, c->h2, c->h3, c->h4 };
+	unsigned long long length = ((((unsigned long long)c->Nh) << 32) | c->Nl) >> 3;
+
+	return encodeState(state, length, chain, 5, 4, c->data, c->num, SHA_CBLOCK);
+}
+
+static bool sha1Import(OSSLRawDigestCTX* ctx, const ByteString& state)
+{
+	SHA_CTX* c = &ctx->sha1;
+	unsigned long long chain[5];
+	unsigned long long length;
+	const unsigned char* buffered;
+	size_t num;
+
+	if (!decodeState(state, length, chain, 5, 4, buffered, num, SHA_CBLOCK)) return false;
+
+	c->h0 = (SHA_LONG)chain[0];
+	c->h1 = (SHA_LONG)chain[1];
+	c->h2 = (SHA_LONG)chain[2];
+	c->h3 = (SHA_LONG)chain[3];
+	c->h4 = (SHA_LONG)chain[4];
+	c->Nl = (SHA_LONG)(length << 3);
+	c->Nh = (SHA_LONG)(length >> 29);
+	memcpy(c->data, buffered, num);
+	c->num = num;
+
+	return true;
+}
+
+// SHA-224 and SHA-256
+static bool sha224Init(OSSLRawDigestCTX* ctx)
+{
+	return SHA224_Init(&ctx->sha256) == 1;
+}
+
+static bool sha256Init(OSSLRawDigestCTX* ctx)
+{
+	return SHA256_Init(&ctx->sha256) == 1;
+}
+
+static bool sha256Update(OSSLRawDigestCTX* ctx, const void* data, size_t len)
+{
+	return SHA256_Update(&ctx->sha256, data, len) == 1;
+}
+
+static bool sha256Final(unsigned char* md, OSSLRawDigestCTX* ctx)
+{
+	return SHA256_Final(md, &ctx->sha256) == 1;
+}
+
+static bool sha256Export(const OSSLRawDigestCTX* ctx, ByteString& state)
+{
+	const SHA256_CTX* c = &ctx->sha256;
+	unsigned long long chain[8];
+	unsigned long long length = ((((unsigned long long)c->Nh) << 32) | c->Nl) >> 3;
+
+	for (size_t i = 0; i < 8; i++) chain[i] = c->h[i];
+
+	return encodeState(state, length, chain, 8, 4, c->data, c->num, SHA256_CBLOCK);
+}
+
+// The context has to be initialised for the same digest length
+static bool sha256Import(OSSLRawDigestCTX* ctx, const ByteString& state)
+{
+	SHA256_CTX* c = &ctx->sha256;
+	unsigned long long chain[8];
+	unsigned long long length;
+	const unsigned char* buffered;
+	size_t num;
+
+	if (!decodeState(state, length, chain, 8, 4, buffered, num, SHA256_CBLOCK)) return false;
+
+	for (size_t i = 0; i < 8; i++) c->h[i] = (SHA_LONG)chain[i];
+	c->Nl = (SHA_LONG)(length << 3);
+	c->Nh = (SHA_LONG)(length >> 29);
+	memcpy(c->data, buffered, num);
+	c->num = num;
+
+	return true;
+}
+
+// SHA-384 and SHA-512
+static bool sha384Init(OSSLRawDigestCTX* ctx)
+{
+	return SHA384_Init(&ctx->sha512) == 1;
+}
+
+static bool sha512Init(OSSLRawDigestCTX* ctx)
+{
+	return SHA512_Init(&ctx->sha512) == 1;
+}
+
+static bool sha512Update(OSSLRawDigestCTX* ctx, const void* data, size_t len)
+{
+	return SHA512_Update(&ctx->sha512, data, len) == 1;
+}
+
+static bool sha512Final(unsigned char* md, OSSLRawDigestCTX* ctx)
+{
+	return SHA512_Final(md, &ctx->sha512) == 1;
+}
+
+static bool sha512Export(const OSSLRawDigestCTX* ctx, ByteString& state)
+{
+	const SHA512_CTX* c = &ctx->sha512;
+	unsigned long long chain[8];
+
+	// More than 2^64 bytes cannot be saved
+	if (c->Nh >> 3) return false;
+	unsigned long long length = (((unsigned long long)c->Nh) << 61) | (c->Nl >> 3);
+
+	for (size_t i = 0; i < 8; i++) chain[i] = c->h[i];
+
+	return encodeState(state, length, chain, 8, 8, c->u.p, c->num, SHA512_CBLOCK);
+}
+
+// The context has to be initialised for the same digest length
+static bool sha512Import(OSSLRawDigestCTX* ctx, const ByteString& state)
+{
+	SHA512_CTX* c = &ctx->sha512;
+	unsigned long long chain[8];
+	unsigned long long length;
+	const unsigned char* buffered;
+	size_t num;
+
+	if (!decodeState(state, length, chain, 8, 8, buffered, num, SHA512_CBLOCK)) return false;
+
+	for (size_t i = 0; i < 8; i++) c->h[i] = chain[i];
+	c->Nl = length << 3;
+	c->Nh = length >> 61;
+	memcpy(c->u.p, buffered, num);
+	c->num = num;
+
+	return true;
+}
+
+static const OSSLRawDigest rawMD5 =
+	{ MD5_CBLOCK, MD5_DIGEST_LENGTH, md5Init, md5Update, md5Final, md5Export, md5Import };
+static const OSSLRawDigest rawSHA1 =
+	{ SHA_CBLOCK, SHA_DIGEST_LENGTH, sha1Init, sha1Update, sha1Final, sha1Export, sha1Import };
+static const OSSLRawDigest rawSHA224 =
+	{ SHA256_CBLOCK, SHA224_DIGEST_LENGTH, sha224Init, sha256Update, sha256Final, sha256Export, sha256Import };
+static const OSSLRawDigest rawSHA256 =
+	{ SHA256_CBLOCK, SHA256_DIGEST_LENGTH, sha256Init, sha256Update, sha256Final, sha256Export, sha256Import };
+static const OSSLRawDigest rawSHA384 =
+	{ SHA512_CBLOCK, SHA384_DIGEST_LENGTH, sha384Init, sha512Update, sha512Final, sha512Export, sha512Import };
+static const OSSLRawDigest rawSHA512 =
+	{ SHA512_CBLOCK, SHA512_DIGEST_LENGTH, sha512Init, sha512Update, sha512Final, sha512Export, sha512Import };
+
+#endif // !WITH_FIPS
+
+// Return the primitives for the given algorithm
+const OSSLRawDigest* OSSLRawDigest::get(HashAlgo::Type algorithm)
+{
+	switch (algorithm)
+	{
+#ifndef WITH_FIPS
+		case HashAlgo::MD5:
+			return &rawMD5;
+		case HashAlgo::SHA1:
+			return &rawSHA1;
+		case HashAlgo::SHA224:
+			return &rawSHA224;
+		case HashAlgo::SHA256:
+			return &rawSHA256;
+		case HashAlgo::SHA384:
+			return &rawSHA384;
+		case HashAlgo::SHA512:
+			return &rawSHA512;
+#endif
+		default:
+			return NULL;
+	}
+}
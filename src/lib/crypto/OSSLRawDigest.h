@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*****************************************************************************
+ OSSLRawDigest.h
+
+ OpenSSL digest primitives operating on a plain context structure. Unlike an
+ EVP_MD_CTX, the context is a public C structure whose running state can be
+ exported and imported again. They are only used for the operations of which
+ the state is saved through C_GetOperationState/C_SetOperationState, and are
+ not available in FIPS mode.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OSSLRAWDIGEST_H
+#define _SOFTHSM_V2_OSSLRAWDIGEST_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "HashAlgorithm.h"
+#include <stddef.h>
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+// Storage large enough for any of the supported contexts
+union OSSLRawDigestCTX
+{
+	MD5_CTX md5;
+	SHA_CTX sha1;
+	SHA256_CTX sha256;
+	SHA512_CTX sha512;
+};
+
+struct OSSLRawDigest
+{
+	// The block size and the digest size in bytes
+	size_t blockSize;
+	size_t digestSize;
+
+	// The digest primitives
+	bool (*init)(OSSLRawDigestCTX* ctx);
+	bool (*update)(OSSLRawDigestCTX* ctx, const void* data, size_t len);
+	bool (*final)(unsigned char* md, OSSLRawDigestCTX* ctx);
+
+	// Encode a running context in the saved state format, and restore it
+	// from there into a context that was initialised by init
+	bool (*exportState)(const OSSLRawDigestCTX* ctx, ByteString& state);
+	bool (*importState)(OSSLRawDigestCTX* ctx, const ByteString& state);
+
+	// Return the primitives for the given algorithm; NULL if there are none
+	static const OSSLRawDigest* get(HashAlgo::Type algorithm);
+};
+
+#endif // !_SOFTHSM_V2_OSSLRAWDIGEST_H
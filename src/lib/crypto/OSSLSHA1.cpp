@@ -44,3 +44,7 @@ const EVP_MD* OSSLSHA1::getEVPHash() const
 	return EVP_sha1();
 }
 
+const OSSLRawDigest* OSSLSHA1::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA1);
+}
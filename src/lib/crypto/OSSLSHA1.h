@@ -42,6 +42,7 @@ class OSSLSHA1 : public OSSLEVPHashAlgorithm
 	virtual int getHashSize();
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 };
 
 #endif // !_SOFTHSM_V2_OSSLSHA1_H
@@ -44,3 +44,7 @@ const EVP_MD* OSSLSHA224::getEVPHash() const
 	return EVP_sha224();
 }
 
+const OSSLRawDigest* OSSLSHA224::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA224);
+}
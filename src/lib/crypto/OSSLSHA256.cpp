@@ -44,3 +44,7 @@ const EVP_MD* OSSLSHA256::getEVPHash() const
 	return EVP_sha256();
 }
 
+const OSSLRawDigest* OSSLSHA256::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA256);
+}
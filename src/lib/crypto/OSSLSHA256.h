@@ -42,6 +42,7 @@ class OSSLSHA256 : public OSSLEVPHashAlgorithm
 	virtual int getHashSize();
 protected:
 	virtual const EVP_MD* getEVPHash() const;
+	virtual const OSSLRawDigest* getRawDigest() const;
 };
 
 #endif // !_SOFTHSM_V2_OSSLSHA256_H
@@ -44,3 +44,7 @@ const EVP_MD* OSSLSHA384::getEVPHash() const
 	return EVP_sha384();
 }
 
+const OSSLRawDigest* OSSLSHA384::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA384);
+}
@@ -44,3 +44,7 @@ const EVP_MD* OSSLSHA512::getEVPHash() const
 	return EVP_sha512();
 }
 
+const OSSLRawDigest* OSSLSHA512::getRawDigest() const
+{
+	return OSSLRawDigest::get(HashAlgo::SHA512);
+}
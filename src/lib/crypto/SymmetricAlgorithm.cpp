@@ -75,6 +75,31 @@ bool SymmetricAlgorithm::encryptUpdate(const ByteString& data, ByteString& /*enc
 	return true;
 }
 
+// Implementations that cannot take the segments directly encrypt them one by one
+bool SymmetricAlgorithm::encryptUpdateSegments(const DataSegment* segments, size_t count, ByteString& encryptedData)
+{
+	if (currentOperation != ENCRYPT)
+	{
+		return false;
+	}
+
+	encryptedData.resize(0);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		ByteString encryptedPart;
+
+		if (!encryptUpdate(ByteString(segments[i].data, segments[i].size), encryptedPart))
+		{
+			return false;
+		}
+
+		encryptedData += encryptedPart;
+	}
+
+	return true;
+}
+
 bool SymmetricAlgorithm::encryptFinal(ByteString& /*encryptedData*/)
 {
 	if (currentOperation != ENCRYPT)
@@ -37,6 +37,7 @@
 #include "config.h"
 #include "SymmetricKey.h"
 #include "RNG.h"
+#include "DataSegment.h"
 
 struct SymAlgo
 {
@@ -87,6 +88,9 @@ public:
 	virtual bool encryptUpdate(const ByteString& data, ByteString& encryptedData);
 	virtual bool encryptFinal(ByteString& encryptedData);
 
+	// Encrypt the segments[0..count-1] in order, as if they were one buffer
+	virtual bool encryptUpdateSegments(const DataSegment* segments, size_t count, ByteString& encryptedData);
+
 	// Decryption functions
 	virtual bool decryptInit(const SymmetricKey* key, const SymMode::Type mode = SymMode::CBC, const ByteString& IV = ByteString(), bool padding = true, size_t counterBits = 0, const ByteString& aad = ByteString(), size_t tagBytes = 0);
 	virtual bool decryptUpdate(const ByteString& encryptedData, ByteString& data);
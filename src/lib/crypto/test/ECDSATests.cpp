@@ -94,8 +94,29 @@ void ECDSATests::testKeyGeneration()
 		CPPUNIT_ASSERT(pub->getEC() == *c);
 		CPPUNIT_ASSERT(priv->getEC() == *c);
 
-		ecdsa->recycleParameters(p);
 		ecdsa->recycleKeyPair(kp);
+
+		// Generate several key-pairs at once
+		AsymmetricKeyPair* kps[3];
+		CPPUNIT_ASSERT(ecdsa->generateKeyPairs(kps, 3, p));
+
+		for (size_t i = 0; i < 3; i++)
+		{
+			pub = (ECPublicKey*) kps[i]->getPublicKey();
+			priv = (ECPrivateKey*) kps[i]->getPrivateKey();
+
+			CPPUNIT_ASSERT(pub->getEC() == *c);
+			CPPUNIT_ASSERT(priv->getEC() == *c);
+		}
+		CPPUNIT_ASSERT(((ECPublicKey*) kps[0]->getPublicKey())->getQ() != ((ECPublicKey*) kps[1]->getPublicKey())->getQ());
+		CPPUNIT_ASSERT(((ECPublicKey*) kps[1]->getPublicKey())->getQ() != ((ECPublicKey*) kps[2]->getPublicKey())->getQ());
+
+		for (size_t i = 0; i < 3; i++)
+		{
+			ecdsa->recycleKeyPair(kps[i]);
+		}
+
+		ecdsa->recycleParameters(p);
 	}
 }
 
@@ -92,8 +92,29 @@ void EDDSATests::testKeyGeneration()
 		CPPUNIT_ASSERT(pub->getEC() == *c);
 		CPPUNIT_ASSERT(priv->getEC() == *c);
 
-		eddsa->recycleParameters(p);
 		eddsa->recycleKeyPair(kp);
+
+		// Generate several key-pairs at once
+		AsymmetricKeyPair* kps[3];
+		CPPUNIT_ASSERT(eddsa->generateKeyPairs(kps, 3, p));
+
+		for (size_t i = 0; i < 3; i++)
+		{
+			pub = (EDPublicKey*) kps[i]->getPublicKey();
+			priv = (EDPrivateKey*) kps[i]->getPrivateKey();
+
+			CPPUNIT_ASSERT(pub->getEC() == *c);
+			CPPUNIT_ASSERT(priv->getEC() == *c);
+		}
+		CPPUNIT_ASSERT(((EDPublicKey*) kps[0]->getPublicKey())->getA() != ((EDPublicKey*) kps[1]->getPublicKey())->getA());
+		CPPUNIT_ASSERT(((EDPublicKey*) kps[1]->getPublicKey())->getA() != ((EDPublicKey*) kps[2]->getPublicKey())->getA());
+
+		for (size_t i = 0; i < 3; i++)
+		{
+			eddsa->recycleKeyPair(kps[i]);
+		}
+
+		eddsa->recycleParameters(p);
 	}
 }
 
@@ -192,6 +192,39 @@ void HashTests::testSHA256()
 
 	CPPUNIT_ASSERT(osslHash == shsmHash);
 
+#if defined(WITH_OPENSSL) && !defined(WITH_FIPS)
+	// Now save the state halfway and finish the hash in another instance
+	HashAlgorithm* resumed;
+	ByteString state;
+
+	CPPUNIT_ASSERT((resumed = CryptoFactory::i()->getHashAlgorithm(HashAlgo::SHA256)) != NULL);
+	shsmHash.wipe();
+
+	CPPUNIT_ASSERT(hash->hashInit());
+	CPPUNIT_ASSERT(hash->hashUpdate(b.substr(0, 567)));
+	CPPUNIT_ASSERT(!hash->getState(state));
+	CPPUNIT_ASSERT(hash->hashFinal(shsmHash));
+
+	CPPUNIT_ASSERT(hash->setSaveable());
+	CPPUNIT_ASSERT(hash->hashInit());
+	CPPUNIT_ASSERT(hash->hashUpdate(b.substr(0, 567)));
+	CPPUNIT_ASSERT(hash->getState(state));
+	CPPUNIT_ASSERT(hash->hashFinal(shsmHash));
+
+	shsmHash.wipe();
+
+	CPPUNIT_ASSERT(!resumed->setState(state));
+	CPPUNIT_ASSERT(resumed->hashInit());
+	CPPUNIT_ASSERT(resumed->setState(state));
+	CPPUNIT_ASSERT(!resumed->setState(state.substr(1)));
+	CPPUNIT_ASSERT(resumed->hashUpdate(b.substr(567)));
+	CPPUNIT_ASSERT(resumed->hashFinal(shsmHash));
+
+	CPPUNIT_ASSERT(osslHash == shsmHash);
+
+	CryptoFactory::i()->recycleHashAlgorithm(resumed);
+#endif
+
 	CryptoFactory::i()->recycleHashAlgorithm(hash);
 
 	hash = NULL;
@@ -220,6 +220,32 @@ void MacTests::testHMACSHA256()
 	CPPUNIT_ASSERT(mac->verifyUpdate(b.substr(567 + 989)));
 	CPPUNIT_ASSERT(mac->verifyFinal(osslMac));
 
+#if defined(WITH_OPENSSL) && !defined(WITH_FIPS)
+	// Now save the state halfway and finish the MAC in another instance
+	MacAlgorithm* resumed;
+	ByteString state, shsmMac;
+
+	CPPUNIT_ASSERT((resumed = CryptoFactory::i()->getMacAlgorithm(MacAlgo::HMAC_SHA256)) != NULL);
+
+	CPPUNIT_ASSERT(mac->signInit(&key));
+	CPPUNIT_ASSERT(mac->signUpdate(b.substr(0, 567)));
+	CPPUNIT_ASSERT(!mac->getState(state));
+	CPPUNIT_ASSERT(mac->signFinal(shsmMac));
+
+	CPPUNIT_ASSERT(mac->setSaveable());
+	CPPUNIT_ASSERT(mac->signInit(&key));
+	CPPUNIT_ASSERT(mac->signUpdate(b.substr(0, 567)));
+	CPPUNIT_ASSERT(mac->getState(state));
+	CPPUNIT_ASSERT(mac->signFinal(shsmMac));
+
+	CPPUNIT_ASSERT(resumed->verifyInit(&key));
+	CPPUNIT_ASSERT(resumed->setState(state));
+	CPPUNIT_ASSERT(resumed->verifyUpdate(b.substr(567)));
+	CPPUNIT_ASSERT(resumed->verifyFinal(osslMac));
+
+	CryptoFactory::i()->recycleMacAlgorithm(resumed);
+#endif
+
 	// Check if bad key is refused
 	osslMac[10] ^= 0x11;
 	CPPUNIT_ASSERT(mac->verifyInit(&key));
@@ -303,6 +303,11 @@ void ByteString::wipe(const size_t newSize /* = 0 */)
 		memset(&byteString[0], 0x00, byteString.size());
 }
 
+void ByteString::swap(ByteString& other)
+{
+	byteString.swap(other.byteString);
+}
+
 // Comparison
 bool ByteString::operator==(const ByteString& compareTo) const
 {
@@ -103,6 +103,9 @@ public:
 	// Wipe
 	void wipe(const size_t newSize = 0);
 
+	// Exchange the contents with another byte string
+	void swap(ByteString& other);
+
 	// Comparison
 	bool operator==(const ByteString& compareTo) const;
 	bool operator!=(const ByteString& compareTo) const;
@@ -46,6 +46,10 @@
 #include "SymmetricAlgorithm.h"
 #include "RFC4880.h"
 
+// Sizes of the GCM nonce and authentication tag used for sealed data
+#define SEAL_IV_SIZE	12
+#define SEAL_TAG_SIZE	16
+
 // Constructors
 
 // Initialise the object; called by all constructors
@@ -494,6 +498,100 @@ bool SecureDataManager::encrypt(const ByteString& plaintext, ByteString& encrypt
 	return true;
 }
 
+// Encrypt and authenticate the supplied data
+bool SecureDataManager::seal(const ByteString& plaintext, const ByteString& aad, ByteString& sealed)
+{
+	// Check the object logged in state
+	if ((!userLoggedIn && !soLoggedIn) || (maskedKey.size() != 32))
+	{
+		return false;
+	}
+
+	AESKey theKey(256);
+	ByteString unmaskedKey;
+
+	{
+		MutexLocker lock(dataMgrMutex);
+
+		unmask(unmaskedKey);
+
+		theKey.setKeyBits(unmaskedKey);
+
+		remask(unmaskedKey);
+	}
+
+	// Wipe sealed data block
+	sealed.wipe();
+
+	// Generate random IV
+	ByteString IV;
+
+	if (!rng->generateRandom(IV, SEAL_IV_SIZE)) return false;
+
+	ByteString finalBlock;
+
+	if (!aes->encryptInit(&theKey, SymMode::GCM, IV, false, 0, aad, SEAL_TAG_SIZE) ||
+	    !aes->encryptUpdate(plaintext, sealed) ||
+	    !aes->encryptFinal(finalBlock))
+	{
+		return false;
+	}
+
+	// The final block carries the authentication tag
+	sealed += finalBlock;
+
+	// Add IV to output data
+	sealed = IV + sealed;
+
+	return true;
+}
+
+// Verify and decrypt data that was produced by seal
+bool SecureDataManager::unseal(const ByteString& sealed, const ByteString& aad, ByteString& plaintext)
+{
+	// Check the object logged in state
+	if ((!userLoggedIn && !soLoggedIn) || (maskedKey.size() != 32))
+	{
+		return false;
+	}
+
+	if (sealed.size() < SEAL_IV_SIZE + SEAL_TAG_SIZE)
+	{
+		ERROR_MSG("Sealed data is too short");
+
+		return false;
+	}
+
+	AESKey theKey(256);
+	ByteString unmaskedKey;
+
+	{
+		MutexLocker lock(dataMgrMutex);
+
+		unmask(unmaskedKey);
+
+		theKey.setKeyBits(unmaskedKey);
+
+		remask(unmaskedKey);
+	}
+
+	ByteString IV = sealed.substr(0, SEAL_IV_SIZE);
+	ByteString finalBlock;
+
+	plaintext.wipe();
+
+	if (!aes->decryptInit(&theKey, SymMode::GCM, IV, false, 0, aad, SEAL_TAG_SIZE) ||
+	    !aes->decryptUpdate(sealed.substr(SEAL_IV_SIZE), plaintext) ||
+	    !aes->decryptFinal(finalBlock))
+	{
+		return false;
+	}
+
+	plaintext += finalBlock;
+
+	return true;
+}
+
 // Returns the key blob for the SO PIN
 ByteString SecureDataManager::getSOPINBlob()
 {
@@ -94,6 +94,13 @@ public:
 	// Encrypt the supplied data
 	bool encrypt(const ByteString& plaintext, ByteString& encrypted);
 
+	// Encrypt and authenticate the supplied data (AES-GCM); the additional
+	// data is authenticated but not included in the output
+	bool seal(const ByteString& plaintext, const ByteString& aad, ByteString& sealed);
+
+	// Verify and decrypt data that was produced by seal
+	bool unseal(const ByteString& sealed, const ByteString& aad, ByteString& plaintext);
+
 	// Returns the key blob for the SO PIN
 	ByteString getSOPINBlob();
 
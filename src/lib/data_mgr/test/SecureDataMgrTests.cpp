@@ -96,6 +96,21 @@ void SecureDataMgrTests::testSecureDataManager()
 	CPPUNIT_ASSERT(s1.decrypt(encrypted, decrypted));
 	CPPUNIT_ASSERT(decrypted == plaintext);
 
+	// Check that it is possible to seal and unseal some data
+	ByteString aad = "0a0b0c";
+	ByteString sealed;
+
+	CPPUNIT_ASSERT(s1.seal(plaintext, aad, sealed));
+	CPPUNIT_ASSERT(sealed.size() == plaintext.size() + 12 + 16);
+
+	CPPUNIT_ASSERT(s1.unseal(sealed, aad, decrypted));
+	CPPUNIT_ASSERT(decrypted == plaintext);
+
+	// Check that tampering with the sealed data or the additional data is detected
+	CPPUNIT_ASSERT(!s1.unseal(sealed, ByteString("0a0b0d"), decrypted));
+	sealed[sealed.size() - 1] ^= 0x01;
+	CPPUNIT_ASSERT(!s1.unseal(sealed, aad, decrypted));
+
 	// Log out
 	s1.logout();
 
@@ -41,16 +41,22 @@
  use the same handle manager and therefore there will never be e.g. a session
  with the same handle as an object.
 
+ Token object handles are normally dropped when the last session of a token
+ closes and, for private objects, on logout. In stable mode they are kept for
+ as long as the object exists, so applications can cache them; the access
+ rules are still checked whenever a handle is used.
+
  *****************************************************************************/
 
 #include "HandleManager.h"
 #include "log.h"
 
 // Constructor
-HandleManager::HandleManager()
+HandleManager::HandleManager(bool stableTokenObjects /* = false */)
 {
 	handlesMutex = MutexFactory::i()->getMutex();
 	handleCounter = 0;
+	this->stableTokenObjects = stableTokenObjects;
 }
 
 // Destructor
@@ -201,6 +207,16 @@ void HandleManager::sessionClosed(const CK_SESSION_HANDLE hSession)
 }
 
 void HandleManager::allSessionsClosed(const CK_SLOT_ID slotID)
+{
+	removeSlotHandles(slotID, stableTokenObjects);
+}
+
+void HandleManager::tokenInitialized(const CK_SLOT_ID slotID)
+{
+	removeSlotHandles(slotID, false);
+}
+
+void HandleManager::removeSlotHandles(const CK_SLOT_ID slotID, bool keepTokenObjects)
 {
 	MutexLocker lock(handlesMutex);
 
@@ -209,6 +225,11 @@ void HandleManager::allSessionsClosed(const CK_SLOT_ID slotID)
 	for (it = handles.begin(); it != handles.end(); ) {
 		Handle &h = it->second;
 		if (slotID == h.slotID) {
+			// Token objects are not associated with a session.
+			if (keepTokenObjects && CKH_OBJECT == h.kind && CK_INVALID_HANDLE == h.hSession) {
+				++it;
+				continue;
+			}
 			if (CKH_OBJECT == it->second.kind)
 				objects.erase(it->second.object);
 			// Iterator post-incrementing (it++) will return a copy of the original it (which points to handle to be deleted).
@@ -227,7 +248,8 @@ void HandleManager::tokenLoggedOut(const CK_SLOT_ID slotID)
 	std::map< CK_ULONG, Handle>::iterator it;
 	for (it = handles.begin(); it != handles.end(); ) {
 		Handle &h = it->second;
-		if (CKH_OBJECT == h.kind && slotID == h.slotID && h.isPrivate) {
+		if (CKH_OBJECT == h.kind && slotID == h.slotID && h.isPrivate &&
+		    !(stableTokenObjects && CK_INVALID_HANDLE == h.hSession)) {
 			// A private object is present for the given slotID so we need to remove it.
 			objects.erase(it->second.object);
 			// Iterator post-incrementing (it++) will return a copy of the original it (which points to handle to be deleted).
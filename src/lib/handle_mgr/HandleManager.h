@@ -44,7 +44,10 @@
 class HandleManager
 {
 public:
-    HandleManager();
+    // When stableTokenObjects is set, token object handles stay valid until the
+    // object is destroyed or the token is initialized; closing sessions and
+    // logging out no longer invalidate them.
+    HandleManager(bool stableTokenObjects = false);
 
     virtual ~HandleManager();
 
@@ -76,15 +79,25 @@ public:
     void sessionClosed(const CK_SESSION_HANDLE hSession);
 
     // Remove all session and object handles for the given slotID.
-    // All handles for the given slotID will become invalid.
+    // All handles for the given slotID will become invalid, except for the
+    // token object handles when these are stable.
     void allSessionsClosed(const CK_SLOT_ID slotID);
 
     // Remove all handles to private objects for the given slotID.
-    // All handles to public objects for the given slotID remain valid.
+    // All handles to public objects for the given slotID remain valid, as
+    // do the handles to private token objects when these are stable.
     void tokenLoggedOut(const CK_SLOT_ID slotID);
 
+    // Remove all session and object handles for the given slotID, including
+    // stable token object handles; used when the token is initialized.
+    void tokenInitialized(const CK_SLOT_ID slotID);
+
 private:
+    // Remove the handles for the given slotID
+    void removeSlotHandles(const CK_SLOT_ID slotID, bool keepTokenObjects);
+
     Mutex* handlesMutex;
+    bool stableTokenObjects;
     std::map< CK_ULONG, Handle> handles;
     std::map< CK_VOID_PTR, CK_ULONG> objects;
     CK_ULONG handleCounter;
@@ -176,3 +176,60 @@ void HandleManagerTests::testHandleManager()
 	CPPUNIT_ASSERT(NULL == handleManager->getSession(hSession));
 	CPPUNIT_ASSERT(NULL == handleManager->getSession(hSession2));
 }
+
+void HandleManagerTests::testStableTokenObjects()
+{
+	HandleManager stableManager(true);
+
+	CK_SLOT_ID slotID = 1234; // we need a unique value
+	CK_SESSION_HANDLE hSession;
+	CK_VOID_PTR session = &hSession; // we need a unique value
+	CK_OBJECT_HANDLE hObject;
+	CK_VOID_PTR object = &hObject; // we need a unique value
+	CK_OBJECT_HANDLE hObject2;
+	CK_VOID_PTR object2 = &hObject2; // we need a unique value
+	CK_OBJECT_HANDLE hObject3;
+	CK_VOID_PTR object3 = &hObject3; // we need a unique value
+
+	hSession = stableManager.addSession(slotID, session);
+	CPPUNIT_ASSERT(hSession != CK_INVALID_HANDLE);
+
+	// A public and a private token object and a private session object
+	hObject = stableManager.addTokenObject(slotID, false, object);
+	CPPUNIT_ASSERT(hObject != CK_INVALID_HANDLE);
+	hObject2 = stableManager.addTokenObject(slotID, true, object2);
+	CPPUNIT_ASSERT(hObject2 != CK_INVALID_HANDLE);
+	hObject3 = stableManager.addSessionObject(slotID, hSession, true, object3);
+	CPPUNIT_ASSERT(hObject3 != CK_INVALID_HANDLE);
+
+	// Logging out only removes the private session object
+	stableManager.tokenLoggedOut(slotID);
+	CPPUNIT_ASSERT(object == stableManager.getObject(hObject));
+	CPPUNIT_ASSERT(object2 == stableManager.getObject(hObject2));
+	CPPUNIT_ASSERT(NULL == stableManager.getObject(hObject3));
+
+	// Closing the last session keeps the token objects
+	stableManager.sessionClosed(hSession);
+	CPPUNIT_ASSERT(NULL == stableManager.getSession(hSession));
+	CPPUNIT_ASSERT(object == stableManager.getObject(hObject));
+	CPPUNIT_ASSERT(object2 == stableManager.getObject(hObject2));
+
+	// And a new session finds the same handles
+	hSession = stableManager.addSession(slotID, session);
+	CPPUNIT_ASSERT(hSession != CK_INVALID_HANDLE);
+	CPPUNIT_ASSERT(hObject == stableManager.addTokenObject(slotID, false, object));
+	CPPUNIT_ASSERT(hObject2 == stableManager.addTokenObject(slotID, true, object2));
+
+	stableManager.allSessionsClosed(slotID);
+	CPPUNIT_ASSERT(NULL == stableManager.getSession(hSession));
+	CPPUNIT_ASSERT(object == stableManager.getObject(hObject));
+
+	// Destroying an object still removes its handle
+	stableManager.destroyObject(hObject);
+	CPPUNIT_ASSERT(NULL == stableManager.getObject(hObject));
+	CPPUNIT_ASSERT(object2 == stableManager.getObject(hObject2));
+
+	// Initializing the token removes all handles
+	stableManager.tokenInitialized(slotID);
+	CPPUNIT_ASSERT(NULL == stableManager.getObject(hObject2));
+}
@@ -39,6 +39,7 @@
 #include "log.h"
 #include "fatal.h"
 #include "cryptoki.h"
+#include "softhsm2_vendor.h"
 #include "SoftHSM.h"
 
 #if defined(__GNUC__) && \
@@ -1185,3 +1186,338 @@ PKCS_API CK_RV C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR pSlot, CK_VOID_
 	return CKR_FUNCTION_FAILED;
 }
 
+// Wrap a batch of keys using one wrapping key and mechanism
+PKCS_API CK_RV C_SoftHSM_WrapKeyBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hWrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_OBJECT_HANDLE_PTR phKeys,
+	CK_BYTE_PTR* ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_WrapKeyBatch(hSession, pMechanism, hWrappingKey, ulKeyCount, phKeys, ppWrappedKeys, pulWrappedKeyLens);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Unwrap a batch of keys using one unwrapping key and mechanism
+PKCS_API CK_RV C_SoftHSM_UnwrapKeyBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hUnwrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_BYTE_PTR* ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens,
+	CK_ATTRIBUTE_PTR* ppTemplates,
+	CK_ULONG_PTR pulCounts,
+	CK_OBJECT_HANDLE_PTR phKeys
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_UnwrapKeyBatch(hSession, pMechanism, hUnwrappingKey, ulKeyCount, ppWrappedKeys, pulWrappedKeyLens, ppTemplates, pulCounts, phKeys);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue a single-part signing operation
+PKCS_API CK_RV C_SoftHSM_SignAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_BYTE_PTR pSignature,
+	CK_ULONG_PTR pulSignatureLen,
+	CK_VOID_PTR pTag
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_SignAsync(hSession, pMechanism, hKey, pData, ulDataLen, pSignature, pulSignatureLen, pTag);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue a single-part decryption operation
+PKCS_API CK_RV C_SoftHSM_DecryptAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pEncryptedData,
+	CK_ULONG ulEncryptedDataLen,
+	CK_BYTE_PTR pData,
+	CK_ULONG_PTR pulDataLen,
+	CK_VOID_PTR pTag
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_DecryptAsync(hSession, pMechanism, hKey, pEncryptedData, ulEncryptedDataLen, pData, pulDataLen, pTag);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue the derivation of a key
+PKCS_API CK_RV C_SoftHSM_DeriveKeyAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hBaseKey,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_DeriveKeyAsync(hSession, pMechanism, hBaseKey, pTemplate, ulCount, phKey, pTag);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue the generation of a secret key
+PKCS_API CK_RV C_SoftHSM_GenerateKeyAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_GenerateKeyAsync(hSession, pMechanism, pTemplate, ulCount, phKey, pTag);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Queue the generation of a key pair
+PKCS_API CK_RV C_SoftHSM_GenerateKeyPairAsync
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_OBJECT_HANDLE_PTR phPublicKey,
+	CK_OBJECT_HANDLE_PTR phPrivateKey,
+	CK_VOID_PTR pTag
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_GenerateKeyPairAsync(hSession, pMechanism, pPublicKeyTemplate, ulPublicKeyAttributeCount, pPrivateKeyTemplate, ulPrivateKeyAttributeCount, phPublicKey, phPrivateKey, pTag);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Return the descriptor that signals waiting completions
+PKCS_API CK_RV C_SoftHSM_GetAsyncEventFd
+(
+	int* pFd
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_GetAsyncEventFd(pFd);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Take the results of finished asynchronous operations
+PKCS_API CK_RV C_SoftHSM_HarvestCompletions
+(
+	CK_SOFTHSM_COMPLETION_PTR pCompletions,
+	CK_ULONG ulMaxCount,
+	CK_ULONG_PTR pulCount
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_HarvestCompletions(pCompletions, ulMaxCount, pulCount);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Feed data in one or more segments to the running encryption operation
+PKCS_API CK_RV C_SoftHSM_EncryptUpdateV
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount,
+	CK_BYTE_PTR pEncryptedPart,
+	CK_ULONG_PTR pulEncryptedPartLen
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_EncryptUpdateV(hSession, pSegments, ulSegmentCount, pEncryptedPart, pulEncryptedPartLen);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Feed data in one or more segments to the running digest operation
+PKCS_API CK_RV C_SoftHSM_DigestUpdateV
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_DigestUpdateV(hSession, pSegments, ulSegmentCount);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Digest a batch of independent messages with one mechanism
+PKCS_API CK_RV C_SoftHSM_DigestBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ULONG ulCount,
+	CK_BYTE_PTR* ppData,
+	CK_ULONG_PTR pulDataLens,
+	CK_BYTE_PTR pDigests,
+	CK_ULONG_PTR pulDigestsLen
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_DigestBatch(hSession, pMechanism, ulCount, ppData, pulDataLens, pDigests, pulDigestsLen);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Return the state of the scheduler of expensive operations
+PKCS_API CK_RV C_SoftHSM_GetSchedulerInfo
+(
+	CK_SOFTHSM_SCHEDULER_INFO_PTR pInfo
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_GetSchedulerInfo(pInfo);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Generate several EC or EDDSA key pairs from one pair of templates
+PKCS_API CK_RV C_SoftHSM_GenerateKeyPairBatch
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phPublicKeys,
+	CK_OBJECT_HANDLE_PTR phPrivateKeys
+)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_GenerateKeyPairBatch(hSession, pMechanism, pPublicKeyTemplate, ulPublicKeyAttributeCount, pPrivateKeyTemplate, ulPrivateKeyAttributeCount, ulCount, phPublicKeys, phPrivateKeys);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
+
+// Return the usage counters of the most or least used keys
+PKCS_API CK_RV C_SoftHSM_GetKeyUsage(CK_SESSION_HANDLE hSession, CK_FLAGS flags, CK_SOFTHSM_KEY_USAGE_PTR pUsage, CK_ULONG_PTR pulCount)
+{
+	try
+	{
+		return SoftHSM::i()->C_SoftHSM_GetKeyUsage(hSession, flags, pUsage, pulCount);
+	}
+	catch (...)
+	{
+		FatalException();
+	}
+
+	return CKR_FUNCTION_FAILED;
+}
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AttributePool.cpp
+
+ Reference-counted pool of attribute values that are shared between objects
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "AttributePool.h"
+#include "OSAttribute.h"
+#include <string.h>
+
+// Initialise the one-and-only instance
+#ifdef HAVE_CXX11
+std::unique_ptr<AttributePool> AttributePool::instance(nullptr);
+#else
+std::auto_ptr<AttributePool> AttributePool::instance(NULL);
+#endif
+
+// Constructor
+AttributePool::AttributePool()
+{
+	poolMutex = MutexFactory::i()->getMutex();
+	shared = 0;
+}
+
+// Destructor
+AttributePool::~AttributePool()
+{
+	for (std::map<const ByteString*, ByteStringEntry*, ByteStringLess>::iterator i = byteStrings.begin(); i != byteStrings.end(); i++)
+	{
+		delete i->second;
+	}
+
+	for (std::map<const std::set<CK_MECHANISM_TYPE>*, MechSetEntry*, MechSetLess>::iterator i = mechSets.begin(); i != mechSets.end(); i++)
+	{
+		delete i->second;
+	}
+
+	MutexFactory::i()->recycleMutex(poolMutex);
+}
+
+// Return the one-and-only instance
+AttributePool* AttributePool::i()
+{
+	if (!instance.get())
+	{
+		instance.reset(new AttributePool());
+	}
+
+	return instance.get();
+}
+
+// This will destroy the one-and-only instance; it is kept when values are
+// still in use, since the attributes holding them refer to its entries
+void AttributePool::reset()
+{
+	if (!instance.get())
+	{
+		return;
+	}
+
+	if (instance->size() != 0)
+	{
+		WARNING_MSG("Keeping %lu interned attribute values that are still in use", (unsigned long) instance->size());
+
+		return;
+	}
+
+	unsigned long shared;
+	{
+		MutexLocker lock(instance->poolMutex);
+
+		shared = instance->shared;
+	}
+
+	if (shared != 0)
+	{
+		WARNING_MSG("Keeping %lu attribute values that are still in use", shared);
+
+		return;
+	}
+
+	instance.reset();
+}
+
+// Is the value of the attribute type eligible for interning? These are the
+// public values that are commonly repeated across the objects of a token
+/*static*/ bool AttributePool::isInternable(CK_ATTRIBUTE_TYPE type)
+{
+	switch (type)
+	{
+		case CKA_EC_PARAMS:
+		case CKA_PUBLIC_EXPONENT:
+		case CKA_PRIME:
+		case CKA_SUBPRIME:
+		case CKA_BASE:
+		case CKA_GOSTR3410_PARAMS:
+		case CKA_GOSTR3411_PARAMS:
+		case CKA_GOST28147_PARAMS:
+		case CKA_ISSUER:
+		case CKA_SUBJECT:
+		case CKA_HASH_OF_ISSUER_PUBLIC_KEY:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Is the object holding the attributes known to be public? The values of
+// private objects are encrypted and therefore never shared
+static bool isPublicObject(const OSAttribute* isPrivate)
+{
+	return isPrivate != NULL &&
+	       isPrivate->isBooleanAttribute() &&
+	       !isPrivate->getBooleanValue();
+}
+
+// Intern the value of the attribute if it is eligible and the object holding
+// the attributes is known to be public
+/*static*/ void AttributePool::internAttribute(std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>& attributes, CK_ATTRIBUTE_TYPE type)
+{
+	if (!isInternable(type)) return;
+
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>::iterator isPrivate = attributes.find(CKA_PRIVATE);
+	if (isPrivate == attributes.end() || !isPublicObject(isPrivate->second)) return;
+
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>::iterator attr = attributes.find(type);
+	if (attr == attributes.end() || attr->second == NULL) return;
+
+	attr->second->intern();
+}
+
+// Intern all eligible values of a public object
+/*static*/ void AttributePool::internAttributes(std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>& attributes)
+{
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>::iterator isPrivate = attributes.find(CKA_PRIVATE);
+	if (isPrivate == attributes.end() || !isPublicObject(isPrivate->second)) return;
+
+	for (std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>::iterator i = attributes.begin(); i != attributes.end(); i++)
+	{
+		if (i->second != NULL && isInternable(i->first))
+		{
+			i->second->intern();
+		}
+	}
+}
+
+/*static*/ void AttributePool::internAttributes(std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& attributes)
+{
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute>::iterator isPrivate = attributes.find(CKA_PRIVATE);
+	if (isPrivate == attributes.end() || !isPublicObject(&isPrivate->second)) return;
+
+	for (std::map<CK_ATTRIBUTE_TYPE,OSAttribute>::iterator i = attributes.begin(); i != attributes.end(); i++)
+	{
+		if (isInternable(i->first))
+		{
+			i->second.intern();
+		}
+	}
+}
+
+// Return the entry holding the value, adding a reference to it
+AttributePool::ByteStringEntry* AttributePool::acquire(const ByteString& value)
+{
+	MutexLocker lock(poolMutex);
+
+	std::map<const ByteString*, ByteStringEntry*, ByteStringLess>::iterator i = byteStrings.find(&value);
+	if (i != byteStrings.end())
+	{
+		i->second->refs++;
+
+		return i->second;
+	}
+
+	ByteStringEntry* entry = new ByteStringEntry();
+	entry->value = value;
+	entry->refs = 1;
+	entry->pooled = true;
+	byteStrings[&entry->value] = entry;
+
+	return entry;
+}
+
+AttributePool::MechSetEntry* AttributePool::acquire(const std::set<CK_MECHANISM_TYPE>& value)
+{
+	MutexLocker lock(poolMutex);
+
+	std::map<const std::set<CK_MECHANISM_TYPE>*, MechSetEntry*, MechSetLess>::iterator i = mechSets.find(&value);
+	if (i != mechSets.end())
+	{
+		i->second->refs++;
+
+		return i->second;
+	}
+
+	MechSetEntry* entry = new MechSetEntry();
+	entry->value = value;
+	entry->refs = 1;
+	mechSets[&entry->value] = entry;
+
+	return entry;
+}
+
+// Return a new entry outside the pool holding the value; it is not found
+// by identical values, so values that must not be interned can be shared
+// between the copies of an attribute
+AttributePool::ByteStringEntry* AttributePool::share(const ByteString& value)
+{
+	ByteStringEntry* entry = new ByteStringEntry();
+	entry->value = value;
+	entry->refs = 1;
+	entry->pooled = false;
+
+#ifdef HAVE_CXX11
+	shared++;
+#else
+	MutexLocker lock(poolMutex);
+
+	shared++;
+#endif
+
+	return entry;
+}
+
+// Add a reference to an entry. The caller holds a reference already, so
+// the entry cannot go away meanwhile.
+void AttributePool::retain(ByteStringEntry* entry)
+{
+#ifdef HAVE_CXX11
+	entry->refs.fetch_add(1, std::memory_order_relaxed);
+#else
+	MutexLocker lock(poolMutex);
+
+	entry->refs++;
+#endif
+}
+
+void AttributePool::retain(MechSetEntry* entry)
+{
+#ifdef HAVE_CXX11
+	entry->refs.fetch_add(1, std::memory_order_relaxed);
+#else
+	MutexLocker lock(poolMutex);
+
+	entry->refs++;
+#endif
+}
+
+// Drop a reference that is not the last one of an entry in the pool. The
+// last one has to be dropped under the mutex, so that acquire cannot find
+// the entry while it is removed.
+/*static*/ bool AttributePool::dropReference(RefCount& refs)
+{
+#ifdef HAVE_CXX11
+	unsigned long n = refs.load(std::memory_order_relaxed);
+
+	while (n > 1)
+	{
+		if (refs.compare_exchange_weak(n, n - 1, std::memory_order_release, std::memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+#else
+	(void) refs;
+#endif
+
+	return false;
+}
+
+// Drop a reference to an entry; the entry is removed when it is no longer
+// referenced
+void AttributePool::release(ByteStringEntry* entry)
+{
+	if (!entry->pooled)
+	{
+#ifdef HAVE_CXX11
+		// Nobody else can find the entry, so the last reference is
+		// dropped without the mutex too
+		if (entry->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			delete entry;
+			shared--;
+		}
+#else
+		MutexLocker lock(poolMutex);
+
+		if (--entry->refs == 0)
+		{
+			delete entry;
+			shared--;
+		}
+#endif
+
+		return;
+	}
+
+	if (dropReference(entry->refs)) return;
+
+	MutexLocker lock(poolMutex);
+
+	if (--entry->refs == 0)
+	{
+		byteStrings.erase(&entry->value);
+
+		delete entry;
+	}
+}
+
+void AttributePool::release(MechSetEntry* entry)
+{
+	if (dropReference(entry->refs)) return;
+
+	MutexLocker lock(poolMutex);
+
+	if (--entry->refs == 0)
+	{
+		mechSets.erase(&entry->value);
+
+		delete entry;
+	}
+}
+
+// Return the number of distinct values in the pool
+size_t AttributePool::size()
+{
+	MutexLocker lock(poolMutex);
+
+	return byteStrings.size() + mechSets.size();
+}
+
+// Orderings on the values
+bool AttributePool::ByteStringLess::operator()(const ByteString* a, const ByteString* b) const
+{
+	if (a->size() != b->size())
+	{
+		return a->size() < b->size();
+	}
+
+	if (a->size() == 0)
+	{
+		return false;
+	}
+
+	return memcmp(a->const_byte_str(), b->const_byte_str(), a->size()) < 0;
+}
+
+bool AttributePool::MechSetLess::operator()(const std::set<CK_MECHANISM_TYPE>* a, const std::set<CK_MECHANISM_TYPE>* b) const
+{
+	return *a < *b;
+}
+
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AttributePool.h
+
+ Reference-counted pool of attribute values that are shared between objects.
+ Large tokens hold the same public values over and over (the curve of every
+ EC key, the public exponent of every RSA key, the issuer of certificates);
+ interning them keeps a single copy of each distinct value in memory.
+ Mechanism type sets (CKA_ALLOWED_MECHANISMS) are never encrypted and are
+ always held in the pool. The other byte string values are held in entries
+ outside the pool, which are only shared by the copies of an attribute.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_ATTRIBUTEPOOL_H
+#define _SOFTHSM_V2_ATTRIBUTEPOOL_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "MutexFactory.h"
+#include "cryptoki.h"
+#include <map>
+#include <set>
+#include <memory>
+#ifdef HAVE_CXX11
+#include <atomic>
+#endif
+
+class OSAttribute;
+
+class AttributePool
+{
+public:
+	// The reference count of an entry; it is only changed under the pool
+	// mutex when atomic operations are not available
+#ifdef HAVE_CXX11
+	typedef std::atomic<unsigned long> RefCount;
+#else
+	typedef unsigned long RefCount;
+#endif
+
+	// A shared byte string value
+	struct ByteStringEntry
+	{
+		ByteString value;
+		RefCount refs;
+		bool pooled;
+	};
+
+	// A shared mechanism type set value
+	struct MechSetEntry
+	{
+		std::set<CK_MECHANISM_TYPE> value;
+		RefCount refs;
+	};
+
+	// Return the one-and-only instance
+	static AttributePool* i();
+
+	// This will destroy the one-and-only instance; it is kept when
+	// values are still in use
+	static void reset();
+
+	// Destructor
+	virtual ~AttributePool();
+
+	// Is the value of the attribute type eligible for interning?
+	static bool isInternable(CK_ATTRIBUTE_TYPE type);
+
+	// Intern the value of the attribute if it is eligible and the object
+	// holding the attributes is known to be public
+	static void internAttribute(std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>& attributes, CK_ATTRIBUTE_TYPE type);
+
+	// Intern all eligible values of a public object
+	static void internAttributes(std::map<CK_ATTRIBUTE_TYPE,OSAttribute*>& attributes);
+	static void internAttributes(std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& attributes);
+
+	// Return the entry holding the value, adding a reference to it
+	ByteStringEntry* acquire(const ByteString& value);
+	MechSetEntry* acquire(const std::set<CK_MECHANISM_TYPE>& value);
+
+	// Return a new entry outside the pool holding the value
+	ByteStringEntry* share(const ByteString& value);
+
+	// Add a reference to an entry
+	void retain(ByteStringEntry* entry);
+	void retain(MechSetEntry* entry);
+
+	// Drop a reference to an entry; the entry is removed when it is no
+	// longer referenced
+	void release(ByteStringEntry* entry);
+	void release(MechSetEntry* entry);
+
+	// Return the number of distinct values in the pool
+	size_t size();
+
+private:
+	// Constructor
+	AttributePool();
+
+	// Orderings on the values
+	struct ByteStringLess
+	{
+		bool operator()(const ByteString* a, const ByteString* b) const;
+	};
+
+	struct MechSetLess
+	{
+		bool operator()(const std::set<CK_MECHANISM_TYPE>* a, const std::set<CK_MECHANISM_TYPE>* b) const;
+	};
+
+	// The one-and-only instance
+#ifdef HAVE_CXX11
+	static std::unique_ptr<AttributePool> instance;
+#else
+	static std::auto_ptr<AttributePool> instance;
+#endif
+
+	// The entries, indexed by their value
+	std::map<const ByteString*, ByteStringEntry*, ByteStringLess> byteStrings;
+	std::map<const std::set<CK_MECHANISM_TYPE>*, MechSetEntry*, MechSetLess> mechSets;
+
+	// Drop a reference that is not the last one of an entry in the pool;
+	// returns false if it is the last one
+	static bool dropReference(RefCount& refs);
+
+	// The number of entries outside the pool
+	RefCount shared;
+
+	// Protects the entries in the pool; with atomic operations, only the
+	// last reference to such an entry is dropped under it
+	Mutex* poolMutex;
+};
+
+#endif // !_SOFTHSM_V2_ATTRIBUTEPOOL_H
+
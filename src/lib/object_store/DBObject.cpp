@@ -200,6 +200,39 @@ bool DBObject::createTables()
 	return true;
 }
 
+bool DBObject::createIndexes()
+{
+	MutexLocker lock(_mutex);
+
+	if (_connection == NULL)
+	{
+		ERROR_MSG("Object is not connected to the database.");
+		return false;
+	}
+
+	// The binary attributes are searched by value
+	DB::Statement cr_attr_binary_value = _connection->prepare(
+		"create index if not exists attribute_binary_value on attribute_binary (type,value)"
+		);
+	if (!_connection->execute(cr_attr_binary_value))
+	{
+		ERROR_MSG("Failed to create \"attribute_binary_value\" index");
+		return false;
+	}
+
+	// The private objects are always searched
+	DB::Statement cr_attr_boolean_value = _connection->prepare(
+		"create index if not exists attribute_boolean_value on attribute_boolean (type,value)"
+		);
+	if (!_connection->execute(cr_attr_boolean_value))
+	{
+		ERROR_MSG("Failed to create \"attribute_boolean_value\" index");
+		return false;
+	}
+
+	return true;
+}
+
 bool DBObject::dropTables()
 {
 	MutexLocker lock(_mutex);
@@ -385,6 +418,7 @@ static bool isModifiable(CK_ATTRIBUTE_TYPE type)
 	case CKA_OS_TOKENFLAGS:
 	case CKA_OS_SOPIN:
 	case CKA_OS_USERPIN:
+	case CKA_OS_ENVELOPE:
 		return true;
 	default:
 		return false;
@@ -516,6 +550,7 @@ static AttributeKind attributeKind(CK_ATTRIBUTE_TYPE type)
 	case CKA_OS_TOKENFLAGS: return akInteger;
 	case CKA_OS_SOPIN: return akBinary;
 	case CKA_OS_USERPIN: return akBinary;
+	case CKA_OS_ENVELOPE: return akBinary;
 
 	default: return akUnknown;
 	}
@@ -855,8 +890,8 @@ OSAttribute *DBObject::accessAttribute(CK_ATTRIBUTE_TYPE type)
 			{
 				attr = new OSAttribute(ByteString(value,size));
 				(*attrs)[type] = attr;
-				return attr;
 			}
+			AttributePool::internAttribute(*attrs, type);
 			return attr;
 		}
 		case akMechSet:
@@ -905,8 +940,8 @@ OSAttribute *DBObject::accessAttribute(CK_ATTRIBUTE_TYPE type)
 			{
 				attr = new OSAttribute(set);
 				(*attrs)[type] = attr;
-				return attr;
 			}
+			AttributePool::internAttribute(*attrs, type);
 			return attr;
 		}
 		case akAttrMap:
@@ -1193,8 +1228,13 @@ bool DBObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute
 					*it->second = attribute;
 				else
 					(*_transaction)[type] = new OSAttribute(attribute);
-			} else
+				AttributePool::internAttribute(*_transaction, type);
+			}
+			else
+			{
 				*attr = attribute;
+				AttributePool::internAttribute(_attributes, type);
+			}
 			return true;
 		}
 	}
@@ -1269,9 +1309,15 @@ bool DBObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute
 		}
 
 		if (_transaction)
+		{
 			(*_transaction)[type] = new OSAttribute(attribute);
+			AttributePool::internAttribute(*_transaction, type);
+		}
 		else
+		{
 			_attributes[type] = new OSAttribute(attribute);
+			AttributePool::internAttribute(_attributes, type);
+		}
 		return true;
 	}
 
@@ -1491,3 +1537,16 @@ bool DBObject::destroyObject()
 
 	return _token->deleteObject(this);
 }
+
+// Return an identifier of the object that stays the same across restarts
+std::string DBObject::getPersistentId()
+{
+	long long id = objectId();
+
+	if (id == 0) return std::string();
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%lld", id);
+
+	return std::string(buf);
+}
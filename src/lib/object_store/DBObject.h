@@ -62,6 +62,9 @@ public:
 	// create tables to support storage of attributes for the object.
 	bool createTables();
 
+	// create the indexes that objects are searched by.
+	bool createIndexes();
+
 	// drop tables that support storage of attributes for the object.
 	bool dropTables();
 
@@ -118,6 +121,9 @@ public:
 	// valid after this call because delete is called!)
 	virtual bool destroyObject();
 
+	// The object id identifies the object across restarts
+	virtual std::string getPersistentId();
+
 private:
 	// Disable copy constructor and assignment
 	DBObject();
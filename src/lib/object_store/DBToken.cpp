@@ -43,6 +43,7 @@
 #include "DBToken.h"
 #include "DBObject.h"
 #include "DB.h"
+#include "ObjectIndex.h"
 
 #include "Directory.h"
 
@@ -114,7 +115,8 @@ DBToken::DBToken(const std::string &baseDir, const std::string &tokenName, const
 
 	// First create the tables that support storage of object attributes and then insert the object containing
 	// the token info into the database.
-	if (!tokenObject.createTables() || !tokenObject.insert() || tokenObject.objectId()!=DBTOKEN_OBJECT_TOKENINFO)
+	if (!tokenObject.createTables() || !tokenObject.insert() || tokenObject.objectId()!=DBTOKEN_OBJECT_TOKENINFO ||
+		(ObjectIndex::isEnabled() && !tokenObject.createIndexes()))
 	{
 		tokenObject.dropConnection();
 
@@ -215,6 +217,12 @@ DBToken::DBToken(const std::string &baseDir, const std::string &tokenName)
 		return;
 	}
 
+	// Tokens created before indexing was enabled get their indexes now
+	if (ObjectIndex::isEnabled() && !ObjectStoreToken::isReadOnly() && !tokenObject.createIndexes())
+	{
+		WARNING_MSG("Failed to create the indexes in the token database at \"%s\"", tokenPath.c_str());
+	}
+
 	_tokenMutex = MutexFactory::i()->getMutex();
 
 	// Success!
@@ -623,23 +631,63 @@ void DBToken::getObjects(std::set<OSObject*> &objects)
 
 	DB::Result result = _connection->perform(statement);
 
+	if (result.isValid())
+	{
+		do {
+			objects.insert(getObject(result.getLongLong(1)));
+		} while (result.nextRow());
+	}
+
+	_connection->endTransactionRO();
+}
+
+void DBToken::findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &objects)
+{
+	if (_connection == NULL) return;
+
+	// Look for an indexed attribute in the template
+	CK_ULONG i = 0;
+
+	if (ObjectIndex::isEnabled())
+	{
+		while (i < ulCount && (!ObjectIndex::isIndexed(pTemplate[i].type) || pTemplate[i].pValue == NULL_PTR || pTemplate[i].ulValueLen == 0))
+		{
+			i++;
+		}
+	}
+	else
+	{
+		i = ulCount;
+	}
+
+	if (i == ulCount)
+	{
+		getObjects(objects);
+		return;
+	}
+
+	if (!_connection->beginTransactionRO()) return;
+
+	// The objects holding the value, and the private objects of which the
+	// values are encrypted
+	DB::Statement statement = _connection->prepare(
+		"select object_id from attribute_binary where type=%lu and value=? "
+		"union "
+		"select object_id from attribute_boolean where type=%lu and value=1",
+		pTemplate[i].type,
+		CKA_PRIVATE);
+
+	DB::Bindings(statement).bindBlob(1, pTemplate[i].pValue, pTemplate[i].ulValueLen, SQLITE_TRANSIENT);
+
+	DB::Result result = _connection->perform(statement);
+
 	if (result.isValid())
 	{
 		do {
 			long long objectId = result.getLongLong(1);
+			if (objectId != DBTOKEN_OBJECT_TOKENINFO)
 			{
-				MutexLocker lock(_tokenMutex);
-				std::map<long long, OSObject*>::iterator it = _allObjects.find(objectId);
-				if (it == _allObjects.end())
-				{
-					DBObject *object = new DBObject(_connection, this, objectId);
-					_allObjects[objectId] = object;
-					objects.insert(object);
-				}
-				else
-				{
-					objects.insert(it->second);
-				}
+				objects.insert(getObject(objectId));
 			}
 		} while (result.nextRow());
 	}
@@ -647,6 +695,23 @@ void DBToken::getObjects(std::set<OSObject*> &objects)
 	_connection->endTransactionRO();
 }
 
+// Return the instance of an object, creating it if necessary
+OSObject* DBToken::getObject(long long objectId)
+{
+	MutexLocker lock(_tokenMutex);
+
+	std::map<long long, OSObject*>::iterator it = _allObjects.find(objectId);
+	if (it != _allObjects.end())
+	{
+		return it->second;
+	}
+
+	DBObject *object = new DBObject(_connection, this, objectId);
+	_allObjects[objectId] = object;
+
+	return object;
+}
+
 // Create a new object
 OSObject *DBToken::createObject()
 {
@@ -97,6 +97,9 @@ public:
 	// Insert objects into the given set
 	virtual void getObjects(std::set<OSObject*> &objects);
 
+	// Insert the objects that may match the template into the given set
+	virtual void findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &objects);
+
 	// Create a new object
 	virtual OSObject* createObject();
 
@@ -116,6 +119,9 @@ public:
 	virtual bool resetToken(const ByteString& label);
 
 private:
+	// Return the instance of an object, creating it if necessary
+	OSObject* getObject(long long objectId);
+
 	DB::Connection *_connection;
 
 	// All the objects ever associated with this token
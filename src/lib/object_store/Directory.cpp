@@ -54,6 +54,10 @@ Directory::Directory(std::string inPath)
 {
 	path = inPath;
 	dirMutex = MutexFactory::i()->getMutex();
+	stamped = false;
+	stampSec = 0;
+	stampNsec = 0;
+	scanTime = 0;
 
 	valid = (dirMutex != NULL) && refresh();
 }
@@ -221,6 +225,55 @@ bool Directory::refresh()
 	return true;
 }
 
+// Refresh the directory listing only if the directory was modified since the
+// previous call; changed reports whether the listing was refreshed
+bool Directory::refreshIfChanged(bool& changed)
+{
+	changed = false;
+
+#ifndef _WIN32
+	struct stat s;
+
+	if (stat(path.c_str(), &s) != 0)
+#else
+	struct _stat s;
+
+	if (_stat(path.c_str(), &s) != 0)
+#endif
+	{
+		DEBUG_MSG("Failed to stat directory %s", path.c_str());
+
+		valid = false;
+
+		return false;
+	}
+
+#if defined(__APPLE__)
+	long nsec = s.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+	long nsec = s.st_mtim.tv_nsec;
+#else
+	long nsec = 0;
+#endif
+
+	// A modification in the same second as the previous scan may not have
+	// changed the time stamp, so such a listing is never trusted
+	if (stamped && valid &&
+	    s.st_mtime == stampSec && nsec == stampNsec &&
+	    stampSec < scanTime)
+	{
+		return true;
+	}
+
+	stamped = true;
+	stampSec = s.st_mtime;
+	stampNsec = nsec;
+	scanTime = time(NULL);
+	changed = true;
+
+	return refresh();
+}
+
 // Create a new subdirectory
 bool Directory::mkdir(std::string name)
 {
@@ -276,3 +329,18 @@ bool Directory::remove(std::string name)
 #endif
 }
 
+// Rename a file in the directory; the listing is not refreshed
+bool Directory::rename(std::string oldName, std::string newName)
+{
+	std::string oldPath = path + OS_PATHSEP + oldName;
+	std::string newPath = path + OS_PATHSEP + newName;
+
+	if (::rename(oldPath.c_str(), newPath.c_str()) != 0)
+	{
+		ERROR_MSG("Failed to rename %s to %s: %s", oldPath.c_str(), newPath.c_str(), strerror(errno));
+
+		return false;
+	}
+
+	return true;
+}
@@ -37,6 +37,7 @@
 #include "MutexFactory.h"
 #include <string>
 #include <vector>
+#include <time.h>
 
 class Directory
 {
@@ -59,6 +60,10 @@ public:
 	// Refresh the directory listing
 	bool refresh();
 
+	// Refresh the directory listing only if the directory was modified since
+	// the previous call; changed reports whether the listing was refreshed
+	bool refreshIfChanged(bool& changed);
+
 	// Create a new subdirectory
 	bool mkdir(std::string name);
 
@@ -68,6 +73,9 @@ public:
 	// Delete a file in the directory
 	bool remove(std::string name);
 
+	// Rename a file in the directory; the listing is not refreshed
+	bool rename(std::string oldName, std::string newName);
+
 private:
 	// The directory path
 	std::string path;
@@ -81,6 +89,13 @@ private:
 	// All subdirectories in the directory
 	std::vector<std::string> subDirs;
 
+	// The modification time seen by refreshIfChanged and the time at which
+	// it refreshed the listing
+	bool stamped;
+	time_t stampSec;
+	long stampNsec;
+	time_t scanTime;
+
 	// For thread safeness
 	Mutex* dirMutex;
 };
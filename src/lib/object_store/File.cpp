@@ -32,6 +32,7 @@
 
 #include "config.h"
 #include "File.h"
+#include "FileSyncer.h"
 #include "log.h"
 #include <string>
 #include <stdio.h>
@@ -71,6 +72,7 @@ File::File(std::string inPath, bool forRead /* = true */, bool forWrite /* = fal
 	isReadable = forRead;
 	isWritable = forWrite;
 	locked = false;
+	anonymous = false;
 
 	path = inPath;
 	valid = false;
@@ -128,6 +130,90 @@ File::File(std::string inPath, bool forRead /* = true */, bool forWrite /* = fal
 	}
 }
 
+// Constructor for temporary files
+File::File()
+{
+	stream = NULL;
+
+	isReadable = true;
+	isWritable = true;
+	locked = false;
+	anonymous = false;
+
+	valid = false;
+}
+
+// Create a temporary file in the directory of the target path
+/*static*/ File* File::createTemp(const std::string& target)
+{
+	File* file = new File();
+	int fd = -1;
+
+	file->target = target;
+
+#if defined(O_TMPFILE) && !defined(_WIN32)
+	// Create an unnamed file in the target directory if the file system
+	// supports it; it is discarded automatically if it is never published
+	std::string dirPath = ".";
+	size_t sep = target.find_last_of('/');
+
+	if (sep != std::string::npos)
+	{
+		dirPath = target.substr(0, sep);
+	}
+
+	fd = open(dirPath.c_str(), O_TMPFILE | O_RDWR, 0600);
+
+	if (fd != -1)
+	{
+		file->anonymous = true;
+		file->path = target;
+	}
+#endif
+
+	// Otherwise use a named file next to the target, which is never
+	// picked up as an object by the token index
+	if (fd == -1)
+	{
+		file->path = target + ".tmp";
+
+#ifndef _WIN32
+		fd = open(file->path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+#else
+		fd = _open(file->path.c_str(), _O_BINARY | _O_RDWR | _O_CREAT | _O_EXCL, _S_IREAD | _S_IWRITE);
+#endif
+	}
+
+	if (fd == -1)
+	{
+		ERROR_MSG("Could not create a temporary file for %s: %s", target.c_str(), strerror(errno));
+
+		delete file;
+
+		return NULL;
+	}
+
+#ifndef _WIN32
+	file->valid = ((file->stream = fdopen(fd, "w+")) != NULL);
+#else
+	file->valid = ((file->stream = _fdopen(fd, "wb+")) != NULL);
+#endif
+
+	if (!file->valid)
+	{
+#ifndef _WIN32
+		close(fd);
+#else
+		_close(fd);
+#endif
+		delete file;
+
+		return NULL;
+	}
+
+	return file;
+}
+
 // Destructor
 File::~File()
 {
@@ -140,6 +226,12 @@ File::~File()
 	{
 		fclose(stream);
 	}
+
+	// Remove a named temporary file that was not published
+	if (!target.empty() && !anonymous)
+	{
+		(void) ::remove(path.c_str());
+	}
 }
 
 // Check if the file is valid
@@ -194,21 +286,77 @@ bool File::isEOF()
 	return valid && feof(stream);
 }
 
+// Read the entire contents of the file in a single operation, regardless of
+// the current position; warning: not thread safe without locking!
+bool File::readAll(ByteString& value)
+{
+	if (!valid) return false;
+
+#ifndef _WIN32
+	int fd = fileno(stream);
+	struct stat s;
+
+	if (fstat(fd, &s) != 0)
+	{
+		return false;
+	}
+
+	value.resize(s.st_size);
+
+	size_t done = 0;
+
+	while (done < value.size())
+	{
+		ssize_t rv = pread(fd, &value[done], value.size() - done, done);
+
+		if (rv < 0 && errno == EINTR) continue;
+		if (rv < 0) return false;
+
+		// The file was truncated in the meantime
+		if (rv == 0) break;
+
+		done += rv;
+	}
+
+	value.resize(done);
+#else
+	struct _stat s;
+
+	if (_fstat(_fileno(stream), &s) != 0 || !rewind())
+	{
+		return false;
+	}
+
+	value.resize(s.st_size);
+
+	if (value.size() != 0)
+	{
+		value.resize(fread(&value[0], 1, value.size(), stream));
+	}
+#endif
+
+	return true;
+}
+
 // Read an unsigned long value; warning: not thread safe without locking!
 bool File::readULong(unsigned long& value)
 {
 	if (!valid) return false;
 
-	ByteString ulongVal;
+	unsigned char ulongVal[8];
 
-	ulongVal.resize(8);
-
-	if (fread(&ulongVal[0], 1, 8, stream) != 8)
+	if (fread(ulongVal, 1, 8, stream) != 8)
 	{
 		return false;
 	}
 
-	value = ulongVal.long_val();
+	value = 0;
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		value <<= 8;
+		value += ulongVal[i];
+	}
 
 	return true;
 }
@@ -763,3 +911,80 @@ bool File::flush()
 	return valid && !fflush(stream);
 }
 
+// Flush the buffered stream and make the file durable
+bool File::sync()
+{
+	if (!flush()) return false;
+
+#ifndef _WIN32
+	return FileSyncer::i()->sync(path, fileno(stream));
+#else
+	return FileSyncer::i()->sync(path, _fileno(stream));
+#endif
+}
+
+// Atomically make a temporary file available under its target path
+bool File::publish()
+{
+	if (!valid || target.empty())
+	{
+		return false;
+	}
+
+#if defined(O_TMPFILE) && !defined(_WIN32)
+	if (anonymous)
+	{
+		// Linking through /proc does not require any privileges, unlike
+		// linking the descriptor itself with AT_EMPTY_PATH
+		char procPath[64];
+
+		snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fileno(stream));
+
+		if ((linkat(AT_FDCWD, procPath, AT_FDCWD, target.c_str(), AT_SYMLINK_FOLLOW) != 0) &&
+		    ((errno == EEXIST) || (linkat(fileno(stream), "", AT_FDCWD, target.c_str(), AT_EMPTY_PATH) != 0)))
+		{
+			ERROR_MSG("Could not publish the file (%s): %s", strerror(errno), target.c_str());
+
+			return false;
+		}
+
+		anonymous = false;
+		target.clear();
+
+		return true;
+	}
+#endif
+
+#ifndef _WIN32
+	// A link, unlike a rename, does not replace an existing target
+	if (link(path.c_str(), target.c_str()) != 0)
+	{
+		ERROR_MSG("Could not publish the file (%s): %s", strerror(errno), target.c_str());
+
+		return false;
+	}
+
+	(void) unlink(path.c_str());
+#else
+	// Files cannot be renamed while they are open on Windows
+	fclose(stream);
+	stream = NULL;
+	locked = false;
+	valid = false;
+
+	if (rename(path.c_str(), target.c_str()) != 0)
+	{
+		ERROR_MSG("Could not publish the file (%s): %s", strerror(errno), target.c_str());
+
+		(void) ::remove(path.c_str());
+
+		return false;
+	}
+#endif
+
+	path = target;
+	target.clear();
+
+	return true;
+}
+
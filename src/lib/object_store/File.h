@@ -44,6 +44,11 @@ public:
 	// Constructor
 	File(std::string inPath, bool forRead = true, bool forWrite = false, bool create = false, bool truncate = true);
 
+	// Create a temporary file in the directory of the target path; the file
+	// only appears under the target path once it is published. Returns NULL
+	// on failure.
+	static File* createTemp(const std::string& target);
+
 	// Destructor
 	virtual ~File();
 
@@ -62,6 +67,10 @@ public:
 	// Check if the end-of-file was reached
 	bool isEOF();
 
+	// Read the entire contents of the file in a single operation, regardless
+	// of the current position; warning: not thread safe without locking!
+	bool readAll(ByteString& value);
+
 	// Read an unsigned long value; warning: not thread safe without locking!
 	bool readULong(unsigned long& value);
 
@@ -117,10 +126,25 @@ public:
 	// Flush the buffered stream to background storage
 	bool flush();
 
+	// Flush the buffered stream and make the file durable if syncing
+	// is enabled (see FileSyncer)
+	bool sync();
+
+	// Atomically make a temporary file available under its target path;
+	// fails if the target already exists
+	bool publish();
+
 private:
+	// Constructor for temporary files
+	File();
+
 	// The file path
 	std::string path;
 
+	// The target path of a temporary file and whether it has no name
+	std::string target;
+	bool anonymous;
+
 	// The status
 	bool valid;
 	bool locked;
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FileBuffer.cpp
+
+ The contents of a file that were read in a single operation, with
+ bounds-checked read methods that decode the same encoding as the read
+ methods of the File class
+ *****************************************************************************/
+
+#include "config.h"
+#include "FileBuffer.h"
+
+enum AttributeKind {
+	akUnknown,
+	akBoolean,
+	akInteger,
+	akBinary,
+	akAttrMap,
+	akMechSet
+};
+
+// Constructor
+FileBuffer::FileBuffer(const ByteString& contents)
+{
+	data = contents.const_byte_str();
+	size = contents.size();
+	pos = 0;
+	eof = false;
+}
+
+// Check if the end of the contents was reached
+bool FileBuffer::isEOF()
+{
+	return eof;
+}
+
+// Check that the specified number of bytes can still be read
+bool FileBuffer::have(size_t len)
+{
+	if (size - pos < len)
+	{
+		// Like a short read, this consumes the remaining contents
+		pos = size;
+		eof = true;
+
+		return false;
+	}
+
+	return true;
+}
+
+// Read an unsigned long value
+bool FileBuffer::readULong(unsigned long& value)
+{
+	if (!have(8)) return false;
+
+	value = 0;
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		value <<= 8;
+		value += data[pos + i];
+	}
+
+	pos += 8;
+
+	return true;
+}
+
+// Read a ByteString value
+bool FileBuffer::readByteString(ByteString& value)
+{
+	unsigned long len;
+
+	if (!readULong(len) || !have(len)) return false;
+
+	value = ByteString(data + pos, len);
+
+	pos += len;
+
+	return true;
+}
+
+// Read a boolean value
+bool FileBuffer::readBool(bool& value)
+{
+	if (!have(1)) return false;
+
+	value = data[pos++] ? true : false;
+
+	return true;
+}
+
+// Read a mechanism type set value
+bool FileBuffer::readMechanismTypeSet(std::set<CK_MECHANISM_TYPE>& value)
+{
+	unsigned long count;
+
+	if (!readULong(count)) return false;
+
+	// Every mechanism type takes 8 bytes
+	if (count > (size - pos) / 8)
+	{
+		pos = size;
+		eof = true;
+
+		return false;
+	}
+
+	for (unsigned long i = 0; i < count; i++)
+	{
+		unsigned long mechType;
+
+		if (!readULong(mechType)) return false;
+
+		value.insert((CK_MECHANISM_TYPE) mechType);
+	}
+
+	return true;
+}
+
+// Read an attribute map value
+bool FileBuffer::readAttributeMap(std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& value)
+{
+	unsigned long len;
+
+	if (!readULong(len) || !have(len)) return false;
+
+	// The map must be decoded from exactly the announced number of bytes
+	size_t end = pos + len;
+
+	while (pos != end)
+	{
+		unsigned long attrType;
+		unsigned long attrKind;
+
+		if (end - pos < 16 || !readULong(attrType) || !readULong(attrKind))
+		{
+			return false;
+		}
+
+		size_t start = pos;
+
+		switch (attrKind)
+		{
+			case akBoolean:
+			{
+				bool val;
+
+				if (!readBool(val)) return false;
+
+				value.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute> (attrType, val));
+			}
+			break;
+
+			case akInteger:
+			{
+				unsigned long val;
+
+				if (!readULong(val)) return false;
+
+				value.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute> (attrType, val));
+			}
+			break;
+
+			case akBinary:
+			{
+				ByteString val;
+
+				if (!readByteString(val)) return false;
+
+				value.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute> (attrType, val));
+			}
+			break;
+
+			case akMechSet:
+			{
+				std::set<CK_MECHANISM_TYPE> val;
+
+				if (!readMechanismTypeSet(val)) return false;
+
+				value.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute> (attrType, val));
+			}
+			break;
+
+			default:
+				return false;
+		}
+
+		if (pos - start > end - start) return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FileBuffer.h
+
+ The contents of a file that were read in a single operation, with
+ bounds-checked read methods that decode the same encoding as the read
+ methods of the File class
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_FILEBUFFER_H
+#define _SOFTHSM_V2_FILEBUFFER_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSAttribute.h"
+#include <map>
+#include <set>
+
+class FileBuffer
+{
+public:
+	// Constructor; the contents must remain available while the buffer is in use
+	FileBuffer(const ByteString& contents);
+
+	// Destructor
+	virtual ~FileBuffer() { }
+
+	// Check if the end of the contents was reached
+	bool isEOF();
+
+	// Read an unsigned long value
+	bool readULong(unsigned long& value);
+
+	// Read a ByteString value
+	bool readByteString(ByteString& value);
+
+	// Read a boolean value
+	bool readBool(bool& value);
+
+	// Read a mechanism type set value
+	bool readMechanismTypeSet(std::set<CK_MECHANISM_TYPE>& value);
+
+	// Read an attribute map value
+	bool readAttributeMap(std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& value);
+
+private:
+	// Check that the specified number of bytes can still be read
+	bool have(size_t len);
+
+	// The contents
+	const unsigned char* data;
+	size_t size;
+
+	// The current position
+	size_t pos;
+
+	// Did a read run past the end?
+	bool eof;
+};
+
+#endif // !_SOFTHSM_V2_FILEBUFFER_H
+
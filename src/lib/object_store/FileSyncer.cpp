@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FileSyncer.cpp
+
+ Makes the writes of the file backend durable
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "FileSyncer.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+// Initialise the one-and-only instance
+#ifdef HAVE_CXX11
+std::unique_ptr<FileSyncer> FileSyncer::instance(nullptr);
+#else
+std::auto_ptr<FileSyncer> FileSyncer::instance(NULL);
+#endif
+
+// Constructor
+FileSyncer::FileSyncer()
+{
+	enabled = false;
+}
+
+// Destructor
+FileSyncer::~FileSyncer()
+{
+}
+
+// Return the one-and-only instance
+FileSyncer* FileSyncer::i()
+{
+	if (!instance.get())
+	{
+		instance.reset(new FileSyncer());
+	}
+
+	return instance.get();
+}
+
+// Enable/disable syncing
+void FileSyncer::setEnabled(bool inEnabled)
+{
+	enabled = inEnabled;
+}
+
+bool FileSyncer::isEnabled()
+{
+	return enabled;
+}
+
+// Make the data that has been written to the open file durable
+bool FileSyncer::sync(const std::string& path, int fd)
+{
+	if (!enabled) return true;
+
+#ifdef HAVE_CXX11
+	std::unique_lock<std::mutex> lock(statesMutex);
+
+	SyncState& state = states[path];
+	unsigned long ticket = ++state.requested;
+	bool rv = true;
+
+	state.users++;
+
+	// Wait until an fsync that started after our request has completed,
+	// or perform it ourselves if none is in progress
+	while (state.completed < ticket)
+	{
+		if (state.inProgress)
+		{
+			syncDone.wait(lock);
+
+			continue;
+		}
+
+		// Everything requested up to now has been written before the
+		// fsync starts, so it covers all of these requests
+		unsigned long target = state.requested;
+
+		state.inProgress = true;
+
+		lock.unlock();
+		bool synced = doSync(fd);
+		lock.lock();
+
+		state.inProgress = false;
+
+		if (synced)
+		{
+			state.completed = target;
+		}
+		else
+		{
+			rv = false;
+
+			// Let one of the waiting callers try again with its own file
+			syncDone.notify_all();
+
+			break;
+		}
+
+		syncDone.notify_all();
+	}
+
+	// Clean up the state once nobody uses it
+	if (--state.users == 0)
+	{
+		states.erase(path);
+	}
+
+	return rv;
+#else
+	return doSync(fd);
+#endif
+}
+
+// Make the entries of the directory durable
+bool FileSyncer::syncDirectory(const std::string& path)
+{
+	if (!enabled) return true;
+
+#ifndef _WIN32
+	int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd == -1)
+	{
+		ERROR_MSG("Could not open directory %s to sync it: %s", path.c_str(), strerror(errno));
+
+		return false;
+	}
+
+	bool rv = sync(path, fd);
+
+	close(fd);
+
+	return rv;
+#else
+	// Directory entries can not be synced on Windows
+	return true;
+#endif
+}
+
+// Perform the actual fsync
+/*static*/ bool FileSyncer::doSync(int fd)
+{
+#ifndef _WIN32
+	if (fsync(fd) != 0)
+	{
+		ERROR_MSG("Could not sync file: %s", strerror(errno));
+
+		return false;
+	}
+#else
+	if (_commit(fd) != 0)
+	{
+		ERROR_MSG("Could not sync file: %d", errno);
+
+		return false;
+	}
+#endif
+
+	return true;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ FileSyncer.h
+
+ Makes the writes of the file backend durable. Concurrent requests to sync
+ the same file or directory are coalesced into a single fsync (group commit):
+ a caller blocks only until an fsync that started after its own write has
+ completed, and the first caller to find no fsync in progress performs it on
+ behalf of all callers that are waiting at that point.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_FILESYNCER_H
+#define _SOFTHSM_V2_FILESYNCER_H
+
+#include "config.h"
+#include <string>
+#include <map>
+#include <memory>
+#ifdef HAVE_CXX11
+#include <mutex>
+#include <condition_variable>
+#endif
+
+class FileSyncer
+{
+public:
+	// Return the one-and-only instance
+	static FileSyncer* i();
+
+	// Destructor
+	virtual ~FileSyncer();
+
+	// Enable/disable syncing; syncing is disabled by default
+	void setEnabled(bool inEnabled);
+	bool isEnabled();
+
+	// Make the data that has been written to the open file durable
+	bool sync(const std::string& path, int fd);
+
+	// Make the entries of the directory durable
+	bool syncDirectory(const std::string& path);
+
+private:
+	// Constructor
+	FileSyncer();
+
+	// Perform the actual fsync
+	static bool doSync(int fd);
+
+	// The one-and-only instance
+#ifdef HAVE_CXX11
+	static std::unique_ptr<FileSyncer> instance;
+#else
+	static std::auto_ptr<FileSyncer> instance;
+#endif
+
+	// Is syncing enabled?
+	bool enabled;
+
+#ifdef HAVE_CXX11
+	// The sync state of a file
+	struct SyncState
+	{
+		// Number of sync requests made so far
+		unsigned long requested;
+
+		// Number of sync requests that are durable
+		unsigned long completed;
+
+		// Is an fsync in progress?
+		bool inProgress;
+
+		// Number of callers using this state
+		unsigned long users;
+
+		SyncState() : requested(0), completed(0), inProgress(false), users(0) { }
+	};
+
+	// The sync states, indexed by path
+	std::map<std::string, SyncState> states;
+
+	// Protects the sync states
+	std::mutex statesMutex;
+
+	// Signalled when an fsync completes
+	std::condition_variable syncDone;
+#endif
+};
+
+#endif // !_SOFTHSM_V2_FILESYNCER_H
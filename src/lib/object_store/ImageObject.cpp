@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ImageObject.cpp
+
+ This class implements the immutable objects of read-only token images
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "ImageObject.h"
+#include "MemObject.h"
+
+// Constructor
+ImageObject::ImageObject()
+{
+}
+
+// Destructor
+ImageObject::~ImageObject()
+{
+}
+
+// Check if the specified attribute exists
+bool ImageObject::attributeExists(CK_ATTRIBUTE_TYPE type)
+{
+	return attributes.find(type) != attributes.end();
+}
+
+// Retrieve the specified attribute
+OSAttribute ImageObject::getAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute>::const_iterator attr = attributes.find(type);
+	if (attr == attributes.end())
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return OSAttribute((unsigned long)0);
+	}
+
+	return attr->second;
+}
+
+bool ImageObject::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
+{
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute>::const_iterator attr = attributes.find(type);
+	if (attr == attributes.end())
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (attr->second.isBooleanAttribute())
+	{
+		return attr->second.getBooleanValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a boolean: 0x%08X", type);
+		return val;
+	}
+}
+
+unsigned long ImageObject::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val)
+{
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute>::const_iterator attr = attributes.find(type);
+	if (attr == attributes.end())
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (attr->second.isUnsignedLongAttribute())
+	{
+		return attr->second.getUnsignedLongValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not an unsigned long: 0x%08X", type);
+		return val;
+	}
+}
+
+ByteString ImageObject::getByteStringValue(CK_ATTRIBUTE_TYPE type)
+{
+	ByteString val;
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute>::const_iterator attr = attributes.find(type);
+	if (attr == attributes.end())
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (attr->second.isByteStringAttribute())
+	{
+		return attr->second.getByteStringValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a byte string: 0x%08X", type);
+		return val;
+	}
+}
+
+// Retrieve the next attribute type
+CK_ATTRIBUTE_TYPE ImageObject::nextAttributeType(CK_ATTRIBUTE_TYPE type)
+{
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute>::const_iterator n = attributes.upper_bound(type);
+
+	// return type or CKA_CLASS (= 0)
+	if (n == attributes.end())
+	{
+		return CKA_CLASS;
+	}
+	else
+	{
+		return n->first;
+	}
+}
+
+// Set the specified attribute
+bool ImageObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& /*attribute*/)
+{
+	DEBUG_MSG("Cannot set attribute 0x%08X of read-only object 0x%08X", type, this);
+
+	return false;
+}
+
+// Delete the specified attribute
+bool ImageObject::deleteAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	DEBUG_MSG("Cannot delete attribute 0x%08X of read-only object 0x%08X", type, this);
+
+	return false;
+}
+
+// The validity state of the object
+bool ImageObject::isValid()
+{
+	return true;
+}
+
+// Start an attribute set transaction
+bool ImageObject::startTransaction(Access access)
+{
+	if (access != ReadOnly)
+	{
+		DEBUG_MSG("Cannot start a read-write transaction on read-only object 0x%08X", this);
+
+		return false;
+	}
+
+	return true;
+}
+
+// Commit an attribute transaction
+bool ImageObject::commitTransaction()
+{
+	return true;
+}
+
+// Abort an attribute transaction
+bool ImageObject::abortTransaction()
+{
+	return true;
+}
+
+// Destroy the object
+bool ImageObject::destroyObject()
+{
+	ERROR_MSG("Cannot destroy read-only object 0x%08X", this);
+
+	return false;
+}
+
+// Load the attributes of the object from a serialised token image
+bool ImageObject::load(const unsigned char* data, size_t size, size_t& pos)
+{
+	attributes.clear();
+
+	if (!MemObject::readAttributes(data, size, pos, attributes))
+	{
+		return false;
+	}
+
+	AttributePool::internAttributes(attributes);
+
+	return true;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ImageObject.h
+
+ This class implements the immutable objects of read-only token images. The
+ attributes are loaded once and never change afterwards, so they are read
+ without any locking.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_IMAGEOBJECT_H
+#define _SOFTHSM_V2_IMAGEOBJECT_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSAttribute.h"
+#include <map>
+#include "cryptoki.h"
+#include "OSObject.h"
+
+class ImageObject : public OSObject
+{
+public:
+	// Constructor
+	ImageObject();
+
+	// Destructor
+	virtual ~ImageObject();
+
+	// Check if the specified attribute exists
+	virtual bool attributeExists(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the specified attribute
+	virtual OSAttribute getAttribute(CK_ATTRIBUTE_TYPE type);
+	virtual bool getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val);
+	virtual unsigned long getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val);
+	virtual ByteString getByteStringValue(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the next attribute type
+	virtual CK_ATTRIBUTE_TYPE nextAttributeType(CK_ATTRIBUTE_TYPE type);
+
+	// Set the specified attribute; always fails
+	virtual bool setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute);
+
+	// Delete the specified attribute; always fails
+	virtual bool deleteAttribute(CK_ATTRIBUTE_TYPE type);
+
+	// The validity state of the object
+	virtual bool isValid();
+
+	// Start an attribute set transaction; only read-only transactions
+	// are possible
+	virtual bool startTransaction(Access access);
+
+	// Commit an attribute transaction
+	virtual bool commitTransaction();
+
+	// Abort an attribute transaction
+	virtual bool abortTransaction();
+
+	// Destroys the object; always fails
+	virtual bool destroyObject();
+
+	// Load the attributes of the object from a serialised token image,
+	// starting at the given position; the position is advanced past the object
+	bool load(const unsigned char* data, size_t size, size_t& pos);
+
+private:
+	// The object's attributes
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute> attributes;
+};
+
+#endif // !_SOFTHSM_V2_IMAGEOBJECT_H
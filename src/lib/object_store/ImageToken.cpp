@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ImageToken.cpp
+
+ The token class for read-only tokens that are loaded from a token image
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "ImageToken.h"
+#include "MemObject.h"
+#include "OSAttributes.h"
+#include "OSPathSep.h"
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// The name of the image in the token directory
+#define IMAGE_NAME		"token.image"
+
+// Version of the image format
+#define IMAGE_VERSION		1
+
+// Constructor
+ImageToken::ImageToken()
+{
+	valid = false;
+	tokenFlags = 0;
+	tokenObject = new ImageObject();
+}
+
+// Check if the given token directory contains a token image
+/*static*/ bool ImageToken::hasImage(const std::string &basePath, const std::string &tokenDir)
+{
+	std::string imagePath = basePath + OS_PATHSEP + tokenDir + OS_PATHSEP + IMAGE_NAME;
+	struct stat entry;
+
+	return stat(imagePath.c_str(), &entry) == 0;
+}
+
+// Access the token image in the given token directory
+/*static*/ ImageToken* ImageToken::accessToken(const std::string &basePath, const std::string &tokenDir)
+{
+	std::string imagePath = basePath + OS_PATHSEP + tokenDir + OS_PATHSEP + IMAGE_NAME;
+	ImageToken* token = new ImageToken();
+
+#ifndef _WIN32
+	int fd = open(imagePath.c_str(), O_RDONLY);
+
+	if (fd == -1)
+	{
+		ERROR_MSG("Could not open token image %s", imagePath.c_str());
+
+		return token;
+	}
+
+	struct stat entry;
+
+	if (fstat(fd, &entry) != 0 || entry.st_size <= 0)
+	{
+		ERROR_MSG("Could not read token image %s", imagePath.c_str());
+
+		close(fd);
+
+		return token;
+	}
+
+	size_t size = (size_t) entry.st_size;
+	void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (mapped == MAP_FAILED)
+	{
+		ERROR_MSG("Could not map token image %s", imagePath.c_str());
+
+		return token;
+	}
+
+	token->valid = token->load((const unsigned char*) mapped, size);
+
+	munmap(mapped, size);
+#else
+	FILE* stream = fopen(imagePath.c_str(), "rb");
+
+	if (stream == NULL)
+	{
+		ERROR_MSG("Could not open token image %s", imagePath.c_str());
+
+		return token;
+	}
+
+	ByteString image;
+	unsigned char buffer[4096];
+	size_t read;
+
+	while ((read = fread(buffer, 1, sizeof(buffer), stream)) > 0)
+	{
+		image += ByteString(buffer, read);
+	}
+
+	fclose(stream);
+
+	token->valid = token->load(image.const_byte_str(), image.size());
+#endif
+
+	if (!token->valid)
+	{
+		ERROR_MSG("Corrupt token image %s", imagePath.c_str());
+	}
+	else
+	{
+		DEBUG_MSG("Loaded token image %s", imagePath.c_str());
+	}
+
+	return token;
+}
+
+// Create a read-only copy of an existing token
+/*static*/ ImageToken* ImageToken::copyToken(ObjectStoreToken* source)
+{
+	ImageToken* token = new ImageToken();
+	ByteString image;
+
+	if (buildImage(source, image))
+	{
+		token->valid = token->load(image.const_byte_str(), image.size());
+	}
+
+	return token;
+}
+
+// Build the image of an existing token
+/*static*/ bool ImageToken::buildImage(ObjectStoreToken* source, ByteString& image)
+{
+	ByteString label, serial, soPIN, userPIN;
+	CK_ULONG flags;
+
+	if (source == NULL || !source->isValid() ||
+	    !source->getTokenLabel(label) ||
+	    !source->getTokenSerial(serial) ||
+	    !source->getTokenFlags(flags))
+	{
+		ERROR_MSG("Cannot build an image of an invalid token");
+
+		return false;
+	}
+
+	// The token object
+	MemObject tokenObject(NULL);
+
+	if (!tokenObject.setAttribute(CKA_OS_TOKENLABEL, label) ||
+	    !tokenObject.setAttribute(CKA_OS_TOKENSERIAL, serial) ||
+	    !tokenObject.setAttribute(CKA_OS_TOKENFLAGS, flags) ||
+	    (source->getSOPIN(soPIN) && !tokenObject.setAttribute(CKA_OS_SOPIN, soPIN)) ||
+	    (source->getUserPIN(userPIN) && !tokenObject.setAttribute(CKA_OS_USERPIN, userPIN)))
+	{
+		ERROR_MSG("Failed to set the token attributes");
+
+		return false;
+	}
+
+	image.wipe();
+	image += ByteString((unsigned long) IMAGE_VERSION);
+	tokenObject.serialise(image);
+
+	// The objects
+	std::set<OSObject*> sourceObjects = source->getObjects();
+
+	for (std::set<OSObject*>::iterator i = sourceObjects.begin(); i != sourceObjects.end(); i++)
+	{
+		if (!(*i)->isValid()) continue;
+
+		MemObject::serialiseObject(*i, image);
+	}
+
+	return true;
+}
+
+// Store an image in the given token directory
+/*static*/ bool ImageToken::writeImage(const std::string &basePath, const std::string &tokenDir, const ByteString& image)
+{
+	std::string imagePath = basePath + OS_PATHSEP + tokenDir + OS_PATHSEP + IMAGE_NAME;
+	std::string tmpPath = imagePath + ".tmp";
+
+#ifndef _WIN32
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+	if (fd == -1)
+	{
+		ERROR_MSG("Could not create the token image %s", tmpPath.c_str());
+
+		return false;
+	}
+
+	size_t written = 0;
+
+	while (written < image.size())
+	{
+		ssize_t rv = write(fd, image.const_byte_str() + written, image.size() - written);
+
+		if (rv <= 0)
+		{
+			ERROR_MSG("Failed to write the token image %s", tmpPath.c_str());
+
+			close(fd);
+
+			return false;
+		}
+
+		written += (size_t) rv;
+	}
+
+	if (close(fd) != 0)
+	{
+		ERROR_MSG("Failed to write the token image %s", tmpPath.c_str());
+
+		return false;
+	}
+#else
+	FILE* stream = fopen(tmpPath.c_str(), "wb");
+
+	if (stream == NULL)
+	{
+		ERROR_MSG("Could not create the token image %s", tmpPath.c_str());
+
+		return false;
+	}
+
+	if (fwrite(image.const_byte_str(), 1, image.size(), stream) != image.size())
+	{
+		ERROR_MSG("Failed to write the token image %s", tmpPath.c_str());
+
+		fclose(stream);
+
+		return false;
+	}
+
+	fclose(stream);
+#endif
+
+	// Replace the previous image in one go
+#ifdef _WIN32
+	remove(imagePath.c_str());
+#endif
+	if (rename(tmpPath.c_str(), imagePath.c_str()) != 0)
+	{
+		ERROR_MSG("Could not replace the token image %s", imagePath.c_str());
+
+		return false;
+	}
+
+	return true;
+}
+
+// Load the token from the serialised image
+bool ImageToken::load(const unsigned char* data, size_t size)
+{
+	unsigned long version = 0;
+
+	if (size < 8)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		version = (version << 8) + data[i];
+	}
+
+	if (version != IMAGE_VERSION)
+	{
+		ERROR_MSG("Unsupported token image version %lu", version);
+
+		return false;
+	}
+
+	size_t pos = 8;
+
+	// The token object comes first, followed by the objects
+	if (!tokenObject->load(data, size, pos) ||
+	    !tokenObject->attributeExists(CKA_OS_TOKENFLAGS))
+	{
+		return false;
+	}
+
+	tokenFlags = tokenObject->getUnsignedLongValue(CKA_OS_TOKENFLAGS, 0);
+
+	while (pos < size)
+	{
+		ImageObject* object = new ImageObject();
+
+		if (!object->load(data, size, pos))
+		{
+			delete object;
+
+			return false;
+		}
+
+		objects.insert(object);
+		objectIndex.addObject(object);
+	}
+
+	return true;
+}
+
+// Destructor
+ImageToken::~ImageToken()
+{
+	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+	{
+		delete *i;
+	}
+
+	delete tokenObject;
+}
+
+// Set the SO PIN
+bool ImageToken::setSOPIN(const ByteString& /*soPINBlob*/)
+{
+	ERROR_MSG("Cannot change the SO PIN of a read-only token");
+
+	return false;
+}
+
+// Get the SO PIN
+bool ImageToken::getSOPIN(ByteString& soPINBlob)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_SOPIN))
+	{
+		return false;
+	}
+
+	soPINBlob = tokenObject->getByteStringValue(CKA_OS_SOPIN);
+
+	return true;
+}
+
+// Set the user PIN
+bool ImageToken::setUserPIN(ByteString /*userPINBlob*/)
+{
+	ERROR_MSG("Cannot change the user PIN of a read-only token");
+
+	return false;
+}
+
+// Get the user PIN
+bool ImageToken::getUserPIN(ByteString& userPINBlob)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_USERPIN))
+	{
+		return false;
+	}
+
+	userPINBlob = tokenObject->getByteStringValue(CKA_OS_USERPIN);
+
+	return true;
+}
+
+// Retrieve the token label
+bool ImageToken::getTokenLabel(ByteString& label)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_TOKENLABEL))
+	{
+		return false;
+	}
+
+	label = tokenObject->getByteStringValue(CKA_OS_TOKENLABEL);
+
+	return true;
+}
+
+// Retrieve the token serial
+bool ImageToken::getTokenSerial(ByteString& serial)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_TOKENSERIAL))
+	{
+		return false;
+	}
+
+	serial = tokenObject->getByteStringValue(CKA_OS_TOKENSERIAL);
+
+	return true;
+}
+
+// Get the token flags
+bool ImageToken::getTokenFlags(CK_ULONG& flags)
+{
+	if (!valid) return false;
+
+	flags = tokenFlags | CKF_WRITE_PROTECTED;
+
+	// Check if the user PIN is initialised
+	if (tokenObject->attributeExists(CKA_OS_USERPIN))
+	{
+		flags |= CKF_USER_PIN_INITIALIZED;
+	}
+
+	return true;
+}
+
+// Set the token flags; the token class serialises access to the flags
+bool ImageToken::setTokenFlags(const CK_ULONG flags)
+{
+	if (!valid) return false;
+
+	tokenFlags = flags;
+
+	return true;
+}
+
+// Retrieve objects
+std::set<OSObject*> ImageToken::getObjects()
+{
+	return objects;
+}
+
+void ImageToken::getObjects(std::set<OSObject*> &inObjects)
+{
+	inObjects.insert(objects.begin(), objects.end());
+}
+
+// Insert the objects that may match the template into the given set
+void ImageToken::findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects)
+{
+	if (objectIndex.findObjects(pTemplate, ulCount, inObjects)) return;
+
+	inObjects.insert(objects.begin(), objects.end());
+}
+
+// Create a new object
+OSObject* ImageToken::createObject()
+{
+	ERROR_MSG("Cannot create objects on a read-only token");
+
+	return NULL;
+}
+
+// Delete an object
+bool ImageToken::deleteObject(OSObject* object)
+{
+	ERROR_MSG("Cannot delete object 0x%08X from a read-only token", object);
+
+	return false;
+}
+
+// Checks if the token is consistent
+bool ImageToken::isValid()
+{
+	return valid;
+}
+
+// Invalidate the token (for instance if it is deleted)
+void ImageToken::invalidate()
+{
+	valid = false;
+}
+
+// Delete the token
+bool ImageToken::clearToken()
+{
+	ERROR_MSG("Cannot delete a read-only token");
+
+	return false;
+}
+
+// Reset the token
+bool ImageToken::resetToken(const ByteString& /*label*/)
+{
+	ERROR_MSG("Cannot reset a read-only token");
+
+	return false;
+}
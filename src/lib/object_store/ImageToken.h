@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ImageToken.h
+
+ The token class for read-only tokens. A compact image of the token is loaded
+ once, after which the objects are served without any file locking,
+ generation checks or write-path bookkeeping. Any modification of the token
+ fails. The image is stored in the token directory (token.image) and is built
+ offline from an existing token.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_IMAGETOKEN_H
+#define _SOFTHSM_V2_IMAGETOKEN_H
+
+#include "config.h"
+#include "ObjectStoreToken.h"
+#include "OSAttribute.h"
+#include "ImageObject.h"
+#include "ObjectIndex.h"
+#include "cryptoki.h"
+#include <string>
+#include <set>
+
+class ImageToken : public ObjectStoreToken
+{
+public:
+	// Check if the given token directory contains a token image
+	static bool hasImage(const std::string &basePath, const std::string &tokenDir);
+
+	// Access the token image in the given token directory
+	static ImageToken* accessToken(const std::string &basePath, const std::string &tokenDir);
+
+	// Create a read-only copy of an existing token
+	static ImageToken* copyToken(ObjectStoreToken* source);
+
+	// Build the image of an existing token
+	static bool buildImage(ObjectStoreToken* source, ByteString& image);
+
+	// Store an image in the given token directory
+	static bool writeImage(const std::string &basePath, const std::string &tokenDir, const ByteString& image);
+
+	// Set the SO PIN; always fails
+	virtual bool setSOPIN(const ByteString& soPINBlob);
+
+	// Get the SO PIN
+	virtual bool getSOPIN(ByteString& soPINBlob);
+
+	// Set the user PIN; always fails
+	virtual bool setUserPIN(ByteString userPINBlob);
+
+	// Get the user PIN
+	virtual bool getUserPIN(ByteString& userPINBlob);
+
+	// Get the token flags; CKF_WRITE_PROTECTED is always set
+	virtual bool getTokenFlags(CK_ULONG& flags);
+
+	// Set the token flags; the flags are only kept in memory
+	virtual bool setTokenFlags(const CK_ULONG flags);
+
+	// Retrieve the token label
+	virtual bool getTokenLabel(ByteString& label);
+
+	// Retrieve the token serial
+	virtual bool getTokenSerial(ByteString& serial);
+
+	// Retrieve objects
+	virtual std::set<OSObject*> getObjects();
+
+	// Insert objects into the given set
+	virtual void getObjects(std::set<OSObject*> &inObjects);
+
+	// Insert the objects that may match the template into the given set
+	virtual void findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects);
+
+	// Create a new object; always fails
+	virtual OSObject* createObject();
+
+	// Delete an object; always fails
+	virtual bool deleteObject(OSObject* object);
+
+	// Destructor
+	virtual ~ImageToken();
+
+	// Checks if the token is consistent
+	virtual bool isValid();
+
+	// Invalidate the token (for instance if it is deleted)
+	virtual void invalidate();
+
+	// Delete the token; always fails
+	virtual bool clearToken();
+
+	// Reset the token; always fails
+	virtual bool resetToken(const ByteString& label);
+
+private:
+	// Constructor
+	ImageToken();
+
+	// Load the token from the serialised image
+	bool load(const unsigned char* data, size_t size);
+
+	// Is the token consistent and valid?
+	bool valid;
+
+	// The token flags
+	CK_ULONG tokenFlags;
+
+	// The objects of the token; these never change after loading
+	std::set<OSObject*> objects;
+
+	// The index over the attributes the objects are searched by
+	ObjectIndex objectIndex;
+
+	// The token object
+	ImageObject* tokenObject;
+};
+
+#endif // !_SOFTHSM_V2_IMAGETOKEN_H
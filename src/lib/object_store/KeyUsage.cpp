@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ KeyUsage.cpp
+
+ Counts how often an object has been used in cryptographic operations
+ *****************************************************************************/
+
+#include "config.h"
+#include "KeyUsage.h"
+
+// Constructor
+KeyUsage::KeyUsage()
+{
+	for (int i = 0; i < OperationCount; i++)
+	{
+		counts[i] = 0;
+	}
+
+	lastUsed = 0;
+	seeded = false;
+}
+
+// Count uses of the object
+void KeyUsage::count(Operation op, unsigned long long n)
+{
+	if (op < 0 || op >= OperationCount) return;
+
+#ifdef HAVE_CXX11
+	counts[op].fetch_add(n, std::memory_order_relaxed);
+	lastUsed.store((long long)time(NULL), std::memory_order_relaxed);
+#else
+	counts[op] += n;
+	lastUsed = (long long)time(NULL);
+#endif
+}
+
+// Return the number of uses
+unsigned long long KeyUsage::getCount(Operation op) const
+{
+	if (op < 0 || op >= OperationCount) return 0;
+
+#ifdef HAVE_CXX11
+	return counts[op].load(std::memory_order_relaxed);
+#else
+	return counts[op];
+#endif
+}
+
+unsigned long long KeyUsage::getTotal() const
+{
+	unsigned long long total = 0;
+
+	for (int i = 0; i < OperationCount; i++)
+	{
+		total += getCount((Operation)i);
+	}
+
+	return total;
+}
+
+// Return the time of the last use
+time_t KeyUsage::getLastUsed() const
+{
+#ifdef HAVE_CXX11
+	return (time_t)lastUsed.load(std::memory_order_relaxed);
+#else
+	return (time_t)lastUsed;
+#endif
+}
+
+// Add the counters that have been saved by an earlier run
+bool KeyUsage::isSeeded() const
+{
+#ifdef HAVE_CXX11
+	return seeded.load(std::memory_order_acquire);
+#else
+	return seeded;
+#endif
+}
+
+void KeyUsage::seed(const unsigned long long* inCounts, time_t inLastUsed)
+{
+#ifdef HAVE_CXX11
+	if (seeded.exchange(true)) return;
+
+	if (inCounts == NULL) return;
+
+	for (int i = 0; i < OperationCount; i++)
+	{
+		counts[i].fetch_add(inCounts[i], std::memory_order_relaxed);
+	}
+
+	// Keep the most recent of the two times
+	long long current = lastUsed.load(std::memory_order_relaxed);
+	while (current < (long long)inLastUsed &&
+	       !lastUsed.compare_exchange_weak(current, (long long)inLastUsed))
+	{
+	}
+#else
+	if (seeded) return;
+
+	seeded = true;
+
+	if (inCounts == NULL) return;
+
+	for (int i = 0; i < OperationCount; i++)
+	{
+		counts[i] += inCounts[i];
+	}
+
+	if (lastUsed < (long long)inLastUsed)
+	{
+		lastUsed = (long long)inLastUsed;
+	}
+#endif
+}
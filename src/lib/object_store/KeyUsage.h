@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ KeyUsage.h
+
+ Counts how often an object has been used in cryptographic operations and
+ when it was last used. The counters are kept in memory only and are updated
+ without taking a lock, so counting does not slow down the operations.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_KEYUSAGE_H
+#define _SOFTHSM_V2_KEYUSAGE_H
+
+#include "config.h"
+#include <time.h>
+#ifdef HAVE_CXX11
+#include <atomic>
+#endif
+
+class KeyUsage
+{
+public:
+	// The operations that are counted
+	enum Operation {
+		Sign,
+		Verify,
+		Encrypt,
+		Decrypt,
+		Derive,
+		Wrap,
+		Unwrap,
+		OperationCount
+	};
+
+	// Constructor
+	KeyUsage();
+
+	// Count uses of the object
+	void count(Operation op, unsigned long long n = 1);
+
+	// Return the number of uses
+	unsigned long long getCount(Operation op) const;
+	unsigned long long getTotal() const;
+
+	// Return the time of the last use; 0 if the object has not been used
+	time_t getLastUsed() const;
+
+	// Add the counters that have been saved by an earlier run; only the
+	// first call has effect
+	bool isSeeded() const;
+	void seed(const unsigned long long* counts, time_t lastUsed);
+
+private:
+	// Not copyable
+	KeyUsage(const KeyUsage&);
+	KeyUsage& operator=(const KeyUsage&);
+
+#ifdef HAVE_CXX11
+	std::atomic<unsigned long long> counts[OperationCount];
+	std::atomic<long long> lastUsed;
+	std::atomic<bool> seeded;
+#else
+	// Without atomics a concurrent use may occasionally not be counted
+	volatile unsigned long long counts[OperationCount];
+	volatile long long lastUsed;
+	volatile bool seeded;
+#endif
+};
+
+#endif // !_SOFTHSM_V2_KEYUSAGE_H
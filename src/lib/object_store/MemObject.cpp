@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MemObject.cpp
+
+ This class implements objects of tokens that are kept in process memory
+ *****************************************************************************/
+
+#include "config.h"
+#include "MemObject.h"
+#include "MemToken.h"
+#include <vector>
+
+// Attribute types
+#define BOOLEAN_ATTR			0x1
+#define ULONG_ATTR			0x2
+#define BYTESTR_ATTR			0x3
+#define ATTRMAP_ATTR			0x4
+#define MECHSET_ATTR			0x5
+
+// Append an attribute to the serialised data
+static void serialiseAttribute(ByteString& serialised, const OSAttribute& attribute)
+{
+	if (attribute.isBooleanAttribute())
+	{
+		serialised += ByteString((unsigned long) BOOLEAN_ATTR);
+		serialised += ByteString((unsigned long) (attribute.getBooleanValue() ? 1 : 0));
+	}
+	else if (attribute.isUnsignedLongAttribute())
+	{
+		serialised += ByteString((unsigned long) ULONG_ATTR);
+		serialised += ByteString(attribute.getUnsignedLongValue());
+	}
+	else if (attribute.isByteStringAttribute())
+	{
+		serialised += ByteString((unsigned long) BYTESTR_ATTR);
+		serialised += attribute.getByteStringValue().serialise();
+	}
+	else if (attribute.isMechanismTypeSetAttribute())
+	{
+		const std::set<CK_MECHANISM_TYPE>& value = attribute.getMechanismTypeSetValue();
+
+		serialised += ByteString((unsigned long) MECHSET_ATTR);
+		serialised += ByteString((unsigned long) value.size());
+
+		for (std::set<CK_MECHANISM_TYPE>::const_iterator i = value.begin(); i != value.end(); i++)
+		{
+			serialised += ByteString((unsigned long) *i);
+		}
+	}
+	else if (attribute.isAttributeMapAttribute())
+	{
+		const std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& value = attribute.getAttributeMapValue();
+
+		serialised += ByteString((unsigned long) ATTRMAP_ATTR);
+		serialised += ByteString((unsigned long) value.size());
+
+		for (std::map<CK_ATTRIBUTE_TYPE,OSAttribute>::const_iterator i = value.begin(); i != value.end(); i++)
+		{
+			serialised += ByteString((unsigned long) i->first);
+			serialiseAttribute(serialised, i->second);
+		}
+	}
+}
+
+// Read an unsigned long from the serialised data
+static bool readULong(const unsigned char* data, size_t size, size_t& pos, unsigned long& value)
+{
+	if (size < pos || size - pos < 8)
+	{
+		return false;
+	}
+
+	const unsigned char* bytes = data + pos;
+
+	value = 0;
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		value <<= 8;
+		value += bytes[i];
+	}
+
+	pos += 8;
+
+	return true;
+}
+
+// Read an attribute from the serialised data; the caller owns the result
+static OSAttribute* readAttribute(const unsigned char* data, size_t size, size_t& pos)
+{
+	unsigned long osAttrType;
+	unsigned long value;
+
+	if (!readULong(data, size, pos, osAttrType))
+	{
+		return NULL;
+	}
+
+	switch (osAttrType)
+	{
+		case BOOLEAN_ATTR:
+			if (!readULong(data, size, pos, value)) return NULL;
+
+			return new OSAttribute(value != 0);
+		case ULONG_ATTR:
+			if (!readULong(data, size, pos, value)) return NULL;
+
+			return new OSAttribute(value);
+		case BYTESTR_ATTR:
+			if (!readULong(data, size, pos, value) || (size - pos) < value) return NULL;
+
+			pos += value;
+
+			return new OSAttribute(ByteString(data + pos - value, value));
+		case MECHSET_ATTR:
+		{
+			unsigned long count;
+			std::set<CK_MECHANISM_TYPE> mechSet;
+
+			if (!readULong(data, size, pos, count)) return NULL;
+
+			for (unsigned long i = 0; i < count; i++)
+			{
+				if (!readULong(data, size, pos, value)) return NULL;
+
+				mechSet.insert(value);
+			}
+
+			return new OSAttribute(mechSet);
+		}
+		case ATTRMAP_ATTR:
+		{
+			unsigned long count;
+			std::map<CK_ATTRIBUTE_TYPE,OSAttribute> attrMap;
+
+			if (!readULong(data, size, pos, count)) return NULL;
+
+			for (unsigned long i = 0; i < count; i++)
+			{
+				if (!readULong(data, size, pos, value)) return NULL;
+
+				OSAttribute* attribute = readAttribute(data, size, pos);
+
+				if (attribute == NULL) return NULL;
+
+				attrMap.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(value, *attribute));
+
+				delete attribute;
+			}
+
+			return new OSAttribute(attrMap);
+		}
+		default:
+			DEBUG_MSG("Unknown attribute type %lu in serialised object", osAttrType);
+
+			return NULL;
+	}
+}
+
+// Constructor
+MemObject::MemObject(MemToken* inParent)
+{
+	objectMutex = MutexFactory::i()->getMutex();
+	valid = (objectMutex != NULL);
+	inTransaction = false;
+	parent = inParent;
+}
+
+// Destructor
+MemObject::~MemObject()
+{
+	discardAttributes();
+
+	MutexFactory::i()->recycleMutex(objectMutex);
+}
+
+// Check if the specified attribute exists
+bool MemObject::attributeExists(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	return valid && (attributes[type] != NULL);
+}
+
+// Retrieve the specified attribute
+OSAttribute MemObject::getAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	OSAttribute* attr = attributes[type];
+	if (attr == NULL)
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return OSAttribute((unsigned long)0);
+	}
+
+	return *attr;
+}
+
+bool MemObject::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
+{
+	MutexLocker lock(objectMutex);
+
+	OSAttribute* attr = attributes[type];
+	if (attr == NULL)
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (attr->isBooleanAttribute())
+	{
+		return attr->getBooleanValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a boolean: 0x%08X", type);
+		return val;
+	}
+}
+
+unsigned long MemObject::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val)
+{
+	MutexLocker lock(objectMutex);
+
+	OSAttribute* attr = attributes[type];
+	if (attr == NULL)
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (attr->isUnsignedLongAttribute())
+	{
+		return attr->getUnsignedLongValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not an unsigned long: 0x%08X", type);
+		return val;
+	}
+}
+
+ByteString MemObject::getByteStringValue(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	ByteString val;
+
+	OSAttribute* attr = attributes[type];
+	if (attr == NULL)
+	{
+		ERROR_MSG("The attribute does not exist: 0x%08X", type);
+		return val;
+	}
+
+	if (attr->isByteStringAttribute())
+	{
+		return attr->getByteStringValue();
+	}
+	else
+	{
+		ERROR_MSG("The attribute is not a byte string: 0x%08X", type);
+		return val;
+	}
+}
+
+// Retrieve the next attribute type
+CK_ATTRIBUTE_TYPE MemObject::nextAttributeType(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator n = attributes.upper_bound(type);
+
+	// skip null attributes
+	while ((n != attributes.end()) && (n->second == NULL))
+		++n;
+
+	// return type or CKA_CLASS (= 0)
+	if (n == attributes.end())
+	{
+		return CKA_CLASS;
+	}
+	else
+	{
+		return n->first;
+	}
+}
+
+// Set the specified attribute
+bool MemObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute)
+{
+	MutexLocker lock(objectMutex);
+
+	if (!valid)
+	{
+		DEBUG_MSG("Cannot update invalid memory object 0x%08X", this);
+
+		return false;
+	}
+
+	if (attributes[type] != NULL)
+	{
+		delete attributes[type];
+
+		attributes[type] = NULL;
+	}
+
+	attributes[type] = new OSAttribute(attribute);
+	AttributePool::internAttribute(attributes, type);
+
+	if (parent != NULL) parent->objectIndex.attributeChanged(this, type);
+
+	return true;
+}
+
+// Delete the specified attribute
+bool MemObject::deleteAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	MutexLocker lock(objectMutex);
+
+	if (!valid)
+	{
+		DEBUG_MSG("Cannot update invalid memory object 0x%08X", this);
+
+		return false;
+	}
+
+	if (attributes[type] == NULL)
+	{
+		DEBUG_MSG("Cannot delete attribute that doesn't exist in object 0x%08X", this);
+
+		return false;
+	}
+
+	delete attributes[type];
+	attributes.erase(type);
+
+	if (parent != NULL) parent->objectIndex.attributeChanged(this, type);
+
+	return true;
+}
+
+// The validity state of the object
+bool MemObject::isValid()
+{
+	return valid;
+}
+
+// Start an attribute set transaction
+bool MemObject::startTransaction(Access)
+{
+	MutexLocker lock(objectMutex);
+
+	if (inTransaction)
+	{
+		return false;
+	}
+
+	savedAttributes.clear();
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.begin(); i != attributes.end(); i++)
+	{
+		if (i->second == NULL)
+		{
+			continue;
+		}
+
+		savedAttributes.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(i->first, *i->second));
+	}
+
+	inTransaction = true;
+
+	return true;
+}
+
+// Commit an attribute transaction
+bool MemObject::commitTransaction()
+{
+	MutexLocker lock(objectMutex);
+
+	if (!inTransaction)
+	{
+		return false;
+	}
+
+	savedAttributes.clear();
+	inTransaction = false;
+
+	return true;
+}
+
+// Abort an attribute transaction; restores the previous attributes
+bool MemObject::abortTransaction()
+{
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute> restore;
+
+	{
+		MutexLocker lock(objectMutex);
+
+		if (!inTransaction)
+		{
+			return false;
+		}
+
+		restore.swap(savedAttributes);
+		inTransaction = false;
+	}
+
+	discardAttributes();
+
+	MutexLocker lock(objectMutex);
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute>::iterator i = restore.begin(); i != restore.end(); i++)
+	{
+		attributes[i->first] = new OSAttribute(i->second);
+	}
+
+	if (parent != NULL) parent->objectIndex.objectChanged(this);
+
+	return true;
+}
+
+// Destroy the object; WARNING: pointers to the object become invalid after this call
+bool MemObject::destroyObject()
+{
+	if (parent == NULL)
+	{
+		ERROR_MSG("Cannot destroy an object that is not associated with a token");
+
+		return false;
+	}
+
+	return parent->deleteObject(this);
+}
+
+// Invalidate the object
+void MemObject::invalidate()
+{
+	valid = false;
+	discardAttributes();
+}
+
+// Append the attributes of the object to the serialised data
+void MemObject::serialise(ByteString& serialised)
+{
+	MutexLocker lock(objectMutex);
+
+	size_t count = 0;
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.begin(); i != attributes.end(); i++)
+	{
+		if (i->second != NULL) count++;
+	}
+
+	serialised += ByteString((unsigned long) count);
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.begin(); i != attributes.end(); i++)
+	{
+		if (i->second == NULL)
+		{
+			continue;
+		}
+
+		serialised += ByteString((unsigned long) i->first);
+		serialiseAttribute(serialised, *i->second);
+	}
+}
+
+// Read the attributes of the object from the serialised data, starting at
+// the given position; the position is advanced past the object
+bool MemObject::deserialise(const ByteString& serialised, size_t& pos)
+{
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute> read;
+
+	discardAttributes();
+
+	if (!readAttributes(serialised.const_byte_str(), serialised.size(), pos, read))
+	{
+		return false;
+	}
+
+	MutexLocker lock(objectMutex);
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute>::iterator i = read.begin(); i != read.end(); i++)
+	{
+		attributes[i->first] = new OSAttribute(i->second);
+	}
+
+	AttributePool::internAttributes(attributes);
+
+	return true;
+}
+
+// Append the attributes of any object to the serialised data, in the same
+// format as serialise()
+/*static*/ void MemObject::serialiseObject(OSObject* object, ByteString& serialised)
+{
+	std::vector<CK_ATTRIBUTE_TYPE> types;
+
+	// CKA_CLASS (= 0) also marks the end of the attributes
+	if (object->attributeExists(CKA_CLASS))
+	{
+		types.push_back(CKA_CLASS);
+	}
+
+	for (CK_ATTRIBUTE_TYPE type = object->nextAttributeType(CKA_CLASS); type != CKA_CLASS; type = object->nextAttributeType(type))
+	{
+		types.push_back(type);
+	}
+
+	serialised += ByteString((unsigned long) types.size());
+
+	for (std::vector<CK_ATTRIBUTE_TYPE>::iterator i = types.begin(); i != types.end(); i++)
+	{
+		serialised += ByteString((unsigned long) *i);
+		serialiseAttribute(serialised, object->getAttribute(*i));
+	}
+}
+
+// Read the attributes of a serialised object, starting at the given position;
+// the position is advanced past the object
+/*static*/ bool MemObject::readAttributes(const unsigned char* data, size_t size, size_t& pos, std::map<CK_ATTRIBUTE_TYPE, OSAttribute>& attributes)
+{
+	unsigned long count;
+
+	if (!readULong(data, size, pos, count))
+	{
+		return false;
+	}
+
+	for (unsigned long i = 0; i < count; i++)
+	{
+		unsigned long p11AttrType;
+
+		if (!readULong(data, size, pos, p11AttrType))
+		{
+			return false;
+		}
+
+		OSAttribute* attribute = readAttribute(data, size, pos);
+
+		if (attribute == NULL)
+		{
+			return false;
+		}
+
+		attributes.erase(p11AttrType);
+		attributes.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(p11AttrType, *attribute));
+
+		delete attribute;
+	}
+
+	return true;
+}
+
+// Discard the object's attributes
+void MemObject::discardAttributes()
+{
+	MutexLocker lock(objectMutex);
+
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> cleanUp = attributes;
+	attributes.clear();
+
+	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = cleanUp.begin(); i != cleanUp.end(); i++)
+	{
+		if (i->second == NULL)
+		{
+			continue;
+		}
+
+		delete i->second;
+		i->second = NULL;
+	}
+}
+
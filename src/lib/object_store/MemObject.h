@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MemObject.h
+
+ This class implements objects of tokens that are kept in process memory
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MEMOBJECT_H
+#define _SOFTHSM_V2_MEMOBJECT_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSAttribute.h"
+#include "MutexFactory.h"
+#include <map>
+#include "cryptoki.h"
+#include "OSObject.h"
+
+// Forward declaration of the memory token
+class MemToken;
+
+class MemObject : public OSObject
+{
+public:
+	// Constructor
+	MemObject(MemToken* inParent);
+
+	// Destructor
+	virtual ~MemObject();
+
+	// Check if the specified attribute exists
+	virtual bool attributeExists(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the specified attribute
+	virtual OSAttribute getAttribute(CK_ATTRIBUTE_TYPE type);
+	virtual bool getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val);
+	virtual unsigned long getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val);
+	virtual ByteString getByteStringValue(CK_ATTRIBUTE_TYPE type);
+
+	// Retrieve the next attribute type
+	virtual CK_ATTRIBUTE_TYPE nextAttributeType(CK_ATTRIBUTE_TYPE type);
+
+	// Set the specified attribute
+	virtual bool setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribute);
+
+	// Delete the specified attribute
+	virtual bool deleteAttribute(CK_ATTRIBUTE_TYPE type);
+
+	// The validity state of the object
+	virtual bool isValid();
+
+	// Start an attribute set transaction; the current attributes are
+	// kept so that they can be restored when the transaction is aborted
+	virtual bool startTransaction(Access access);
+
+	// Commit an attribute transaction
+	virtual bool commitTransaction();
+
+	// Abort an attribute transaction; restores the previous attributes
+	virtual bool abortTransaction();
+
+	// Destroys the object; WARNING: pointers to the object become invalid after this
+	// call!
+	virtual bool destroyObject();
+
+	// Invalidate the object
+	void invalidate();
+
+	// Append the attributes of the object to the serialised data
+	void serialise(ByteString& serialised);
+
+	// Read the attributes of the object from the serialised data, starting
+	// at the given position; the position is advanced past the object
+	bool deserialise(const ByteString& serialised, size_t& pos);
+
+	// Append the attributes of any object to the serialised data, in the
+	// same format as serialise()
+	static void serialiseObject(OSObject* object, ByteString& serialised);
+
+	// Read the attributes of a serialised object, starting at the given
+	// position; the position is advanced past the object
+	static bool readAttributes(const unsigned char* data, size_t size, size_t& pos, std::map<CK_ATTRIBUTE_TYPE, OSAttribute>& attributes);
+
+private:
+	// Discard the object's attributes
+	void discardAttributes();
+
+	// The object's raw attributes
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> attributes;
+
+	// The attributes at the start of the running transaction
+	std::map<CK_ATTRIBUTE_TYPE, OSAttribute> savedAttributes;
+
+	// The object's validity state
+	bool valid;
+
+	// Is there a transaction in progress?
+	bool inTransaction;
+
+	// Mutex object for thread-safeness
+	Mutex* objectMutex;
+
+	// The parent token
+	MemToken* parent;
+};
+
+#endif // !_SOFTHSM_V2_MEMOBJECT_H
+
@@ -0,0 +1,699 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MemToken.cpp
+
+ The token class for tokens that are kept in process memory. The contents of
+ the tokens survive C_Finalize/C_Initialize cycles within the same process
+ and can optionally be loaded from and saved to a snapshot file.
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "MemToken.h"
+#include "OSAttributes.h"
+#include "File.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+// Version of the snapshot file format
+#define SNAPSHOT_VERSION	1
+
+// The serialised contents of the tokens, indexed by base path and token
+// directory. Token instances are created from and stored back to this image,
+// so that the tokens survive the object store being discarded at C_Finalize
+// without holding on to secure memory. Sensitive attributes are encrypted by
+// the token before they reach the object store, just like for the file
+// backend. Access is serialised by the object store.
+typedef std::map<std::string, std::string> TokenImages;
+static std::map<std::string, TokenImages> images;
+
+// The base paths for which the snapshot has been loaded
+static std::set<std::string> loadedPaths;
+
+// The snapshot file
+static std::string snapshotFile;
+
+// Load the snapshot file into the image of the given base path
+static bool loadSnapshot(const std::string& basePath)
+{
+	// A missing snapshot is not an error; the tokens start out empty
+	FILE* exists = fopen(snapshotFile.c_str(), "rb");
+
+	if (exists == NULL)
+	{
+		INFO_MSG("No snapshot found in %s", snapshotFile.c_str());
+
+		return true;
+	}
+
+	fclose(exists);
+
+	File snapshot(snapshotFile);
+
+	if (!snapshot.isValid() || !snapshot.lock())
+	{
+		ERROR_MSG("Could not read the snapshot %s", snapshotFile.c_str());
+
+		return false;
+	}
+
+	unsigned long version;
+	unsigned long count;
+
+	if (!snapshot.readULong(version) || version != SNAPSHOT_VERSION ||
+	    !snapshot.readULong(count))
+	{
+		ERROR_MSG("Snapshot %s has an unsupported format", snapshotFile.c_str());
+
+		return false;
+	}
+
+	TokenImages loaded;
+
+	for (unsigned long i = 0; i < count; i++)
+	{
+		std::string tokenDir;
+		std::string image;
+
+		if (!snapshot.readString(tokenDir) || !snapshot.readString(image))
+		{
+			ERROR_MSG("Corrupt snapshot %s", snapshotFile.c_str());
+
+			return false;
+		}
+
+		loaded[tokenDir] = image;
+	}
+
+	images[basePath].swap(loaded);
+
+	DEBUG_MSG("Loaded %lu tokens from snapshot %s", count, snapshotFile.c_str());
+
+	return true;
+}
+
+// Save the image of the given base path to the snapshot file
+static bool saveSnapshot(const std::string& basePath)
+{
+	TokenImages& tokens = images[basePath];
+
+	// Write to a new file of our own, so that processes that finalize at the
+	// same time never write to the same file
+	std::string tmpFile = snapshotFile + ".XXXXXX";
+	std::vector<char> tmpName(tmpFile.begin(), tmpFile.end());
+	tmpName.push_back('\0');
+	int fd = -1;
+
+#ifndef _WIN32
+	fd = mkstemp(&tmpName[0]);
+#else
+	if (_mktemp_s(&tmpName[0], tmpName.size()) == 0)
+	{
+		fd = _open(&tmpName[0], _O_BINARY | _O_RDWR | _O_CREAT | _O_EXCL, _S_IREAD | _S_IWRITE);
+	}
+#endif
+
+	tmpFile = &tmpName[0];
+
+	if (fd == -1)
+	{
+		ERROR_MSG("Could not create the snapshot %s: %s", tmpFile.c_str(), strerror(errno));
+
+		return false;
+	}
+
+	bool bOK;
+
+	{
+		File snapshot(tmpFile, false, true);
+
+		bOK = snapshot.isValid() &&
+		      snapshot.writeULong(SNAPSHOT_VERSION) &&
+		      snapshot.writeULong(tokens.size());
+
+		for (TokenImages::iterator i = tokens.begin(); bOK && i != tokens.end(); i++)
+		{
+			bOK = snapshot.writeString(i->first) && snapshot.writeString(i->second);
+		}
+
+		bOK = bOK && snapshot.flush();
+	}
+
+	// Make the snapshot durable before it replaces the previous one
+#ifndef _WIN32
+	bOK = bOK && (fsync(fd) == 0);
+	close(fd);
+#else
+	bOK = bOK && (_commit(fd) == 0);
+	_close(fd);
+#endif
+
+	if (!bOK)
+	{
+		ERROR_MSG("Failed to write the snapshot %s", tmpFile.c_str());
+
+		remove(tmpFile.c_str());
+
+		return false;
+	}
+
+	// Replace the previous snapshot in one go
+#ifdef _WIN32
+	remove(snapshotFile.c_str());
+#endif
+	if (rename(tmpFile.c_str(), snapshotFile.c_str()) != 0)
+	{
+		ERROR_MSG("Could not replace the snapshot %s", snapshotFile.c_str());
+
+		remove(tmpFile.c_str());
+
+		return false;
+	}
+
+	DEBUG_MSG("Saved %lu tokens to snapshot %s", tokens.size(), snapshotFile.c_str());
+
+	return true;
+}
+
+// Constructor
+MemToken::MemToken(const std::string& inBasePath, const std::string& inTokenDir)
+{
+	basePath = inBasePath;
+	tokenDir = inTokenDir;
+	tokenObject = new MemObject(this);
+	tokenMutex = MutexFactory::i()->getMutex();
+	valid = (tokenMutex != NULL) && tokenObject->isValid();
+
+	if (!valid) return;
+
+	TokenImages& tokens = images[basePath];
+	TokenImages::iterator image = tokens.find(tokenDir);
+
+	if (image == tokens.end())
+	{
+		DEBUG_MSG("Memory token %s does not exist", tokenDir.c_str());
+
+		valid = false;
+
+		return;
+	}
+
+	ByteString serialised((const unsigned char*) image->second.data(), image->second.size());
+	size_t pos = 0;
+
+	// The token object comes first, followed by the objects
+	if (!tokenObject->deserialise(serialised, pos))
+	{
+		ERROR_MSG("Corrupt memory token %s", tokenDir.c_str());
+
+		valid = false;
+
+		return;
+	}
+
+	while (pos < serialised.size())
+	{
+		MemObject* object = new MemObject(this);
+
+		allObjects.insert(object);
+
+		if (!object->deserialise(serialised, pos))
+		{
+			ERROR_MSG("Corrupt memory token %s", tokenDir.c_str());
+
+			valid = false;
+
+			return;
+		}
+
+		objects.insert(object);
+		objectIndex.addObject(object);
+	}
+
+	DEBUG_MSG("Opened memory token %s", tokenDir.c_str());
+}
+
+// Create a new token
+/*static*/ MemToken* MemToken::createToken(const std::string basePath, const std::string tokenDir, const ByteString& label, const ByteString& serial)
+{
+	TokenImages& tokens = images[basePath];
+
+	if (tokens.find(tokenDir) != tokens.end())
+	{
+		ERROR_MSG("Memory token %s already exists", tokenDir.c_str());
+
+		return NULL;
+	}
+
+	// Set the initial attributes
+	CK_ULONG flags =
+		CKF_RNG |
+		CKF_LOGIN_REQUIRED | // FIXME: check
+		CKF_RESTORE_KEY_NOT_NEEDED |
+		CKF_TOKEN_INITIALIZED |
+		CKF_SO_PIN_LOCKED |
+		CKF_SO_PIN_TO_BE_CHANGED;
+
+	MemObject tokenObject(NULL);
+
+	if (!tokenObject.setAttribute(CKA_OS_TOKENLABEL, label) ||
+	    !tokenObject.setAttribute(CKA_OS_TOKENSERIAL, serial) ||
+	    !tokenObject.setAttribute(CKA_OS_TOKENFLAGS, flags))
+	{
+		ERROR_MSG("Failed to set the token attributes");
+
+		return NULL;
+	}
+
+	ByteString serialised;
+
+	tokenObject.serialise(serialised);
+
+	tokens[tokenDir] = std::string((const char*) serialised.const_byte_str(), serialised.size());
+
+	DEBUG_MSG("Created new memory token %s", tokenDir.c_str());
+
+	return new MemToken(basePath, tokenDir);
+}
+
+// Access an existing token
+/*static*/ MemToken* MemToken::accessToken(const std::string &basePath, const std::string &tokenDir)
+{
+	return new MemToken(basePath, tokenDir);
+}
+
+// Enumerate the tokens in the given base path
+/*static*/ bool MemToken::findTokens(const std::string& basePath, std::vector<std::string>& tokenDirs)
+{
+	if (loadedPaths.find(basePath) == loadedPaths.end())
+	{
+		if (!snapshotFile.empty() && !loadSnapshot(basePath))
+		{
+			return false;
+		}
+
+		loadedPaths.insert(basePath);
+	}
+
+	TokenImages& tokens = images[basePath];
+
+	for (TokenImages::iterator i = tokens.begin(); i != tokens.end(); i++)
+	{
+		tokenDirs.push_back(i->first);
+	}
+
+	return true;
+}
+
+// Save the tokens in the given base path to the snapshot file
+/*static*/ void MemToken::closeTokens(const std::string& basePath)
+{
+	if (snapshotFile.empty()) return;
+
+	if (!saveSnapshot(basePath))
+	{
+		ERROR_MSG("The memory tokens in %s were not saved", basePath.c_str());
+	}
+}
+
+// Set the snapshot file
+/*static*/ void MemToken::setSnapshotFile(const std::string& path)
+{
+	snapshotFile = path;
+}
+
+// Destructor
+MemToken::~MemToken()
+{
+	// Store the token back into the image
+	if (valid)
+	{
+		ByteString serialised;
+
+		tokenObject->serialise(serialised);
+
+		for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+		{
+			((MemObject*) *i)->serialise(serialised);
+		}
+
+		images[basePath][tokenDir] = std::string((const char*) serialised.const_byte_str(), serialised.size());
+	}
+
+	// Clean up
+	std::set<OSObject*> cleanUp = allObjects;
+	allObjects.clear();
+
+	for (std::set<OSObject*>::iterator i = cleanUp.begin(); i != cleanUp.end(); i++)
+	{
+		delete *i;
+	}
+
+	MutexFactory::i()->recycleMutex(tokenMutex);
+	delete tokenObject;
+}
+
+// Set the SO PIN
+bool MemToken::setSOPIN(const ByteString& soPINBlob)
+{
+	if (!valid) return false;
+
+	OSAttribute soPIN(soPINBlob);
+
+	CK_ULONG flags;
+
+	if (tokenObject->setAttribute(CKA_OS_SOPIN, soPIN) &&
+	    getTokenFlags(flags))
+	{
+		flags &= ~CKF_SO_PIN_COUNT_LOW;
+		flags &= ~CKF_SO_PIN_FINAL_TRY;
+		flags &= ~CKF_SO_PIN_LOCKED;
+		flags &= ~CKF_SO_PIN_TO_BE_CHANGED;
+
+		return setTokenFlags(flags);
+	}
+
+	return false;
+}
+
+// Get the SO PIN
+bool MemToken::getSOPIN(ByteString& soPINBlob)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_SOPIN))
+	{
+		return false;
+	}
+
+	soPINBlob = tokenObject->getAttribute(CKA_OS_SOPIN).getByteStringValue();
+
+	return true;
+}
+
+// Set the user PIN
+bool MemToken::setUserPIN(ByteString userPINBlob)
+{
+	if (!valid) return false;
+
+	OSAttribute userPIN(userPINBlob);
+
+	CK_ULONG flags;
+
+	if (tokenObject->setAttribute(CKA_OS_USERPIN, userPIN) &&
+	    getTokenFlags(flags))
+	{
+		flags |= CKF_USER_PIN_INITIALIZED;
+		flags &= ~CKF_USER_PIN_COUNT_LOW;
+		flags &= ~CKF_USER_PIN_FINAL_TRY;
+		flags &= ~CKF_USER_PIN_LOCKED;
+		flags &= ~CKF_USER_PIN_TO_BE_CHANGED;
+
+		return setTokenFlags(flags);
+	}
+
+	return false;
+}
+
+// Get the user PIN
+bool MemToken::getUserPIN(ByteString& userPINBlob)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_USERPIN))
+	{
+		return false;
+	}
+
+	userPINBlob = tokenObject->getAttribute(CKA_OS_USERPIN).getByteStringValue();
+
+	return true;
+}
+
+// Retrieve the token label
+bool MemToken::getTokenLabel(ByteString& label)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_TOKENLABEL))
+	{
+		return false;
+	}
+
+	label = tokenObject->getAttribute(CKA_OS_TOKENLABEL).getByteStringValue();
+
+	return true;
+}
+
+// Retrieve the token serial
+bool MemToken::getTokenSerial(ByteString& serial)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_TOKENSERIAL))
+	{
+		return false;
+	}
+
+	serial = tokenObject->getAttribute(CKA_OS_TOKENSERIAL).getByteStringValue();
+
+	return true;
+}
+
+// Get the token flags
+bool MemToken::getTokenFlags(CK_ULONG& flags)
+{
+	if (!valid || !tokenObject->attributeExists(CKA_OS_TOKENFLAGS))
+	{
+		return false;
+	}
+
+	flags = tokenObject->getAttribute(CKA_OS_TOKENFLAGS).getUnsignedLongValue();
+
+	// Check if the user PIN is initialised
+	if (tokenObject->attributeExists(CKA_OS_USERPIN))
+	{
+		flags |= CKF_USER_PIN_INITIALIZED;
+	}
+
+	return true;
+}
+
+// Set the token flags
+bool MemToken::setTokenFlags(const CK_ULONG flags)
+{
+	if (!valid) return false;
+
+	OSAttribute tokenFlags(flags);
+
+	return tokenObject->setAttribute(CKA_OS_TOKENFLAGS, tokenFlags);
+}
+
+// Retrieve objects
+std::set<OSObject*> MemToken::getObjects()
+{
+	// Make sure that no other thread is in the process of changing
+	// the object list when we return it
+	MutexLocker lock(tokenMutex);
+
+	return objects;
+}
+
+void MemToken::getObjects(std::set<OSObject*> &inObjects)
+{
+	// Make sure that no other thread is in the process of changing
+	// the object list when we return it
+	MutexLocker lock(tokenMutex);
+
+	inObjects.insert(objects.begin(),objects.end());
+}
+
+// Insert the objects that may match the template into the given set
+void MemToken::findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects)
+{
+	if (objectIndex.findObjects(pTemplate, ulCount, inObjects)) return;
+
+	getObjects(inObjects);
+}
+
+// Create a new object
+OSObject* MemToken::createObject()
+{
+	if (!valid) return NULL;
+
+	MemObject* newObject = new MemObject(this);
+
+	if (!newObject->isValid())
+	{
+		ERROR_MSG("Failed to create new memory object");
+
+		delete newObject;
+
+		return NULL;
+	}
+
+	// Now add it to the set of objects
+	MutexLocker lock(tokenMutex);
+
+	objects.insert(newObject);
+	allObjects.insert(newObject);
+	objectIndex.addObject(newObject);
+
+	DEBUG_MSG("(0x%08X) Created new memory object (0x%08X)", this, newObject);
+
+	return newObject;
+}
+
+// Delete an object
+bool MemToken::deleteObject(OSObject* object)
+{
+	if (!valid) return false;
+
+	MutexLocker lock(tokenMutex);
+
+	if (objects.find(object) == objects.end())
+	{
+		ERROR_MSG("Cannot delete non-existent object 0x%08X", object);
+
+		return false;
+	}
+
+	MemObject* memObject = dynamic_cast<MemObject*>(object);
+	if (memObject == NULL)
+	{
+		ERROR_MSG("Object type not compatible with this token class 0x%08X", object);
+
+		return false;
+	}
+
+	// Invalidate the object instance
+	memObject->invalidate();
+
+	objects.erase(object);
+	objectIndex.removeObject(object);
+
+	DEBUG_MSG("Deleted memory object 0x%08X", object);
+
+	return true;
+}
+
+// Checks if the token is consistent
+bool MemToken::isValid()
+{
+	return valid;
+}
+
+// Invalidate the token (for instance if it is deleted)
+void MemToken::invalidate()
+{
+	valid = false;
+}
+
+// Delete the token
+bool MemToken::clearToken()
+{
+	MutexLocker lock(tokenMutex);
+
+	// Invalidate the token
+	invalidate();
+
+	// First, clear out all objects
+	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+	{
+		((MemObject*) *i)->invalidate();
+	}
+
+	objects.clear();
+	objectIndex.clear();
+
+	// Now remove the token from the image
+	images[basePath].erase(tokenDir);
+
+	DEBUG_MSG("Memory token %s was succesfully cleared", tokenDir.c_str());
+
+	return true;
+}
+
+// Reset the token
+bool MemToken::resetToken(const ByteString& label)
+{
+	CK_ULONG flags;
+
+	if (!getTokenFlags(flags))
+	{
+		ERROR_MSG("Failed to get the token attributes");
+
+		return false;
+	}
+
+	MutexLocker lock(tokenMutex);
+
+	// Clean up
+	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+	{
+		((MemObject*) *i)->invalidate();
+	}
+
+	objects.clear();
+	objectIndex.clear();
+
+	// The user PIN has been removed
+	flags &= ~CKF_USER_PIN_INITIALIZED;
+	flags &= ~CKF_USER_PIN_COUNT_LOW;
+	flags &= ~CKF_USER_PIN_FINAL_TRY;
+	flags &= ~CKF_USER_PIN_LOCKED;
+	flags &= ~CKF_USER_PIN_TO_BE_CHANGED;
+
+	// Set new token attributes
+	OSAttribute tokenLabel(label);
+	OSAttribute tokenFlags(flags);
+
+	if (!tokenObject->setAttribute(CKA_OS_TOKENLABEL, tokenLabel) ||
+	    !tokenObject->setAttribute(CKA_OS_TOKENFLAGS, tokenFlags))
+	{
+		ERROR_MSG("Failed to set the token attributes");
+
+		return false;
+	}
+
+	if (tokenObject->attributeExists(CKA_OS_USERPIN) &&
+	    !tokenObject->deleteAttribute(CKA_OS_USERPIN))
+	{
+		ERROR_MSG("Failed to remove USERPIN");
+
+		return false;
+	}
+
+	DEBUG_MSG("Memory token %s was succesfully reset", tokenDir.c_str());
+
+	return true;
+}
+
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MemToken.h
+
+ The token class for tokens that are kept in process memory. The contents of
+ the tokens survive C_Finalize/C_Initialize cycles within the same process
+ and can optionally be loaded from and saved to a snapshot file.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_MEMTOKEN_H
+#define _SOFTHSM_V2_MEMTOKEN_H
+
+#include "config.h"
+#include "ObjectStoreToken.h"
+#include "OSAttribute.h"
+#include "MemObject.h"
+#include "ObjectIndex.h"
+#include "MutexFactory.h"
+#include "cryptoki.h"
+#include <string>
+#include <set>
+#include <vector>
+
+class MemToken : public ObjectStoreToken
+{
+public:
+	// Create a new token
+	static MemToken* createToken(const std::string basePath, const std::string tokenDir, const ByteString& label, const ByteString& serial);
+
+	// Access an existing token
+	static MemToken* accessToken(const std::string &basePath, const std::string &tokenDir);
+
+	// Enumerate the tokens in the given base path; loads the snapshot
+	// file the first time the base path is used in this process
+	static bool findTokens(const std::string& basePath, std::vector<std::string>& tokenDirs);
+
+	// Save the tokens in the given base path to the snapshot file
+	static void closeTokens(const std::string& basePath);
+
+	// Set the snapshot file; an empty path disables snapshots
+	static void setSnapshotFile(const std::string& path);
+
+	// Set the SO PIN
+	virtual bool setSOPIN(const ByteString& soPINBlob);
+
+	// Get the SO PIN
+	virtual bool getSOPIN(ByteString& soPINBlob);
+
+	// Set the user PIN
+	virtual bool setUserPIN(ByteString userPINBlob);
+
+	// Get the user PIN
+	virtual bool getUserPIN(ByteString& userPINBlob);
+
+	// Get the token flags
+	virtual bool getTokenFlags(CK_ULONG& flags);
+
+	// Set the token flags
+	virtual bool setTokenFlags(const CK_ULONG flags);
+
+	// Retrieve the token label
+	virtual bool getTokenLabel(ByteString& label);
+
+	// Retrieve the token serial
+	virtual bool getTokenSerial(ByteString& serial);
+
+	// Retrieve objects
+	virtual std::set<OSObject*> getObjects();
+
+	// Insert objects into the given set
+	virtual void getObjects(std::set<OSObject*> &inObjects);
+
+	// Insert the objects that may match the template into the given set
+	virtual void findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects);
+
+	// Create a new object
+	virtual OSObject* createObject();
+
+	// Delete an object
+	virtual bool deleteObject(OSObject* object);
+
+	// Destructor; stores the contents of the token in the process image
+	virtual ~MemToken();
+
+	// Checks if the token is consistent
+	virtual bool isValid();
+
+	// Invalidate the token (for instance if it is deleted)
+	virtual void invalidate();
+
+	// Delete the token
+	virtual bool clearToken();
+
+	// Reset the token
+	virtual bool resetToken(const ByteString& label);
+
+private:
+	// MemObject instances report their changes to the index
+	friend class MemObject;
+
+	// Constructor
+	MemToken(const std::string& inBasePath, const std::string& inTokenDir);
+
+	// Is the token consistent and valid?
+	bool valid;
+
+	// The location of the token in the process image
+	std::string basePath;
+	std::string tokenDir;
+
+	// The current objects of the token
+	std::set<OSObject*> objects;
+
+	// All the objects ever associated with this token
+	std::set<OSObject*> allObjects;
+
+	// The index over the attributes the objects are searched by
+	ObjectIndex objectIndex;
+
+	// The token object
+	MemObject* tokenObject;
+
+	// For thread safeness
+	Mutex* tokenMutex;
+};
+
+#endif // !_SOFTHSM_V2_MEMTOKEN_H
+
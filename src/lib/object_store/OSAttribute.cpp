@@ -36,17 +36,52 @@
 // Copy constructor
 OSAttribute::OSAttribute(const OSAttribute& in)
 {
+	byteStrEntry = NULL;
+	mechSetEntry = NULL;
+
+	*this = in;
+}
+
+// Assignment; the byte string or mechanism type set value stays shared
+// with the copy, so copying an attribute does not copy its value
+OSAttribute& OSAttribute::operator=(const OSAttribute& in)
+{
+	if (this == &in) return *this;
+
+	release();
+
 	attributeType = in.attributeType;
 	boolValue = in.boolValue;
 	ulongValue = in.ulongValue;
-	byteStrValue = in.byteStrValue;
-	mechSetValue = in.mechSetValue;
 	attrMapValue = in.attrMapValue;
+
+	if (in.byteStrEntry != NULL)
+	{
+		AttributePool::i()->retain(in.byteStrEntry);
+		byteStrEntry = in.byteStrEntry;
+	}
+
+	if (in.mechSetEntry != NULL)
+	{
+		AttributePool::i()->retain(in.mechSetEntry);
+		mechSetEntry = in.mechSetEntry;
+	}
+
+	return *this;
+}
+
+// Destructor
+OSAttribute::~OSAttribute()
+{
+	release();
 }
 
 // Constructor for a boolean type attribute
 OSAttribute::OSAttribute(const bool value)
 {
+	byteStrEntry = NULL;
+	mechSetEntry = NULL;
+
 	boolValue = value;
 	attributeType = BOOL;
 
@@ -56,6 +91,9 @@ OSAttribute::OSAttribute(const bool value)
 // Constructor for an unsigned long type attribute
 OSAttribute::OSAttribute(const unsigned long value)
 {
+	byteStrEntry = NULL;
+	mechSetEntry = NULL;
+
 	ulongValue = value;
 	attributeType = ULONG;
 
@@ -65,7 +103,13 @@ OSAttribute::OSAttribute(const unsigned long value)
 // Constructor for a byte string type attribute
 OSAttribute::OSAttribute(const ByteString& value)
 {
-	byteStrValue = value;
+	byteStrEntry = NULL;
+	mechSetEntry = NULL;
+
+	if (value.size() != 0)
+	{
+		byteStrEntry = AttributePool::i()->share(value);
+	}
 	attributeType = BYTESTR;
 
 	boolValue = false;
@@ -75,7 +119,13 @@ OSAttribute::OSAttribute(const ByteString& value)
 // Constructor for a mechanism type set attribute
 OSAttribute::OSAttribute(const std::set<CK_MECHANISM_TYPE>& value)
 {
-	mechSetValue = value;
+	byteStrEntry = NULL;
+	mechSetEntry = NULL;
+
+	if (!value.empty())
+	{
+		mechSetEntry = AttributePool::i()->acquire(value);
+	}
 	attributeType = MECHSET;
 
 	boolValue = false;
@@ -85,6 +135,9 @@ OSAttribute::OSAttribute(const std::set<CK_MECHANISM_TYPE>& value)
 // Constructor for an attribute map type attribute
 OSAttribute::OSAttribute(const std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& value)
 {
+	byteStrEntry = NULL;
+	mechSetEntry = NULL;
+
 	attrMapValue = value;
 	attributeType = ATTRMAP;
 
@@ -131,12 +184,20 @@ unsigned long OSAttribute::getUnsignedLongValue() const
 
 const ByteString& OSAttribute::getByteStringValue() const
 {
-	return byteStrValue;
+	static const ByteString emptyValue;
+
+	if (byteStrEntry != NULL) return byteStrEntry->value;
+
+	return emptyValue;
 }
 
 const std::set<CK_MECHANISM_TYPE>& OSAttribute::getMechanismTypeSetValue() const
 {
-	return mechSetValue;
+	static const std::set<CK_MECHANISM_TYPE> emptySet;
+
+	if (mechSetEntry != NULL) return mechSetEntry->value;
+
+	return emptySet;
 }
 
 const std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& OSAttribute::getAttributeMapValue() const
@@ -164,13 +225,13 @@ bool OSAttribute::peekValue(ByteString& value) const
 			return true;
 
 		case BYTESTR:
-			value.resize(byteStrValue.size());
-			memcpy(&value[0], byteStrValue.const_byte_str(), value.size());
+			value.resize(getByteStringValue().size());
+			memcpy(&value[0], getByteStringValue().const_byte_str(), value.size());
 			return true;
 
 		case MECHSET:
-			value.resize(mechSetValue.size() * sizeof(mech));
-			for (std::set<CK_MECHANISM_TYPE>::const_iterator i = mechSetValue.begin(); i != mechSetValue.end(); ++i)
+			value.resize(getMechanismTypeSetValue().size() * sizeof(mech));
+			for (std::set<CK_MECHANISM_TYPE>::const_iterator i = getMechanismTypeSetValue().begin(); i != getMechanismTypeSetValue().end(); ++i)
 			{
 				mech = *i;
 				memcpy(&value[0] + counter * sizeof(mech), &mech, sizeof(mech));
@@ -185,3 +246,37 @@ bool OSAttribute::peekValue(ByteString& value) const
 			return false;
 	}
 }
+
+// Share the byte string value with identical values of other attributes;
+// the entry only shared with the copies of the attribute is released
+void OSAttribute::intern()
+{
+	if (attributeType == BYTESTR && byteStrEntry != NULL && !byteStrEntry->pooled)
+	{
+		AttributePool::ByteStringEntry* entry = AttributePool::i()->acquire(byteStrEntry->value);
+
+		release();
+		byteStrEntry = entry;
+	}
+}
+
+bool OSAttribute::isInterned() const
+{
+	return (byteStrEntry != NULL && byteStrEntry->pooled) || (mechSetEntry != NULL);
+}
+
+// Drop the reference to the shared value
+void OSAttribute::release()
+{
+	if (byteStrEntry != NULL)
+	{
+		AttributePool::i()->release(byteStrEntry);
+		byteStrEntry = NULL;
+	}
+
+	if (mechSetEntry != NULL)
+	{
+		AttributePool::i()->release(mechSetEntry);
+		mechSetEntry = NULL;
+	}
+}
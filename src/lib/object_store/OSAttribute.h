@@ -35,6 +35,7 @@
 
 #include "config.h"
 #include "ByteString.h"
+#include "AttributePool.h"
 #include <map>
 #include <set>
 
@@ -59,8 +60,11 @@ public:
 	// Constructor for an attribute map type attribute
 	OSAttribute(const std::map<CK_ATTRIBUTE_TYPE,OSAttribute>& value);
 
+	// Assignment
+	OSAttribute& operator=(const OSAttribute& in);
+
 	// Destructor
-	virtual ~OSAttribute() { }
+	virtual ~OSAttribute();
 
 	// Check the attribute type
 	bool isBooleanAttribute() const;
@@ -79,6 +83,11 @@ public:
 	// Helper for template (aka array) matching
 	bool peekValue(ByteString& value) const;
 
+	// Share the byte string value with identical values of other
+	// attributes; mechanism type sets are always shared
+	void intern();
+	bool isInterned() const;
+
 private:
 	// The attribute type
 	enum
@@ -94,9 +103,17 @@ private:
 	// The attribute value
 	bool boolValue;
 	unsigned long ulongValue;
-	ByteString byteStrValue;
-	std::set<CK_MECHANISM_TYPE> mechSetValue;
 	std::map<CK_ATTRIBUTE_TYPE,OSAttribute> attrMapValue;
+
+	// The byte string value, shared with the copies of the attribute or,
+	// when interned, with identical values; NULL for the empty value
+	AttributePool::ByteStringEntry* byteStrEntry;
+
+	// The mechanism type set value; NULL for the empty set
+	AttributePool::MechSetEntry* mechSetEntry;
+
+	// Drop the reference to the shared value
+	void release();
 };
 
 #endif // !_SOFTHSM_V2_OSATTRIBUTE_H
@@ -46,5 +46,11 @@
 #define CKA_OS_SOPIN		(CKA_VENDOR_SOFTHSM + 4)
 #define CKA_OS_USERPIN		(CKA_VENDOR_SOFTHSM + 5)
 
+// Vendor defined attribute type for the sealed key material of private objects
+#define CKA_OS_ENVELOPE		(CKA_VENDOR_SOFTHSM + 6)
+
+// Vendor defined attribute type for the random identifier the envelope is bound to
+#define CKA_OS_ENVELOPEID	(CKA_VENDOR_SOFTHSM + 7)
+
 #endif // !_SOFTHSM_V2_OSATTRIBUTES_H
 
@@ -37,7 +37,9 @@
 
 #include "config.h"
 #include "OSAttribute.h"
+#include "KeyUsage.h"
 #include "cryptoki.h"
+#include <string>
 
 class OSObject
 {
@@ -89,6 +91,16 @@ public:
 	// Destroys the object (warning, any pointers to the object are no longer
 	// valid after this call because delete is called!)
 	virtual bool destroyObject() = 0;
+
+	// Return an identifier of the object that stays the same across
+	// restarts; empty if the object is not stored persistently
+	virtual std::string getPersistentId() { return std::string(); }
+
+	// The usage counters of the object
+	KeyUsage* getUsage() { return &usage; }
+
+private:
+	KeyUsage usage;
 };
 
 #endif // !_SOFTHSM_V2_OSOBJECT_H
@@ -29,7 +29,8 @@
 
  The token class; a token is stored in a directory containing several files.
  Each object is stored in a separate file and a token object is present that
- has the token specific attributes
+ has the token specific attributes. With sharding, the object files are kept
+ in subdirectories named after the first two characters of their UUID
  *****************************************************************************/
 
 #include "config.h"
@@ -39,6 +40,8 @@
 #include "ObjectFile.h"
 #include "Directory.h"
 #include "Generation.h"
+#include "File.h"
+#include "FileSyncer.h"
 #include "UUID.h"
 #include "cryptoki.h"
 #include "OSToken.h"
@@ -49,6 +52,24 @@
 #include <map>
 #include <list>
 #include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Temporary files that were not modified for this many seconds were left
+// behind by a writer that did not finish
+#define STALE_TEMP_AGE	300
+
+// Store the objects of tokens in hashed subdirectories?
+bool OSToken::sharding = false;
+
+#ifdef HAVE_CXX11
+// The token on which the calling thread runs a batch, and the directories
+// of the objects that it has created in the batch so far
+static thread_local OSToken* batchToken = NULL;
+static thread_local size_t batchDepth = 0;
+static thread_local std::set<std::string> batchDirs;
+#endif
 
 // Constructor
 OSToken::OSToken(const std::string inTokenPath)
@@ -63,9 +84,20 @@ OSToken::OSToken(const std::string inTokenPath)
 
 	DEBUG_MSG("Opened token %s", tokenPath.c_str());
 
+	if (valid && sharding)
+	{
+		shardObjects();
+	}
+
 	index(true);
 }
 
+// Store the objects of tokens in hashed subdirectories
+/*static*/ void OSToken::setSharding(bool enabled)
+{
+	sharding = enabled;
+}
+
 // Create a new token
 /*static*/ OSToken* OSToken::createToken(const std::string basePath, const std::string tokenDir, const ByteString& label, const ByteString& serial)
 {
@@ -123,6 +155,13 @@ OSToken::OSToken(const std::string inTokenPath)
 		return NULL;
 	}
 
+	// Make the new token durable
+	if (!FileSyncer::i()->syncDirectory(basePath + OS_PATHSEP + tokenDir) ||
+	    !FileSyncer::i()->syncDirectory(basePath))
+	{
+		ERROR_MSG("Failed to sync the new token %s", tokenDir.c_str());
+	}
+
 	DEBUG_MSG("Created new token %s", tokenDir.c_str());
 
 	return new OSToken(basePath + OS_PATHSEP + tokenDir);
@@ -146,6 +185,11 @@ OSToken::~OSToken()
 		delete *i;
 	}
 
+	for (std::map<std::string, Directory*>::iterator i = shardDirs.begin(); i != shardDirs.end(); i++)
+	{
+		delete i->second;
+	}
+
 	delete tokenDir;
 	if (gen != NULL) delete gen;
 	MutexFactory::i()->recycleMutex(tokenMutex);
@@ -338,6 +382,18 @@ void OSToken::getObjects(std::set<OSObject*> &inObjects)
 	inObjects.insert(objects.begin(),objects.end());
 }
 
+// Insert the objects that may match the template into the given set
+void OSToken::findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects)
+{
+	index();
+
+	if (objectIndex.findObjects(pTemplate, ulCount, inObjects)) return;
+
+	MutexLocker lock(tokenMutex);
+
+	inObjects.insert(objects.begin(),objects.end());
+}
+
 // Create a new object
 OSObject* OSToken::createObject()
 {
@@ -345,8 +401,24 @@ OSObject* OSToken::createObject()
 
 	// Generate a name for the object
 	std::string objectUUID = UUID::newUUID();
-	std::string objectPath = tokenPath + OS_PATHSEP + objectUUID + ".object";
-	std::string lockPath = tokenPath + OS_PATHSEP + objectUUID + ".lock";
+	std::string objectDir;
+	std::string objectDirPath = tokenPath;
+
+	if (sharding)
+	{
+		MutexLocker lock(tokenMutex);
+
+		objectDir = shardOf(objectUUID);
+		objectDirPath = tokenPath + OS_PATHSEP + objectDir;
+
+		if (getShard(objectDir) == NULL)
+		{
+			return NULL;
+		}
+	}
+
+	std::string objectPath = objectDirPath + OS_PATHSEP + objectUUID + ".object";
+	std::string lockPath = objectDirPath + OS_PATHSEP + objectUUID + ".lock";
 
 	// Create the new object file
 	ObjectFile* newObject = new ObjectFile(this, objectPath, lockPath, true);
@@ -360,20 +432,112 @@ OSObject* OSToken::createObject()
 		return NULL;
 	}
 
-	// Now add it to the set of objects
-	MutexLocker lock(tokenMutex);
+	// Now add it to the set of objects; other processes are told about it
+	// once its file has been written (see publishObject)
+	{
+		MutexLocker lock(tokenMutex);
+
+		objects.insert(newObject);
+		allObjects.insert(newObject);
+		currentFiles[objectDir].insert(newObject->getFilename());
+		objectIndex.addObject(newObject);
+
+		DEBUG_MSG("(0x%08X) Created new object %s (0x%08X)", this, objectPath.c_str(), newObject);
+	}
+
+	return newObject;
+}
+
+// Announce an object file that was written for the first time
+void OSToken::publishObject(const std::string& objectPath)
+{
+#ifdef HAVE_CXX11
+	// Announced by endBatch
+	if (batchToken == this)
+	{
+		batchDirs.insert(objectPath.substr(0, objectPath.find_last_of(OS_PATHSEP)));
+
+		return;
+	}
+#endif
+
+	{
+		MutexLocker lock(tokenMutex);
+
+		gen->update();
+
+		gen->commit();
+	}
 
-	objects.insert(newObject);
-	allObjects.insert(newObject);
-	currentFiles.insert(newObject->getFilename());
+	// Make the new directory entry durable; this is done outside the token
+	// lock so that the syncs of concurrent object creations are coalesced.
+	// The generation file only signals changes to running processes and
+	// does not need to be synced.
+	std::string objectDirPath = objectPath.substr(0, objectPath.find_last_of(OS_PATHSEP));
 
-	DEBUG_MSG("(0x%08X) Created new object %s (0x%08X)", this, objectPath.c_str(), newObject);
+	if (!FileSyncer::i()->syncDirectory(objectDirPath))
+	{
+		ERROR_MSG("Failed to sync token directory %s", objectDirPath.c_str());
+	}
+}
+
+// Announce an object file that was written again; the indexes of other
+// processes only notice the change when the token generation changes
+void OSToken::publishChange()
+{
+	if (!ObjectIndex::isEnabled()) return;
+
+	MutexLocker lock(tokenMutex);
 
 	gen->update();
 
 	gen->commit();
+}
 
-	return newObject;
+// Start a batch; only the outermost batch of a thread is tracked
+void OSToken::beginBatch()
+{
+#ifdef HAVE_CXX11
+	if (batchToken == NULL)
+	{
+		batchToken = this;
+	}
+
+	if (batchToken == this)
+	{
+		batchDepth++;
+	}
+#endif
+}
+
+// End a batch and announce its objects with a single generation update
+void OSToken::endBatch()
+{
+#ifdef HAVE_CXX11
+	if (batchToken != this || --batchDepth > 0) return;
+
+	batchToken = NULL;
+
+	if (batchDirs.empty()) return;
+
+	{
+		MutexLocker lock(tokenMutex);
+
+		gen->update();
+
+		gen->commit();
+	}
+
+	for (std::set<std::string>::iterator i = batchDirs.begin(); i != batchDirs.end(); i++)
+	{
+		if (!FileSyncer::i()->syncDirectory(*i))
+		{
+			ERROR_MSG("Failed to sync token directory %s", i->c_str());
+		}
+	}
+
+	batchDirs.clear();
+#endif
 }
 
 // Delete an object
@@ -401,35 +565,89 @@ bool OSToken::deleteObject(OSObject* object)
 	// Invalidate the object instance
 	fileObject->invalidate();
 
-	// Retrieve the filename of the object
-	std::string objectFilename = fileObject->getFilename();
+	std::string objectDirPath = tokenPath;
 
-	// Attempt to delete the file
-	if (!tokenDir->remove(objectFilename))
+	if (currentFiles[""].find(fileObject->getFilename()) == currentFiles[""].end())
 	{
-		ERROR_MSG("Failed to delete object file %s", objectFilename.c_str());
+		objectDirPath += OS_PATHSEP + shardOf(fileObject->getFilename());
+	}
 
+	// Attempt to delete the files
+	if (!removeObjectFiles(fileObject))
+	{
 		return false;
 	}
 
-	// Retrieve the filename of the lock
+	objects.erase(object);
+	objectIndex.removeObject(object);
+
+	DEBUG_MSG("Deleted object %s", fileObject->getFilename().c_str());
+
+	gen->update();
+
+	gen->commit();
+
+	if (!FileSyncer::i()->syncDirectory(objectDirPath))
+	{
+		ERROR_MSG("Failed to sync token directory %s", objectDirPath.c_str());
+	}
+
+	return true;
+}
+
+// Delete the object file, the blob files and the lock file of an object
+bool OSToken::removeObjectFiles(ObjectFile* fileObject)
+{
+	// Objects that are not listed in the token directory itself are
+	// stored in their shard
+	std::string objectFilename = fileObject->getFilename();
 	std::string lockFilename = fileObject->getLockname();
+	Directory* dir = tokenDir;
 
-	// Attempt to delete the lock
-	if (!tokenDir->remove(lockFilename))
+	if (currentFiles[""].find(objectFilename) == currentFiles[""].end())
 	{
-		ERROR_MSG("Failed to delete lock file %s", lockFilename.c_str());
+		dir = getShard(shardOf(objectFilename));
+
+		if (dir == NULL)
+		{
+			return false;
+		}
+	}
+
+	// An object that was never stored has no file, but may have a lock
+	if (fileObject->isNew)
+	{
+		(void) dir->remove(lockFilename);
+
+		return true;
+	}
+
+	// Attempt to delete the file
+	if (!dir->remove(objectFilename))
+	{
+		ERROR_MSG("Failed to delete object file %s", objectFilename.c_str());
 
 		return false;
 	}
 
-	objects.erase(object);
+	// Delete the blobs of the object, which are stored next to it
+	std::vector<std::string> blobFilenames = fileObject->getBlobnames();
 
-	DEBUG_MSG("Deleted object %s", objectFilename.c_str());
+	for (std::vector<std::string>::iterator i = blobFilenames.begin(); i != blobFilenames.end(); i++)
+	{
+		if (!dir->remove(*i))
+		{
+			WARNING_MSG("Failed to delete blob file %s", i->c_str());
+		}
+	}
 
-	gen->update();
+	// Attempt to delete the lock
+	if (!dir->remove(lockFilename))
+	{
+		ERROR_MSG("Failed to delete lock file %s", lockFilename.c_str());
 
-	gen->commit();
+		return false;
+	}
 
 	return true;
 }
@@ -456,6 +674,7 @@ bool OSToken::clearToken()
 
 	// First, clear out all objects
 	objects.clear();
+	objectIndex.clear();
 
 	// Now, delete all files in the token directory
 	if (!tokenDir->refresh())
@@ -475,6 +694,34 @@ bool OSToken::clearToken()
 		}
 	}
 
+	// Delete the shards
+	std::vector<std::string> subDirs = tokenDir->getSubDirs();
+
+	for (std::vector<std::string>::iterator i = subDirs.begin(); i != subDirs.end(); i++)
+	{
+		if (!isShardName(*i)) continue;
+
+		Directory shardDir(tokenPath + OS_PATHSEP + *i);
+		std::vector<std::string> shardFiles = shardDir.getFiles();
+
+		for (std::vector<std::string>::iterator j = shardFiles.begin(); j != shardFiles.end(); j++)
+		{
+			if (!shardDir.remove(*j))
+			{
+				ERROR_MSG("Failed to remove %s from token directory %s", j->c_str(), tokenPath.c_str());
+
+				return false;
+			}
+		}
+
+		if (!tokenDir->rmdir(*i))
+		{
+			ERROR_MSG("Failed to remove %s from token directory %s", i->c_str(), tokenPath.c_str());
+
+			return false;
+		}
+	}
+
 	// Now remove the token directory
 	if (!tokenDir->rmdir(""))
 	{
@@ -518,31 +765,16 @@ bool OSToken::resetToken(const ByteString& label)
 		// Invalidate the object instance
 		fileObject->invalidate();
 
-		// Retrieve the filename of the object
-		std::string objectFilename = fileObject->getFilename();
-
-		// Attempt to delete the file
-		if (!tokenDir->remove(objectFilename))
+		// Attempt to delete the files
+		if (!removeObjectFiles(fileObject))
 		{
-			ERROR_MSG("Failed to delete object file %s", objectFilename.c_str());
-
-			return false;
-		}
-
-		// Retrieve the filename of the lock
-		std::string lockFilename = fileObject->getLockname();
-
-		// Attempt to delete the lock
-		if (!tokenDir->remove(lockFilename))
-		{
-			ERROR_MSG("Failed to delete lock file %s", lockFilename.c_str());
-
 			return false;
 		}
 
 		objects.erase(*i);
+		objectIndex.removeObject(*i);
 
-		DEBUG_MSG("Deleted object %s", objectFilename.c_str());
+		DEBUG_MSG("Deleted object %s", fileObject->getFilename().c_str());
 	}
 
 	// The user PIN has been removed
@@ -594,8 +826,10 @@ bool OSToken::index(bool isFirstTime /* = false */)
 		return true;
 	}
 
-	// Check the integrity
-	if (!tokenDir->refresh() || !tokenObject->valid)
+	// Check the integrity; the directory is only listed again if it was modified
+	bool changed;
+
+	if (!tokenDir->refreshIfChanged(changed) || !tokenObject->valid)
 	{
 		ERROR_MSG("Token integrity check failed");
 
@@ -606,86 +840,73 @@ bool OSToken::index(bool isFirstTime /* = false */)
 
 	DEBUG_MSG("Token %s has changed", tokenPath.c_str());
 
-	// Retrieve the directory listing
-	std::vector<std::string> tokenFiles = tokenDir->getFiles();
-
-	// Filter out the objects
-	std::set<std::string> newSet;
+	// Compute the changes compared to the last list of files, only looking
+	// at the directories that were modified
+	std::map<std::string, std::string> addedFiles;
+	std::set<std::string> removedFiles;
+	std::set<std::string> newShards;
 
-	for (std::vector<std::string>::iterator i = tokenFiles.begin(); i != tokenFiles.end(); i++)
+	if (changed || isFirstTime)
 	{
-		if ((i->size() > 7) &&
-		    (!(i->substr(i->size() - 7).compare(".object"))) &&
-		    (i->compare("token.object")))
-		{
-			newSet.insert(*i);
-		}
-		else
-		{
-			DEBUG_MSG("Ignored file %s", i->c_str());
-		}
-	}
+		indexFiles("", tokenDir->getFiles(), addedFiles, removedFiles);
 
-	// Compute the changes compared to the last list of files
-	std::set<std::string> addedFiles;
-	std::set<std::string> removedFiles;
+		// Pick up new shards and forget the ones that were removed
+		std::vector<std::string> subDirs = tokenDir->getSubDirs();
+		std::set<std::string> shardSet;
 
-	if (!isFirstTime)
-	{
-		// First compute which files were added
-		for (std::set<std::string>::iterator i = newSet.begin(); i != newSet.end(); i++)
+		for (std::vector<std::string>::iterator i = subDirs.begin(); i != subDirs.end(); i++)
 		{
-			if (currentFiles.find(*i) == currentFiles.end())
+			if (!isShardName(*i)) continue;
+
+			shardSet.insert(*i);
+
+			if (shardDirs.find(*i) == shardDirs.end())
 			{
-				addedFiles.insert(*i);
+				shardDirs[*i] = new Directory(tokenPath + OS_PATHSEP + *i);
+				newShards.insert(*i);
 			}
 		}
 
-		// Now compute which files were removed
-		for (std::set<std::string>::iterator i = currentFiles.begin(); i != currentFiles.end(); i++)
+		std::map<std::string, Directory*>::iterator i = shardDirs.begin();
+
+		while (i != shardDirs.end())
 		{
-			if (newSet.find(*i) == newSet.end())
+			if (shardSet.find(i->first) != shardSet.end())
 			{
-				removedFiles.insert(*i);
+				i++;
+
+				continue;
 			}
-		}
-	}
-	else
-	{
-		addedFiles = newSet;
-	}
 
-	currentFiles = newSet;
+			indexFiles(i->first, std::vector<std::string>(), addedFiles, removedFiles);
+			currentFiles.erase(i->first);
 
-	DEBUG_MSG("%d objects were added and %d objects were removed", addedFiles.size(), removedFiles.size());
-	DEBUG_MSG("Current directory set contains %d objects", currentFiles.size());
-
-	// Now update the set of objects
+			delete i->second;
+			shardDirs.erase(i++);
+		}
+	}
 
-	// Add new objects
-	for (std::set<std::string>::iterator i = addedFiles.begin(); i != addedFiles.end(); i++)
+	for (std::map<std::string, Directory*>::iterator i = shardDirs.begin(); i != shardDirs.end(); i++)
 	{
-		if ((i->find_last_of('.') == std::string::npos) ||
-		    (i->substr(i->find_last_of('.')) != ".object"))
+		bool shardChanged;
+
+		if (!i->second->refreshIfChanged(shardChanged))
 		{
-			continue;
+			// The shard is being removed
+			indexFiles(i->first, std::vector<std::string>(), addedFiles, removedFiles);
 		}
+		else if (shardChanged || newShards.find(i->first) != newShards.end())
+		{
+			indexFiles(i->first, i->second->getFiles(), addedFiles, removedFiles);
+		}
+	}
 
-		std::string lockName(*i);
-		lockName.replace(lockName.find_last_of('.'), std::string::npos, ".lock");
-
-		// Create a new token object for the added file
-		ObjectFile* newObject = new ObjectFile(this, tokenPath + OS_PATHSEP + *i, tokenPath + OS_PATHSEP + lockName);
+	DEBUG_MSG("%d objects were added and %d objects were removed", addedFiles.size(), removedFiles.size());
 
-		// Add the object, even invalid ones.
-		// This is so the we can read the attributes once
-		// the other process has finished writing to disc.
-		DEBUG_MSG("(0x%08X) New object %s (0x%08X) added", this, newObject->getFilename().c_str(), newObject);
-		objects.insert(newObject);
-		allObjects.insert(newObject);
-	}
+	// Now update the set of objects
 
-	// Remove deleted objects
+	// Remove deleted objects; an object that another process moved to
+	// another directory of the token keeps its instance
 	std::set<OSObject*> newObjects;
 
 	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
@@ -705,13 +926,62 @@ bool OSToken::index(bool isFirstTime /* = false */)
 			DEBUG_MSG("Adding object %s", fileObject->getFilename().c_str());
 			// This object gets to stay in the set
 			newObjects.insert(*i);
+
+			// Its index entries are stale if another process wrote it
+			if (ObjectIndex::isEnabled() && fileObject->generationChanged())
+			{
+				objectIndex.objectChanged(*i);
+			}
+		}
+		else if (addedFiles.find(fileObject->getFilename()) != addedFiles.end())
+		{
+			std::map<std::string, std::string>::iterator moved = addedFiles.find(fileObject->getFilename());
+			std::string dirPath = tokenPath;
+
+			if (!moved->second.empty())
+			{
+				dirPath += OS_PATHSEP + moved->second;
+			}
+
+			DEBUG_MSG("Moving object %s", fileObject->getFilename().c_str());
+
+			fileObject->relocate(dirPath + OS_PATHSEP + moved->first, dirPath + OS_PATHSEP + fileObject->getLockname());
+			addedFiles.erase(moved);
+
+			newObjects.insert(*i);
 		}
 		else
 		{
 			fileObject->invalidate();
+			objectIndex.removeObject(*i);
 		}
 	}
 
+	// Add new objects
+	for (std::map<std::string, std::string>::iterator i = addedFiles.begin(); i != addedFiles.end(); i++)
+	{
+		std::string dirPath = tokenPath;
+
+		if (!i->second.empty())
+		{
+			dirPath += OS_PATHSEP + i->second;
+		}
+
+		std::string lockName(i->first);
+		lockName.replace(lockName.find_last_of('.'), std::string::npos, ".lock");
+
+		// Create a new token object for the added file
+		ObjectFile* newObject = new ObjectFile(this, dirPath + OS_PATHSEP + i->first, dirPath + OS_PATHSEP + lockName);
+
+		// Add the object, even invalid ones.
+		// This is so the we can read the attributes once
+		// the other process has finished writing to disc.
+		DEBUG_MSG("(0x%08X) New object %s (0x%08X) added", this, newObject->getFilename().c_str(), newObject);
+		newObjects.insert(newObject);
+		allObjects.insert(newObject);
+		objectIndex.addObject(newObject);
+	}
+
 	// Set the new objects
 	objects = newObjects;
 
@@ -720,3 +990,237 @@ bool OSToken::index(bool isFirstTime /* = false */)
 	return true;
 }
 
+// Update the list of object files of one directory of the token and record
+// which files were added and removed
+void OSToken::indexFiles(const std::string& dirName, const std::vector<std::string>& files, std::map<std::string, std::string>& addedFiles, std::set<std::string>& removedFiles)
+{
+	// Filter out the objects
+	std::set<std::string> newSet;
+
+	for (std::vector<std::string>::const_iterator i = files.begin(); i != files.end(); i++)
+	{
+		if (isObjectFile(*i))
+		{
+			newSet.insert(*i);
+		}
+		else if ((i->size() > 4) && !i->compare(i->size() - 4, 4, ".tmp"))
+		{
+			sweepTempFile(dirName, *i);
+		}
+		else
+		{
+			DEBUG_MSG("Ignored file %s", i->c_str());
+		}
+	}
+
+	std::set<std::string>& current = currentFiles[dirName];
+
+	// First compute which files were added
+	for (std::set<std::string>::iterator i = newSet.begin(); i != newSet.end(); i++)
+	{
+		if (current.find(*i) == current.end())
+		{
+			addedFiles[*i] = dirName;
+		}
+	}
+
+	// Now compute which files were removed
+	for (std::set<std::string>::iterator i = current.begin(); i != current.end(); i++)
+	{
+		if (newSet.find(*i) == newSet.end())
+		{
+			removedFiles.insert(*i);
+		}
+	}
+
+	current.swap(newSet);
+}
+
+// Remove a temporary file that a writer left behind; files that are still
+// being written are recent, so only old ones are removed
+void OSToken::sweepTempFile(const std::string& dirName, const std::string& name)
+{
+	std::string filePath = tokenPath;
+
+	if (!dirName.empty())
+	{
+		filePath += OS_PATHSEP + dirName;
+	}
+
+	filePath += OS_PATHSEP + name;
+
+	struct stat s;
+
+	if ((stat(filePath.c_str(), &s) != 0) || (time(NULL) - s.st_mtime < STALE_TEMP_AGE))
+	{
+		return;
+	}
+
+	if (::remove(filePath.c_str()) == 0)
+	{
+		DEBUG_MSG("Removed stale temporary file %s", filePath.c_str());
+	}
+}
+
+// Is the name that of an object file?
+/*static*/ bool OSToken::isObjectFile(const std::string& name)
+{
+	return (name.size() > 7) &&
+	       (!(name.substr(name.size() - 7).compare(".object"))) &&
+	       (name.compare("token.object"));
+}
+
+// Is the name that of a shard subdirectory?
+/*static*/ bool OSToken::isShardName(const std::string& name)
+{
+	return (name.size() == 2) &&
+	       (isdigit((unsigned char) name[0]) || (name[0] >= 'a' && name[0] <= 'f')) &&
+	       (isdigit((unsigned char) name[1]) || (name[1] >= 'a' && name[1] <= 'f'));
+}
+
+// Return the shard subdirectory for an object file
+/*static*/ std::string OSToken::shardOf(const std::string& filename)
+{
+	return filename.substr(0, 2);
+}
+
+// Return the shard subdirectory, creating it if necessary
+Directory* OSToken::getShard(const std::string& shard)
+{
+	std::map<std::string, Directory*>::iterator i = shardDirs.find(shard);
+
+	if (i != shardDirs.end())
+	{
+		return i->second;
+	}
+
+	// Another process may have created the shard already
+	Directory* shardDir = new Directory(tokenPath + OS_PATHSEP + shard);
+
+	if (!shardDir->isValid())
+	{
+		delete shardDir;
+
+		if (!tokenDir->mkdir(shard))
+		{
+			ERROR_MSG("Failed to create shard %s of token %s", shard.c_str(), tokenPath.c_str());
+
+			return NULL;
+		}
+
+		if (!FileSyncer::i()->syncDirectory(tokenPath))
+		{
+			ERROR_MSG("Failed to sync token directory %s", tokenPath.c_str());
+		}
+
+		shardDir = new Directory(tokenPath + OS_PATHSEP + shard);
+
+		if (!shardDir->isValid())
+		{
+			delete shardDir;
+
+			return NULL;
+		}
+	}
+
+	// The next index lists the files of the new shard, since it has not
+	// been checked for changes yet
+	shardDirs[shard] = shardDir;
+
+	return shardDir;
+}
+
+// Move the objects stored in the token directory itself into shards
+void OSToken::shardObjects()
+{
+	// The generation file serves as the token-wide lock: processes that
+	// open the token at the same time migrate it one at a time, and the
+	// other processes only check the token for changes once it is done
+	File tokenLock(tokenPath + OS_PATHSEP + "generation", true, true, true, false);
+
+	if (!tokenLock.isValid() || !tokenLock.lock())
+	{
+		ERROR_MSG("Could not lock token %s to move its objects into shards", tokenPath.c_str());
+
+		return;
+	}
+
+	// Another process may have moved the objects while we waited
+	if (!tokenDir->refresh())
+	{
+		return;
+	}
+
+	std::vector<std::string> tokenFiles = tokenDir->getFiles();
+	std::set<std::string> usedShards;
+	size_t moved = 0;
+
+	// The blob files of an object are named after the object
+	std::map<std::string, std::vector<std::string> > blobFiles;
+
+	for (std::vector<std::string>::iterator i = tokenFiles.begin(); i != tokenFiles.end(); i++)
+	{
+		if ((i->size() > 5) && !i->substr(i->size() - 5).compare(".blob"))
+		{
+			blobFiles[i->substr(0, i->find('.'))].push_back(*i);
+		}
+	}
+
+	for (std::vector<std::string>::iterator i = tokenFiles.begin(); i != tokenFiles.end(); i++)
+	{
+		if (!isObjectFile(*i)) continue;
+
+		std::string shard = shardOf(*i);
+
+		if (!isShardName(shard) || getShard(shard) == NULL) continue;
+
+		std::string lockName(*i);
+		lockName.replace(lockName.find_last_of('.'), std::string::npos, ".lock");
+
+		// Move the lock and the blobs first, so the object is never
+		// without them
+		bool bOK = tokenDir->rename(lockName, shard + OS_PATHSEP + lockName);
+
+		std::vector<std::string>& blobs = blobFiles[i->substr(0, i->find('.'))];
+
+		for (std::vector<std::string>::iterator j = blobs.begin(); bOK && j != blobs.end(); j++)
+		{
+			bOK = tokenDir->rename(*j, shard + OS_PATHSEP + *j);
+		}
+
+		if (!bOK || !tokenDir->rename(*i, shard + OS_PATHSEP + *i))
+		{
+			ERROR_MSG("Failed to move object %s into shard %s", i->c_str(), shard.c_str());
+
+			continue;
+		}
+
+		usedShards.insert(shard);
+		moved++;
+	}
+
+	if (moved == 0) return;
+
+	INFO_MSG("Moved %u objects of token %s into shards", (unsigned int) moved, tokenPath.c_str());
+
+	// Make the new layout durable and tell other processes to index again
+	for (std::set<std::string>::iterator i = usedShards.begin(); i != usedShards.end(); i++)
+	{
+		if (!FileSyncer::i()->syncDirectory(tokenPath + OS_PATHSEP + *i))
+		{
+			ERROR_MSG("Failed to sync token directory %s", (tokenPath + OS_PATHSEP + *i).c_str());
+		}
+	}
+
+	if (!FileSyncer::i()->syncDirectory(tokenPath))
+	{
+		ERROR_MSG("Failed to sync token directory %s", tokenPath.c_str());
+	}
+
+	// The generation file is locked again for the update
+	tokenLock.unlock();
+
+	gen->update();
+
+	gen->commit();
+}
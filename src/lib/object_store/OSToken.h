@@ -29,7 +29,8 @@
 
  The token class; a token is stored in a directory containing several files.
  Each object is stored in a separate file and a token object is present that
- has the token specific attributes
+ has the token specific attributes. With sharding, the object files are kept
+ in subdirectories named after the first two characters of their UUID
  *****************************************************************************/
 
 #ifndef _SOFTHSM_V2_OSTOKEN_H
@@ -39,6 +40,7 @@
 #include "ObjectStoreToken.h"
 #include "OSAttribute.h"
 #include "ObjectFile.h"
+#include "ObjectIndex.h"
 #include "Directory.h"
 #include "Generation.h"
 #include "UUID.h"
@@ -48,6 +50,7 @@
 #include <set>
 #include <map>
 #include <list>
+#include <vector>
 
 class OSToken : public ObjectStoreToken
 {
@@ -94,12 +97,19 @@ public:
 	// Insert objects into the given set
 	virtual void getObjects(std::set<OSObject*> &inObjects);
 
+	// Insert the objects that may match the template into the given set
+	virtual void findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects);
+
 	// Create a new object
 	virtual OSObject* createObject();
 
 	// Delete an object
 	virtual bool deleteObject(OSObject* object);
 
+	// Announce the objects created by the calling thread once, at the end
+	virtual void beginBatch();
+	virtual void endBatch();
+
 	// Destructor
 	virtual ~OSToken();
 
@@ -115,6 +125,9 @@ public:
 	// Reset the token
 	virtual bool resetToken(const ByteString& label);
 
+	// Store the objects of tokens in hashed subdirectories
+	static void setSharding(bool enabled);
+
 private:
 	// ObjectFile instances can call the index() function
 	friend class ObjectFile;
@@ -122,6 +135,41 @@ private:
 	// Index the token
 	bool index(bool isFirstTime = false);
 
+	// Update the list of object files of one directory of the token and
+	// record which files were added and removed
+	void indexFiles(const std::string& dirName, const std::vector<std::string>& files, std::map<std::string, std::string>& addedFiles, std::set<std::string>& removedFiles);
+
+	// Remove a temporary file that a writer left behind
+	void sweepTempFile(const std::string& dirName, const std::string& name);
+
+	// Is the name that of an object file?
+	static bool isObjectFile(const std::string& name);
+
+	// Is the name that of a shard subdirectory?
+	static bool isShardName(const std::string& name);
+
+	// Return the shard subdirectory for an object file
+	static std::string shardOf(const std::string& filename);
+
+	// Return the shard subdirectory, creating it if necessary
+	Directory* getShard(const std::string& shard);
+
+	// Delete the object file, the blob files and the lock file of an object
+	bool removeObjectFiles(ObjectFile* fileObject);
+
+	// Announce an object file that was written for the first time
+	void publishObject(const std::string& objectPath);
+
+	// Announce an object file that was written again, if the objects are
+	// indexed
+	void publishChange();
+
+	// Move the objects stored in the token directory itself into shards
+	void shardObjects();
+
+	// Store the objects of tokens in hashed subdirectories?
+	static bool sharding;
+
 	// Is the token consistent and valid?
 	bool valid;
 
@@ -140,8 +188,15 @@ private:
 	// object outside of this class.
 	std::set<OSObject*> allObjects;
 
-	// The current list of files
-	std::set<std::string> currentFiles;
+	// The current list of object files per directory; the token
+	// directory itself is listed under the empty name
+	std::map<std::string, std::set<std::string> > currentFiles;
+
+	// The shard subdirectories of the token
+	std::map<std::string, Directory*> shardDirs;
+
+	// The index over the attributes the objects are searched by
+	ObjectIndex objectIndex;
 
 	// The token object
 	ObjectFile* tokenObject;
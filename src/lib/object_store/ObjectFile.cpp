@@ -32,8 +32,10 @@
 
 #include "config.h"
 #include "ObjectFile.h"
+#include "FileBuffer.h"
 #include "OSToken.h"
 #include "OSPathSep.h"
+#include "UUID.h"
 #ifndef _WIN32
 #include <unistd.h>
 #endif
@@ -47,9 +49,13 @@
 #define BYTESTR_ATTR			0x3
 #define ATTRMAP_ATTR			0x4
 #define MECHSET_ATTR			0x5
+#define BLOB_ATTR			0x6
+
+// Store large values in blob files from this size on?
+size_t ObjectFile::blobSize = 0;
 
 // Constructor
-ObjectFile::ObjectFile(OSToken* parent, std::string inPath, std::string inLockpath, bool isNew /* = false */)
+ObjectFile::ObjectFile(OSToken* parent, std::string inPath, std::string inLockpath, bool inIsNew /* = false */)
 {
 	path = inPath;
 	gen = Generation::create(path);
@@ -59,6 +65,7 @@ ObjectFile::ObjectFile(OSToken* parent, std::string inPath, std::string inLockpa
 	inTransaction = false;
 	transactionLockFile = NULL;
 	lockpath = inLockpath;
+	isNew = inIsNew;
 
 	if (!valid) return;
 
@@ -70,10 +77,9 @@ ObjectFile::ObjectFile(OSToken* parent, std::string inPath, std::string inLockpa
 	}
 	else
 	{
+		// The object file is written when the object is first stored,
+		// so other processes never see it without its attributes
 		DEBUG_MSG("Created new object %s", path.c_str());
-
-		// Create an empty object file
-		store();
 	}
 
 }
@@ -91,17 +97,78 @@ ObjectFile::~ObjectFile()
 	MutexFactory::i()->recycleMutex(objectMutex);
 }
 
+// Store large values in blob files from this size on
+/*static*/ void ObjectFile::setBlobSize(size_t inBlobSize)
+{
+	blobSize = inBlobSize;
+}
+
 // Check if the specified attribute exists
 bool ObjectFile::attributeExists(CK_ATTRIBUTE_TYPE type)
 {
 	MutexLocker lock(objectMutex);
 
-	return valid && (attributes[type] != NULL);
+	return valid && ((attributes[type] != NULL) || (blobs.find(type) != blobs.end()));
+}
+
+// Read the value of the attribute from its blob file if that has not been
+// done yet. The blob file is gone if another process wrote the object since
+// it was read; the object is then read again and the read is retried.
+void ObjectFile::loadBlob(CK_ATTRIBUTE_TYPE type)
+{
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		{
+			MutexLocker lock(objectMutex);
+
+			if (readBlob(type)) return;
+		}
+
+		refresh();
+	}
+
+	ERROR_MSG("Could not read the value of attribute 0x%08X of %s", type, path.c_str());
+}
+
+// Read the value of the attribute from its blob file; returns true if the
+// value is available or not in a blob file. Calling function must lock the
+// mutex.
+bool ObjectFile::readBlob(CK_ATTRIBUTE_TYPE type)
+{
+	if (attributes[type] != NULL) return true;
+
+	std::map<CK_ATTRIBUTE_TYPE, std::string>::iterator blob = blobs.find(type);
+
+	if (blob == blobs.end()) return true;
+
+	// Writers remove the blob files of the previous version under the
+	// lock file, which a transaction of this object holds already
+	File lockFile(lockpath, !inTransaction, !inTransaction, true, false);
+
+	if (!inTransaction && !lockFile.lock())
+	{
+		return false;
+	}
+
+	File blobFile(getDirname() + blob->second);
+	ByteString value;
+
+	if (!blobFile.isValid() || !blobFile.readByteString(value))
+	{
+		return false;
+	}
+
+	attributes[type] = new OSAttribute(value);
+	AttributePool::internAttribute(attributes, type);
+
+	return true;
 }
 
 // Retrieve the specified attribute
 OSAttribute ObjectFile::getAttribute(CK_ATTRIBUTE_TYPE type)
 {
+	loadBlob(type);
+
 	MutexLocker lock(objectMutex);
 
 	OSAttribute* attr = attributes[type];
@@ -116,6 +183,8 @@ OSAttribute ObjectFile::getAttribute(CK_ATTRIBUTE_TYPE type)
 
 bool ObjectFile::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
 {
+	loadBlob(type);
+
 	MutexLocker lock(objectMutex);
 
 	OSAttribute* attr = attributes[type];
@@ -138,6 +207,8 @@ bool ObjectFile::getBooleanValue(CK_ATTRIBUTE_TYPE type, bool val)
 
 unsigned long ObjectFile::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned long val)
 {
+	loadBlob(type);
+
 	MutexLocker lock(objectMutex);
 
 	OSAttribute* attr = attributes[type];
@@ -160,6 +231,8 @@ unsigned long ObjectFile::getUnsignedLongValue(CK_ATTRIBUTE_TYPE type, unsigned
 
 ByteString ObjectFile::getByteStringValue(CK_ATTRIBUTE_TYPE type)
 {
+	loadBlob(type);
+
 	MutexLocker lock(objectMutex);
 
 	ByteString val;
@@ -193,6 +266,14 @@ CK_ATTRIBUTE_TYPE ObjectFile::nextAttributeType(CK_ATTRIBUTE_TYPE type)
 	while ((n != attributes.end()) && (n->second == NULL))
 		++n;
 
+	// the values in blob files may not have been read yet
+	std::map<CK_ATTRIBUTE_TYPE, std::string>::iterator b = blobs.upper_bound(type);
+
+	if ((b != blobs.end()) && ((n == attributes.end()) || (b->first < n->first)))
+	{
+		return b->first;
+	}
+
 	// return type or CKA_CLASS (= 0)
 	if (n == attributes.end())
 	{
@@ -225,8 +306,12 @@ bool ObjectFile::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attribu
 		}
 
 		attributes[type] = new OSAttribute(attribute);
+		AttributePool::internAttribute(attributes, type);
+		dropBlob(type);
 	}
 
+	if (token != NULL) token->objectIndex.attributeChanged(this, type);
+
 	store();
 
 	return valid;
@@ -245,7 +330,7 @@ bool ObjectFile::deleteAttribute(CK_ATTRIBUTE_TYPE type)
 	{
 		MutexLocker lock(objectMutex);
 
-		if (attributes[type] == NULL)
+		if ((attributes[type] == NULL) && (blobs.find(type) == blobs.end()))
 		{
 			DEBUG_MSG("Cannot delete attribute that doesn't exist in object %s", path.c_str());
 
@@ -254,8 +339,11 @@ bool ObjectFile::deleteAttribute(CK_ATTRIBUTE_TYPE type)
 
 		delete attributes[type];
 		attributes.erase(type);
+		dropBlob(type);
 	}
 
+	if (token != NULL) token->objectIndex.attributeChanged(this, type);
+
 	store();
 
 	return valid;
@@ -269,6 +357,17 @@ bool ObjectFile::isValid()
 	return valid;
 }
 
+// Was the object written by another process since it was read? Unlike
+// refresh(), this does not read the object again.
+bool ObjectFile::generationChanged()
+{
+	MutexLocker lock(objectMutex);
+
+	if (isNew || inTransaction || (gen == NULL)) return false;
+
+	return gen->wasUpdated();
+}
+
 // Invalidate the object file externally; this method is normally
 // only called by the OSToken class in case an object file has
 // been deleted.
@@ -279,6 +378,30 @@ void ObjectFile::invalidate()
 	discardAttributes();
 }
 
+// Point the object at its files after another process moved them; the new
+// generation reads the object again on the next access
+void ObjectFile::relocate(const std::string& inPath, const std::string& inLockpath)
+{
+	MutexLocker lock(objectMutex);
+
+	Generation* newGen = Generation::create(inPath);
+
+	if (newGen == NULL)
+	{
+		valid = false;
+
+		return;
+	}
+
+	DEBUG_MSG("Object %s moved to %s", path.c_str(), inPath.c_str());
+
+	delete gen;
+
+	gen = newGen;
+	path = inPath;
+	lockpath = inLockpath;
+}
+
 // Refresh the object if necessary
 void ObjectFile::refresh(bool isFirstTime /* = false */)
 {
@@ -290,6 +413,14 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 		return;
 	}
 
+	// Check if the object was written to disk
+	if (isNew)
+	{
+		DEBUG_MSG("The object has not been stored yet");
+
+		return;
+	}
+
 	// Refresh the associated token if set
 	if (!isFirstTime && (token != NULL))
 	{
@@ -318,7 +449,23 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 
 	objectFile.lock();
 
-	if (objectFile.isEmpty())
+	// Read the whole object in one go and parse it from memory
+	ByteString contents;
+
+	if (!objectFile.readAll(contents))
+	{
+		DEBUG_MSG("Could not read object %s", path.c_str());
+
+		valid = false;
+
+		objectFile.unlock();
+
+		return;
+	}
+
+	objectFile.unlock();
+
+	if (contents.size() == 0)
 	{
 		DEBUG_MSG("Object %s is empty", path.c_str());
 
@@ -334,19 +481,23 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 
 	MutexLocker lock(objectMutex);
 
+	// The blob files belong to the version that is read now
+	blobs.clear();
+	staleBlobs.clear();
+
+	FileBuffer buffer(contents);
+
 	// Read back the generation number
 	unsigned long curGen;
 
-	if (!objectFile.readULong(curGen))
+	if (!buffer.readULong(curGen))
 	{
-		if (!objectFile.isEOF())
+		if (!buffer.isEOF())
 		{
 			DEBUG_MSG("Corrupt object file %s", path.c_str());
 
 			valid = false;
 
-			objectFile.unlock();
-
 			return;
 		}
 	}
@@ -356,14 +507,14 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 	}
 
 	// Read back the attributes
-	while (!objectFile.isEOF())
+	while (!buffer.isEOF())
 	{
 		unsigned long p11AttrType;
 		unsigned long osAttrType;
 
-		if (!objectFile.readULong(p11AttrType))
+		if (!buffer.readULong(p11AttrType))
 		{
-			if (objectFile.isEOF())
+			if (buffer.isEOF())
 			{
 				break;
 			}
@@ -372,132 +523,83 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 
 			valid = false;
 
-			objectFile.unlock();
-
 			return;
 		}
 
-		if (!objectFile.readULong(osAttrType))
+		if (!buffer.readULong(osAttrType))
 		{
 			DEBUG_MSG("Corrupt object file %s", path.c_str());
 
 			valid = false;
 
-			objectFile.unlock();
-
 			return;
 		}
 
 		// Depending on the type, read back the actual value
+		OSAttribute* attribute = NULL;
+
 		if (osAttrType == BOOLEAN_ATTR)
 		{
 			bool value;
 
-			if (!objectFile.readBool(value))
+			if (buffer.readBool(value))
 			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-				valid = false;
-
-				objectFile.unlock();
-
-				return;
-			}
-
-			if (attributes[p11AttrType] != NULL)
-			{
-				delete attributes[p11AttrType];
+				attribute = new OSAttribute(value);
 			}
-
-			attributes[p11AttrType] = new OSAttribute(value);
 		}
 		else if (osAttrType == ULONG_ATTR)
 		{
 			unsigned long value;
 
-			if (!objectFile.readULong(value))
-			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-				valid = false;
-
-				objectFile.unlock();
-
-				return;
-			}
-
-			if (attributes[p11AttrType] != NULL)
+			if (buffer.readULong(value))
 			{
-				delete attributes[p11AttrType];
+				attribute = new OSAttribute(value);
 			}
-
-			attributes[p11AttrType] = new OSAttribute(value);
 		}
 		else if (osAttrType == BYTESTR_ATTR)
 		{
 			ByteString value;
 
-			if (!objectFile.readByteString(value))
-			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-				valid = false;
-
-				objectFile.unlock();
-
-				return;
-			}
-
-			if (attributes[p11AttrType] != NULL)
+			if (buffer.readByteString(value))
 			{
-				delete attributes[p11AttrType];
+				attribute = new OSAttribute(value);
 			}
-
-			attributes[p11AttrType] = new OSAttribute(value);
 		}
 		else if (osAttrType == MECHSET_ATTR)
 		{
 			std::set<CK_MECHANISM_TYPE> value;
 
-			if (!objectFile.readMechanismTypeSet(value))
+			if (buffer.readMechanismTypeSet(value))
 			{
-				DEBUG_MSG("Corrupt object file %s", path.c_str());
-
-				valid = false;
-
-				objectFile.unlock();
-
-				return;
+				attribute = new OSAttribute(value);
 			}
+		}
+		else if (osAttrType == ATTRMAP_ATTR)
+		{
+			std::map<CK_ATTRIBUTE_TYPE,OSAttribute> value;
 
-			if (attributes[p11AttrType] != NULL)
+			if (buffer.readAttributeMap(value))
 			{
-				delete attributes[p11AttrType];
+				attribute = new OSAttribute(value);
 			}
-
-			attributes[p11AttrType] = new OSAttribute(value);
 		}
-		else if (osAttrType == ATTRMAP_ATTR)
+		else if (osAttrType == BLOB_ATTR)
 		{
-			std::map<CK_ATTRIBUTE_TYPE,OSAttribute> value;
+			ByteString name;
 
-			if (!objectFile.readAttributeMap(value))
+			if (!buffer.readByteString(name) || (name.size() == 0))
 			{
 				DEBUG_MSG("Corrupt object file %s", path.c_str());
 
 				valid = false;
 
-				objectFile.unlock();
-
 				return;
 			}
 
-			if (attributes[p11AttrType] != NULL)
-			{
-				delete attributes[p11AttrType];
-			}
+			// The value is read from the blob file when it is used
+			blobs[p11AttrType] = std::string((const char*) name.const_byte_str(), name.size());
 
-			attributes[p11AttrType] = new OSAttribute(value);
+			continue;
 		}
 		else
 		{
@@ -505,15 +607,36 @@ void ObjectFile::refresh(bool isFirstTime /* = false */)
 
 			valid = false;
 
-			objectFile.unlock();
+			return;
+		}
+
+		if (attribute == NULL)
+		{
+			DEBUG_MSG("Corrupt object file %s", path.c_str());
+
+			valid = false;
 
 			return;
 		}
+
+		std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator existing = attributes.find(p11AttrType);
+
+		if (existing != attributes.end())
+		{
+			delete existing->second;
+			existing->second = attribute;
+		}
+		else
+		{
+			attributes.insert(existing, std::pair<CK_ATTRIBUTE_TYPE, OSAttribute*>(p11AttrType, attribute));
+		}
 	}
 
-	objectFile.unlock();
+	AttributePool::internAttributes(attributes);
 
 	valid = true;
+
+	if (token != NULL) token->objectIndex.objectChanged(this);
 }
 
 // Common write part in store()
@@ -556,7 +679,8 @@ bool ObjectFile::writeAttributes(File &objectFile)
 
 	for (std::map<CK_ATTRIBUTE_TYPE, OSAttribute*>::iterator i = attributes.begin(); i != attributes.end(); i++)
 	{
-		if (i->second == NULL)
+		// Values that are still in their blob files are written below
+		if ((i->second == NULL) || (blobs.find(i->first) != blobs.end()))
 		{
 			continue;
 		}
@@ -600,6 +724,33 @@ bool ObjectFile::writeAttributes(File &objectFile)
 				return false;
 			}
 		}
+		else if (i->second->isByteStringAttribute() &&
+			 (blobSize != 0) &&
+			 (i->second->getByteStringValue().size() >= blobSize))
+		{
+			unsigned long osAttrType = BLOB_ATTR;
+			std::string name;
+
+			if (!writeBlob(i->second->getByteStringValue(), name))
+			{
+				DEBUG_MSG("Failed to write blob of object %s", path.c_str());
+
+				objectFile.unlock();
+
+				return false;
+			}
+
+			newBlobs[p11AttrType] = name;
+
+			if (!objectFile.writeULong(osAttrType) || !objectFile.writeString(name))
+			{
+				DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
+
+				objectFile.unlock();
+
+				return false;
+			}
+		}
 		else if (i->second->isByteStringAttribute())
 		{
 			unsigned long osAttrType = BYTESTR_ATTR;
@@ -652,11 +803,132 @@ bool ObjectFile::writeAttributes(File &objectFile)
 		}
 	}
 
+	for (std::map<CK_ATTRIBUTE_TYPE, std::string>::iterator i = blobs.begin(); i != blobs.end(); i++)
+	{
+		unsigned long p11AttrType = i->first;
+		unsigned long osAttrType = BLOB_ATTR;
+
+		if (!objectFile.writeULong(p11AttrType) ||
+		    !objectFile.writeULong(osAttrType) ||
+		    !objectFile.writeString(i->second))
+		{
+			DEBUG_MSG("Failed to write attribute to object %s", path.c_str());
+
+			objectFile.unlock();
+
+			return false;
+		}
+	}
+
 	objectFile.unlock();
 
 	return true;
 }
 
+// Write a value to a new blob file next to the object file; the blob is
+// named after the object, so it is stored in the same shard
+bool ObjectFile::writeBlob(const ByteString& value, std::string& name)
+{
+	std::string filename = getFilename();
+
+	name = filename.substr(0, filename.find_last_of('.')) + "." + UUID::newUUID() + ".blob";
+
+	File* blobFile = File::createTemp(getDirname() + name);
+
+	if (blobFile == NULL)
+	{
+		return false;
+	}
+
+	bool bOK = blobFile->writeByteString(value);
+
+	if (bOK && !blobFile->sync())
+	{
+		ERROR_MSG("Failed to sync blob %s", name.c_str());
+
+		bOK = false;
+	}
+
+	bOK = bOK && blobFile->publish();
+
+	delete blobFile;
+
+	return bOK;
+}
+
+// The value of the attribute is no longer in its blob file; the blob file
+// is removed once the object no longer refers to it
+void ObjectFile::dropBlob(CK_ATTRIBUTE_TYPE type)
+{
+	std::map<CK_ATTRIBUTE_TYPE, std::string>::iterator blob = blobs.find(type);
+
+	if (blob == blobs.end()) return;
+
+	staleBlobs.insert(blob->second);
+	blobs.erase(blob);
+}
+
+// Keep the new blob files and remove the unused ones if the object was
+// stored; otherwise remove the new blob files
+void ObjectFile::settleBlobs(bool stored)
+{
+	std::string dirname = getDirname();
+
+	if (stored)
+	{
+		for (std::map<CK_ATTRIBUTE_TYPE, std::string>::iterator i = newBlobs.begin(); i != newBlobs.end(); i++)
+		{
+			blobs[i->first] = i->second;
+		}
+
+		for (std::set<std::string>::iterator i = staleBlobs.begin(); i != staleBlobs.end(); i++)
+		{
+			(void) ::remove((dirname + *i).c_str());
+		}
+
+		staleBlobs.clear();
+	}
+	else
+	{
+		for (std::map<CK_ATTRIBUTE_TYPE, std::string>::iterator i = newBlobs.begin(); i != newBlobs.end(); i++)
+		{
+			(void) ::remove((dirname + i->second).c_str());
+		}
+	}
+
+	newBlobs.clear();
+}
+
+// Returns the file names of the blobs of the object
+std::vector<std::string> ObjectFile::getBlobnames()
+{
+	MutexLocker lock(objectMutex);
+
+	std::vector<std::string> names;
+
+	for (std::map<CK_ATTRIBUTE_TYPE, std::string>::iterator i = blobs.begin(); i != blobs.end(); i++)
+	{
+		names.push_back(i->second);
+	}
+
+	names.insert(names.end(), staleBlobs.begin(), staleBlobs.end());
+
+	return names;
+}
+
+// Returns the directory of the object, including the separator
+std::string ObjectFile::getDirname() const
+{
+	size_t sep = path.find_last_of(OS_PATHSEP);
+
+	if (sep == std::string::npos)
+	{
+		return std::string();
+	}
+
+	return path.substr(0, sep + 1);
+}
+
 // Write the object to background storage
 void ObjectFile::store(bool isCommit /* = false */)
 {
@@ -673,6 +945,22 @@ void ObjectFile::store(bool isCommit /* = false */)
 		return;
 	}
 
+	if (isNew)
+	{
+		storeNew(isCommit);
+
+		return;
+	}
+
+	// Keep the readers of the blob files out until the blob files of the
+	// previous version are removed; a transaction has locked it already
+	File lockFile(lockpath, false, !isCommit, true);
+
+	if (!isCommit)
+	{
+		lockFile.lock();
+	}
+
 	File objectFile(path, true, true, true, false);
 
 	if (!objectFile.isValid())
@@ -688,10 +976,11 @@ void ObjectFile::store(bool isCommit /* = false */)
 
 	if (!isCommit) {
 		MutexLocker lock(objectMutex);
-		File lockFile(lockpath, false, true, true);
 
 		if (!writeAttributes(objectFile))
 		{
+			settleBlobs(false);
+
 			valid = false;
 
 			return;
@@ -701,13 +990,128 @@ void ObjectFile::store(bool isCommit /* = false */)
 	{
 		if (!writeAttributes(objectFile))
 		{
+			settleBlobs(false);
+
 			valid = false;
 
 			return;
 		}
 	}
 
+	// Make the object durable; the blob files of the previous version are
+	// kept, since the object file on disk may still refer to them
+	if (!objectFile.sync())
+	{
+		ERROR_MSG("Failed to sync object %s", path.c_str());
+
+		if (!isCommit)
+		{
+			MutexLocker lock(objectMutex);
+
+			settleBlobs(false);
+		}
+		else
+		{
+			settleBlobs(false);
+		}
+
+		valid = false;
+
+		return;
+	}
+
+	// Only remove the blob files of the previous version now
+	if (!isCommit)
+	{
+		MutexLocker lock(objectMutex);
+
+		settleBlobs(true);
+	}
+	else
+	{
+		settleBlobs(true);
+	}
+
+	valid = true;
+
+	// Let the token announce the change outside the object lock
+	if (!isCommit && (token != NULL))
+	{
+		token->publishChange();
+	}
+}
+
+// Write a new object to a temporary file and publish it in one step
+void ObjectFile::storeNew(bool isCommit)
+{
+	File* objectFile = File::createTemp(path);
+
+	if (objectFile == NULL)
+	{
+		DEBUG_MSG("Cannot create object %s", path.c_str());
+
+		valid = false;
+
+		return;
+	}
+
+	objectFile->lock();
+
+	bool bOK;
+
+	if (!isCommit)
+	{
+		MutexLocker lock(objectMutex);
+		File lockFile(lockpath, false, true, true);
+
+		bOK = writeAttributes(*objectFile);
+	}
+	else
+	{
+		bOK = writeAttributes(*objectFile);
+	}
+
+	// Make the object durable before it becomes visible
+	if (bOK && !objectFile->sync())
+	{
+		ERROR_MSG("Failed to sync object %s", path.c_str());
+
+		bOK = false;
+	}
+
+	bOK = bOK && objectFile->publish();
+
+	delete objectFile;
+
+	if (!isCommit)
+	{
+		MutexLocker lock(objectMutex);
+
+		settleBlobs(bOK);
+	}
+	else
+	{
+		settleBlobs(bOK);
+	}
+
+	if (!bOK)
+	{
+		ERROR_MSG("Failed to create object %s", path.c_str());
+
+		valid = false;
+
+		return;
+	}
+
+	isNew = false;
 	valid = true;
+
+	// Let the token announce the object; this takes the token lock, which
+	// must not be taken while holding the object lock
+	if (!isCommit && (token != NULL))
+	{
+		token->publishObject(path);
+	}
 }
 
 // Discard the cached attributes
@@ -793,33 +1197,52 @@ bool ObjectFile::startTransaction(Access)
 // Commit an attribute transaction
 bool ObjectFile::commitTransaction()
 {
-	MutexLocker lock(objectMutex);
+	bool published;
 
-	if (!inTransaction)
 	{
-		return false;
-	}
+		MutexLocker lock(objectMutex);
 
-	if (transactionLockFile == NULL)
-	{
-		ERROR_MSG("Transaction lock file instance invalid!");
+		if (!inTransaction)
+		{
+			return false;
+		}
 
-		return false;
-	}
+		if (transactionLockFile == NULL)
+		{
+			ERROR_MSG("Transaction lock file instance invalid!");
+
+			return false;
+		}
 
-	// Special store case
-	store(true);
+		// Special store case
+		published = isNew;
 
-	if (!valid)
-	{
-		return false;
-	}
+		store(true);
 
-	transactionLockFile->unlock();
+		if (!valid)
+		{
+			return false;
+		}
 
-	delete transactionLockFile;
-	transactionLockFile = NULL;
-	inTransaction = false;
+		transactionLockFile->unlock();
+
+		delete transactionLockFile;
+		transactionLockFile = NULL;
+		inTransaction = false;
+	}
+
+	// Announce the object outside the object lock
+	if (token != NULL)
+	{
+		if (published)
+		{
+			token->publishObject(path);
+		}
+		else
+		{
+			token->publishChange();
+		}
+	}
 
 	return true;
 }
@@ -849,8 +1272,17 @@ bool ObjectFile::abortTransaction()
 		inTransaction = false;
 	}
 
-	// Force reload from disk
-	refresh(true);
+	// Force reload from disk; a new object is reset to empty
+	if (isNew)
+	{
+		discardAttributes();
+
+		if (token != NULL) token->objectIndex.objectChanged(this);
+	}
+	else
+	{
+		refresh(true);
+	}
 
 	return true;
 }
@@ -868,3 +1300,9 @@ bool ObjectFile::destroyObject()
 	return token->deleteObject(this);
 }
 
+// Return an identifier of the object that stays the same across restarts
+std::string ObjectFile::getPersistentId()
+{
+	return getFilename();
+}
+
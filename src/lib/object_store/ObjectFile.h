@@ -41,6 +41,8 @@
 #include "MutexFactory.h"
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 #include <time.h>
 #include "cryptoki.h"
 #include "OSObject.h"
@@ -57,6 +59,11 @@ public:
 	// Destructor
 	virtual ~ObjectFile();
 
+	// Byte string values of at least this size are stored in blob files of
+	// their own and only read when they are used; 0 (the default) keeps all
+	// values in the object file
+	static void setBlobSize(size_t inBlobSize);
+
 	// Check if the specified attribute exists
 	virtual bool attributeExists(CK_ATTRIBUTE_TYPE type);
 
@@ -83,6 +90,14 @@ public:
 	// been deleted.
 	void invalidate();
 
+	// Point the object at its files after another process moved them to
+	// another directory of the token; this method is only called by the
+	// OSToken class when it finds the object file in its new place.
+	void relocate(const std::string& inPath, const std::string& inLockpath);
+
+	// Was the object written by another process since it was read?
+	bool generationChanged();
+
 	// Returns the file name of the object
 	std::string getFilename() const;
 
@@ -109,6 +124,9 @@ public:
 	// call!
 	virtual bool destroyObject();
 
+	// The name of the object file identifies the object across restarts
+	virtual std::string getPersistentId();
+
 private:
 	// OSToken instances can read valid (vs calling IsValid() from index())
 	friend class OSToken;
@@ -119,9 +137,35 @@ private:
 	// Write the object to background storage
 	void store(bool isCommit = false);
 
+	// Write a new object to a temporary file and publish it in one step
+	void storeNew(bool isCommit);
+
 	// Store subroutine
 	bool writeAttributes(File &objectFile);
 
+	// Read the value of the attribute from its blob file if needed, reading
+	// the object again if the blob file was replaced
+	void loadBlob(CK_ATTRIBUTE_TYPE type);
+
+	// Read the value of the attribute from its blob file
+	bool readBlob(CK_ATTRIBUTE_TYPE type);
+
+	// Write a value to a new blob file
+	bool writeBlob(const ByteString& value, std::string& name);
+
+	// The value of the attribute is no longer in its blob file
+	void dropBlob(CK_ATTRIBUTE_TYPE type);
+
+	// Keep the new blob files and remove the unused ones if the object was
+	// stored; otherwise remove the new blob files
+	void settleBlobs(bool stored);
+
+	// Returns the file names of the blobs of the object
+	std::vector<std::string> getBlobnames();
+
+	// Returns the directory of the object, including the separator
+	std::string getDirname() const;
+
 	// Discard the cached attributes
 	void discardAttributes();
 
@@ -135,6 +179,19 @@ private:
 	// The object's raw attributes
 	std::map<CK_ATTRIBUTE_TYPE, OSAttribute*> attributes;
 
+	// The file names of the values that are stored in blob files; these
+	// values are only in the attributes above once they have been read
+	std::map<CK_ATTRIBUTE_TYPE, std::string> blobs;
+
+	// The blob files written by the current store
+	std::map<CK_ATTRIBUTE_TYPE, std::string> newBlobs;
+
+	// The blob files that are to be removed by the next store
+	std::set<std::string> staleBlobs;
+
+	// The size from which values are stored in blob files
+	static size_t blobSize;
+
 	// The object's validity state
 	bool valid;
 
@@ -144,6 +201,9 @@ private:
 	// Mutex object for thread-safeness
 	Mutex* objectMutex;
 
+	// Has the new object not been written to disk yet?
+	bool isNew;
+
 	// Is the object undergoing an attribute transaction?
 	bool inTransaction;
 	File* transactionLockFile;
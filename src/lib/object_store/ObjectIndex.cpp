@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectIndex.cpp
+
+ Hash index over the binary attributes that objects are searched by
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "ObjectIndex.h"
+#include "OSAttribute.h"
+
+// The attribute types that are indexed
+static const CK_ATTRIBUTE_TYPE indexedTypes[] =
+{
+	CKA_SUBJECT,
+	CKA_ISSUER,
+	CKA_SERIAL_NUMBER,
+	CKA_HASH_OF_SUBJECT_PUBLIC_KEY,
+	CKA_HASH_OF_ISSUER_PUBLIC_KEY,
+	CKA_ID
+};
+
+// Are the indexes of new tokens enabled?
+static bool static_enabled = false;
+
+// Constructor
+ObjectIndex::ObjectIndex()
+{
+	enabled = static_enabled;
+	indexMutex = MutexFactory::i()->getMutex();
+}
+
+// Destructor
+ObjectIndex::~ObjectIndex()
+{
+	MutexFactory::i()->recycleMutex(indexMutex);
+}
+
+// Enable/disable the indexes of new tokens
+/*static*/ void ObjectIndex::setEnabled(bool inEnabled)
+{
+	static_enabled = inEnabled;
+}
+
+/*static*/ bool ObjectIndex::isEnabled()
+{
+	return static_enabled;
+}
+
+// Is the attribute type indexed?
+/*static*/ bool ObjectIndex::isIndexed(CK_ATTRIBUTE_TYPE type)
+{
+	for (size_t i = 0; i < sizeof(indexedTypes) / sizeof(indexedTypes[0]); i++)
+	{
+		if (indexedTypes[i] == type) return true;
+	}
+
+	return false;
+}
+
+// Start tracking an object; it is read on the next search
+void ObjectIndex::addObject(OSObject* object)
+{
+	if (!enabled || object == NULL) return;
+
+	MutexLocker lock(indexMutex);
+
+	changed[object]++;
+}
+
+// Stop tracking an object
+void ObjectIndex::removeObject(OSObject* object)
+{
+	if (!enabled) return;
+
+	MutexLocker lock(indexMutex);
+
+	unlink(object);
+	changed.erase(object);
+}
+
+// Forget all objects
+void ObjectIndex::clear()
+{
+	if (!enabled) return;
+
+	MutexLocker lock(indexMutex);
+
+	indexed.clear();
+	buckets.clear();
+	unindexed.clear();
+	changed.clear();
+}
+
+// The attributes of the object were changed or reloaded
+void ObjectIndex::objectChanged(OSObject* object)
+{
+	if (!enabled) return;
+
+	MutexLocker lock(indexMutex);
+
+	// Objects that are not tracked (like the token object) are ignored
+	if (indexed.find(object) == indexed.end() &&
+	    unindexed.find(object) == unindexed.end() &&
+	    changed.find(object) == changed.end())
+	{
+		return;
+	}
+
+	changed[object]++;
+}
+
+// The attribute of the object was set or deleted
+void ObjectIndex::attributeChanged(OSObject* object, CK_ATTRIBUTE_TYPE type)
+{
+	if (!enabled) return;
+
+	if (type == CKA_PRIVATE || isIndexed(type))
+	{
+		objectChanged(object);
+	}
+}
+
+// Add the objects that may match the template to the set
+bool ObjectIndex::findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*>& candidates)
+{
+	if (!enabled) return false;
+
+	// Look for the indexed attributes in the template
+	std::vector<Key> keys;
+
+	for (CK_ULONG i = 0; i < ulCount; i++)
+	{
+		if (!isIndexed(pTemplate[i].type)) continue;
+
+		if (pTemplate[i].pValue == NULL_PTR && pTemplate[i].ulValueLen != 0) return false;
+
+		keys.push_back(Key(pTemplate[i].type, hash((const unsigned char*)pTemplate[i].pValue, pTemplate[i].ulValueLen)));
+	}
+
+	if (keys.empty()) return false;
+
+	update();
+
+	MutexLocker lock(indexMutex);
+
+	// Only the public objects in the smallest bucket can match
+	std::set<OSObject*>* bucket = NULL;
+	bool found = true;
+
+	for (std::vector<Key>::iterator i = keys.begin(); i != keys.end(); i++)
+	{
+		std::map<Key, std::set<OSObject*> >::iterator entry = buckets.find(*i);
+
+		if (entry == buckets.end())
+		{
+			found = false;
+
+			break;
+		}
+
+		if (bucket == NULL || entry->second.size() < bucket->size())
+		{
+			bucket = &entry->second;
+		}
+	}
+
+	if (found)
+	{
+		candidates.insert(bucket->begin(), bucket->end());
+	}
+
+	// The other objects could not be indexed
+	candidates.insert(unindexed.begin(), unindexed.end());
+
+	for (std::map<OSObject*, unsigned long>::iterator i = changed.begin(); i != changed.end(); i++)
+	{
+		candidates.insert(i->first);
+	}
+
+	return true;
+}
+
+// Compute the hash of a value (FNV-1a)
+/*static*/ unsigned long ObjectIndex::hash(const unsigned char* data, size_t len)
+{
+	unsigned long h = 2166136261UL;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= data[i];
+		h *= 16777619UL;
+	}
+
+	return h;
+}
+
+// Read the objects that changed again
+void ObjectIndex::update()
+{
+	std::map<OSObject*, unsigned long> toRead;
+
+	{
+		MutexLocker lock(indexMutex);
+
+		if (changed.empty()) return;
+
+		toRead = changed;
+	}
+
+	// The objects are read without holding the lock, since reading may
+	// refresh the object and its token, which report back to the index
+	for (std::map<OSObject*, unsigned long>::iterator i = toRead.begin(); i != toRead.end(); i++)
+	{
+		OSObject* object = i->first;
+		bool isPublic = object->isValid() && !object->getBooleanValue(CKA_PRIVATE, true);
+		std::vector<Key> keys;
+
+		if (isPublic)
+		{
+			for (size_t j = 0; j < sizeof(indexedTypes) / sizeof(indexedTypes[0]); j++)
+			{
+				if (!object->attributeExists(indexedTypes[j])) continue;
+
+				OSAttribute attr = object->getAttribute(indexedTypes[j]);
+
+				if (!attr.isByteStringAttribute()) continue;
+
+				const ByteString& value = attr.getByteStringValue();
+
+				keys.push_back(Key(indexedTypes[j], hash(value.const_byte_str(), value.size())));
+			}
+		}
+
+		MutexLocker lock(indexMutex);
+
+		// Skip objects that were removed, or changed again while they
+		// were being read
+		std::map<OSObject*, unsigned long>::iterator entry = changed.find(object);
+
+		if (entry == changed.end() || entry->second != i->second) continue;
+
+		changed.erase(entry);
+		unlink(object);
+
+		if (!isPublic)
+		{
+			unindexed.insert(object);
+
+			continue;
+		}
+
+		for (std::vector<Key>::iterator k = keys.begin(); k != keys.end(); k++)
+		{
+			buckets[*k].insert(object);
+		}
+
+		indexed[object].swap(keys);
+	}
+
+	DEBUG_MSG("Indexed %zu objects", toRead.size());
+}
+
+// Drop the keys of an object; the index must be locked
+void ObjectIndex::unlink(OSObject* object)
+{
+	unindexed.erase(object);
+
+	std::map<OSObject*, std::vector<Key> >::iterator entry = indexed.find(object);
+
+	if (entry == indexed.end()) return;
+
+	for (std::vector<Key>::iterator k = entry->second.begin(); k != entry->second.end(); k++)
+	{
+		std::map<Key, std::set<OSObject*> >::iterator bucket = buckets.find(*k);
+
+		if (bucket == buckets.end()) continue;
+
+		bucket->second.erase(object);
+
+		if (bucket->second.empty()) buckets.erase(bucket);
+	}
+
+	indexed.erase(entry);
+}
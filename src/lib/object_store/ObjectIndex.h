@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectIndex.h
+
+ Hash index over the large binary attributes that certificate stores are
+ searched by (CKA_SUBJECT, CKA_ISSUER and CKA_SERIAL_NUMBER, the public key
+ hashes and CKA_ID). The index maps the hash of a value to the objects that
+ hold it, so that C_FindObjectsInit only needs to match the objects in one
+ bucket instead of all objects of the token. Only public objects are
+ indexed; the values of private objects are encrypted and these objects are
+ always returned as candidates, as are objects that changed and have not
+ been read again yet. The caller still matches every candidate against the
+ template, so hash collisions are harmless.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OBJECTINDEX_H
+#define _SOFTHSM_V2_OBJECTINDEX_H
+
+#include "config.h"
+#include "OSObject.h"
+#include "MutexFactory.h"
+#include "cryptoki.h"
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+class ObjectIndex
+{
+public:
+	// Constructor; the index is enabled if indexing is enabled at this time
+	ObjectIndex();
+
+	// Destructor
+	virtual ~ObjectIndex();
+
+	// Enable/disable the indexes of the tokens created from now on;
+	// indexing is disabled by default
+	static void setEnabled(bool inEnabled);
+	static bool isEnabled();
+
+	// Is the attribute type indexed?
+	static bool isIndexed(CK_ATTRIBUTE_TYPE type);
+
+	// Start or stop tracking an object
+	void addObject(OSObject* object);
+	void removeObject(OSObject* object);
+
+	// Forget all objects
+	void clear();
+
+	// The attributes of the object were changed or reloaded
+	void objectChanged(OSObject* object);
+
+	// The attribute of the object was set or deleted
+	void attributeChanged(OSObject* object, CK_ATTRIBUTE_TYPE type);
+
+	// Add the objects that may match the template to the set; returns false
+	// if the index cannot narrow the search and all objects must be matched
+	bool findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*>& candidates);
+
+private:
+	// The attribute type and the hash of its value
+	typedef std::pair<CK_ATTRIBUTE_TYPE, unsigned long> Key;
+
+	// Compute the hash of a value
+	static unsigned long hash(const unsigned char* data, size_t len);
+
+	// Read the objects that changed again
+	void update();
+
+	// Drop the keys of an object
+	void unlink(OSObject* object);
+
+	// Is this index in use?
+	bool enabled;
+
+	// The keys of the indexed public objects
+	std::map<OSObject*, std::vector<Key> > indexed;
+
+	// The public objects by key
+	std::map<Key, std::set<OSObject*> > buckets;
+
+	// The private objects
+	std::set<OSObject*> unindexed;
+
+	// The objects that need to be read again, with the number of changes
+	// so that an object changed while it is being read is read once more
+	std::map<OSObject*, unsigned long> changed;
+
+	// Protects the index
+	Mutex* indexMutex;
+};
+
+#endif // !_SOFTHSM_V2_OBJECTINDEX_H
@@ -36,7 +36,6 @@
 #include "config.h"
 #include "log.h"
 #include "ObjectStore.h"
-#include "Directory.h"
 #include "ObjectStoreToken.h"
 #include "OSPathSep.h"
 #include "UUID.h"
@@ -52,18 +51,15 @@ ObjectStore::ObjectStore(std::string inStorePath)
 	MutexLocker lock(storeMutex);
 
 	// Find all tokens in the specified path
-	Directory storeDir(storePath);
+	std::vector<std::string> dirs;
 
-	if (!storeDir.isValid())
+	if (!ObjectStoreToken::findTokens(storePath, dirs))
 	{
 		WARNING_MSG("Failed to enumerate object store in %s", storePath.c_str());
 
 		return;
 	}
 
-	// Assume that all subdirectories are tokens
-	std::vector<std::string> dirs = storeDir.getSubDirs();
-
 	for (std::vector<std::string>::iterator i = dirs.begin(); i != dirs.end(); i++)
 	{
 		// Create a token instance
@@ -99,6 +95,8 @@ ObjectStore::~ObjectStore()
 		{
 			delete *i;
 		}
+
+		ObjectStoreToken::closeTokens(storePath);
 	}
 
 	MutexFactory::i()->recycleMutex(storeMutex);
@@ -33,6 +33,7 @@
 #include "config.h"
 #include "log.h"
 #include "ObjectStoreToken.h"
+#include "Directory.h"
 
 // OSToken is a concrete implementation of ObjectStoreToken base class.
 #include "OSToken.h"
@@ -42,11 +43,45 @@
 #include "DBToken.h"
 #endif
 
+// MemToken is a concrete implementation of ObjectStoreToken that keeps the objects in process memory.
+#include "MemToken.h"
+
+// ImageToken is a read-only token that is loaded from a token image.
+#include "ImageToken.h"
+
 typedef ObjectStoreToken* (*CreateToken)(const std::string , const std::string , const ByteString& , const ByteString& );
 typedef ObjectStoreToken* (*AccessToken)(const std::string &, const std::string &);
+typedef bool (*FindTokens)(const std::string &, std::vector<std::string> &);
+typedef void (*CloseTokens)(const std::string &);
+
+// The file and database backends keep each token in a subdirectory of the base path
+static bool findTokenDirs(const std::string &basePath, std::vector<std::string> &tokenDirs)
+{
+	Directory storeDir(basePath);
+
+	if (!storeDir.isValid())
+	{
+		return false;
+	}
+
+	// Assume that all subdirectories are tokens
+	std::vector<std::string> dirs = storeDir.getSubDirs();
+
+	tokenDirs.insert(tokenDirs.end(), dirs.begin(), dirs.end());
+
+	return true;
+}
+
+// Nothing needs to be done when the file and database tokens are closed
+static void closeTokenDirs(const std::string & /*basePath*/)
+{
+}
 
 static CreateToken static_createToken = reinterpret_cast<CreateToken>(OSToken::createToken);
 static AccessToken static_accessToken = reinterpret_cast<AccessToken>(OSToken::accessToken);
+static FindTokens static_findTokens = findTokenDirs;
+static CloseTokens static_closeTokens = closeTokenDirs;
+static bool static_readOnly = false;
 
 // Create a new token
 /*static*/ bool ObjectStoreToken::selectBackend(const std::string &backend)
@@ -55,14 +90,25 @@ static AccessToken static_accessToken = reinterpret_cast<AccessToken>(OSToken::a
 	{
 		static_createToken = reinterpret_cast<CreateToken>(OSToken::createToken);
 		static_accessToken = reinterpret_cast<AccessToken>(OSToken::accessToken);
+		static_findTokens = findTokenDirs;
+		static_closeTokens = closeTokenDirs;
 	}
 #ifdef HAVE_OBJECTSTORE_BACKEND_DB
 	else if (backend == "db")
 	{
 		static_createToken = reinterpret_cast<CreateToken>(DBToken::createToken);
 		static_accessToken = reinterpret_cast<AccessToken>(DBToken::accessToken);
+		static_findTokens = findTokenDirs;
+		static_closeTokens = closeTokenDirs;
 	}
 #endif
+	else if (backend == "memory")
+	{
+		static_createToken = reinterpret_cast<CreateToken>(MemToken::createToken);
+		static_accessToken = reinterpret_cast<AccessToken>(MemToken::accessToken);
+		static_findTokens = MemToken::findTokens;
+		static_closeTokens = MemToken::closeTokens;
+	}
 	else
 	{
 		ERROR_MSG("Unknown value (%s) for objectstore.backend in configuration", backend.c_str());
@@ -72,13 +118,82 @@ static AccessToken static_accessToken = reinterpret_cast<AccessToken>(OSToken::a
 	return true;
 }
 
+// Select whether all tokens are accessed read-only
+/*static*/ void ObjectStoreToken::setReadOnly(bool readOnly)
+{
+	static_readOnly = readOnly;
+}
+
+// Are all tokens accessed read-only?
+/*static*/ bool ObjectStoreToken::isReadOnly()
+{
+	return static_readOnly;
+}
+
 ObjectStoreToken* ObjectStoreToken::createToken(const std::string basePath, const std::string tokenDir, const ByteString& label, const ByteString& serial)
 {
+	if (static_readOnly)
+	{
+		ERROR_MSG("Cannot create a token in read-only mode");
+		return NULL;
+	}
+
 	return static_createToken(basePath,tokenDir,label,serial);
 }
 
 // Access an existing token
 /*static*/ ObjectStoreToken *ObjectStoreToken::accessToken(const std::string &basePath, const std::string &tokenDir)
+{
+	// A token image marks the token as read-only
+	if (ImageToken::hasImage(basePath, tokenDir))
+	{
+		return ImageToken::accessToken(basePath, tokenDir);
+	}
+
+	ObjectStoreToken* token = static_accessToken(basePath, tokenDir);
+
+	// In read-only mode, tokens without an image are copied once
+	if (static_readOnly && token->isValid())
+	{
+		ObjectStoreToken* copy = ImageToken::copyToken(token);
+
+		delete token;
+
+		return copy;
+	}
+
+	return token;
+}
+
+// Access an existing token in the selected backend, ignoring any token image
+/*static*/ ObjectStoreToken *ObjectStoreToken::accessBackendToken(const std::string &basePath, const std::string &tokenDir)
 {
 	return static_accessToken(basePath, tokenDir);
 }
+
+// Enumerate the tokens in the given base path
+/*static*/ bool ObjectStoreToken::findTokens(const std::string &basePath, std::vector<std::string> &tokenDirs)
+{
+	return static_findTokens(basePath, tokenDirs);
+}
+
+// Release the tokens in the given base path
+/*static*/ void ObjectStoreToken::closeTokens(const std::string &basePath)
+{
+	static_closeTokens(basePath);
+}
+
+// Insert the objects that may match the template into the given set
+void ObjectStoreToken::findObjects(CK_ATTRIBUTE_PTR, CK_ULONG, std::set<OSObject*> &objects)
+{
+	getObjects(objects);
+}
+
+// Group the objects created by the calling thread
+void ObjectStoreToken::beginBatch()
+{
+}
+
+void ObjectStoreToken::endBatch()
+{
+}
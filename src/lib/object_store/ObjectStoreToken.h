@@ -37,6 +37,7 @@
 #include "OSObject.h"
 #include <string>
 #include <set>
+#include <vector>
 
 class ObjectStoreToken
 {
@@ -44,12 +45,26 @@ public:
 	// Select the type of backend to use for storing token objects.
 	static bool selectBackend(const std::string& backend);
 
+	// Select whether all tokens are accessed read-only; tokens that have
+	// a token image are always accessed read-only
+	static void setReadOnly(bool readOnly);
+	static bool isReadOnly();
+
 	// Create a new token
 	static ObjectStoreToken* createToken(const std::string basePath, const std::string tokenDir, const ByteString& label, const ByteString& serial);
 
 	// Access an existing token
 	static ObjectStoreToken* accessToken(const std::string &basePath, const std::string &tokenDir);
 
+	// Access an existing token in the selected backend, ignoring any token image
+	static ObjectStoreToken* accessBackendToken(const std::string &basePath, const std::string &tokenDir);
+
+	// Enumerate the tokens in the given base path
+	static bool findTokens(const std::string &basePath, std::vector<std::string> &tokenDirs);
+
+	// Release the tokens in the given base path after their instances are gone
+	static void closeTokens(const std::string &basePath);
+
 	// Set the SO PIN
 	virtual bool setSOPIN(const ByteString& soPINBlob) = 0;
 
@@ -80,12 +95,22 @@ public:
 	// Insert objects into the given set
 	virtual void getObjects(std::set<OSObject*> &objects) = 0;
 
+	// Insert the objects that may match the template into the given set;
+	// tokens without an index insert all objects
+	virtual void findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &objects);
+
 	// Create a new object
 	virtual OSObject* createObject() = 0;
 
 	// Delete an object
 	virtual bool deleteObject(OSObject* object) = 0;
 
+	// Group the objects that the calling thread creates until the matching
+	// endBatch, so that the token can announce and sync them once; tokens
+	// that store each object on its own ignore this
+	virtual void beginBatch();
+	virtual void endBatch();
+
 	// Destructor
 	virtual ~ObjectStoreToken() {};
 
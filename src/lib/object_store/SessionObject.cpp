@@ -187,6 +187,9 @@ bool SessionObject::setAttribute(CK_ATTRIBUTE_TYPE type, const OSAttribute& attr
 	}
 
 	attributes[type] = new OSAttribute(attribute);
+	AttributePool::internAttribute(attributes, type);
+
+	if (parent != NULL) parent->objectIndex.attributeChanged(this, type);
 
 	return true;
 }
@@ -213,6 +216,8 @@ bool SessionObject::deleteAttribute(CK_ATTRIBUTE_TYPE type)
 	delete attributes[type];
 	attributes.erase(type);
 
+	if (parent != NULL) parent->objectIndex.attributeChanged(this, type);
+
 	return true;
 }
 
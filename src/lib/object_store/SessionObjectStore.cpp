@@ -93,6 +93,26 @@ void SessionObjectStore::getObjects(CK_SLOT_ID slotID, std::set<OSObject*> &inOb
 	}
 }
 
+void SessionObjectStore::findObjects(CK_SLOT_ID slotID, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects)
+{
+	std::set<OSObject*> candidates;
+
+	if (!objectIndex.findObjects(pTemplate, ulCount, candidates))
+	{
+		getObjects(slotID, inObjects);
+
+		return;
+	}
+
+	MutexLocker lock(storeMutex);
+
+	std::set<OSObject*>::iterator it;
+	for (it=candidates.begin(); it!=candidates.end(); ++it) {
+		if (((SessionObject*)*it)->hasSlotID(slotID))
+			inObjects.insert(*it);
+	}
+}
+
 // Create a new object
 SessionObject* SessionObjectStore::createObject(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, bool isPrivate)
 {
@@ -113,6 +133,7 @@ SessionObject* SessionObjectStore::createObject(CK_SLOT_ID slotID, CK_SESSION_HA
 
 	objects.insert(newObject);
 	allObjects.insert(newObject);
+	objectIndex.addObject(newObject);
 
 	DEBUG_MSG("(0x%08X) Created new object (0x%08X)", this, newObject);
 
@@ -135,6 +156,7 @@ bool SessionObjectStore::deleteObject(SessionObject* object)
 	object->invalidate();
 
 	objects.erase(object);
+	objectIndex.removeObject(object);
 
 	return true;
 }
@@ -155,6 +177,7 @@ void SessionObjectStore::sessionClosed(CK_SESSION_HANDLE hSession)
 			// remain valid but it will no longer be returned when the set of objects
 			// is requested
 			objects.erase(*i);
+			objectIndex.removeObject(*i);
 		}
     }
 }
@@ -173,6 +196,7 @@ void SessionObjectStore::allSessionsClosed(CK_SLOT_ID slotID)
 			// remain valid but it will no longer be returned when the set of objects
 			// is requested
 			objects.erase(*i);
+			objectIndex.removeObject(*i);
 		}
 	}
 }
@@ -191,6 +215,7 @@ void SessionObjectStore::tokenLoggedOut(CK_SLOT_ID slotID)
 			// remain valid but it will no longer be returned when the set of objects
 			// is requested
 			objects.erase(*i);
+			objectIndex.removeObject(*i);
 		}
 	}
 }
@@ -201,6 +226,7 @@ void SessionObjectStore::clearStore()
 	MutexLocker lock(storeMutex);
 
 	objects.clear();
+	objectIndex.clear();
 	std::set<SessionObject*> clearObjects = allObjects;
 	allObjects.clear();
 
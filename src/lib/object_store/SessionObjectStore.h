@@ -38,6 +38,7 @@
 #include "config.h"
 #include "OSAttribute.h"
 #include "SessionObject.h"
+#include "ObjectIndex.h"
 #include "MutexFactory.h"
 #include "cryptoki.h"
 #include <string>
@@ -58,6 +59,10 @@ public:
 	// Insert the session objects for the given slotID into the given OSObject set
 	void getObjects(CK_SLOT_ID slotID, std::set<OSObject*> &inObjects);
 
+	// Insert the session objects for the given slotID that may match the
+	// template into the given OSObject set
+	void findObjects(CK_SLOT_ID slotID, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject*> &inObjects);
+
 	// Create a new object
 	SessionObject* createObject(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, bool isPrivate = false);
 
@@ -83,6 +88,9 @@ public:
 	void clearStore();
 
 private:
+	// SessionObject instances report their changes to the index
+	friend class SessionObject;
+
 	// The current objects in the store
 	std::set<SessionObject*> objects;
 
@@ -92,6 +100,9 @@ private:
 	// The current list of files
 	std::set<std::string> currentFiles;
 
+	// The index over the attributes the objects are searched by
+	ObjectIndex objectIndex;
+
 	// For thread safeness
 	Mutex* storeMutex;
 };
@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ UsageStore.cpp
+
+ Saves the usage counters of the token objects to a side file
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "UsageStore.h"
+#include "ObjectStoreToken.h"
+#include "File.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_CXX11
+#include <chrono>
+#endif
+
+// Constructor
+UsageStore::UsageStore(const std::string& inPath, ObjectStore* inObjectStore, unsigned long inInterval)
+{
+	path = inPath;
+	objectStore = inObjectStore;
+	interval = inInterval;
+	savedMutex = MutexFactory::i()->getMutex();
+	saveMutex = MutexFactory::i()->getMutex();
+	changed = false;
+
+#ifdef HAVE_CXX11
+	stopping = false;
+
+	if (interval > 0)
+	{
+		saver = std::thread(&UsageStore::run, this);
+	}
+#endif
+}
+
+// Destructor
+UsageStore::~UsageStore()
+{
+#ifdef HAVE_CXX11
+	{
+		std::lock_guard<std::mutex> lock(stopMutex);
+		stopping = true;
+	}
+	stopSignal.notify_all();
+
+	if (saver.joinable())
+	{
+		saver.join();
+	}
+#endif
+
+	save();
+
+	MutexFactory::i()->recycleMutex(saveMutex);
+	MutexFactory::i()->recycleMutex(savedMutex);
+}
+
+// Load the counters saved by an earlier run
+bool UsageStore::load()
+{
+	std::map<std::string, Entry> entries;
+
+	if (!readEntries(path, entries)) return false;
+
+	MutexLocker lock(savedMutex);
+
+	for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end(); it++)
+	{
+		saved[it->first] = it->second;
+	}
+
+	return true;
+}
+
+// Read the counters in the file
+/*static*/ bool UsageStore::readEntries(const std::string& path, std::map<std::string, Entry>& entries)
+{
+	FILE* fp = fopen(path.c_str(), "r");
+
+	if (fp == NULL)
+	{
+		// Nothing has been saved yet
+		if (errno == ENOENT) return true;
+
+		ERROR_MSG("Could not open the usage file %s: %s", path.c_str(), strerror(errno));
+
+		return false;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (line[0] == '#' || line[0] == '\n') continue;
+
+		char serial[256];
+		char id[256];
+		Entry entry;
+		long long lastUsed;
+
+		if (sscanf(line, "%255s %255s %llu %llu %llu %llu %llu %llu %llu %lld",
+		           serial, id,
+		           &entry.counts[KeyUsage::Sign], &entry.counts[KeyUsage::Verify],
+		           &entry.counts[KeyUsage::Encrypt], &entry.counts[KeyUsage::Decrypt],
+		           &entry.counts[KeyUsage::Derive], &entry.counts[KeyUsage::Wrap],
+		           &entry.counts[KeyUsage::Unwrap], &lastUsed) != 10)
+		{
+			WARNING_MSG("Skipping an invalid line in the usage file %s", path.c_str());
+
+			continue;
+		}
+
+		entry.lastUsed = (time_t)lastUsed;
+
+		entries[std::string(serial) + " " + id] = entry;
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+// Add the saved counters of the object to its usage counters
+void UsageStore::seed(const ByteString& serial, OSObject* object)
+{
+	KeyUsage* usage = object->getUsage();
+
+	if (usage->isSeeded()) return;
+
+	std::string id = object->getPersistentId();
+
+	// Seeding under the lock makes sure that the saved counters are added
+	// by whichever thread gets here first
+	MutexLocker lock(savedMutex);
+
+	if (usage->isSeeded()) return;
+
+	std::map<std::string, Entry>::iterator it = saved.end();
+
+	if (!id.empty())
+	{
+		it = saved.find(makeKey(serial, id));
+	}
+
+	if (it == saved.end())
+	{
+		usage->seed(NULL, 0);
+
+		if (!id.empty()) synced[makeKey(serial, id)] = Entry();
+
+		return;
+	}
+
+	usage->seed(it->second.counts, it->second.lastUsed);
+
+	// The saved counters are on disk already
+	synced[it->first] = it->second;
+	saved.erase(it);
+}
+
+// Note that a counter has changed since the last save
+void UsageStore::setChanged()
+{
+#ifdef HAVE_CXX11
+	if (!changed.load(std::memory_order_relaxed))
+	{
+		changed.store(true, std::memory_order_relaxed);
+	}
+#else
+	changed = true;
+#endif
+}
+
+// Save the counters of all token objects. Other processes may save to the
+// same file; under the lock the counters on disk are read back and only the
+// uses counted since the last save are added to them.
+bool UsageStore::save()
+{
+	MutexLocker saveLock(saveMutex);
+
+#ifdef HAVE_CXX11
+	if (!changed.exchange(false)) return true;
+#else
+	if (!changed) return true;
+	changed = false;
+#endif
+
+	std::string lockPath = path + ".lock";
+	File lockFile(lockPath, false, true, true);
+
+	if (!lockFile.isValid() || !lockFile.lock())
+	{
+		ERROR_MSG("Could not lock the usage file %s", path.c_str());
+
+		setChanged();
+
+		return false;
+	}
+
+	std::map<std::string, Entry> onDisk;
+
+	if (!readEntries(path, onDisk))
+	{
+		setChanged();
+
+		return false;
+	}
+
+	// Write to a new file of our own and replace the file with it
+	std::string tmpPath = path + ".XXXXXX";
+	std::vector<char> tmpName(tmpPath.begin(), tmpPath.end());
+	tmpName.push_back('\0');
+	FILE* fp = NULL;
+
+#ifndef _WIN32
+	int fd = mkstemp(&tmpName[0]);
+
+	if (fd != -1)
+	{
+		fp = fdopen(fd, "w");
+
+		if (fp == NULL)
+		{
+			close(fd);
+			remove(&tmpName[0]);
+		}
+	}
+#else
+	if (_mktemp_s(&tmpName[0], tmpName.size()) == 0)
+	{
+		fp = fopen(&tmpName[0], "wx");
+	}
+#endif
+
+	tmpPath = &tmpName[0];
+
+	if (fp == NULL)
+	{
+		ERROR_MSG("Could not create the usage file %s: %s", tmpPath.c_str(), strerror(errno));
+
+		setChanged();
+
+		return false;
+	}
+
+	fprintf(fp, "# serial id sign verify encrypt decrypt derive wrap unwrap lastused\n");
+
+	// The counters of the objects of the tokens that are present, and the
+	// values they had when they were written
+	std::set<std::string> serials;
+	std::map<std::string, Entry> written;
+
+	for (size_t i = 0; i < objectStore->getTokenCount(); i++)
+	{
+		ObjectStoreToken* token = objectStore->getToken(i);
+		ByteString serial;
+
+		if (token == NULL || !token->getTokenSerial(serial) || serial.size() == 0) continue;
+
+		std::string serialStr = serial.hex_str();
+		serials.insert(serialStr);
+
+		std::set<OSObject*> objects;
+		token->getObjects(objects);
+
+		for (std::set<OSObject*>::iterator it = objects.begin(); it != objects.end(); it++)
+		{
+			std::string id = (*it)->getPersistentId();
+
+			if (id.empty()) continue;
+
+			seed(serial, *it);
+
+			std::string key = makeKey(serial, id);
+			KeyUsage* usage = (*it)->getUsage();
+			Entry current;
+
+			for (int op = 0; op < KeyUsage::OperationCount; op++)
+			{
+				current.counts[op] = usage->getCount((KeyUsage::Operation) op);
+			}
+			current.lastUsed = usage->getLastUsed();
+
+			// Add the uses since the last save to the counters on disk
+			Entry entry;
+			{
+				MutexLocker lock(savedMutex);
+
+				const Entry& last = synced[key];
+				std::map<std::string, Entry>::iterator disk = onDisk.find(key);
+				const Entry& base = (disk != onDisk.end()) ? disk->second : last;
+
+				for (int op = 0; op < KeyUsage::OperationCount; op++)
+				{
+					entry.counts[op] = base.counts[op] + current.counts[op] - last.counts[op];
+				}
+				entry.lastUsed = (base.lastUsed > current.lastUsed) ? base.lastUsed : current.lastUsed;
+			}
+
+			written[key] = current;
+
+			unsigned long long total = 0;
+			for (int op = 0; op < KeyUsage::OperationCount; op++)
+			{
+				total += entry.counts[op];
+			}
+
+			if (total == 0) continue;
+
+			fprintf(fp, "%s %llu %llu %llu %llu %llu %llu %llu %lld\n",
+			        key.c_str(),
+			        entry.counts[KeyUsage::Sign], entry.counts[KeyUsage::Verify],
+			        entry.counts[KeyUsage::Encrypt], entry.counts[KeyUsage::Decrypt],
+			        entry.counts[KeyUsage::Derive], entry.counts[KeyUsage::Wrap],
+			        entry.counts[KeyUsage::Unwrap], (long long)entry.lastUsed);
+		}
+	}
+
+	// The counters of tokens that are not present are kept; those of the
+	// tokens that are present belong to objects that have been deleted
+	for (std::map<std::string, Entry>::iterator it = onDisk.begin(); it != onDisk.end(); it++)
+	{
+		std::string serialStr = it->first.substr(0, it->first.find(' '));
+
+		if (serials.find(serialStr) != serials.end()) continue;
+
+		const Entry& entry = it->second;
+
+		fprintf(fp, "%s %llu %llu %llu %llu %llu %llu %llu %lld\n",
+		        it->first.c_str(),
+		        entry.counts[KeyUsage::Sign], entry.counts[KeyUsage::Verify],
+		        entry.counts[KeyUsage::Encrypt], entry.counts[KeyUsage::Decrypt],
+		        entry.counts[KeyUsage::Derive], entry.counts[KeyUsage::Wrap],
+		        entry.counts[KeyUsage::Unwrap], (long long)entry.lastUsed);
+	}
+
+	bool ok = (fflush(fp) == 0);
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		ERROR_MSG("Could not write the usage file %s: %s", tmpPath.c_str(), strerror(errno));
+
+		remove(tmpPath.c_str());
+		setChanged();
+
+		return false;
+	}
+
+#ifdef _WIN32
+	// Windows does not replace an existing file on rename
+	remove(path.c_str());
+#endif
+
+	if (rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		ERROR_MSG("Could not replace the usage file %s: %s", path.c_str(), strerror(errno));
+
+		remove(tmpPath.c_str());
+		setChanged();
+
+		return false;
+	}
+
+	// The uses counted until now are on disk; the saved counters of the
+	// tokens that are present belong to objects that have been deleted
+	{
+		MutexLocker lock(savedMutex);
+
+		for (std::map<std::string, Entry>::iterator it = written.begin(); it != written.end(); it++)
+		{
+			synced[it->first] = it->second;
+		}
+
+		std::map<std::string, Entry>::iterator it = saved.begin();
+		while (it != saved.end())
+		{
+			std::string serialStr = it->first.substr(0, it->first.find(' '));
+
+			if (serials.find(serialStr) != serials.end())
+			{
+				saved.erase(it++);
+
+				continue;
+			}
+
+			it++;
+		}
+	}
+
+	return true;
+}
+
+// Return the key of an object in the file
+/*static*/ std::string UsageStore::makeKey(const ByteString& serial, const std::string& id)
+{
+	return serial.hex_str() + " " + id;
+}
+
+#ifdef HAVE_CXX11
+// The background thread
+void UsageStore::run()
+{
+	std::unique_lock<std::mutex> lock(stopMutex);
+
+	while (!stopping)
+	{
+		stopSignal.wait_for(lock, std::chrono::seconds(interval), [this] { return stopping; });
+
+		if (stopping) break;
+
+		lock.unlock();
+		save();
+		lock.lock();
+	}
+}
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ UsageStore.h
+
+ Saves the usage counters of the token objects to a side file, so that they
+ survive a restart without ever touching the object files. The counters are
+ saved periodically by a background thread and when the store is deleted. The
+ counters saved by an earlier run are added to those of an object the first
+ time it is counted or saved. Processes that share the file lock it while
+ saving, and add the uses they counted to the counters in it.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_USAGESTORE_H
+#define _SOFTHSM_V2_USAGESTORE_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "KeyUsage.h"
+#include "MutexFactory.h"
+#include "ObjectStore.h"
+#include "OSObject.h"
+#include <map>
+#include <string>
+#ifdef HAVE_CXX11
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+class UsageStore
+{
+public:
+	// Constructor; the counters of the objects in inObjectStore are saved to
+	// inPath every inInterval seconds, or only when the store is deleted if
+	// inInterval is 0
+	UsageStore(const std::string& inPath, ObjectStore* inObjectStore, unsigned long inInterval);
+
+	// Destructor; stops the background thread and saves the counters
+	virtual ~UsageStore();
+
+	// Load the counters saved by an earlier run
+	bool load();
+
+	// Add the saved counters of the object to its usage counters
+	void seed(const ByteString& serial, OSObject* object);
+
+	// Note that a counter has changed since the last save
+	void setChanged();
+
+	// Save the counters of all token objects; nothing is written if no
+	// counter has changed
+	bool save();
+
+private:
+	// The saved counters of an object
+	struct Entry
+	{
+		unsigned long long counts[KeyUsage::OperationCount];
+		time_t lastUsed;
+	};
+
+	// Return the key of an object in the file
+	static std::string makeKey(const ByteString& serial, const std::string& id);
+
+	// Read the counters in the file
+	static bool readEntries(const std::string& path, std::map<std::string, Entry>& entries);
+
+	std::string path;
+	ObjectStore* objectStore;
+	unsigned long interval;
+
+	// The counters saved by an earlier run, indexed by token serial and
+	// object id, that have not been added to an object yet
+	std::map<std::string, Entry> saved;
+
+	// The counters of the objects when they were last seeded or saved, so
+	// that only the uses since then are added to the counters on disk
+	std::map<std::string, Entry> synced;
+	Mutex* savedMutex;
+
+	// Serialises the saves
+	Mutex* saveMutex;
+
+#ifdef HAVE_CXX11
+	std::atomic<bool> changed;
+
+	// The background thread
+	void run();
+
+	bool stopping;
+	std::mutex stopMutex;
+	std::condition_variable stopSignal;
+	std::thread saver;
+#else
+	volatile bool changed;
+#endif
+};
+
+#endif // !_SOFTHSM_V2_USAGESTORE_H
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AttributePoolTests.cpp
+
+ Contains test cases to test the attribute value pool
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "AttributePoolTests.h"
+#include "AttributePool.h"
+#include "OSAttribute.h"
+#include "SessionObject.h"
+#include "cryptoki.h"
+#ifdef HAVE_CXX11
+#include <thread>
+#include <vector>
+#endif
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AttributePoolTests);
+
+void AttributePoolTests::setUp()
+{
+}
+
+void AttributePoolTests::tearDown()
+{
+}
+
+void AttributePoolTests::testInternByteStr()
+{
+	size_t before = AttributePool::i()->size();
+
+	ByteString p256 = "06082a8648ce3d030107";
+	ByteString p384 = "06052b81040022";
+
+	{
+		OSAttribute attr1(p256);
+		OSAttribute attr2(p256);
+		OSAttribute attr3(p384);
+
+		attr1.intern();
+		attr2.intern();
+		attr3.intern();
+
+		CPPUNIT_ASSERT(attr1.isInterned());
+		CPPUNIT_ASSERT(attr2.isInterned());
+		CPPUNIT_ASSERT(attr3.isInterned());
+
+		// Identical values share a single copy
+		CPPUNIT_ASSERT(&attr1.getByteStringValue() == &attr2.getByteStringValue());
+		CPPUNIT_ASSERT(&attr1.getByteStringValue() != &attr3.getByteStringValue());
+		CPPUNIT_ASSERT(attr1.getByteStringValue() == p256);
+		CPPUNIT_ASSERT(attr3.getByteStringValue() == p384);
+		CPPUNIT_ASSERT_EQUAL(before + 2, AttributePool::i()->size());
+
+		// Interning twice has no effect
+		attr1.intern();
+		CPPUNIT_ASSERT_EQUAL(before + 2, AttributePool::i()->size());
+
+		ByteString peeked;
+		CPPUNIT_ASSERT(attr1.peekValue(peeked));
+		CPPUNIT_ASSERT(peeked == p256);
+
+		// Only byte string values are interned on request
+		ByteString empty;
+		OSAttribute attr4((unsigned long) 0x1234);
+		OSAttribute attr5(empty);
+		attr4.intern();
+		attr5.intern();
+		CPPUNIT_ASSERT(!attr4.isInterned());
+		CPPUNIT_ASSERT(!attr5.isInterned());
+	}
+
+	// Entries are dropped when no longer referenced
+	CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+}
+
+void AttributePoolTests::testInternMechTypeSet()
+{
+	size_t before = AttributePool::i()->size();
+
+	std::set<CK_MECHANISM_TYPE> set1;
+	set1.insert(CKM_SHA256);
+	set1.insert(CKM_ECDSA);
+	std::set<CK_MECHANISM_TYPE> set2(set1);
+	set2.insert(CKM_ECDSA_SHA256);
+
+	{
+		// Mechanism type sets are always shared
+		OSAttribute attr1(set1);
+		OSAttribute attr2(set1);
+		OSAttribute attr3(set2);
+		OSAttribute attr4(attr3);
+		std::set<CK_MECHANISM_TYPE> empty;
+		OSAttribute attr5(empty);
+
+		CPPUNIT_ASSERT(attr1.isInterned());
+		CPPUNIT_ASSERT(!attr5.isInterned());
+		CPPUNIT_ASSERT(attr5.getMechanismTypeSetValue().empty());
+		CPPUNIT_ASSERT(&attr3.getMechanismTypeSetValue() == &attr4.getMechanismTypeSetValue());
+		CPPUNIT_ASSERT(&attr1.getMechanismTypeSetValue() == &attr2.getMechanismTypeSetValue());
+		CPPUNIT_ASSERT(&attr1.getMechanismTypeSetValue() != &attr3.getMechanismTypeSetValue());
+		CPPUNIT_ASSERT(attr1.getMechanismTypeSetValue() == set1);
+		CPPUNIT_ASSERT(attr3.getMechanismTypeSetValue() == set2);
+		CPPUNIT_ASSERT_EQUAL(before + 2, AttributePool::i()->size());
+	}
+
+	CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+}
+
+void AttributePoolTests::testCopyAndAssign()
+{
+	size_t before = AttributePool::i()->size();
+
+	ByteString value = "010001";
+
+	{
+		OSAttribute attr1(value);
+		attr1.intern();
+
+		// A copy shares the interned value
+		OSAttribute attr2(attr1);
+		CPPUNIT_ASSERT(attr2.isInterned());
+		CPPUNIT_ASSERT(&attr1.getByteStringValue() == &attr2.getByteStringValue());
+
+		// Assignment drops the previous value
+		OSAttribute attr3(ByteString("03"));
+		attr3.intern();
+		CPPUNIT_ASSERT_EQUAL(before + 2, AttributePool::i()->size());
+		attr3 = attr1;
+		CPPUNIT_ASSERT_EQUAL(before + 1, AttributePool::i()->size());
+		CPPUNIT_ASSERT(attr3.getByteStringValue() == value);
+
+		// Assigning a plain value
+		attr3 = OSAttribute(true);
+		CPPUNIT_ASSERT(!attr3.isInterned());
+		CPPUNIT_ASSERT(attr3.isBooleanAttribute());
+		CPPUNIT_ASSERT(attr3.getBooleanValue());
+
+		// Self assignment
+		attr1 = attr1;
+		CPPUNIT_ASSERT(attr1.getByteStringValue() == value);
+
+		// The value survives its first owner
+		OSAttribute* attr4 = new OSAttribute(value);
+		attr4->intern();
+		OSAttribute attr5(*attr4);
+		delete attr4;
+		CPPUNIT_ASSERT(attr5.getByteStringValue() == value);
+		CPPUNIT_ASSERT_EQUAL(before + 1, AttributePool::i()->size());
+	}
+
+	CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+}
+
+void AttributePoolTests::testShareByteStr()
+{
+	size_t before = AttributePool::i()->size();
+
+	ByteString value = "0102030405060708";
+
+	{
+		// A copy shares a value that is not interned
+		OSAttribute attr1(value);
+		OSAttribute attr2(attr1);
+		CPPUNIT_ASSERT(!attr2.isInterned());
+		CPPUNIT_ASSERT(&attr1.getByteStringValue() == &attr2.getByteStringValue());
+		CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+
+		// The values of private objects are shared with their copies
+		SessionObject privateKey(NULL, 1, 1, true);
+		SessionObject copy(NULL, 1, 1, true);
+		CPPUNIT_ASSERT(privateKey.setAttribute(CKA_PRIVATE, OSAttribute(true)));
+		CPPUNIT_ASSERT(privateKey.setAttribute(CKA_VALUE, attr1));
+		CPPUNIT_ASSERT(copy.setAttribute(CKA_VALUE, privateKey.getAttribute(CKA_VALUE)));
+		CPPUNIT_ASSERT(&copy.getAttribute(CKA_VALUE).getByteStringValue() == &attr1.getByteStringValue());
+		CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+
+		// Interning a copy leaves the other copies alone
+		attr2.intern();
+		CPPUNIT_ASSERT(attr2.isInterned());
+		CPPUNIT_ASSERT(!attr1.isInterned());
+		CPPUNIT_ASSERT(&attr1.getByteStringValue() != &attr2.getByteStringValue());
+		CPPUNIT_ASSERT(attr2.getByteStringValue() == value);
+		CPPUNIT_ASSERT_EQUAL(before + 1, AttributePool::i()->size());
+
+		// The empty value is not shared
+		OSAttribute attr3((ByteString()));
+		CPPUNIT_ASSERT(attr3.isByteStringAttribute());
+		CPPUNIT_ASSERT(attr3.getByteStringValue().size() == 0);
+		attr3.intern();
+		CPPUNIT_ASSERT(!attr3.isInterned());
+	}
+
+	CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+}
+
+void AttributePoolTests::testSessionObjects()
+{
+	size_t before = AttributePool::i()->size();
+
+	ByteString ecParams = "06082a8648ce3d030107";
+
+	{
+		SessionObject publicKey1(NULL, 1, 1);
+		SessionObject publicKey2(NULL, 1, 1);
+		SessionObject privateKey(NULL, 1, 1, true);
+
+		CPPUNIT_ASSERT(publicKey1.setAttribute(CKA_PRIVATE, OSAttribute(false)));
+		CPPUNIT_ASSERT(publicKey2.setAttribute(CKA_PRIVATE, OSAttribute(false)));
+		CPPUNIT_ASSERT(privateKey.setAttribute(CKA_PRIVATE, OSAttribute(true)));
+
+		CPPUNIT_ASSERT(publicKey1.setAttribute(CKA_EC_PARAMS, ecParams));
+		CPPUNIT_ASSERT(publicKey2.setAttribute(CKA_EC_PARAMS, ecParams));
+		CPPUNIT_ASSERT(privateKey.setAttribute(CKA_EC_PARAMS, ecParams));
+
+		// Public values share one entry, private values are never interned
+		CPPUNIT_ASSERT(publicKey1.getAttribute(CKA_EC_PARAMS).isInterned());
+		CPPUNIT_ASSERT(publicKey2.getAttribute(CKA_EC_PARAMS).isInterned());
+		CPPUNIT_ASSERT(!privateKey.getAttribute(CKA_EC_PARAMS).isInterned());
+		CPPUNIT_ASSERT_EQUAL(before + 1, AttributePool::i()->size());
+
+		// Values of attribute types that are not eligible are not interned
+		CPPUNIT_ASSERT(publicKey1.setAttribute(CKA_EC_POINT, ecParams));
+		CPPUNIT_ASSERT(!publicKey1.getAttribute(CKA_EC_POINT).isInterned());
+
+		CPPUNIT_ASSERT(publicKey1.getByteStringValue(CKA_EC_PARAMS) == ecParams);
+		CPPUNIT_ASSERT(privateKey.getByteStringValue(CKA_EC_PARAMS) == ecParams);
+	}
+
+	CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+}
+
+#ifdef HAVE_CXX11
+// Take and drop references to the same values, and intern a value that is
+// not held by anyone else, so that its entry comes and goes
+static void referenceValues(const OSAttribute* interned, const OSAttribute* mechs, const ByteString* transient)
+{
+	for (int i = 0; i < 20000; i++)
+	{
+		OSAttribute copy1(*interned);
+		OSAttribute copy2(*mechs);
+		OSAttribute copy3(copy1);
+
+		OSAttribute other(*transient);
+		other.intern();
+	}
+}
+#endif
+
+void AttributePoolTests::testConcurrentReferences()
+{
+#ifdef HAVE_CXX11
+	size_t before = AttributePool::i()->size();
+
+	ByteString p256 = "06082a8648ce3d030107";
+	ByteString transient = "0a0b0c0d";
+	std::set<CK_MECHANISM_TYPE> mechs;
+	mechs.insert(CKM_SHA256_RSA_PKCS);
+
+	{
+		OSAttribute interned(p256);
+		interned.intern();
+		OSAttribute mechSet(mechs);
+		CPPUNIT_ASSERT_EQUAL(before + 2, AttributePool::i()->size());
+
+		std::vector<std::thread> threads;
+		for (int i = 0; i < 4; i++)
+		{
+			threads.push_back(std::thread(referenceValues, &interned, &mechSet, &transient));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+
+		CPPUNIT_ASSERT_EQUAL(before + 2, AttributePool::i()->size());
+		CPPUNIT_ASSERT(interned.getByteStringValue() == p256);
+		CPPUNIT_ASSERT(mechSet.getMechanismTypeSetValue() == mechs);
+	}
+
+	CPPUNIT_ASSERT_EQUAL(before, AttributePool::i()->size());
+#endif
+}
@@ -35,6 +35,7 @@
 #include "DBTokenTests.h"
 #include "DBToken.h"
 #include "DB.h"
+#include "ObjectIndex.h"
 
 #include <cstdio>
 
@@ -489,3 +490,53 @@ void test_a_dbtoken::support_clearing_a_token()
 
 	DB::setLogErrorHandler(eh);
 }
+
+void test_a_dbtoken::support_finding_objects()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+	ByteString subject1 = "3011310F300D06035504030C064F626A31";
+	ByteString subject2 = "3011310F300D06035504030C064F626A32";
+
+	// The indexes are created with the token
+	ObjectIndex::setEnabled(true);
+
+	ObjectStoreToken* testToken = new DBToken("testdir", "newToken", label, serial);
+
+	CPPUNIT_ASSERT(testToken != NULL);
+	CPPUNIT_ASSERT(testToken->isValid());
+
+	OSObject* obj1 = testToken->createObject();
+	CPPUNIT_ASSERT(obj1 != NULL);
+	OSObject* obj2 = testToken->createObject();
+	CPPUNIT_ASSERT(obj2 != NULL);
+
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_SUBJECT, subject1));
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_SUBJECT, subject2));
+
+	// Only the object with the subject is a candidate
+	CK_ATTRIBUTE findTemplate[] = {
+		{ CKA_SUBJECT, subject2.byte_str(), subject2.size() }
+	};
+	std::set<OSObject*> candidates;
+
+	testToken->findObjects(findTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT_EQUAL(candidates.size(), (size_t)1);
+	CPPUNIT_ASSERT(candidates.count(obj2) == 1);
+
+	// A template without indexed attributes returns all objects
+	CK_OBJECT_CLASS certClass = CKO_CERTIFICATE;
+	CK_ATTRIBUTE classTemplate[] = {
+		{ CKA_CLASS, &certClass, sizeof(certClass) }
+	};
+
+	candidates.clear();
+	testToken->findObjects(classTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT_EQUAL(candidates.size(), (size_t)2);
+
+	ObjectIndex::setEnabled(false);
+
+	delete testToken;
+}
@@ -45,6 +45,7 @@ class test_a_dbtoken : public CppUnit::TestFixture
 	CPPUNIT_TEST(should_fail_to_open_nonexistant_tokens);
 	CPPUNIT_TEST(support_create_delete_objects);
 	CPPUNIT_TEST(support_clearing_a_token);
+	CPPUNIT_TEST(support_finding_objects);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -57,6 +58,7 @@ public:
 	void should_fail_to_open_nonexistant_tokens();
 	void support_create_delete_objects();
 	void support_clearing_a_token();
+	void support_finding_objects();
 
 protected:
 
@@ -35,9 +35,16 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include "FileTests.h"
 #include "File.h"
+#include "FileBuffer.h"
+#include "FileSyncer.h"
 #include "Directory.h"
 #include "CryptoFactory.h"
 #include "RNG.h"
+#include <algorithm>
+#include <vector>
+#ifdef HAVE_CXX11
+#include <thread>
+#endif
 
 CPPUNIT_TEST_SUITE_REGISTRATION(FileTests);
 
@@ -241,6 +248,105 @@ void FileTests::testWriteRead()
 	}
 }
 
+void FileTests::testReadAll()
+{
+	// Generate some test data
+	RNG* rng = CryptoFactory::i()->getRNG();
+
+	ByteString testData1;
+
+	CPPUNIT_ASSERT(rng->generateRandom(testData1, 187));
+
+	std::set<CK_MECHANISM_TYPE> testSet;
+	testSet.insert(CKM_RSA_PKCS);
+	testSet.insert(CKM_SHA256_RSA_PKCS);
+
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute> testMap;
+	testMap.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(CKA_TOKEN, OSAttribute(true)));
+	testMap.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(CKA_CLASS, OSAttribute((unsigned long) CKO_SECRET_KEY)));
+	testMap.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(CKA_VALUE, OSAttribute(testData1)));
+	testMap.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(CKA_ALLOWED_MECHANISMS, OSAttribute(testSet)));
+
+	// Create a file for writing
+	{
+#ifndef _WIN32
+		File newFile("testdir/newFile", false, true);
+#else
+		File newFile("testdir\\newFile", false, true);
+#endif
+
+		CPPUNIT_ASSERT(newFile.isValid());
+		CPPUNIT_ASSERT(newFile.writeBool(true));
+		CPPUNIT_ASSERT(newFile.writeULong(0x12345678));
+		CPPUNIT_ASSERT(newFile.writeByteString(testData1));
+		CPPUNIT_ASSERT(newFile.writeMechanismTypeSet(testSet));
+		CPPUNIT_ASSERT(newFile.writeAttributeMap(testMap));
+	}
+
+	// Read the whole file back, regardless of the current position
+	ByteString contents;
+
+	{
+#ifndef _WIN32
+		File newFile("testdir/newFile");
+#else
+		File newFile("testdir\\newFile");
+#endif
+
+		CPPUNIT_ASSERT(newFile.isValid());
+
+		unsigned long ulongValue;
+
+		CPPUNIT_ASSERT(newFile.seek(1) && newFile.readULong(ulongValue));
+		CPPUNIT_ASSERT(ulongValue == 0x12345678);
+		CPPUNIT_ASSERT(newFile.readAll(contents));
+	}
+
+	// Parse the contents from memory
+	{
+		FileBuffer buffer(contents);
+
+		bool b;
+		unsigned long ulongValue;
+		ByteString bsValue;
+		std::set<CK_MECHANISM_TYPE> setVal;
+		std::map<CK_ATTRIBUTE_TYPE,OSAttribute> mapVal;
+
+		CPPUNIT_ASSERT(buffer.readBool(b) && b);
+		CPPUNIT_ASSERT(buffer.readULong(ulongValue));
+		CPPUNIT_ASSERT(ulongValue == 0x12345678);
+		CPPUNIT_ASSERT(buffer.readByteString(bsValue));
+		CPPUNIT_ASSERT(bsValue == testData1);
+		CPPUNIT_ASSERT(buffer.readMechanismTypeSet(setVal));
+		CPPUNIT_ASSERT(setVal == testSet);
+		CPPUNIT_ASSERT(buffer.readAttributeMap(mapVal));
+		CPPUNIT_ASSERT(mapVal.size() == 4);
+		CPPUNIT_ASSERT(mapVal.find(CKA_TOKEN)->second.getBooleanValue());
+		CPPUNIT_ASSERT(mapVal.find(CKA_CLASS)->second.getUnsignedLongValue() == CKO_SECRET_KEY);
+		CPPUNIT_ASSERT(mapVal.find(CKA_VALUE)->second.getByteStringValue() == testData1);
+		CPPUNIT_ASSERT(mapVal.find(CKA_ALLOWED_MECHANISMS)->second.getMechanismTypeSetValue() == testSet);
+
+		// Check for EOF
+		CPPUNIT_ASSERT(!buffer.isEOF());
+		CPPUNIT_ASSERT(!buffer.readBool(b));
+		CPPUNIT_ASSERT(buffer.isEOF());
+	}
+
+	// Truncated contents must not be read past their end
+	{
+		ByteString truncated = contents.substr(0, 1 + 8 + 8 + 100);
+		FileBuffer buffer(truncated);
+
+		bool b;
+		unsigned long ulongValue;
+		ByteString bsValue;
+
+		CPPUNIT_ASSERT(buffer.readBool(b) && buffer.readULong(ulongValue));
+		CPPUNIT_ASSERT(!buffer.readByteString(bsValue));
+		CPPUNIT_ASSERT(buffer.isEOF());
+	}
+}
+
 void FileTests::testSeek()
 {
 	ByteString t1 = "112233445566778899";       // 9 long
@@ -314,6 +420,75 @@ void FileTests::testSeek()
 	CPPUNIT_ASSERT(trrr2 == t2);
 }
 
+#ifdef HAVE_CXX11
+// Write to the shared file and sync it
+static void writeAndSync(std::string path, unsigned long value, bool* result)
+{
+	File testFile(path, true, true, false, false);
+
+	*result = testFile.isValid() &&
+		  testFile.lock() &&
+		  testFile.writeULong(value) &&
+		  testFile.unlock() &&
+		  testFile.sync();
+}
+#endif
+
+void FileTests::testSync()
+{
+#ifndef _WIN32
+	std::string dirName = "./testdir";
+	std::string fileName = "./testdir/syncFile";
+#else
+	std::string dirName = ".\\testdir";
+	std::string fileName = ".\\testdir\\syncFile";
+#endif
+
+	CPPUNIT_ASSERT(!FileSyncer::i()->isEnabled());
+
+	FileSyncer::i()->setEnabled(true);
+
+	{
+		File testFile(fileName, true, true, true);
+
+		CPPUNIT_ASSERT(testFile.isValid());
+		CPPUNIT_ASSERT(testFile.writeULong(0x12345678));
+		CPPUNIT_ASSERT(testFile.sync());
+	}
+
+	CPPUNIT_ASSERT(FileSyncer::i()->syncDirectory(dirName));
+
+#ifdef HAVE_CXX11
+	// Concurrent syncs of the same file are coalesced
+	const size_t writers = 16;
+	bool results[writers];
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < writers; i++)
+	{
+		results[i] = false;
+		threads.push_back(std::thread(writeAndSync, fileName, (unsigned long) i, &results[i]));
+	}
+
+	for (size_t i = 0; i < writers; i++)
+	{
+		threads[i].join();
+
+		CPPUNIT_ASSERT(results[i]);
+	}
+#endif
+
+	FileSyncer::i()->setEnabled(false);
+
+	// The written data is still there
+	File readFile(fileName);
+	unsigned long value;
+
+	CPPUNIT_ASSERT(readFile.isValid());
+	CPPUNIT_ASSERT(readFile.readULong(value));
+	CPPUNIT_ASSERT(value < 16 || value == 0x12345678);
+}
+
 bool FileTests::exists(std::string name)
 {
 #ifndef _WIN32
@@ -338,3 +513,73 @@ bool FileTests::exists(std::string name)
 	return false;
 }
 
+void FileTests::testCreateTemp()
+{
+#ifndef _WIN32
+	std::string dirName = "./testdir";
+	std::string fileName = "./testdir/tempFile";
+#else
+	std::string dirName = ".\\testdir";
+	std::string fileName = ".\\testdir\\tempFile";
+#endif
+
+	Directory testDir(dirName);
+
+	CPPUNIT_ASSERT(testDir.isValid());
+
+	// A temporary file is not visible under its target path until it is published
+	File* tempFile = File::createTemp(fileName);
+
+	CPPUNIT_ASSERT(tempFile != NULL);
+	CPPUNIT_ASSERT(tempFile->isValid());
+	CPPUNIT_ASSERT(tempFile->writeULong(0x12345678));
+	CPPUNIT_ASSERT(tempFile->sync());
+
+	CPPUNIT_ASSERT(testDir.refresh());
+
+	std::vector<std::string> files = testDir.getFiles();
+
+	CPPUNIT_ASSERT(std::find(files.begin(), files.end(), "tempFile") == files.end());
+
+	CPPUNIT_ASSERT(tempFile->publish());
+
+	delete tempFile;
+
+	CPPUNIT_ASSERT(testDir.refresh());
+
+	files = testDir.getFiles();
+
+	CPPUNIT_ASSERT(files.size() == 1);
+	CPPUNIT_ASSERT(files[0] == "tempFile");
+
+	{
+		File testFile(fileName);
+		unsigned long value;
+
+		CPPUNIT_ASSERT(testFile.isValid());
+		CPPUNIT_ASSERT(testFile.readULong(value));
+		CPPUNIT_ASSERT(value == 0x12345678);
+	}
+
+	// Publishing never replaces an existing file
+	tempFile = File::createTemp(fileName);
+
+	CPPUNIT_ASSERT(tempFile != NULL);
+	CPPUNIT_ASSERT(tempFile->writeULong(0x87654321));
+	CPPUNIT_ASSERT(!tempFile->publish());
+
+	delete tempFile;
+
+	// And a file that is not published leaves nothing behind
+	CPPUNIT_ASSERT(testDir.refresh());
+	CPPUNIT_ASSERT(testDir.getFiles().size() == 1);
+
+	{
+		File testFile(fileName);
+		unsigned long value;
+
+		CPPUNIT_ASSERT(testFile.isValid());
+		CPPUNIT_ASSERT(testFile.readULong(value));
+		CPPUNIT_ASSERT(value == 0x12345678);
+	}
+}
@@ -42,7 +42,10 @@ class FileTests : public CppUnit::TestFixture
 	CPPUNIT_TEST(testCreateNotCreate);
 	CPPUNIT_TEST(testLockUnlock);
 	CPPUNIT_TEST(testWriteRead);
+	CPPUNIT_TEST(testReadAll);
 	CPPUNIT_TEST(testSeek);
+	CPPUNIT_TEST(testSync);
+	CPPUNIT_TEST(testCreateTemp);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -50,7 +53,10 @@ public:
 	void testCreateNotCreate();
 	void testLockUnlock();
 	void testWriteRead();
+	void testReadAll();
 	void testSeek();
+	void testSync();
+	void testCreateTemp();
 
 	void setUp();
 	void tearDown();
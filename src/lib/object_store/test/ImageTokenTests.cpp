@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ImageTokenTests.cpp
+
+ Contains test cases to test the read-only token image implementation
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "ImageTokenTests.h"
+#include "ImageToken.h"
+#include "ObjectStore.h"
+#include "ObjectStoreToken.h"
+#include "OSToken.h"
+#include "OSAttribute.h"
+#include "OSAttributes.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ImageTokenTests);
+
+// Create a file token with a single object
+static void createSourceToken()
+{
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+	ByteString soPIN = "3132333435363738"; // 12345678
+	ByteString userPIN = "31323334"; // 1234
+	ByteString id = "a1a2a3a4";
+	std::set<CK_MECHANISM_TYPE> mechs;
+	mechs.insert(CKM_SHA256_HMAC);
+
+#ifndef _WIN32
+	OSToken* token = OSToken::createToken("./testdir", "token", label, serial);
+#else
+	OSToken* token = OSToken::createToken(".\\testdir", "token", label, serial);
+#endif
+
+	CPPUNIT_ASSERT(token != NULL);
+	CPPUNIT_ASSERT(token->setSOPIN(soPIN));
+	CPPUNIT_ASSERT(token->setUserPIN(userPIN));
+
+	OSObject* object = token->createObject();
+	CPPUNIT_ASSERT(object != NULL);
+	CPPUNIT_ASSERT(object->setAttribute(CKA_CLASS, OSAttribute((unsigned long)CKO_SECRET_KEY)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_TOKEN, OSAttribute(true)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_ID, OSAttribute(id)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_ALLOWED_MECHANISMS, OSAttribute(mechs)));
+
+	delete token;
+}
+
+// Check the contents of the token created by createSourceToken
+static void checkToken(ObjectStoreToken* token)
+{
+	ByteString label, serial, soPIN, userPIN;
+	CK_ULONG flags;
+
+	CPPUNIT_ASSERT(token->isValid());
+	CPPUNIT_ASSERT(token->getTokenLabel(label));
+	CPPUNIT_ASSERT(label == ByteString("40414243"));
+	CPPUNIT_ASSERT(token->getTokenSerial(serial));
+	CPPUNIT_ASSERT(serial == ByteString("0102030405060708"));
+	CPPUNIT_ASSERT(token->getSOPIN(soPIN));
+	CPPUNIT_ASSERT(soPIN == ByteString("3132333435363738"));
+	CPPUNIT_ASSERT(token->getUserPIN(userPIN));
+	CPPUNIT_ASSERT(userPIN == ByteString("31323334"));
+	CPPUNIT_ASSERT(token->getTokenFlags(flags));
+	CPPUNIT_ASSERT((flags & CKF_WRITE_PROTECTED) == CKF_WRITE_PROTECTED);
+	CPPUNIT_ASSERT((flags & CKF_USER_PIN_INITIALIZED) == CKF_USER_PIN_INITIALIZED);
+
+	std::set<OSObject*> objects = token->getObjects();
+	CPPUNIT_ASSERT_EQUAL(objects.size(), (size_t)1);
+
+	OSObject* object = *objects.begin();
+	CPPUNIT_ASSERT(object->isValid());
+	CPPUNIT_ASSERT_EQUAL(object->getUnsignedLongValue(CKA_CLASS, CKO_DATA), (unsigned long)CKO_SECRET_KEY);
+	CPPUNIT_ASSERT(object->getBooleanValue(CKA_TOKEN, false));
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_ID) == ByteString("a1a2a3a4"));
+	CPPUNIT_ASSERT(object->getAttribute(CKA_ALLOWED_MECHANISMS).getMechanismTypeSetValue().count(CKM_SHA256_HMAC) == 1);
+	CPPUNIT_ASSERT(!object->attributeExists(CKA_LABEL));
+}
+
+void ImageTokenTests::setUp()
+{
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+}
+
+void ImageTokenTests::tearDown()
+{
+	ObjectStoreToken::setReadOnly(false);
+
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void ImageTokenTests::testImage()
+{
+	createSourceToken();
+
+	CPPUNIT_ASSERT(!ImageToken::hasImage("testdir", "token"));
+
+	// Build the image of the token
+	ObjectStoreToken* source = ObjectStoreToken::accessToken("testdir", "token");
+	ByteString image;
+
+	CPPUNIT_ASSERT(ImageToken::buildImage(source, image));
+	CPPUNIT_ASSERT(ImageToken::writeImage("testdir", "token", image));
+
+	delete source;
+
+	CPPUNIT_ASSERT(ImageToken::hasImage("testdir", "token"));
+
+	// The object store now serves the token from the image
+	ObjectStore store("testdir");
+	CPPUNIT_ASSERT_EQUAL(store.getTokenCount(), (size_t)1);
+
+	checkToken(store.getToken(0));
+
+	// The backend token is still available
+	source = ObjectStoreToken::accessBackendToken("testdir", "token");
+	CK_ULONG flags;
+
+	CPPUNIT_ASSERT(source->getTokenFlags(flags));
+	CPPUNIT_ASSERT((flags & CKF_WRITE_PROTECTED) == 0);
+
+	delete source;
+}
+
+void ImageTokenTests::testReadOnly()
+{
+	createSourceToken();
+
+	// In read-only mode the token is copied without building an image
+	ObjectStoreToken::setReadOnly(true);
+
+	ObjectStore store("testdir");
+	CPPUNIT_ASSERT_EQUAL(store.getTokenCount(), (size_t)1);
+
+	checkToken(store.getToken(0));
+
+	CPPUNIT_ASSERT(!ImageToken::hasImage("testdir", "token"));
+
+	// No new tokens can be created
+	CPPUNIT_ASSERT(store.newToken(ByteString("DEADBEEF")) == NULL);
+}
+
+void ImageTokenTests::testWriteProtection()
+{
+	createSourceToken();
+
+	ObjectStoreToken::setReadOnly(true);
+
+	ObjectStore store("testdir");
+	ObjectStoreToken* token = store.getToken(0);
+	CPPUNIT_ASSERT(token != NULL);
+
+	OSObject* object = *token->getObjects().begin();
+
+	// The objects can not be changed
+	CPPUNIT_ASSERT(object->startTransaction(OSObject::ReadOnly));
+	CPPUNIT_ASSERT(object->commitTransaction());
+	CPPUNIT_ASSERT(!object->startTransaction(OSObject::ReadWrite));
+	CPPUNIT_ASSERT(!object->setAttribute(CKA_LABEL, OSAttribute(ByteString("label"))));
+	CPPUNIT_ASSERT(!object->deleteAttribute(CKA_ID));
+	CPPUNIT_ASSERT(!object->destroyObject());
+	CPPUNIT_ASSERT(object->attributeExists(CKA_ID));
+
+	// The token can not be changed
+	CPPUNIT_ASSERT(token->createObject() == NULL);
+	CPPUNIT_ASSERT(!token->deleteObject(object));
+	CPPUNIT_ASSERT(!token->setUserPIN(ByteString("31323334")));
+	CPPUNIT_ASSERT(!token->resetToken(ByteString("DEADBEEF")));
+	CPPUNIT_ASSERT(!token->clearToken());
+	CPPUNIT_ASSERT_EQUAL(token->getObjects().size(), (size_t)1);
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ MemObjectStoreTests.cpp
+
+ Contains test cases to test the object store with the memory backend
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "MemObjectStoreTests.h"
+#include "MemToken.h"
+#include "OSAttribute.h"
+#include "OSAttributes.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MemObjectStoreTests);
+
+void MemObjectStoreTests::setUp()
+{
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+
+	ObjectStoreToken::selectBackend("memory");
+}
+
+void MemObjectStoreTests::tearDown()
+{
+	MemToken::setSnapshotFile("");
+
+	ObjectStoreToken::selectBackend("file");
+
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void MemObjectStoreTests::testNewToken()
+{
+	ObjectStore* store = new ObjectStore("memnew");
+
+	CPPUNIT_ASSERT(store->isValid());
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)0);
+
+	ByteString label = "DEADC0FFEE";
+
+	ObjectStoreToken* token = store->newToken(label);
+	CPPUNIT_ASSERT(token != NULL);
+	CPPUNIT_ASSERT(token->isValid());
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)1);
+
+	ByteString retrieveLabel, retrieveSerial;
+	CK_ULONG flags;
+
+	CPPUNIT_ASSERT(token->getTokenLabel(retrieveLabel));
+	CPPUNIT_ASSERT(retrieveLabel == label);
+	CPPUNIT_ASSERT(token->getTokenSerial(retrieveSerial));
+	CPPUNIT_ASSERT(retrieveSerial.size() > 0);
+	CPPUNIT_ASSERT(token->getTokenFlags(flags));
+	CPPUNIT_ASSERT((flags & CKF_TOKEN_INITIALIZED) == CKF_TOKEN_INITIALIZED);
+	CPPUNIT_ASSERT((flags & CKF_USER_PIN_INITIALIZED) == 0);
+
+	ByteString userPIN = "1234";
+
+	CPPUNIT_ASSERT(token->setUserPIN(userPIN));
+	CPPUNIT_ASSERT(token->getTokenFlags(flags));
+	CPPUNIT_ASSERT((flags & CKF_USER_PIN_INITIALIZED) == CKF_USER_PIN_INITIALIZED);
+
+	CPPUNIT_ASSERT(store->destroyToken(token));
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)0);
+
+	delete store;
+}
+
+void MemObjectStoreTests::testPersistence()
+{
+	ByteString label = "DEADBEEF";
+	ByteString soPIN = "0102030405060708";
+	ByteString id = "0a0b0c0d";
+	std::set<CK_MECHANISM_TYPE> mechs;
+	mechs.insert(CKM_SHA256);
+	mechs.insert(CKM_AES_CBC);
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute> wrapTemplate;
+	wrapTemplate.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(CKA_ENCRYPT, OSAttribute(true)));
+	wrapTemplate.insert(std::pair<CK_ATTRIBUTE_TYPE,OSAttribute>(CKA_KEY_TYPE, OSAttribute((unsigned long)CKK_AES)));
+
+	// Create a token with an object
+	ObjectStore* store = new ObjectStore("mempersist");
+	ObjectStoreToken* token = store->newToken(label);
+	CPPUNIT_ASSERT(token != NULL);
+	CPPUNIT_ASSERT(token->setSOPIN(soPIN));
+
+	OSObject* object = token->createObject();
+	CPPUNIT_ASSERT(object != NULL);
+	CPPUNIT_ASSERT(object->setAttribute(CKA_TOKEN, OSAttribute(true)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_CLASS, OSAttribute((unsigned long)CKO_SECRET_KEY)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_ID, OSAttribute(id)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_ALLOWED_MECHANISMS, OSAttribute(mechs)));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_WRAP_TEMPLATE, OSAttribute(wrapTemplate)));
+
+	// A second object that is deleted again
+	OSObject* deleted = token->createObject();
+	CPPUNIT_ASSERT(deleted != NULL);
+	CPPUNIT_ASSERT(deleted->destroyObject());
+	CPPUNIT_ASSERT(!deleted->isValid());
+
+	delete store;
+
+	// The token survives the object store
+	store = new ObjectStore("mempersist");
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)1);
+
+	token = store->getToken(0);
+	CPPUNIT_ASSERT(token->isValid());
+
+	ByteString retrieveLabel, retrieveSOPIN;
+
+	CPPUNIT_ASSERT(token->getTokenLabel(retrieveLabel));
+	CPPUNIT_ASSERT(retrieveLabel == label);
+	CPPUNIT_ASSERT(token->getSOPIN(retrieveSOPIN));
+	CPPUNIT_ASSERT(retrieveSOPIN == soPIN);
+
+	std::set<OSObject*> objects = token->getObjects();
+	CPPUNIT_ASSERT_EQUAL(objects.size(), (size_t)1);
+
+	object = *objects.begin();
+	CPPUNIT_ASSERT(object->getBooleanValue(CKA_TOKEN, false));
+	CPPUNIT_ASSERT_EQUAL(object->getUnsignedLongValue(CKA_CLASS, CKO_DATA), (unsigned long)CKO_SECRET_KEY);
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_ID) == id);
+	CPPUNIT_ASSERT(object->getAttribute(CKA_ALLOWED_MECHANISMS).getMechanismTypeSetValue() == mechs);
+
+	std::map<CK_ATTRIBUTE_TYPE,OSAttribute> retrieveTemplate = object->getAttribute(CKA_WRAP_TEMPLATE).getAttributeMapValue();
+	CPPUNIT_ASSERT_EQUAL(retrieveTemplate.size(), (size_t)2);
+	CPPUNIT_ASSERT(retrieveTemplate.find(CKA_ENCRYPT)->second.getBooleanValue());
+	CPPUNIT_ASSERT_EQUAL(retrieveTemplate.find(CKA_KEY_TYPE)->second.getUnsignedLongValue(), (unsigned long)CKK_AES);
+
+	CPPUNIT_ASSERT(store->destroyToken(token));
+
+	delete store;
+}
+
+void MemObjectStoreTests::testTransactions()
+{
+	ByteString label = "CAFEBABE";
+
+	ObjectStore* store = new ObjectStore("memtransaction");
+	ObjectStoreToken* token = store->newToken(label);
+	CPPUNIT_ASSERT(token != NULL);
+
+	OSObject* object = token->createObject();
+	CPPUNIT_ASSERT(object != NULL);
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("before"))));
+
+	// Aborted changes are rolled back
+	CPPUNIT_ASSERT(object->startTransaction());
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("after"))));
+	CPPUNIT_ASSERT(object->setAttribute(CKA_ID, OSAttribute(ByteString("id"))));
+	CPPUNIT_ASSERT(object->abortTransaction());
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_LABEL) == ByteString("before"));
+	CPPUNIT_ASSERT(!object->attributeExists(CKA_ID));
+
+	// Committed changes are kept
+	CPPUNIT_ASSERT(object->startTransaction());
+	CPPUNIT_ASSERT(object->setAttribute(CKA_LABEL, OSAttribute(ByteString("after"))));
+	CPPUNIT_ASSERT(object->commitTransaction());
+	CPPUNIT_ASSERT(object->getByteStringValue(CKA_LABEL) == ByteString("after"));
+
+	CPPUNIT_ASSERT(store->destroyToken(token));
+
+	delete store;
+}
+
+void MemObjectStoreTests::testDestroy()
+{
+	ByteString label1 = "DEADC0FFEE";
+	ByteString label2 = "DEADBEEF";
+
+	ObjectStore* store = new ObjectStore("memdestroy");
+	ObjectStoreToken* token1 = store->newToken(label1);
+	ObjectStoreToken* token2 = store->newToken(label2);
+	CPPUNIT_ASSERT(token1 != NULL);
+	CPPUNIT_ASSERT(token2 != NULL);
+	CPPUNIT_ASSERT(token1->createObject() != NULL);
+
+	CPPUNIT_ASSERT(store->destroyToken(token1));
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)1);
+
+	delete store;
+
+	// Only the remaining token is found again
+	store = new ObjectStore("memdestroy");
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)1);
+
+	ByteString retrieveLabel;
+
+	CPPUNIT_ASSERT(store->getToken(0)->getTokenLabel(retrieveLabel));
+	CPPUNIT_ASSERT(retrieveLabel == label2);
+	CPPUNIT_ASSERT(store->destroyToken(store->getToken(0)));
+
+	delete store;
+}
+
+void MemObjectStoreTests::testSnapshot()
+{
+	ByteString label = "5A5A5A5A";
+	ByteString value = "00112233445566778899";
+
+	MemToken::setSnapshotFile("testdir/tokens.snapshot");
+
+	// The tokens are saved when the object store is closed
+	ObjectStore* store = new ObjectStore("memsnapshot");
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)0);
+
+	ObjectStoreToken* token = store->newToken(label);
+	CPPUNIT_ASSERT(token != NULL);
+
+	OSObject* object = token->createObject();
+	CPPUNIT_ASSERT(object != NULL);
+	CPPUNIT_ASSERT(object->setAttribute(CKA_VALUE, OSAttribute(value)));
+
+	delete store;
+
+	// A base path that has not been used yet is loaded from the snapshot
+	store = new ObjectStore("memrestore");
+	CPPUNIT_ASSERT_EQUAL(store->getTokenCount(), (size_t)1);
+
+	token = store->getToken(0);
+
+	ByteString retrieveLabel;
+
+	CPPUNIT_ASSERT(token->getTokenLabel(retrieveLabel));
+	CPPUNIT_ASSERT(retrieveLabel == label);
+
+	std::set<OSObject*> objects = token->getObjects();
+	CPPUNIT_ASSERT_EQUAL(objects.size(), (size_t)1);
+	CPPUNIT_ASSERT((*objects.begin())->getByteStringValue(CKA_VALUE) == value);
+
+	CPPUNIT_ASSERT(store->destroyToken(token));
+
+	delete store;
+
+	// Clean up the original copy
+	MemToken::setSnapshotFile("");
+
+	store = new ObjectStore("memsnapshot");
+	CPPUNIT_ASSERT(store->destroyToken(store->getToken(0)));
+
+	delete store;
+}
@@ -32,6 +32,11 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <vector>
+#ifndef _WIN32
+#include <utime.h>
+#endif
 #include <cppunit/extensions/HelperMacros.h>
 #include "OSTokenTests.h"
 #include "OSToken.h"
@@ -502,3 +507,213 @@ void OSTokenTests::testClearToken()
 	CPPUNIT_ASSERT(!clearedToken.isValid());
 }
 
+
+void OSTokenTests::testShardedToken()
+{
+	ByteString id[3] = { "112233445566", "AABBCCDDEEFF", "ABABABABABAB" };
+	OSAttribute idAtt[3] = { id[0], id[1], id[2] };
+	ByteString label = "AABBCCDDEEFF";
+	ByteString serial = "1234567890";
+
+	// Create a token with two objects in the flat layout
+#ifndef _WIN32
+	OSToken* testToken = OSToken::createToken("./testdir", "testToken", label, serial);
+#else
+	OSToken* testToken = OSToken::createToken(".\\testdir", "testToken", label, serial);
+#endif
+
+	CPPUNIT_ASSERT(testToken != NULL);
+	CPPUNIT_ASSERT(testToken->isValid());
+
+	OSObject* obj1 = testToken->createObject();
+	CPPUNIT_ASSERT(obj1 != NULL);
+	OSObject* obj2 = testToken->createObject();
+	CPPUNIT_ASSERT(obj2 != NULL);
+
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_ID, idAtt[0]));
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_ID, idAtt[1]));
+
+	// Reopening the token with sharding enabled moves the objects, while
+	// the first instance keeps using the flat layout
+	OSToken::setSharding(true);
+
+#ifndef _WIN32
+	OSToken* shardedToken = new OSToken("./testdir/testToken");
+	Directory tokenDir("./testdir/testToken");
+#else
+	OSToken* shardedToken = new OSToken(".\\testdir\\testToken");
+	Directory tokenDir(".\\testdir\\testToken");
+#endif
+
+	CPPUNIT_ASSERT(shardedToken->isValid());
+	CPPUNIT_ASSERT(tokenDir.isValid());
+	CPPUNIT_ASSERT(tokenDir.getSubDirs().size() >= 1);
+
+	std::vector<std::string> tokenFiles = tokenDir.getFiles();
+
+	for (std::vector<std::string>::iterator i = tokenFiles.begin(); i != tokenFiles.end(); i++)
+	{
+		CPPUNIT_ASSERT((*i == "token.object") || (*i == "token.lock") || (*i == "generation"));
+	}
+
+	std::set<OSObject*> objects = shardedToken->getObjects();
+	CPPUNIT_ASSERT(objects.size() == 2);
+
+	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+	{
+		CPPUNIT_ASSERT((*i)->isValid());
+		CPPUNIT_ASSERT((*i)->attributeExists(CKA_ID));
+	}
+
+	// The first instance finds its objects in the shards and keeps them
+	std::set<OSObject*> flatObjects = testToken->getObjects();
+	CPPUNIT_ASSERT(flatObjects.size() == 2);
+	CPPUNIT_ASSERT(flatObjects.find(obj1) != flatObjects.end());
+	CPPUNIT_ASSERT(flatObjects.find(obj2) != flatObjects.end());
+	CPPUNIT_ASSERT(obj1->isValid());
+	CPPUNIT_ASSERT(obj1->getAttribute(CKA_ID).getByteStringValue() == id[0]);
+
+	// and writes them in their new place
+	OSAttribute labelAtt(label);
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_LABEL, labelAtt));
+
+	delete testToken;
+
+	CPPUNIT_ASSERT(tokenDir.refresh());
+	CPPUNIT_ASSERT(tokenDir.getFiles().size() == tokenFiles.size());
+
+	objects = shardedToken->getObjects();
+	bool labelled = false;
+
+	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+	{
+		CPPUNIT_ASSERT((*i)->isValid());
+
+		if ((*i)->attributeExists(CKA_LABEL) && ((*i)->getAttribute(CKA_LABEL).getByteStringValue() == label))
+		{
+			labelled = true;
+		}
+	}
+
+	CPPUNIT_ASSERT(labelled);
+
+	// Open the same token in a second instance
+#ifndef _WIN32
+	OSToken sameToken("./testdir/testToken");
+#else
+	OSToken sameToken(".\\testdir\\testToken");
+#endif
+
+	CPPUNIT_ASSERT(sameToken.isValid());
+	CPPUNIT_ASSERT(sameToken.getObjects().size() == 2);
+
+	// New objects are created in a shard and seen by the other instance
+	OSObject* obj3 = shardedToken->createObject();
+	CPPUNIT_ASSERT(obj3 != NULL);
+	CPPUNIT_ASSERT(obj3->setAttribute(CKA_ID, idAtt[2]));
+
+	std::set<OSObject*> otherObjects = sameToken.getObjects();
+	CPPUNIT_ASSERT(otherObjects.size() == 3);
+
+	bool present[3] = { false, false, false };
+
+	for (std::set<OSObject*>::iterator i = otherObjects.begin(); i != otherObjects.end(); i++)
+	{
+		CPPUNIT_ASSERT((*i)->isValid());
+		CPPUNIT_ASSERT((*i)->attributeExists(CKA_ID));
+
+		for (int j = 0; j < 3; j++)
+		{
+			if ((*i)->getAttribute(CKA_ID).getByteStringValue() == id[j])
+			{
+				present[j] = true;
+			}
+		}
+	}
+
+	for (int j = 0; j < 3; j++)
+	{
+		CPPUNIT_ASSERT(present[j] == true);
+	}
+
+	// Deleting objects from the shards is seen by the other instance
+	OSObject* migrated1 = NULL;
+
+	objects = shardedToken->getObjects();
+
+	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+	{
+		if ((*i)->getAttribute(CKA_ID).getByteStringValue() == id[0])
+		{
+			migrated1 = *i;
+		}
+	}
+
+	CPPUNIT_ASSERT(migrated1 != NULL);
+	CPPUNIT_ASSERT(shardedToken->deleteObject(migrated1));
+	CPPUNIT_ASSERT(shardedToken->deleteObject(obj3));
+	CPPUNIT_ASSERT(shardedToken->getObjects().size() == 1);
+	CPPUNIT_ASSERT(sameToken.getObjects().size() == 1);
+
+	delete shardedToken;
+
+	// The sharded token can still be used without sharding
+	OSToken::setSharding(false);
+
+#ifndef _WIN32
+	OSToken flatToken("./testdir/testToken");
+#else
+	OSToken flatToken(".\\testdir\\testToken");
+#endif
+
+	CPPUNIT_ASSERT(flatToken.isValid());
+
+	objects = flatToken.getObjects();
+	CPPUNIT_ASSERT(objects.size() == 1);
+	CPPUNIT_ASSERT((*objects.begin())->getAttribute(CKA_ID).getByteStringValue() == id[1]);
+
+	// And it can be removed completely
+	CPPUNIT_ASSERT(flatToken.clearToken());
+	CPPUNIT_ASSERT(!flatToken.isValid());
+}
+
+void OSTokenTests::testStaleTempFiles()
+{
+#ifndef _WIN32
+	ByteString label = "40414243"; // ABCD
+	ByteString serial = "0102030405060708";
+
+	OSToken* newToken = OSToken::createToken("./testdir", "newToken", label, serial);
+
+	CPPUNIT_ASSERT(newToken != NULL);
+
+	delete newToken;
+
+	// Leave an old and a recent temporary file behind
+	CPPUNIT_ASSERT(!system("touch ./testdir/newToken/stale.object.tmp ./testdir/newToken/recent.object.tmp"));
+
+	struct utimbuf old;
+	old.actime = old.modtime = time(NULL) - 3600;
+
+	CPPUNIT_ASSERT(!utime("./testdir/newToken/stale.object.tmp", &old));
+
+	// Indexing the token removes the old one only
+	OSToken reopenedToken("./testdir/newToken");
+
+	CPPUNIT_ASSERT(reopenedToken.isValid());
+	CPPUNIT_ASSERT(reopenedToken.getObjects().size() == 0);
+
+	Directory tokenDir("./testdir/newToken");
+	std::vector<std::string> files = tokenDir.getFiles();
+	bool stale = false, recent = false;
+
+	for (std::vector<std::string>::iterator i = files.begin(); i != files.end(); i++)
+	{
+		if (*i == "stale.object.tmp") stale = true;
+		if (*i == "recent.object.tmp") recent = true;
+	}
+
+	CPPUNIT_ASSERT(!stale);
+	CPPUNIT_ASSERT(recent);
+#endif
+}
@@ -909,3 +909,129 @@ void ObjectFileTests::testDestroyObjectFails()
 	CPPUNIT_ASSERT(!testIF->destroyObject());
 }
 
+
+static std::vector<std::string> getBlobFiles()
+{
+	Directory testDir("testdir");
+	std::vector<std::string> files = testDir.getFiles();
+	std::vector<std::string> blobFiles;
+
+	for (std::vector<std::string>::iterator i = files.begin(); i != files.end(); i++)
+	{
+		if ((i->size() > 5) && !i->substr(i->size() - 5).compare(".blob"))
+		{
+			blobFiles.push_back(*i);
+		}
+	}
+
+	return blobFiles;
+}
+
+void ObjectFileTests::testBlobAttr()
+{
+	ByteString label = "4C6162656C"; // Label
+	ByteString smallValue = "0102030405060708";
+	ByteString largeValue;
+	largeValue.resize(4096);
+	memset(&largeValue[0], 0x5A, largeValue.size());
+
+	ObjectFile::setBlobSize(1024);
+
+	// Create the test object
+	{
+#ifndef _WIN32
+		ObjectFile testObject(NULL, "testdir/test.object", "testdir/test.lock", true);
+#else
+		ObjectFile testObject(NULL, "testdir\\test.object", "testdir\\test.lock", true);
+#endif
+
+		CPPUNIT_ASSERT(testObject.isValid());
+
+		CPPUNIT_ASSERT(testObject.startTransaction(OSObject::ReadWrite));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_LABEL, label));
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_VALUE, largeValue));
+		CPPUNIT_ASSERT(testObject.commitTransaction());
+	}
+
+	// Only the large value is in a blob file
+	CPPUNIT_ASSERT(getBlobFiles().size() == 1);
+
+	// The large value is read when it is used
+	{
+#ifndef _WIN32
+		ObjectFile testObject(NULL, "testdir/test.object", "testdir/test.lock");
+#else
+		ObjectFile testObject(NULL, "testdir\\test.object", "testdir\\test.lock");
+#endif
+
+		CPPUNIT_ASSERT(testObject.isValid());
+		CPPUNIT_ASSERT(testObject.attributeExists(CKA_LABEL));
+		CPPUNIT_ASSERT(testObject.attributeExists(CKA_VALUE));
+		CPPUNIT_ASSERT(testObject.nextAttributeType(CKA_LABEL) == CKA_VALUE);
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == label);
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_VALUE) == largeValue);
+
+		// Changing another attribute keeps the blob file
+		std::vector<std::string> blobFiles = getBlobFiles();
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_ID, smallValue));
+		CPPUNIT_ASSERT(getBlobFiles() == blobFiles);
+
+		// A value that shrinks moves back into the object file
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_VALUE, smallValue));
+		CPPUNIT_ASSERT(getBlobFiles().empty());
+
+		// A value that grows moves into a blob file
+		CPPUNIT_ASSERT(testObject.setAttribute(CKA_VALUE, largeValue));
+		CPPUNIT_ASSERT(getBlobFiles().size() == 1);
+	}
+
+	// A value whose blob file was replaced by another writer is read again
+	{
+		ByteString otherValue;
+		otherValue.resize(4096);
+		memset(&otherValue[0], 0xA5, otherValue.size());
+
+#ifndef _WIN32
+		ObjectFile reader(NULL, "testdir/test.object", "testdir/test.lock");
+		ObjectFile writer(NULL, "testdir/test.object", "testdir/test.lock");
+#else
+		ObjectFile reader(NULL, "testdir\\test.object", "testdir\\test.lock");
+		ObjectFile writer(NULL, "testdir\\test.object", "testdir\\test.lock");
+#endif
+
+		CPPUNIT_ASSERT(reader.isValid());
+		CPPUNIT_ASSERT(writer.isValid());
+
+		CPPUNIT_ASSERT(writer.setAttribute(CKA_VALUE, otherValue));
+		CPPUNIT_ASSERT(getBlobFiles().size() == 1);
+
+		CPPUNIT_ASSERT(reader.getByteStringValue(CKA_VALUE) == otherValue);
+
+		CPPUNIT_ASSERT(writer.setAttribute(CKA_VALUE, largeValue));
+	}
+
+	// Metadata reads never touch the blob file
+	{
+		std::vector<std::string> blobFiles = getBlobFiles();
+		Directory testDir("testdir");
+		CPPUNIT_ASSERT(testDir.remove(blobFiles[0]));
+
+#ifndef _WIN32
+		ObjectFile testObject(NULL, "testdir/test.object", "testdir/test.lock");
+#else
+		ObjectFile testObject(NULL, "testdir\\test.object", "testdir\\test.lock");
+#endif
+
+		CPPUNIT_ASSERT(testObject.isValid());
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_LABEL) == label);
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_ID) == smallValue);
+		CPPUNIT_ASSERT(testObject.attributeExists(CKA_VALUE));
+		CPPUNIT_ASSERT(testObject.getByteStringValue(CKA_VALUE).size() == 0);
+
+		// Deleting the attribute drops the reference to the blob file
+		CPPUNIT_ASSERT(testObject.deleteAttribute(CKA_VALUE));
+		CPPUNIT_ASSERT(!testObject.attributeExists(CKA_VALUE));
+	}
+
+	ObjectFile::setBlobSize(0);
+}
@@ -49,6 +49,7 @@ class ObjectFileTests : public CppUnit::TestFixture
 	CPPUNIT_TEST(testCorruptFile);
 	CPPUNIT_TEST(testTransactions);
 	CPPUNIT_TEST(testDestroyObjectFails);
+	CPPUNIT_TEST(testBlobAttr);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -63,6 +64,7 @@ public:
 	void testCorruptFile();
 	void testTransactions();
 	void testDestroyObjectFails();
+	void testBlobAttr();
 
 	void setUp();
 	void tearDown();
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectIndexTests.cpp
+
+ Contains test cases to test the object index
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "ObjectIndexTests.h"
+#include "ObjectIndex.h"
+#include "SessionObjectStore.h"
+#include "SessionObject.h"
+#include "OSToken.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ObjectIndexTests);
+
+void ObjectIndexTests::setUp()
+{
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+
+	// Only the stores created from now on use an index
+	ObjectIndex::setEnabled(true);
+}
+
+void ObjectIndexTests::tearDown()
+{
+	ObjectIndex::setEnabled(false);
+
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void ObjectIndexTests::testSessionObjects()
+{
+	ByteString subject1 = "3011310F300D06035504030C064F626A31";
+	ByteString subject2 = "3011310F300D06035504030C064F626A32";
+	OSAttribute isPrivate(true);
+	OSAttribute isPublic(false);
+
+	SessionObjectStore* testStore = new SessionObjectStore();
+
+	// Two public objects with a different subject and a private object
+	SessionObject* obj1 = testStore->createObject(1, 1);
+	CPPUNIT_ASSERT(obj1 != NULL);
+	SessionObject* obj2 = testStore->createObject(1, 1);
+	CPPUNIT_ASSERT(obj2 != NULL);
+	SessionObject* obj3 = testStore->createObject(1, 1, true);
+	CPPUNIT_ASSERT(obj3 != NULL);
+	SessionObject* obj4 = testStore->createObject(2, 1);
+	CPPUNIT_ASSERT(obj4 != NULL);
+
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_PRIVATE, isPublic));
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_SUBJECT, subject1));
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_PRIVATE, isPublic));
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_SUBJECT, subject2));
+	CPPUNIT_ASSERT(obj3->setAttribute(CKA_PRIVATE, isPrivate));
+	CPPUNIT_ASSERT(obj3->setAttribute(CKA_SUBJECT, subject1));
+	CPPUNIT_ASSERT(obj4->setAttribute(CKA_PRIVATE, isPublic));
+	CPPUNIT_ASSERT(obj4->setAttribute(CKA_SUBJECT, subject1));
+
+	// Search by the first subject
+	CK_ATTRIBUTE findTemplate[] = {
+		{ CKA_SUBJECT, subject1.byte_str(), subject1.size() }
+	};
+	std::set<OSObject*> candidates;
+
+	testStore->findObjects(1, findTemplate, 1, candidates);
+
+	// The private object is always a candidate, the other slot never is
+	CPPUNIT_ASSERT(candidates.size() == 2);
+	CPPUNIT_ASSERT(candidates.count(obj1) == 1);
+	CPPUNIT_ASSERT(candidates.count(obj3) == 1);
+
+	// Change the subject of the second object
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_SUBJECT, subject1));
+
+	candidates.clear();
+	testStore->findObjects(1, findTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 3);
+	CPPUNIT_ASSERT(candidates.count(obj2) == 1);
+
+	// Nothing public has the second subject anymore
+	findTemplate[0].pValue = subject2.byte_str();
+
+	candidates.clear();
+	testStore->findObjects(1, findTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 1);
+	CPPUNIT_ASSERT(candidates.count(obj3) == 1);
+
+	// Deleted objects are no candidates
+	CPPUNIT_ASSERT(testStore->deleteObject(obj3));
+
+	candidates.clear();
+	testStore->findObjects(1, findTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT(candidates.empty());
+
+	// A template without indexed attributes returns all objects
+	CK_OBJECT_CLASS certClass = CKO_CERTIFICATE;
+	CK_ATTRIBUTE classTemplate[] = {
+		{ CKA_CLASS, &certClass, sizeof(certClass) }
+	};
+
+	candidates.clear();
+	testStore->findObjects(1, classTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 2);
+
+	delete testStore;
+}
+
+void ObjectIndexTests::testTokenObjects()
+{
+	ByteString label = "AABBCCDDEEFF";
+	ByteString serial = "1234567890";
+	ByteString issuer = "3011310F300D06035504030C064973737565";
+	ByteString serialNumber1 = "020101";
+	ByteString serialNumber2 = "020102";
+	OSAttribute isPublic(false);
+
+#ifndef _WIN32
+	OSToken* testToken = OSToken::createToken("./testdir", "testToken", label, serial);
+#else
+	OSToken* testToken = OSToken::createToken(".\\testdir", "testToken", label, serial);
+#endif
+
+	CPPUNIT_ASSERT(testToken != NULL);
+	CPPUNIT_ASSERT(testToken->isValid());
+
+	// Two certificates of the same issuer
+	OSObject* obj1 = testToken->createObject();
+	CPPUNIT_ASSERT(obj1 != NULL);
+	OSObject* obj2 = testToken->createObject();
+	CPPUNIT_ASSERT(obj2 != NULL);
+
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_PRIVATE, isPublic));
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_ISSUER, issuer));
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_SERIAL_NUMBER, serialNumber1));
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_PRIVATE, isPublic));
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_ISSUER, issuer));
+	CPPUNIT_ASSERT(obj2->setAttribute(CKA_SERIAL_NUMBER, serialNumber2));
+
+	// Search by issuer and serial number
+	CK_ATTRIBUTE findTemplate[] = {
+		{ CKA_ISSUER, issuer.byte_str(), issuer.size() },
+		{ CKA_SERIAL_NUMBER, serialNumber2.byte_str(), serialNumber2.size() }
+	};
+	std::set<OSObject*> candidates;
+
+	testToken->findObjects(findTemplate, 2, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 1);
+	CPPUNIT_ASSERT(candidates.count(obj2) == 1);
+
+	// Search by issuer only
+	candidates.clear();
+	testToken->findObjects(findTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 2);
+
+	// Deleted objects are no candidates
+	CPPUNIT_ASSERT(testToken->deleteObject(obj2));
+
+	candidates.clear();
+	testToken->findObjects(findTemplate, 2, candidates);
+
+	CPPUNIT_ASSERT(candidates.empty());
+
+	// The objects are indexed again when the token is reopened
+#ifndef _WIN32
+	OSToken sameToken("./testdir/testToken");
+#else
+	OSToken sameToken(".\\testdir\\testToken");
+#endif
+
+	CPPUNIT_ASSERT(sameToken.isValid());
+
+	findTemplate[1].pValue = serialNumber1.byte_str();
+
+	candidates.clear();
+	sameToken.findObjects(findTemplate, 2, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 1);
+
+	// A change made through the other instance, as by another process,
+	// is found as well
+	ByteString serialNumber3 = "020103";
+
+	candidates.clear();
+	testToken->findObjects(findTemplate, 2, candidates);
+
+	CPPUNIT_ASSERT(candidates.count(obj1) == 1);
+
+	candidates.clear();
+	sameToken.findObjects(findTemplate, 2, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 1);
+	CPPUNIT_ASSERT((*candidates.begin())->setAttribute(CKA_SERIAL_NUMBER, serialNumber3));
+
+	findTemplate[1].pValue = serialNumber3.byte_str();
+
+	candidates.clear();
+	testToken->findObjects(findTemplate, 2, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 1);
+	CPPUNIT_ASSERT(candidates.count(obj1) == 1);
+
+	delete testToken;
+}
+
+void ObjectIndexTests::testDisabled()
+{
+	ByteString subject = "3011310F300D06035504030C064F626A31";
+	OSAttribute isPublic(false);
+
+	ObjectIndex::setEnabled(false);
+
+	SessionObjectStore* testStore = new SessionObjectStore();
+
+	SessionObject* obj1 = testStore->createObject(1, 1);
+	CPPUNIT_ASSERT(obj1 != NULL);
+	SessionObject* obj2 = testStore->createObject(1, 1);
+	CPPUNIT_ASSERT(obj2 != NULL);
+
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_PRIVATE, isPublic));
+	CPPUNIT_ASSERT(obj1->setAttribute(CKA_SUBJECT, subject));
+
+	// Without an index all objects are candidates
+	CK_ATTRIBUTE findTemplate[] = {
+		{ CKA_SUBJECT, subject.byte_str(), subject.size() }
+	};
+	std::set<OSObject*> candidates;
+
+	testStore->findObjects(1, findTemplate, 1, candidates);
+
+	CPPUNIT_ASSERT(candidates.size() == 2);
+
+	delete testStore;
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ UsageStoreTests.cpp
+
+ Contains test cases to test the usage counters of objects and the store
+ that saves them
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <set>
+#include <cppunit/extensions/HelperMacros.h>
+#include "UsageStoreTests.h"
+#include "UsageStore.h"
+#include "KeyUsage.h"
+#include "ObjectStore.h"
+#include "ObjectStoreToken.h"
+#include "OSObject.h"
+#include "OSAttribute.h"
+#include "cryptoki.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(UsageStoreTests);
+
+#ifndef _WIN32
+#define TESTDIR "./testdir"
+#define USAGEFILE "./testdir/usage"
+#else
+#define TESTDIR ".\\testdir"
+#define USAGEFILE ".\\testdir\\usage"
+#endif
+
+void UsageStoreTests::setUp()
+{
+	CPPUNIT_ASSERT(!system("mkdir testdir"));
+}
+
+void UsageStoreTests::tearDown()
+{
+#ifndef _WIN32
+	CPPUNIT_ASSERT(!system("rm -rf testdir"));
+#else
+	CPPUNIT_ASSERT(!system("rmdir /s /q testdir 2> nul"));
+#endif
+}
+
+void UsageStoreTests::testCount()
+{
+	KeyUsage usage;
+
+	CPPUNIT_ASSERT(usage.getTotal() == 0);
+	CPPUNIT_ASSERT(usage.getLastUsed() == 0);
+	CPPUNIT_ASSERT(!usage.isSeeded());
+
+	usage.count(KeyUsage::Sign);
+	usage.count(KeyUsage::Sign);
+	usage.count(KeyUsage::Unwrap, 3);
+
+	CPPUNIT_ASSERT(usage.getCount(KeyUsage::Sign) == 2);
+	CPPUNIT_ASSERT(usage.getCount(KeyUsage::Unwrap) == 3);
+	CPPUNIT_ASSERT(usage.getCount(KeyUsage::Verify) == 0);
+	CPPUNIT_ASSERT(usage.getTotal() == 5);
+	CPPUNIT_ASSERT(usage.getLastUsed() != 0);
+
+	// The saved counters are added once
+	unsigned long long saved[KeyUsage::OperationCount] = { 10, 0, 0, 0, 0, 0, 0 };
+	time_t lastUsed = usage.getLastUsed();
+
+	usage.seed(saved, 1);
+	CPPUNIT_ASSERT(usage.isSeeded());
+	CPPUNIT_ASSERT(usage.getCount(KeyUsage::Sign) == 12);
+	CPPUNIT_ASSERT(usage.getLastUsed() == lastUsed);
+
+	usage.seed(saved, lastUsed + 100);
+	CPPUNIT_ASSERT(usage.getCount(KeyUsage::Sign) == 12);
+	CPPUNIT_ASSERT(usage.getLastUsed() == lastUsed);
+}
+
+void UsageStoreTests::testSaveLoad()
+{
+	ByteString label = "DEADBEEF";
+	ByteString serial;
+	std::string hotId, coldId;
+
+	{
+		ObjectStore store(TESTDIR);
+		ObjectStoreToken* token = store.newToken(label);
+		CPPUNIT_ASSERT(token != NULL);
+		CPPUNIT_ASSERT(token->getTokenSerial(serial));
+
+		OSObject* hot = token->createObject();
+		OSObject* cold = token->createObject();
+		CPPUNIT_ASSERT(hot != NULL && cold != NULL);
+
+		OSAttribute keyClass((unsigned long)CKO_SECRET_KEY);
+		CPPUNIT_ASSERT(hot->setAttribute(CKA_CLASS, keyClass));
+		CPPUNIT_ASSERT(cold->setAttribute(CKA_CLASS, keyClass));
+
+		hotId = hot->getPersistentId();
+		coldId = cold->getPersistentId();
+		CPPUNIT_ASSERT(!hotId.empty());
+		CPPUNIT_ASSERT(hotId != coldId);
+
+		UsageStore usageStore(USAGEFILE, &store, 0);
+
+		// There is no file yet
+		CPPUNIT_ASSERT(usageStore.load());
+
+		// Nothing is written if nothing changed
+		CPPUNIT_ASSERT(usageStore.save());
+		FILE* fp = fopen(USAGEFILE, "r");
+		CPPUNIT_ASSERT(fp == NULL);
+
+		usageStore.seed(serial, hot);
+		hot->getUsage()->count(KeyUsage::Decrypt, 4);
+		hot->getUsage()->count(KeyUsage::Derive);
+		usageStore.setChanged();
+
+		CPPUNIT_ASSERT(usageStore.save());
+		fp = fopen(USAGEFILE, "r");
+		CPPUNIT_ASSERT(fp != NULL);
+		fclose(fp);
+	}
+
+	// Reopen the store as a new run would
+	ObjectStore store(TESTDIR);
+	CPPUNIT_ASSERT(store.getTokenCount() == 1);
+	ObjectStoreToken* token = store.getToken(0);
+
+	std::set<OSObject*> objects;
+	token->getObjects(objects);
+	CPPUNIT_ASSERT(objects.size() == 2);
+
+	OSObject* hot = NULL;
+	OSObject* cold = NULL;
+	for (std::set<OSObject*>::iterator i = objects.begin(); i != objects.end(); i++)
+	{
+		if ((*i)->getPersistentId() == hotId) hot = *i;
+		if ((*i)->getPersistentId() == coldId) cold = *i;
+	}
+	CPPUNIT_ASSERT(hot != NULL && cold != NULL);
+	CPPUNIT_ASSERT(hot->getUsage()->getTotal() == 0);
+
+	UsageStore usageStore(USAGEFILE, &store, 0);
+	CPPUNIT_ASSERT(usageStore.load());
+
+	// The saved counters are added to those of this run
+	hot->getUsage()->count(KeyUsage::Decrypt);
+	usageStore.seed(serial, hot);
+	usageStore.seed(serial, cold);
+	usageStore.seed(serial, hot);
+
+	CPPUNIT_ASSERT(hot->getUsage()->getCount(KeyUsage::Decrypt) == 5);
+	CPPUNIT_ASSERT(hot->getUsage()->getCount(KeyUsage::Derive) == 1);
+	CPPUNIT_ASSERT(hot->getUsage()->getLastUsed() != 0);
+	CPPUNIT_ASSERT(cold->getUsage()->getTotal() == 0);
+	CPPUNIT_ASSERT(cold->getUsage()->isSeeded());
+}
+
+void UsageStoreTests::testMerge()
+{
+	ByteString label = "DEADBEEF";
+	ByteString serial;
+	std::string id;
+
+	// Two processes that use the same token and usage file
+	ObjectStore store1(TESTDIR);
+	ObjectStoreToken* token1 = store1.newToken(label);
+	CPPUNIT_ASSERT(token1 != NULL);
+	CPPUNIT_ASSERT(token1->getTokenSerial(serial));
+
+	OSObject* key1 = token1->createObject();
+	CPPUNIT_ASSERT(key1 != NULL);
+	OSAttribute keyClass((unsigned long)CKO_PRIVATE_KEY);
+	CPPUNIT_ASSERT(key1->setAttribute(CKA_CLASS, keyClass));
+	id = key1->getPersistentId();
+
+	ObjectStore store2(TESTDIR);
+	CPPUNIT_ASSERT(store2.getTokenCount() == 1);
+	std::set<OSObject*> objects;
+	store2.getToken(0)->getObjects(objects);
+	CPPUNIT_ASSERT(objects.size() == 1);
+	OSObject* key2 = *objects.begin();
+	CPPUNIT_ASSERT(key2->getPersistentId() == id);
+
+	UsageStore usageStore1(USAGEFILE, &store1, 0);
+	UsageStore usageStore2(USAGEFILE, &store2, 0);
+	CPPUNIT_ASSERT(usageStore1.load());
+	CPPUNIT_ASSERT(usageStore2.load());
+
+	key1->getUsage()->count(KeyUsage::Sign, 2);
+	usageStore1.setChanged();
+	CPPUNIT_ASSERT(usageStore1.save());
+
+	// The second process adds its uses to those of the first one
+	key2->getUsage()->count(KeyUsage::Sign, 3);
+	key2->getUsage()->count(KeyUsage::Unwrap);
+	usageStore2.setChanged();
+	CPPUNIT_ASSERT(usageStore2.save());
+
+	// The uses that were saved already are not added again
+	key1->getUsage()->count(KeyUsage::Sign);
+	usageStore1.setChanged();
+	CPPUNIT_ASSERT(usageStore1.save());
+	usageStore2.setChanged();
+	CPPUNIT_ASSERT(usageStore2.save());
+
+	// A new run sees the uses of both
+	ObjectStore store(TESTDIR);
+	objects.clear();
+	store.getToken(0)->getObjects(objects);
+	CPPUNIT_ASSERT(objects.size() == 1);
+	OSObject* key = *objects.begin();
+
+	UsageStore usageStore(USAGEFILE, &store, 0);
+	CPPUNIT_ASSERT(usageStore.load());
+	usageStore.seed(serial, key);
+
+	CPPUNIT_ASSERT(key->getUsage()->getCount(KeyUsage::Sign) == 6);
+	CPPUNIT_ASSERT(key->getUsage()->getCount(KeyUsage::Unwrap) == 1);
+	CPPUNIT_ASSERT(key->getUsage()->getTotal() == 7);
+}
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ softhsm2_vendor.h
+
+ SoftHSM specific extensions to the PKCS #11 API. They are exported by the
+ library next to the standard functions and can be looked up by name.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM2_VENDOR_H
+#define _SOFTHSM2_VENDOR_H
+
+#include "cryptoki.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The result of an asynchronous operation, returned by
+// C_SoftHSM_HarvestCompletions: the tag passed when the operation was
+// submitted and the return value it would have had as a synchronous call.
+typedef struct CK_SOFTHSM_COMPLETION {
+	CK_VOID_PTR pTag;
+	CK_RV rv;
+} CK_SOFTHSM_COMPLETION;
+
+typedef CK_SOFTHSM_COMPLETION CK_PTR CK_SOFTHSM_COMPLETION_PTR;
+
+// One segment of the data passed to the vectored update functions. The
+// segments are processed in order, as if they were one buffer.
+typedef struct CK_SOFTHSM_SEGMENT {
+	CK_BYTE_PTR pData;
+	CK_ULONG ulLen;
+} CK_SOFTHSM_SEGMENT;
+
+typedef CK_SOFTHSM_SEGMENT CK_PTR CK_SOFTHSM_SEGMENT_PTR;
+
+// The state of the scheduler of expensive operations, returned by
+// C_SoftHSM_GetSchedulerInfo. All fields are 0 if it is not enabled.
+typedef struct CK_SOFTHSM_SCHEDULER_INFO {
+	CK_ULONG ulWorkers;	// threads that run the expensive operations
+	CK_ULONG ulQueued;	// operations waiting for a thread
+	CK_ULONG ulRunning;	// operations running on a thread
+	CK_ULONG ulMaxQueued;	// the largest number of waiting operations so far
+	CK_ULONG ulCompleted;	// operations that have finished
+	CK_ULONG ulRejected;	// operations refused by the slot or session limit
+} CK_SOFTHSM_SCHEDULER_INFO;
+
+typedef CK_SOFTHSM_SCHEDULER_INFO CK_PTR CK_SOFTHSM_SCHEDULER_INFO_PTR;
+
+// The usage counters of a key, returned by C_SoftHSM_GetKeyUsage. The
+// counters are those of successful operations since the object was loaded,
+// plus those saved by earlier runs if usage.file is set.
+typedef struct CK_SOFTHSM_KEY_USAGE {
+	CK_OBJECT_HANDLE hKey;
+	CK_ULONG ulSign;	// sign operations started
+	CK_ULONG ulVerify;	// verify operations started
+	CK_ULONG ulEncrypt;	// encrypt operations started
+	CK_ULONG ulDecrypt;	// decrypt operations started
+	CK_ULONG ulDerive;	// keys derived
+	CK_ULONG ulWrap;	// keys wrapped
+	CK_ULONG ulUnwrap;	// keys unwrapped
+	CK_ULONG ulLastUsed;	// seconds since the epoch; 0 if not used
+} CK_SOFTHSM_KEY_USAGE;
+
+typedef CK_SOFTHSM_KEY_USAGE CK_PTR CK_SOFTHSM_KEY_USAGE_PTR;
+
+// Flags of C_SoftHSM_GetKeyUsage
+#define CKF_SOFTHSM_USAGE_LEAST_USED	0x00000001UL
+
+// Wrap the keys phKeys[0..ulKeyCount-1] with one wrapping key and mechanism.
+// Wrapped key i goes to ppWrappedKeys[i], whose size is passed in and
+// returned in pulWrappedKeyLens[i]. With ppWrappedKeys set to NULL_PTR only
+// the lengths are returned. All keys are checked before any is wrapped.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_WrapKeyBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hWrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_OBJECT_HANDLE_PTR phKeys,
+	CK_BYTE_PTR CK_PTR ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens
+);
+
+// Unwrap the blobs ppWrappedKeys[0..ulKeyCount-1] with one unwrapping key and
+// mechanism into new objects using the templates ppTemplates[i]. Either all
+// objects are created and returned in phKeys, or none of them is.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_UnwrapKeyBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hUnwrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_BYTE_PTR CK_PTR ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens,
+	CK_ATTRIBUTE_PTR CK_PTR ppTemplates,
+	CK_ULONG_PTR pulCounts,
+	CK_OBJECT_HANDLE_PTR phKeys
+);
+
+// The asynchronous functions queue the operation on the internal workers and
+// return at once. The buffers, templates, mechanism parameters and handles
+// that are passed must stay valid until the completion with the same pTag has
+// been harvested. The operations of one session run in submission order.
+// Signing and decryption run on an internal session, so they do not affect
+// an operation that is active on the session. C_Finalize completes the
+// operations that have not started with CKR_CRYPTOKI_NOT_INITIALIZED. They
+// require C_Initialize to have been called with CKF_OS_LOCKING_OK.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_SignAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_BYTE_PTR pSignature,
+	CK_ULONG_PTR pulSignatureLen,
+	CK_VOID_PTR pTag
+);
+
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_DecryptAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pEncryptedData,
+	CK_ULONG ulEncryptedDataLen,
+	CK_BYTE_PTR pData,
+	CK_ULONG_PTR pulDataLen,
+	CK_VOID_PTR pTag
+);
+
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_DeriveKeyAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hBaseKey,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+);
+
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_GenerateKeyAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+);
+
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_GenerateKeyPairAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_OBJECT_HANDLE_PTR phPublicKey,
+	CK_OBJECT_HANDLE_PTR phPrivateKey,
+	CK_VOID_PTR pTag
+);
+
+// Return a descriptor that can be polled; it is readable while completions
+// are waiting to be harvested. It is owned by the library.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_GetAsyncEventFd)
+(
+	int* pFd
+);
+
+// Take up to ulMaxCount completions, in the order in which the operations
+// finished. Returns CKR_OK with *pulCount set to 0 if there are none. The
+// completions remain available after C_Finalize, until asynchronous
+// operations are used again after the next C_Initialize.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_HarvestCompletions)
+(
+	CK_SOFTHSM_COMPLETION_PTR pCompletions,
+	CK_ULONG ulMaxCount,
+	CK_ULONG_PTR pulCount
+);
+
+// Continue a multi-part encryption with the data in the segments
+// pSegments[0..ulSegmentCount-1], like one call to C_EncryptUpdate with
+// that data in one buffer. The output buffer is handled as there.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_EncryptUpdateV)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount,
+	CK_BYTE_PTR pEncryptedPart,
+	CK_ULONG_PTR pulEncryptedPartLen
+);
+
+// Continue a multi-part digest with the data in the segments
+// pSegments[0..ulSegmentCount-1], like one call to C_DigestUpdate.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_DigestUpdateV)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount
+);
+
+// Digest the messages ppData[0..ulCount-1], of pulDataLens[i] bytes each,
+// independently with one mechanism. The digests are returned one after the
+// other in pDigests, whose size is passed in and returned in *pulDigestsLen;
+// digest i starts at i times the digest size of the mechanism. With pDigests
+// set to NULL_PTR only the size is returned. The session is only checked; an
+// operation that is active in it is not affected.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_DigestBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ULONG ulCount,
+	CK_BYTE_PTR CK_PTR ppData,
+	CK_ULONG_PTR pulDataLens,
+	CK_BYTE_PTR pDigests,
+	CK_ULONG_PTR pulDigestsLen
+);
+
+// Return the queue depth and counters of the scheduler that runs expensive
+// operations, such as RSA key generation, on a bounded pool of threads.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_GetSchedulerInfo)
+(
+	CK_SOFTHSM_SCHEDULER_INFO_PTR pInfo
+);
+
+// Generate ulCount EC or EDDSA key pairs, with CKM_EC_KEY_PAIR_GEN or
+// CKM_EC_EDWARDS_KEY_PAIR_GEN, from one pair of templates. Key pair i is
+// returned in phPublicKeys[i] and phPrivateKeys[i]. Either all key pairs are
+// created or none of them is.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_GenerateKeyPairBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phPublicKeys,
+	CK_OBJECT_HANDLE_PTR phPrivateKeys
+);
+
+// Return the usage counters of the keys of the token of the session that the
+// session can see, most used first. Keys that have not been used are left
+// out. With CKF_SOFTHSM_USAGE_LEAST_USED in flags the least used keys are
+// returned first, including those that have not been used. At most *pulCount
+// keys are returned and *pulCount is set to the number returned; with pUsage
+// set to NULL_PTR it is set to the number of keys that would be returned.
+CK_DECLARE_FUNCTION(CK_RV, C_SoftHSM_GetKeyUsage)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_FLAGS flags,
+	CK_SOFTHSM_KEY_USAGE_PTR pUsage,
+	CK_ULONG_PTR pulCount
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_WrapKeyBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hWrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_OBJECT_HANDLE_PTR phKeys,
+	CK_BYTE_PTR CK_PTR ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_UnwrapKeyBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hUnwrappingKey,
+	CK_ULONG ulKeyCount,
+	CK_BYTE_PTR CK_PTR ppWrappedKeys,
+	CK_ULONG_PTR pulWrappedKeyLens,
+	CK_ATTRIBUTE_PTR CK_PTR ppTemplates,
+	CK_ULONG_PTR pulCounts,
+	CK_OBJECT_HANDLE_PTR phKeys
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_SignAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pData,
+	CK_ULONG ulDataLen,
+	CK_BYTE_PTR pSignature,
+	CK_ULONG_PTR pulSignatureLen,
+	CK_VOID_PTR pTag
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_DecryptAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hKey,
+	CK_BYTE_PTR pEncryptedData,
+	CK_ULONG ulEncryptedDataLen,
+	CK_BYTE_PTR pData,
+	CK_ULONG_PTR pulDataLen,
+	CK_VOID_PTR pTag
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_DeriveKeyAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_OBJECT_HANDLE hBaseKey,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_GenerateKeyAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pTemplate,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phKey,
+	CK_VOID_PTR pTag
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_GenerateKeyPairAsync)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_OBJECT_HANDLE_PTR phPublicKey,
+	CK_OBJECT_HANDLE_PTR phPrivateKey,
+	CK_VOID_PTR pTag
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_GetAsyncEventFd)
+(
+	int* pFd
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_HarvestCompletions)
+(
+	CK_SOFTHSM_COMPLETION_PTR pCompletions,
+	CK_ULONG ulMaxCount,
+	CK_ULONG_PTR pulCount
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_EncryptUpdateV)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount,
+	CK_BYTE_PTR pEncryptedPart,
+	CK_ULONG_PTR pulEncryptedPartLen
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_DigestUpdateV)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_SOFTHSM_SEGMENT_PTR pSegments,
+	CK_ULONG ulSegmentCount
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_DigestBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ULONG ulCount,
+	CK_BYTE_PTR CK_PTR ppData,
+	CK_ULONG_PTR pulDataLens,
+	CK_BYTE_PTR pDigests,
+	CK_ULONG_PTR pulDigestsLen
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_GetSchedulerInfo)
+(
+	CK_SOFTHSM_SCHEDULER_INFO_PTR pInfo
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_GenerateKeyPairBatch)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_MECHANISM_PTR pMechanism,
+	CK_ATTRIBUTE_PTR pPublicKeyTemplate,
+	CK_ULONG ulPublicKeyAttributeCount,
+	CK_ATTRIBUTE_PTR pPrivateKeyTemplate,
+	CK_ULONG ulPrivateKeyAttributeCount,
+	CK_ULONG ulCount,
+	CK_OBJECT_HANDLE_PTR phPublicKeys,
+	CK_OBJECT_HANDLE_PTR phPrivateKeys
+);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_SoftHSM_GetKeyUsage)
+(
+	CK_SESSION_HANDLE hSession,
+	CK_FLAGS flags,
+	CK_SOFTHSM_KEY_USAGE_PTR pUsage,
+	CK_ULONG_PTR pulCount
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !_SOFTHSM2_VENDOR_H
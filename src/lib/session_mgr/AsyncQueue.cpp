@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AsyncQueue.cpp
+
+ Runs operations submitted through the asynchronous vendor API on a pool of
+ worker threads
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "AsyncQueue.h"
+
+#ifdef HAVE_CXX11
+#include <errno.h>
+#include <string.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <stdint.h>
+#include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Constructor
+AsyncQueue::AsyncQueue(size_t inWorkers)
+{
+	stopping = false;
+	eventFd[0] = -1;
+	eventFd[1] = -1;
+
+#if defined(HAVE_SYS_EVENTFD_H)
+	eventFd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (eventFd[0] == -1)
+	{
+		ERROR_MSG("Could not create the event descriptor: %s", strerror(errno));
+		return;
+	}
+#elif !defined(_WIN32)
+	if (pipe(eventFd) != 0)
+	{
+		ERROR_MSG("Could not create the event pipe: %s", strerror(errno));
+		eventFd[0] = -1;
+		eventFd[1] = -1;
+		return;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		fcntl(eventFd[i], F_SETFL, fcntl(eventFd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(eventFd[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	if (inWorkers == 0)
+	{
+		inWorkers = std::thread::hardware_concurrency();
+		if (inWorkers == 0) inWorkers = 1;
+	}
+
+	try
+	{
+		for (size_t i = 0; i < inWorkers; i++)
+		{
+			workers.push_back(std::thread(&AsyncQueue::work, this));
+		}
+	}
+	catch (...)
+	{
+		ERROR_MSG("Could only start %zu of %zu workers", workers.size(), inWorkers);
+	}
+}
+
+// Destructor
+AsyncQueue::~AsyncQueue()
+{
+	stop(CKR_CRYPTOKI_NOT_INITIALIZED);
+
+#ifndef _WIN32
+	if (eventFd[0] != -1) close(eventFd[0]);
+	if (eventFd[1] != -1) close(eventFd[1]);
+#endif
+}
+
+bool AsyncQueue::isValid()
+{
+#ifdef _WIN32
+	return !workers.empty();
+#else
+	return !workers.empty() && eventFd[0] != -1;
+#endif
+}
+
+void AsyncQueue::stop(CK_RV rv)
+{
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+
+		stopping = true;
+
+		// The running jobs complete themselves
+		for (std::map<CK_SESSION_HANDLE, SessionJobs>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+		{
+			while (!it->second.pending.empty())
+			{
+				complete(it->second.pending.front().pTag, rv);
+				it->second.pending.pop_front();
+			}
+		}
+		ready.clear();
+	}
+	jobsAvailable.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	workers.clear();
+}
+
+bool AsyncQueue::isStopped()
+{
+	std::lock_guard<std::mutex> lock(jobsMutex);
+
+	return stopping;
+}
+
+void AsyncQueue::abandon()
+{
+#ifndef _WIN32
+	if (eventFd[0] != -1) close(eventFd[0]);
+	if (eventFd[1] != -1) close(eventFd[1]);
+#endif
+	eventFd[0] = -1;
+	eventFd[1] = -1;
+}
+
+int AsyncQueue::getEventFd()
+{
+	return eventFd[0];
+}
+
+CK_RV AsyncQueue::submit(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, CK_VOID_PTR pTag, const std::function<CK_RV()>& run)
+{
+	Job job;
+	job.pTag = pTag;
+	job.run = run;
+
+	std::lock_guard<std::mutex> lock(jobsMutex);
+
+	if (stopping) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	std::map<CK_SESSION_HANDLE, SessionJobs>::iterator it = sessions.find(hSession);
+	if (it == sessions.end())
+	{
+		SessionJobs jobs;
+		jobs.slotID = slotID;
+		jobs.running = false;
+		it = sessions.insert(std::make_pair(hSession, jobs)).first;
+	}
+
+	it->second.pending.push_back(job);
+
+	// A session is in the ready list while it has jobs and none is running
+	if (!it->second.running && it->second.pending.size() == 1)
+	{
+		ready.push_back(hSession);
+		jobsAvailable.notify_one();
+	}
+
+	return CKR_OK;
+}
+
+CK_ULONG AsyncQueue::harvest(CK_SOFTHSM_COMPLETION_PTR pCompletions, CK_ULONG ulMaxCount)
+{
+	std::lock_guard<std::mutex> lock(completionsMutex);
+
+	CK_ULONG count = 0;
+	while (count < ulMaxCount && !completions.empty())
+	{
+		pCompletions[count++] = completions.front();
+		completions.pop_front();
+	}
+
+	if (count > 0 && completions.empty()) clearEvent();
+
+	return count;
+}
+
+void AsyncQueue::closeSession(CK_SESSION_HANDLE hSession)
+{
+	std::unique_lock<std::mutex> lock(jobsMutex);
+
+	cancel(lock, hSession);
+}
+
+void AsyncQueue::closeSessions(CK_SLOT_ID slotID)
+{
+	std::unique_lock<std::mutex> lock(jobsMutex);
+
+	std::vector<CK_SESSION_HANDLE> handles;
+	for (std::map<CK_SESSION_HANDLE, SessionJobs>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+	{
+		if (it->second.slotID == slotID) handles.push_back(it->first);
+	}
+
+	for (size_t i = 0; i < handles.size(); i++)
+	{
+		cancel(lock, handles[i]);
+	}
+}
+
+void AsyncQueue::work()
+{
+	std::unique_lock<std::mutex> lock(jobsMutex);
+
+	for (;;)
+	{
+		jobsAvailable.wait(lock, [this] { return stopping || !ready.empty(); });
+		if (stopping) return;
+
+		CK_SESSION_HANDLE hSession = ready.front();
+		ready.pop_front();
+
+		// The session may have been closed after it was put in the list
+		std::map<CK_SESSION_HANDLE, SessionJobs>::iterator it = sessions.find(hSession);
+		if (it == sessions.end() || it->second.running || it->second.pending.empty()) continue;
+
+		Job job = it->second.pending.front();
+		it->second.pending.pop_front();
+		it->second.running = true;
+
+		lock.unlock();
+
+		CK_RV rv;
+		try
+		{
+			rv = job.run();
+		}
+		catch (...)
+		{
+			ERROR_MSG("Exception in an asynchronous job");
+			rv = CKR_GENERAL_ERROR;
+		}
+
+		// Complete before the next job of the session can start, so that
+		// the completions of a session are in submission order
+		complete(job.pTag, rv);
+
+		lock.lock();
+
+		// The entry stays in place while running, see cancel()
+		it = sessions.find(hSession);
+		it->second.running = false;
+		if (!it->second.pending.empty())
+		{
+			ready.push_back(hSession);
+			jobsAvailable.notify_one();
+		}
+		else
+		{
+			sessions.erase(it);
+		}
+		jobDone.notify_all();
+	}
+}
+
+void AsyncQueue::cancel(std::unique_lock<std::mutex>& lock, CK_SESSION_HANDLE hSession)
+{
+	std::map<CK_SESSION_HANDLE, SessionJobs>::iterator it = sessions.find(hSession);
+	if (it == sessions.end()) return;
+
+	while (!it->second.pending.empty())
+	{
+		complete(it->second.pending.front().pTag, CKR_SESSION_CLOSED);
+		it->second.pending.pop_front();
+	}
+
+	if (it->second.running)
+	{
+		// The worker erases the entry, since nothing is pending anymore
+		jobDone.wait(lock, [this, hSession] { return sessions.find(hSession) == sessions.end(); });
+	}
+	else
+	{
+		sessions.erase(it);
+	}
+}
+
+void AsyncQueue::complete(CK_VOID_PTR pTag, CK_RV rv)
+{
+	CK_SOFTHSM_COMPLETION completion;
+	completion.pTag = pTag;
+	completion.rv = rv;
+
+	std::lock_guard<std::mutex> lock(completionsMutex);
+
+	completions.push_back(completion);
+
+	if (completions.size() == 1) signalEvent();
+}
+
+void AsyncQueue::signalEvent()
+{
+#if defined(HAVE_SYS_EVENTFD_H)
+	uint64_t one = 1;
+	if (write(eventFd[0], &one, sizeof(one)) != sizeof(one))
+	{
+		ERROR_MSG("Could not signal the event descriptor: %s", strerror(errno));
+	}
+#elif !defined(_WIN32)
+	char one = 1;
+	if (write(eventFd[1], &one, 1) != 1)
+	{
+		ERROR_MSG("Could not signal the event pipe: %s", strerror(errno));
+	}
+#endif
+}
+
+void AsyncQueue::clearEvent()
+{
+#if defined(HAVE_SYS_EVENTFD_H)
+	uint64_t value;
+	if (read(eventFd[0], &value, sizeof(value)) != sizeof(value) && errno != EAGAIN)
+	{
+		ERROR_MSG("Could not clear the event descriptor: %s", strerror(errno));
+	}
+#elif !defined(_WIN32)
+	char buffer[16];
+	while (read(eventFd[0], buffer, sizeof(buffer)) > 0);
+#endif
+}
+
+#endif // HAVE_CXX11
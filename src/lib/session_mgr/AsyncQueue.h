@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AsyncQueue.h
+
+ Runs operations submitted through the asynchronous vendor API on a pool of
+ worker threads. Jobs of the same session run one at a time in the order in
+ which they were submitted; jobs of different sessions run in parallel. The
+ result of every job is put in a completion queue, which is signalled through
+ a file descriptor that becomes readable while completions are waiting. Once
+ the queue is stopped, every job that did not run has a completion as well,
+ and the completions can still be harvested.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_ASYNCQUEUE_H
+#define _SOFTHSM_V2_ASYNCQUEUE_H
+
+#include "config.h"
+#include "cryptoki.h"
+#include "softhsm2_vendor.h"
+
+#ifdef HAVE_CXX11
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+class AsyncQueue
+{
+public:
+	// Constructor; starts the workers, one per CPU if inWorkers is 0
+	AsyncQueue(size_t inWorkers);
+
+	// Destructor; stops the queue
+	virtual ~AsyncQueue();
+
+	// Were the workers and the event descriptor set up?
+	bool isValid();
+
+	// Stop the workers; the jobs that have not started yet are completed
+	// with rv and the running ones finish first
+	void stop(CK_RV rv);
+
+	// Was the queue stopped?
+	bool isStopped();
+
+	// Close the event descriptor in a child of a fork; the workers were not
+	// forked along, so the queue cannot be used or deleted afterwards
+	void abandon();
+
+	// The descriptor that is readable while completions are waiting, or -1
+	int getEventFd();
+
+	// Queue a job for the session; its return value becomes the result
+	CK_RV submit(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, CK_VOID_PTR pTag, const std::function<CK_RV()>& run);
+
+	// Take up to ulMaxCount completions from the queue
+	CK_ULONG harvest(CK_SOFTHSM_COMPLETION_PTR pCompletions, CK_ULONG ulMaxCount);
+
+	// Complete the jobs of the session(s) that have not started yet with
+	// CKR_SESSION_CLOSED and wait until the running one has finished
+	void closeSession(CK_SESSION_HANDLE hSession);
+	void closeSessions(CK_SLOT_ID slotID);
+
+private:
+	// A submitted job
+	struct Job
+	{
+		CK_VOID_PTR pTag;
+		std::function<CK_RV()> run;
+	};
+
+	// The jobs of a session
+	struct SessionJobs
+	{
+		CK_SLOT_ID slotID;
+		std::deque<Job> pending;
+		bool running;
+	};
+
+	// The worker loop
+	void work();
+
+	// Move a completion to the queue and signal the descriptor
+	void complete(CK_VOID_PTR pTag, CK_RV rv);
+
+	// Drop the pending jobs of a session and wait for its running job;
+	// jobsMutex must be held through the lock
+	void cancel(std::unique_lock<std::mutex>& lock, CK_SESSION_HANDLE hSession);
+
+	// Set and clear the descriptor
+	void signalEvent();
+	void clearEvent();
+
+	// The jobs per session, and the sessions that have a job to run
+	std::map<CK_SESSION_HANDLE, SessionJobs> sessions;
+	std::deque<CK_SESSION_HANDLE> ready;
+	bool stopping;
+	std::mutex jobsMutex;
+	std::condition_variable jobsAvailable;
+	std::condition_variable jobDone;
+
+	// The finished jobs; completionsMutex may be taken while holding
+	// jobsMutex, but not the other way around
+	std::deque<CK_SOFTHSM_COMPLETION> completions;
+	std::mutex completionsMutex;
+
+	// The descriptors; eventFd[1] is only used for the pipe fallback
+	int eventFd[2];
+
+	std::vector<std::thread> workers;
+};
+
+#endif // HAVE_CXX11
+
+#endif // !_SOFTHSM_V2_ASYNCQUEUE_H
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ OpScheduler.cpp
+
+ Runs expensive operations on a bounded pool of background threads
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "OpScheduler.h"
+
+#ifdef HAVE_CXX11
+
+// Constructor
+OpScheduler::OpScheduler(size_t inWorkers, size_t inSlotLimit)
+{
+	slotLimit = inSlotLimit;
+	stopping = false;
+	running = 0;
+	maxQueued = 0;
+	completed = 0;
+	rejected = 0;
+
+	try
+	{
+		for (size_t i = 0; i < inWorkers; i++)
+		{
+			workers.push_back(std::thread(&OpScheduler::work, this));
+		}
+	}
+	catch (...)
+	{
+		ERROR_MSG("Could only start %zu of %zu workers", workers.size(), inWorkers);
+	}
+}
+
+// Destructor
+OpScheduler::~OpScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+		stopping = true;
+
+		// Release the callers of the operations that did not start
+		while (!queue.empty())
+		{
+			queue.front()->rv = CKR_CRYPTOKI_NOT_INITIALIZED;
+			queue.front()->done = true;
+			queue.pop_front();
+		}
+	}
+	jobsAvailable.notify_all();
+	jobDone.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+
+	// Wait until the callers have taken their return values
+	std::unique_lock<std::mutex> lock(jobsMutex);
+	jobDone.wait(lock, [this] { return sessionJobs.empty(); });
+}
+
+bool OpScheduler::isValid()
+{
+	return !workers.empty();
+}
+
+CK_RV OpScheduler::run(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, const std::function<CK_RV()>& op)
+{
+	Job job;
+	job.op = op;
+	job.rv = CKR_GENERAL_ERROR;
+	job.done = false;
+
+	std::unique_lock<std::mutex> lock(jobsMutex);
+
+	if (stopping) return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+	// Admission control
+	if (sessionJobs.count(hSession) != 0)
+	{
+		rejected++;
+		return CKR_OPERATION_ACTIVE;
+	}
+	if (slotLimit != 0 && slotJobs[slotID] >= slotLimit)
+	{
+		WARNING_MSG("Slot %lu has reached its limit of %zu expensive operations", slotID, slotLimit);
+		rejected++;
+		return CKR_FUNCTION_FAILED;
+	}
+	slotJobs[slotID]++;
+	sessionJobs.insert(hSession);
+
+	queue.push_back(&job);
+	if (queue.size() > maxQueued) maxQueued = queue.size();
+	jobsAvailable.notify_one();
+
+	jobDone.wait(lock, [&job] { return job.done; });
+
+	if (--slotJobs[slotID] == 0) slotJobs.erase(slotID);
+	sessionJobs.erase(hSession);
+	if (stopping) jobDone.notify_all();
+
+	return job.rv;
+}
+
+void OpScheduler::getInfo(CK_SOFTHSM_SCHEDULER_INFO_PTR pInfo)
+{
+	std::lock_guard<std::mutex> lock(jobsMutex);
+
+	pInfo->ulWorkers = workers.size();
+	pInfo->ulQueued = queue.size();
+	pInfo->ulRunning = running;
+	pInfo->ulMaxQueued = maxQueued;
+	pInfo->ulCompleted = completed;
+	pInfo->ulRejected = rejected;
+}
+
+void OpScheduler::work()
+{
+	std::unique_lock<std::mutex> lock(jobsMutex);
+
+	for (;;)
+	{
+		jobsAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+		if (stopping) return;
+
+		Job* job = queue.front();
+		queue.pop_front();
+		running++;
+
+		lock.unlock();
+
+		CK_RV rv;
+		try
+		{
+			rv = job->op();
+		}
+		catch (...)
+		{
+			ERROR_MSG("Exception in a scheduled operation");
+			rv = CKR_GENERAL_ERROR;
+		}
+
+		lock.lock();
+
+		running--;
+		completed++;
+		job->rv = rv;
+		job->done = true;
+		jobDone.notify_all();
+	}
+}
+
+#endif // HAVE_CXX11
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ OpScheduler.h
+
+ Runs expensive operations, such as RSA key generation and the generation of
+ domain parameters, on a bounded pool of background threads. The caller waits
+ for the result, but the number of such operations that use a CPU at the same
+ time is limited to the size of the pool, so that cheap operations such as
+ signing, which still run on the calling thread, are not starved. Each slot
+ can be limited in the number of expensive operations it has admitted, and
+ each session can have one at a time.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OPSCHEDULER_H
+#define _SOFTHSM_V2_OPSCHEDULER_H
+
+#include "config.h"
+#include "cryptoki.h"
+#include "softhsm2_vendor.h"
+
+#ifdef HAVE_CXX11
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <thread>
+#include <vector>
+
+class OpScheduler
+{
+public:
+	// Constructor; starts inWorkers threads and admits at most inSlotLimit
+	// operations per slot, or any number if inSlotLimit is 0
+	OpScheduler(size_t inWorkers, size_t inSlotLimit);
+
+	// Destructor; operations that have not started yet fail
+	virtual ~OpScheduler();
+
+	// Were the workers started?
+	bool isValid();
+
+	// Run the operation on a worker and wait for its return value. Returns
+	// CKR_FUNCTION_FAILED if the slot has reached its limit and
+	// CKR_OPERATION_ACTIVE if the session already has an operation admitted.
+	CK_RV run(CK_SLOT_ID slotID, CK_SESSION_HANDLE hSession, const std::function<CK_RV()>& op);
+
+	// Return the queue depth and the counters
+	void getInfo(CK_SOFTHSM_SCHEDULER_INFO_PTR pInfo);
+
+private:
+	// An admitted operation; it lives on the stack of the waiting caller
+	struct Job
+	{
+		std::function<CK_RV()> op;
+		CK_RV rv;
+		bool done;
+	};
+
+	// The worker loop
+	void work();
+
+	// The operations waiting for a worker, and the admitted operations per
+	// slot and session
+	std::deque<Job*> queue;
+	std::map<CK_SLOT_ID, size_t> slotJobs;
+	std::set<CK_SESSION_HANDLE> sessionJobs;
+	size_t slotLimit;
+	bool stopping;
+	std::mutex jobsMutex;
+	std::condition_variable jobsAvailable;
+	std::condition_variable jobDone;
+
+	// The counters
+	size_t running;
+	size_t maxQueued;
+	unsigned long completed;
+	unsigned long rejected;
+
+	std::vector<std::thread> workers;
+};
+
+#endif // HAVE_CXX11
+
+#endif // !_SOFTHSM_V2_OPSCHEDULER_H
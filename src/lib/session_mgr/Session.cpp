@@ -47,6 +47,7 @@ Session::Session(Slot* inSlot, bool inIsReadWrite, CK_VOID_PTR inPApplication, C
 	digestOp = NULL;
 	hashAlgo = HashAlgo::Unknown;
 	macOp = NULL;
+	macAlgo = MacAlgo::Unknown;
 	asymmetricCryptoOp = NULL;
 	symmetricCryptoOp = NULL;
 	mechanism = AsymMech::Unknown;
@@ -74,6 +75,7 @@ Session::Session()
 	digestOp = NULL;
 	hashAlgo = HashAlgo::Unknown;
 	macOp = NULL;
+	macAlgo = MacAlgo::Unknown;
 	asymmetricCryptoOp = NULL;
 	symmetricCryptoOp = NULL;
 	mechanism = AsymMech::Unknown;
@@ -299,6 +301,16 @@ MacAlgorithm *Session::getMacOp()
 	return macOp;
 }
 
+void Session::setMacAlgo(MacAlgo::Type inMacAlgo)
+{
+	macAlgo = inMacAlgo;
+}
+
+MacAlgo::Type Session::getMacAlgo()
+{
+	return macAlgo;
+}
+
 void Session::setAsymmetricCryptoOp(AsymmetricAlgorithm *inAsymmetricCryptoOp)
 {
 	if (asymmetricCryptoOp != NULL)
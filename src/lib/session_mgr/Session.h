@@ -91,6 +91,8 @@ public:
 	// Mac
 	void setMacOp(MacAlgorithm* inMacOp);
 	MacAlgorithm* getMacOp();
+	void setMacAlgo(MacAlgo::Type inMacAlgo);
+	MacAlgo::Type getMacAlgo();
 
 	// Asymmetric Crypto
 	void setAsymmetricCryptoOp(AsymmetricAlgorithm* inAsymmetricCryptoOp);
@@ -152,6 +154,7 @@ private:
 
 	// Mac
 	MacAlgorithm* macOp;
+	MacAlgo::Type macAlgo;
 
 	// Asymmetric Crypto
 	AsymmetricAlgorithm* asymmetricCryptoOp;
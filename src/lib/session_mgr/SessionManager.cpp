@@ -79,6 +79,9 @@ CK_RV SessionManager::openSession
 	if (token == NULL) return CKR_TOKEN_NOT_PRESENT;
 	if (!token->isInitialized()) return CKR_TOKEN_NOT_RECOGNIZED;
 
+	// Only Read-Only sessions can be opened on a write-protected token
+	if ((flags & CKF_RW_SESSION) == CKF_RW_SESSION && token->isWriteProtected()) return CKR_TOKEN_WRITE_PROTECTED;
+
 	// Can not open a Read-Only session when in SO mode
 	if ((flags & CKF_RW_SESSION) == 0 && token->isSOLoggedIn()) return CKR_SESSION_READ_WRITE_SO_EXISTS;
 
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2010 .SE (The Internet Infrastructure Foundation)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ OpSchedulerTests.cpp
+
+ Contains test cases for OpScheduler
+ *****************************************************************************/
+
+#include <cppunit/extensions/HelperMacros.h>
+#include "OpSchedulerTests.h"
+#include "OpScheduler.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(OpSchedulerTests);
+
+#ifdef HAVE_CXX11
+#include <atomic>
+
+void OpSchedulerTests::testRun()
+{
+	OpScheduler scheduler(2, 0);
+	CK_SOFTHSM_SCHEDULER_INFO info;
+
+	CPPUNIT_ASSERT(scheduler.isValid());
+
+	// The return value of the operation is passed to the caller
+	CPPUNIT_ASSERT(scheduler.run(1, 1, [] { return CKR_OK; }) == CKR_OK);
+	CPPUNIT_ASSERT(scheduler.run(1, 1, [] { return CKR_DEVICE_ERROR; }) == CKR_DEVICE_ERROR);
+
+	// The operation runs on a worker
+	std::thread::id caller = std::this_thread::get_id();
+	std::thread::id worker = caller;
+	CPPUNIT_ASSERT(scheduler.run(1, 2, [&] { worker = std::this_thread::get_id(); return CKR_OK; }) == CKR_OK);
+	CPPUNIT_ASSERT(worker != caller);
+
+	scheduler.getInfo(&info);
+	CPPUNIT_ASSERT(info.ulWorkers == 2);
+	CPPUNIT_ASSERT(info.ulQueued == 0);
+	CPPUNIT_ASSERT(info.ulRunning == 0);
+	CPPUNIT_ASSERT(info.ulMaxQueued >= 1);
+	CPPUNIT_ASSERT(info.ulCompleted == 3);
+	CPPUNIT_ASSERT(info.ulRejected == 0);
+}
+
+void OpSchedulerTests::testAdmission()
+{
+	OpScheduler scheduler(2, 1);
+	CK_SOFTHSM_SCHEDULER_INFO info;
+	std::atomic<bool> release(false);
+	CK_RV rv = CKR_GENERAL_ERROR;
+
+	CPPUNIT_ASSERT(scheduler.isValid());
+
+	// Keep an operation of session 1 on slot 1 running
+	std::thread blocked([&]
+	{
+		rv = scheduler.run(1, 1, [&]
+		{
+			while (!release) std::this_thread::yield();
+			return CKR_OK;
+		});
+	});
+	do
+	{
+		std::this_thread::yield();
+		scheduler.getInfo(&info);
+	}
+	while (info.ulRunning == 0);
+
+	// Slot 1 has reached its limit
+	CPPUNIT_ASSERT(scheduler.run(1, 2, [] { return CKR_OK; }) == CKR_FUNCTION_FAILED);
+
+	// Session 1 already has an operation
+	CPPUNIT_ASSERT(scheduler.run(2, 1, [] { return CKR_OK; }) == CKR_OPERATION_ACTIVE);
+
+	// Other slots are not held up
+	CPPUNIT_ASSERT(scheduler.run(2, 3, [] { return CKR_OK; }) == CKR_OK);
+
+	release = true;
+	blocked.join();
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// The slot admits operations again
+	CPPUNIT_ASSERT(scheduler.run(1, 2, [] { return CKR_OK; }) == CKR_OK);
+
+	scheduler.getInfo(&info);
+	CPPUNIT_ASSERT(info.ulCompleted == 3);
+	CPPUNIT_ASSERT(info.ulRejected == 2);
+}
+#else
+void OpSchedulerTests::testRun()
+{
+}
+
+void OpSchedulerTests::testAdmission()
+{
+}
+#endif
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectEnvelope.cpp
+
+ The sealed key material of a private object
+ *****************************************************************************/
+
+#include "config.h"
+#include "log.h"
+#include "ObjectEnvelope.h"
+#include "OSAttributes.h"
+#include "Token.h"
+#include "CryptoFactory.h"
+
+// Version of the envelope format
+#define ENVELOPE_VERSION	2
+
+// Size of the random identifier an envelope is bound to
+#define ENVELOPE_ID_SIZE	16
+
+// Additional authenticated data binding sealed blobs to their purpose and
+// to the object they belong to
+#define ENVELOPE_AAD(id)	(ByteString((const unsigned char*)"object envelope", 15) + (id))
+
+// The attributes that are sealed in the envelope; this is the key material
+// that is decrypted together whenever a key is used. The attributes used to
+// search for objects (CKA_LABEL, CKA_ID, ...) remain encrypted individually,
+// so matching them does not require opening the envelope.
+static const CK_ATTRIBUTE_TYPE sealedAttributes[] =
+{
+	CKA_VALUE,
+	CKA_MODULUS,
+	CKA_PUBLIC_EXPONENT,
+	CKA_PRIVATE_EXPONENT,
+	CKA_PRIME_1,
+	CKA_PRIME_2,
+	CKA_EXPONENT_1,
+	CKA_EXPONENT_2,
+	CKA_COEFFICIENT,
+	CKA_PRIME,
+	CKA_SUBPRIME,
+	CKA_BASE,
+	CKA_EC_PARAMS,
+	CKA_EC_POINT,
+	CKA_GOSTR3410_PARAMS,
+	CKA_GOSTR3411_PARAMS,
+	CKA_GOST28147_PARAMS
+};
+
+// Constructor
+ObjectEnvelope::ObjectEnvelope(Token* inToken, OSObject* inObject)
+{
+	token = inToken;
+	object = inObject;
+	opened = false;
+}
+
+// Destructor
+ObjectEnvelope::~ObjectEnvelope()
+{
+	for (std::map<CK_ATTRIBUTE_TYPE,ByteString>::iterator i = values.begin(); i != values.end(); i++)
+	{
+		i->second.wipe();
+	}
+}
+
+// Is the attribute type sealed in the envelope of private objects?
+/*static*/ bool ObjectEnvelope::isSealedAttribute(CK_ATTRIBUTE_TYPE type)
+{
+	for (size_t i = 0; i < sizeof(sealedAttributes) / sizeof(sealedAttributes[0]); i++)
+	{
+		if (sealedAttributes[i] == type) return true;
+	}
+
+	return false;
+}
+
+// Decrypt an attribute of the private object
+bool ObjectEnvelope::decrypt(CK_ATTRIBUTE_TYPE type, ByteString& value)
+{
+	ByteString stored = object->getByteStringValue(type);
+
+	// Sealed attributes are left empty in the object
+	if (stored.size() == 0 && isSealedAttribute(type) && open())
+	{
+		std::map<CK_ATTRIBUTE_TYPE,ByteString>::iterator i = values.find(type);
+		if (i != values.end())
+		{
+			value = i->second;
+
+			return true;
+		}
+	}
+
+	return token->decrypt(stored, value);
+}
+
+// Seal the key material of a private object that is still encrypted
+// attribute by attribute into the envelope of the object
+/*static*/ bool ObjectEnvelope::seal(Token* token, OSObject* object)
+{
+	if (!object->getBooleanValue(CKA_PRIVATE, true)) return true;
+
+	// Collect the key material that is encrypted attribute by attribute
+	std::map<CK_ATTRIBUTE_TYPE,ByteString> found;
+
+	for (size_t i = 0; i < sizeof(sealedAttributes) / sizeof(sealedAttributes[0]); i++)
+	{
+		CK_ATTRIBUTE_TYPE type = sealedAttributes[i];
+
+		if (!object->attributeExists(type)) continue;
+
+		OSAttribute attr = object->getAttribute(type);
+		if (!attr.isByteStringAttribute() || attr.getByteStringValue().size() == 0) continue;
+
+		if (!token->decrypt(attr.getByteStringValue(), found[type]))
+		{
+			ERROR_MSG("Could not decrypt attribute 0x%08lx of the object", type);
+
+			return false;
+		}
+	}
+
+	if (found.empty()) return true;
+
+	// Merge with the key material that is already sealed
+	std::map<CK_ATTRIBUTE_TYPE,ByteString> sealed;
+
+	if (object->attributeExists(CKA_OS_ENVELOPE) && !unseal(token, object, sealed))
+	{
+		return false;
+	}
+
+	for (std::map<CK_ATTRIBUTE_TYPE,ByteString>::iterator i = found.begin(); i != found.end(); i++)
+	{
+		sealed[i->first] = i->second;
+		i->second.wipe();
+	}
+
+	// An existing envelope keeps its identifier
+	ByteString id;
+
+	if (object->attributeExists(CKA_OS_ENVELOPEID))
+	{
+		id = object->getByteStringValue(CKA_OS_ENVELOPEID);
+	}
+
+	if (!object->startTransaction(OSObject::ReadWrite)) return false;
+
+	// Store the envelope before clearing the attributes, so the key
+	// material can always be found
+	bool rv = store(token, object, sealed, id);
+
+	for (std::map<CK_ATTRIBUTE_TYPE,ByteString>::iterator i = sealed.begin(); i != sealed.end(); i++)
+	{
+		i->second.wipe();
+	}
+
+	for (std::map<CK_ATTRIBUTE_TYPE,ByteString>::iterator i = found.begin(); rv && i != found.end(); i++)
+	{
+		rv = object->setAttribute(i->first, ByteString());
+	}
+
+	if (!rv)
+	{
+		object->abortTransaction();
+
+		return false;
+	}
+
+	return object->commitTransaction();
+}
+
+// Seal the key material of a private object into the envelope of its copy;
+// the copy gets an identifier of its own, so the envelopes of the two
+// objects cannot be exchanged. The copy must be in a transaction.
+/*static*/ bool ObjectEnvelope::copy(Token* token, OSObject* source, OSObject* target)
+{
+	if (!source->attributeExists(CKA_OS_ENVELOPE)) return true;
+
+	std::map<CK_ATTRIBUTE_TYPE,ByteString> sealed;
+
+	if (!unseal(token, source, sealed))
+	{
+		ERROR_MSG("Could not open the envelope of the source object");
+
+		return false;
+	}
+
+	bool rv = store(token, target, sealed, ByteString());
+
+	for (std::map<CK_ATTRIBUTE_TYPE,ByteString>::iterator i = sealed.begin(); i != sealed.end(); i++)
+	{
+		i->second.wipe();
+	}
+
+	return rv;
+}
+
+// Seal the key material in the envelope of the object under the given
+// identifier, or under a new one when it is empty; the caller handles the
+// transaction
+/*static*/ bool ObjectEnvelope::store(Token* token, OSObject* object, const std::map<CK_ATTRIBUTE_TYPE,ByteString>& values, ByteString id)
+{
+	if (id.size() == 0 &&
+	    !CryptoFactory::i()->getRNG()->generateRandom(id, ENVELOPE_ID_SIZE))
+	{
+		ERROR_MSG("Could not generate the identifier of the envelope");
+
+		return false;
+	}
+
+	ByteString plaintext;
+	ByteString ciphertext;
+
+	serialise(values, plaintext);
+
+	bool rv = token->seal(plaintext, ENVELOPE_AAD(id), ciphertext);
+	plaintext.wipe();
+
+	if (!rv)
+	{
+		ERROR_MSG("Could not seal the key material of the object");
+
+		return false;
+	}
+
+	ByteString envelope((unsigned long) ENVELOPE_VERSION);
+	envelope += ciphertext;
+
+	return object->setAttribute(CKA_OS_ENVELOPEID, id) &&
+	       object->setAttribute(CKA_OS_ENVELOPE, envelope);
+}
+
+// Open the envelope of the object
+bool ObjectEnvelope::open()
+{
+	if (!opened)
+	{
+		opened = true;
+
+		if (object->attributeExists(CKA_OS_ENVELOPE) && !unseal(token, object, values))
+		{
+			ERROR_MSG("Could not open the envelope of the object");
+		}
+	}
+
+	return !values.empty();
+}
+
+// Unseal the envelope of an object
+/*static*/ bool ObjectEnvelope::unseal(Token* token, OSObject* object, std::map<CK_ATTRIBUTE_TYPE,ByteString>& values)
+{
+	ByteString envelope = object->getByteStringValue(CKA_OS_ENVELOPE);
+
+	if (envelope.size() < 8)
+	{
+		ERROR_MSG("The envelope of the object is too short");
+
+		return false;
+	}
+
+	if (envelope.substr(0, 8).long_val() != ENVELOPE_VERSION)
+	{
+		ERROR_MSG("Unsupported object envelope version %lu", envelope.substr(0, 8).long_val());
+
+		return false;
+	}
+
+	if (!object->attributeExists(CKA_OS_ENVELOPEID))
+	{
+		ERROR_MSG("The envelope of the object has no identifier");
+
+		return false;
+	}
+
+	ByteString id = object->getByteStringValue(CKA_OS_ENVELOPEID);
+	ByteString plaintext;
+
+	if (!token->unseal(envelope.substr(8), ENVELOPE_AAD(id), plaintext))
+	{
+		return false;
+	}
+
+	bool rv = parse(plaintext, values);
+	plaintext.wipe();
+
+	return rv;
+}
+
+// Serialise the contents of an envelope; each value is preceded by its
+// attribute type and its length
+/*static*/ void ObjectEnvelope::serialise(const std::map<CK_ATTRIBUTE_TYPE,ByteString>& values, ByteString& serialised)
+{
+	serialised.wipe();
+
+	for (std::map<CK_ATTRIBUTE_TYPE,ByteString>::const_iterator i = values.begin(); i != values.end(); i++)
+	{
+		serialised += ByteString((unsigned long) i->first);
+		serialised += i->second.serialise();
+	}
+}
+
+// Parse the contents of an envelope
+/*static*/ bool ObjectEnvelope::parse(const ByteString& serialised, std::map<CK_ATTRIBUTE_TYPE,ByteString>& values)
+{
+	size_t pos = 0;
+
+	values.clear();
+
+	while (pos < serialised.size())
+	{
+		if (serialised.size() - pos < 16)
+		{
+			ERROR_MSG("Corrupt object envelope");
+
+			return false;
+		}
+
+		CK_ATTRIBUTE_TYPE type = serialised.substr(pos, 8).long_val();
+		size_t len = serialised.substr(pos + 8, 8).long_val();
+		pos += 16;
+
+		if (len > serialised.size() - pos)
+		{
+			ERROR_MSG("Corrupt object envelope");
+
+			return false;
+		}
+
+		values[type] = serialised.substr(pos, len);
+		pos += len;
+	}
+
+	return true;
+}
+
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ ObjectEnvelope.h
+
+ The key material of a private object is sealed together in a single AEAD
+ envelope (AES-GCM under the token key), stored in the CKA_OS_ENVELOPE
+ attribute; the attributes themselves are left empty. The envelope is bound
+ to a random identifier of the object (CKA_OS_ENVELOPEID), so envelopes cannot
+ be exchanged between objects. Opening the envelope once recovers all key
+ material of the object. Objects that still hold their key material encrypted
+ attribute by attribute remain readable and are moved into an envelope the
+ next time they are written.
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_OBJECTENVELOPE_H
+#define _SOFTHSM_V2_OBJECTENVELOPE_H
+
+#include "config.h"
+#include "ByteString.h"
+#include "OSObject.h"
+#include "cryptoki.h"
+#include <map>
+
+class Token;
+
+class ObjectEnvelope
+{
+public:
+	// Constructor; the envelope of the object is opened on first use
+	ObjectEnvelope(Token* inToken, OSObject* inObject);
+
+	// Destructor
+	virtual ~ObjectEnvelope();
+
+	// Is the attribute type sealed in the envelope of private objects?
+	static bool isSealedAttribute(CK_ATTRIBUTE_TYPE type);
+
+	// Decrypt an attribute of the private object
+	bool decrypt(CK_ATTRIBUTE_TYPE type, ByteString& value);
+
+	// Seal the key material of a private object that is still encrypted
+	// attribute by attribute into the envelope of the object
+	static bool seal(Token* token, OSObject* object);
+
+	// Seal the key material of the source object into the envelope of its
+	// copy, which must be in a transaction
+	static bool copy(Token* token, OSObject* source, OSObject* target);
+
+private:
+	// Open the envelope of the object
+	bool open();
+
+	// Serialise and parse the contents of an envelope
+	static void serialise(const std::map<CK_ATTRIBUTE_TYPE,ByteString>& values, ByteString& serialised);
+	static bool parse(const ByteString& serialised, std::map<CK_ATTRIBUTE_TYPE,ByteString>& values);
+
+	// Unseal the envelope of an object
+	static bool unseal(Token* token, OSObject* object, std::map<CK_ATTRIBUTE_TYPE,ByteString>& values);
+
+	// Store key material in the envelope of an object
+	static bool store(Token* token, OSObject* object, const std::map<CK_ATTRIBUTE_TYPE,ByteString>& values, ByteString id);
+
+	// The token the object belongs to
+	Token* token;
+
+	// The object
+	OSObject* object;
+
+	// Has the envelope been opened?
+	bool opened;
+
+	// The contents of the envelope
+	std::map<CK_ATTRIBUTE_TYPE,ByteString> values;
+};
+
+#endif // !_SOFTHSM_V2_OBJECTENVELOPE_H
+
@@ -88,6 +88,19 @@ bool Token::isInitialized()
 	return true;
 }
 
+// Check if the token is write-protected
+bool Token::isWriteProtected()
+{
+	CK_ULONG flags;
+
+	// Lock access to the token
+	MutexLocker lock(tokenMutex);
+
+	if (token == NULL || !token->getTokenFlags(flags)) return false;
+
+	return (flags & CKF_WRITE_PROTECTED) == CKF_WRITE_PROTECTED;
+}
+
 // Check if SO is logged in
 bool Token::isSOLoggedIn()
 {
@@ -382,6 +395,9 @@ CK_RV Token::createToken(ObjectStore* objectStore, ByteString& soPIN, CK_UTF8CHA
 	if (objectStore == NULL) return CKR_GENERAL_ERROR;
 	if (label == NULL_PTR) return CKR_ARGUMENTS_BAD;
 
+	// No tokens can be (re)initialised in read-only mode
+	if (ObjectStoreToken::isReadOnly()) return CKR_TOKEN_WRITE_PROTECTED;
+
 	// Convert the label
 	ByteString labelByteStr((const unsigned char*) label, 32);
 
@@ -394,6 +410,8 @@ CK_RV Token::createToken(ObjectStore* objectStore, ByteString& soPIN, CK_UTF8CHA
 			return CKR_GENERAL_ERROR;
 		}
 
+		if ((flags & CKF_WRITE_PROTECTED) == CKF_WRITE_PROTECTED) return CKR_TOKEN_WRITE_PROTECTED;
+
 		// Verify SO PIN
 		if (sdm->getSOPINBlob().size() > 0 && !sdm->loginSO(soPIN))
 		{
@@ -547,11 +565,37 @@ OSObject* Token::createObject()
 	return token->createObject();
 }
 
+// Get the serial number of the token
+bool Token::getTokenSerial(ByteString& serial)
+{
+	// Lock access to the token
+	MutexLocker lock(tokenMutex);
+
+	if (token == NULL) return false;
+
+	return token->getTokenSerial(serial);
+}
+
+void Token::beginBatch()
+{
+	token->beginBatch();
+}
+
+void Token::endBatch()
+{
+	token->endBatch();
+}
+
 void Token::getObjects(std::set<OSObject *> &objects)
 {
 	token->getObjects(objects);
 }
 
+void Token::findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject *> &objects)
+{
+	token->findObjects(pTemplate, ulCount, objects);
+}
+
 bool Token::decrypt(const ByteString &encrypted, ByteString &plaintext)
 {
 	// Lock access to the token
@@ -571,3 +615,23 @@ bool Token::encrypt(const ByteString &plaintext, ByteString &encrypted)
 
 	return sdm->encrypt(plaintext,encrypted);
 }
+
+bool Token::seal(const ByteString &plaintext, const ByteString &aad, ByteString &sealed)
+{
+	// Lock access to the token
+	MutexLocker lock(tokenMutex);
+
+	if (sdm == NULL) return false;
+
+	return sdm->seal(plaintext,aad,sealed);
+}
+
+bool Token::unseal(const ByteString &sealed, const ByteString &aad, ByteString &plaintext)
+{
+	// Lock access to the token
+	MutexLocker lock(tokenMutex);
+
+	if (sdm == NULL) return false;
+
+	return sdm->unseal(sealed,aad,plaintext);
+}
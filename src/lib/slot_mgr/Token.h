@@ -61,6 +61,9 @@ public:
 	// Is the token initialized?
 	bool isInitialized();
 
+	// Is the token write-protected?
+	bool isWriteProtected();
+
 	// Is SO or user logged in?
 	bool isSOLoggedIn();
 	bool isUserLoggedIn();
@@ -86,15 +89,31 @@ public:
 	// Create object
 	OSObject *createObject();
 
+	// Get the serial number of the token
+	bool getTokenSerial(ByteString& serial);
+
+	// Group the objects created by the calling thread until endBatch
+	void beginBatch();
+	void endBatch();
+
 	// Insert all token objects into the given set.
 	void getObjects(std::set<OSObject *> &objects);
 
+	// Insert the token objects that may match the template into the given set.
+	void findObjects(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, std::set<OSObject *> &objects);
+
 	// Decrypt the supplied data
 	bool decrypt(const ByteString& encrypted, ByteString& plaintext);
 
 	// Encrypt the supplied data
 	bool encrypt(const ByteString& plaintext, ByteString& encrypted);
 
+	// Encrypt and authenticate the supplied data
+	bool seal(const ByteString& plaintext, const ByteString& aad, ByteString& sealed);
+
+	// Verify and decrypt sealed data
+	bool unseal(const ByteString& sealed, const ByteString& aad, ByteString& plaintext);
+
 private:
 	// Token validity
 	bool valid;
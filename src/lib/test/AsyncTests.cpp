@@ -0,0 +1,620 @@
+/*
+ * Copyright (c) 2010 .SE (The Internet Infrastructure Foundation)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AsyncTests.cpp
+
+ Contains test cases for the asynchronous vendor functions
+ *****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include "AsyncTests.h"
+
+// The vendor functions are not in the function list, and the asynchronous
+// operations need the worker threads
+#if defined(HAVE_CXX11) && !defined(P11M) && !defined(_WIN32)
+#include <poll.h>
+#include "softhsm2_vendor.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AsyncTests);
+
+CK_RV AsyncTests::generateHmacKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hKey)
+{
+	CK_MECHANISM mechanism = { CKM_GENERIC_SECRET_KEY_GEN, NULL_PTR, 0 };
+	CK_ULONG bytes = 32;
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_ATTRIBUTE keyAttribs[] = {
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+		{ CKA_PRIVATE, &bTrue, sizeof(bTrue) },
+		{ CKA_SIGN, &bTrue, sizeof(bTrue) },
+		{ CKA_VERIFY, &bTrue, sizeof(bTrue) },
+		{ CKA_VALUE_LEN, &bytes, sizeof(bytes) }
+	};
+
+	hKey = CK_INVALID_HANDLE;
+	return CRYPTOKI_F_PTR( C_GenerateKey(hSession, &mechanism,
+			     keyAttribs, sizeof(keyAttribs)/sizeof(CK_ATTRIBUTE),
+			     &hKey) );
+}
+
+CK_RV AsyncTests::generateAesKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hKey)
+{
+	CK_MECHANISM mechanism = { CKM_AES_KEY_GEN, NULL_PTR, 0 };
+	CK_ULONG bytes = 16;
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_ATTRIBUTE keyAttribs[] = {
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+		{ CKA_PRIVATE, &bTrue, sizeof(bTrue) },
+		{ CKA_ENCRYPT, &bTrue, sizeof(bTrue) },
+		{ CKA_DECRYPT, &bTrue, sizeof(bTrue) },
+		{ CKA_VALUE_LEN, &bytes, sizeof(bytes) }
+	};
+
+	hKey = CK_INVALID_HANDLE;
+	return CRYPTOKI_F_PTR( C_GenerateKey(hSession, &mechanism,
+			     keyAttribs, sizeof(keyAttribs)/sizeof(CK_ATTRIBUTE),
+			     &hKey) );
+}
+
+void AsyncTests::reinitialize(bool osLocking)
+{
+	CK_C_INITIALIZE_ARGS InitArgs;
+
+	memset(&InitArgs, 0, sizeof(InitArgs));
+	if (osLocking) InitArgs.flags = CKF_OS_LOCKING_OK;
+
+	CPPUNIT_ASSERT_EQUAL( (CK_RV)CKR_OK, CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) ) );
+	CPPUNIT_ASSERT_EQUAL( (CK_RV)CKR_OK, CRYPTOKI_F_PTR( C_Initialize(&InitArgs) ) );
+}
+
+void AsyncTests::waitForEvent(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	CPPUNIT_ASSERT(poll(&pfd, 1, 30000) == 1);
+	CPPUNIT_ASSERT(pfd.revents & POLLIN);
+}
+
+void AsyncTests::testAsyncNeedsLocking()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hKey;
+	CK_MECHANISM mechanism = { CKM_SHA256_HMAC, NULL_PTR, 0 };
+	CK_BYTE data[] = { "Some data to sign" };
+	CK_BYTE signature[32];
+	CK_ULONG ulSignatureLen = sizeof(signature);
+	CK_SOFTHSM_COMPLETION completions[4];
+	CK_ULONG ulCount;
+	int fd;
+
+	// Without locking the workers cannot be used
+	reinitialize(false);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession, CKU_USER, m_userPin1, m_userPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateHmacKey(hSession, hKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_SignAsync(hSession, &mechanism, hKey, data, sizeof(data), signature, &ulSignatureLen, NULL_PTR);
+	CPPUNIT_ASSERT(rv == CKR_CANT_LOCK);
+	rv = C_SoftHSM_GetAsyncEventFd(&fd);
+	CPPUNIT_ASSERT(rv == CKR_CANT_LOCK);
+	rv = C_SoftHSM_HarvestCompletions(completions, 4, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == 0);
+
+	reinitialize(true);
+
+	rv = C_SoftHSM_SignAsync(CK_INVALID_HANDLE, &mechanism, hKey, data, sizeof(data), signature, &ulSignatureLen, NULL_PTR);
+	CPPUNIT_ASSERT(rv == CKR_SESSION_HANDLE_INVALID);
+	rv = C_SoftHSM_GetAsyncEventFd(NULL_PTR);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+	rv = C_SoftHSM_HarvestCompletions(NULL_PTR, 4, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+}
+
+void AsyncTests::testAsyncOperations()
+{
+	// An operation that is in flight
+	struct Job
+	{
+		CK_SESSION_HANDLE hSession;
+		CK_ULONG sequence;
+		CK_BYTE input[32];
+		CK_BYTE output[32];
+		CK_ULONG ulOutputLen;
+		CK_OBJECT_HANDLE hKey;
+		CK_RV expected;
+		bool completed;
+	};
+
+	const size_t nrOfSessions = 4;
+	const size_t nrOfSigns = 2000;
+	const size_t nrOfDecrypts = 500;
+	const size_t nrOfGenerates = 16;
+
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessions[nrOfSessions];
+	CK_OBJECT_HANDLE hHmacKey;
+	CK_OBJECT_HANDLE hAesKey;
+	CK_MECHANISM hmacMechanism = { CKM_SHA256_HMAC, NULL_PTR, 0 };
+	CK_MECHANISM aesMechanism = { CKM_AES_ECB, NULL_PTR, 0 };
+	CK_MECHANISM aesGenMechanism = { CKM_AES_KEY_GEN, NULL_PTR, 0 };
+	CK_ULONG bytes = 16;
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_ATTRIBUTE keyAttribs[] = {
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+		{ CKA_PRIVATE, &bTrue, sizeof(bTrue) },
+		{ CKA_ENCRYPT, &bTrue, sizeof(bTrue) },
+		{ CKA_VALUE_LEN, &bytes, sizeof(bytes) }
+	};
+	std::map<CK_SESSION_HANDLE, CK_ULONG> submitted;
+	std::map<CK_SESSION_HANDLE, CK_ULONG> completed;
+	CK_SOFTHSM_COMPLETION completions[64];
+	CK_ULONG ulCount;
+	int fd;
+
+	reinitialize(true);
+
+	for (size_t i = 0; i < nrOfSessions; i++)
+	{
+		rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSessions[i]) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+	rv = CRYPTOKI_F_PTR( C_Login(hSessions[0], CKU_USER, m_userPin1, m_userPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateHmacKey(hSessions[0], hHmacKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateAesKey(hSessions[0], hAesKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_GetAsyncEventFd(&fd);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(fd >= 0);
+
+	// Nothing is waiting yet
+	rv = C_SoftHSM_HarvestCompletions(completions, 64, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == 0);
+
+	// Signatures, decryptions of known ciphertexts, key generations and
+	// one job that fails, spread over the sessions
+	std::vector<Job> jobs(nrOfSigns + nrOfDecrypts + nrOfGenerates + 1);
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		Job& job = jobs[i];
+
+		job.hSession = hSessions[i % nrOfSessions];
+		job.sequence = submitted[job.hSession]++;
+		job.ulOutputLen = sizeof(job.output);
+		job.hKey = CK_INVALID_HANDLE;
+		job.expected = CKR_OK;
+		job.completed = false;
+		for (size_t j = 0; j < sizeof(job.input); j++)
+		{
+			job.input[j] = (CK_BYTE)(i + j * 7);
+		}
+
+		if (i < nrOfSigns)
+		{
+			rv = C_SoftHSM_SignAsync(job.hSession, &hmacMechanism, hHmacKey,
+						 job.input, sizeof(job.input),
+						 job.output, &job.ulOutputLen, &job);
+		}
+		else if (i < nrOfSigns + nrOfDecrypts)
+		{
+			// Encrypt the input in place, the decryption must restore it
+			CK_BYTE plain[32];
+			CK_ULONG ulLen = sizeof(job.input);
+			memcpy(plain, job.input, sizeof(plain));
+			CPPUNIT_ASSERT(CRYPTOKI_F_PTR( C_EncryptInit(hSessions[0], &aesMechanism, hAesKey) ) == CKR_OK);
+			CPPUNIT_ASSERT(CRYPTOKI_F_PTR( C_Encrypt(hSessions[0], plain, sizeof(plain), job.input, &ulLen) ) == CKR_OK);
+			CPPUNIT_ASSERT(ulLen == sizeof(job.input));
+
+			rv = C_SoftHSM_DecryptAsync(job.hSession, &aesMechanism, hAesKey,
+						    job.input, sizeof(job.input),
+						    job.output, &job.ulOutputLen, &job);
+		}
+		else if (i < nrOfSigns + nrOfDecrypts + nrOfGenerates)
+		{
+			rv = C_SoftHSM_GenerateKeyAsync(job.hSession, &aesGenMechanism,
+							keyAttribs, sizeof(keyAttribs)/sizeof(CK_ATTRIBUTE),
+							&job.hKey, &job);
+		}
+		else
+		{
+			job.expected = CKR_OBJECT_HANDLE_INVALID;
+			rv = C_SoftHSM_SignAsync(job.hSession, &hmacMechanism, CK_INVALID_HANDLE,
+						 job.input, sizeof(job.input),
+						 job.output, &job.ulOutputLen, &job);
+		}
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+
+	// Harvest until every job has completed once, in submission order per session
+	size_t nrOfCompleted = 0;
+	while (nrOfCompleted < jobs.size())
+	{
+		waitForEvent(fd);
+
+		rv = C_SoftHSM_HarvestCompletions(completions, 64, &ulCount);
+		CPPUNIT_ASSERT(rv == CKR_OK);
+		CPPUNIT_ASSERT(ulCount > 0 && ulCount <= 64);
+
+		for (CK_ULONG i = 0; i < ulCount; i++)
+		{
+			Job* job = (Job*)completions[i].pTag;
+			CPPUNIT_ASSERT(job >= &jobs.front() && job <= &jobs.back());
+			CPPUNIT_ASSERT(!job->completed);
+			CPPUNIT_ASSERT_EQUAL(job->expected, completions[i].rv);
+			CPPUNIT_ASSERT_EQUAL(completed[job->hSession]++, job->sequence);
+			job->completed = true;
+			nrOfCompleted++;
+		}
+	}
+
+	// The descriptor is clear once everything has been harvested
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	CPPUNIT_ASSERT(poll(&pfd, 1, 0) == 0);
+
+	// Compare the results with the synchronous functions
+	for (size_t i = 0; i < jobs.size() - 1; i++)
+	{
+		Job& job = jobs[i];
+
+		if (i < nrOfSigns)
+		{
+			CK_BYTE signature[32];
+			CK_ULONG ulSignatureLen = sizeof(signature);
+			CPPUNIT_ASSERT(CRYPTOKI_F_PTR( C_SignInit(hSessions[0], &hmacMechanism, hHmacKey) ) == CKR_OK);
+			CPPUNIT_ASSERT(CRYPTOKI_F_PTR( C_Sign(hSessions[0], job.input, sizeof(job.input), signature, &ulSignatureLen) ) == CKR_OK);
+			CPPUNIT_ASSERT(job.ulOutputLen == ulSignatureLen);
+			CPPUNIT_ASSERT(memcmp(job.output, signature, ulSignatureLen) == 0);
+		}
+		else if (i < nrOfSigns + nrOfDecrypts)
+		{
+			CPPUNIT_ASSERT(job.ulOutputLen == sizeof(job.output));
+			for (size_t j = 0; j < sizeof(job.output); j++)
+			{
+				CPPUNIT_ASSERT(job.output[j] == (CK_BYTE)(i + j * 7));
+			}
+		}
+		else
+		{
+			CK_OBJECT_CLASS keyClass = CKO_VENDOR_DEFINED;
+			CK_ATTRIBUTE attribs[] = {
+				{ CKA_CLASS, &keyClass, sizeof(keyClass) }
+			};
+			CPPUNIT_ASSERT(job.hKey != CK_INVALID_HANDLE);
+			CPPUNIT_ASSERT(CRYPTOKI_F_PTR( C_GetAttributeValue(hSessions[0], job.hKey, attribs, 1) ) == CKR_OK);
+			CPPUNIT_ASSERT(keyClass == CKO_SECRET_KEY);
+		}
+	}
+
+	// The sessions are usable again
+	CK_BYTE signature[32];
+	CK_ULONG ulSignatureLen = sizeof(signature);
+	for (size_t i = 0; i < nrOfSessions; i++)
+	{
+		CPPUNIT_ASSERT(CRYPTOKI_F_PTR( C_SignInit(hSessions[i], &hmacMechanism, hHmacKey) ) == CKR_OK);
+		CPPUNIT_ASSERT(CRYPTOKI_F_PTR( C_Sign(hSessions[i], jobs[0].input, sizeof(jobs[0].input), signature, &ulSignatureLen) ) == CKR_OK);
+	}
+}
+
+void AsyncTests::testAsyncCloseSession()
+{
+	const size_t nrOfSigns = 1000;
+
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_SESSION_HANDLE hLoginSession;
+	CK_OBJECT_HANDLE hKey;
+	CK_OBJECT_HANDLE hPublicKey;
+	CK_OBJECT_HANDLE hPrivateKey;
+	CK_MECHANISM mechanism = { CKM_SHA256_HMAC, NULL_PTR, 0 };
+	CK_MECHANISM rsaMechanism = { CKM_RSA_PKCS_KEY_PAIR_GEN, NULL_PTR, 0 };
+	CK_ULONG bits = 2048;
+	CK_BYTE exponent[] = { 0x01, 0x00, 0x01 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+		{ CKA_MODULUS_BITS, &bits, sizeof(bits) },
+		{ CKA_PUBLIC_EXPONENT, exponent, sizeof(exponent) }
+	};
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) }
+	};
+	CK_BYTE data[] = { "Some data to sign" };
+	std::vector<CK_BYTE> signatures(nrOfSigns * 32);
+	std::vector<CK_ULONG> signatureLens(nrOfSigns, 32);
+	std::vector<bool> done(nrOfSigns + 1, false);
+	CK_SOFTHSM_COMPLETION completions[64];
+	CK_ULONG ulCount;
+	int fd;
+
+	reinitialize(true);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hLoginSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession, CKU_USER, m_userPin1, m_userPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateHmacKey(hLoginSession, hKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_GetAsyncEventFd(&fd);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// The key pair generation keeps the worker busy while the rest is queued
+	rv = C_SoftHSM_GenerateKeyPairAsync(hSession, &rsaMechanism,
+					    pukAttribs, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE),
+					    prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+					    &hPublicKey, &hPrivateKey, (CK_VOID_PTR)(nrOfSigns + 1));
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	for (size_t i = 0; i < nrOfSigns; i++)
+	{
+		rv = C_SoftHSM_SignAsync(hSession, &mechanism, hKey, data, sizeof(data),
+					 &signatures[i * 32], &signatureLens[i], (CK_VOID_PTR)(i + 1));
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+
+	// The jobs that have not run yet complete with CKR_SESSION_CLOSED
+	rv = CRYPTOKI_F_PTR( C_CloseSession(hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	size_t nrOfCompleted = 0;
+	size_t nrOfClosed = 0;
+	while (nrOfCompleted < nrOfSigns + 1)
+	{
+		waitForEvent(fd);
+
+		rv = C_SoftHSM_HarvestCompletions(completions, 64, &ulCount);
+		CPPUNIT_ASSERT(rv == CKR_OK);
+
+		for (CK_ULONG i = 0; i < ulCount; i++)
+		{
+			size_t index = (size_t)completions[i].pTag - 1;
+			CPPUNIT_ASSERT(index <= nrOfSigns);
+			CPPUNIT_ASSERT(!done[index]);
+			CPPUNIT_ASSERT(completions[i].rv == CKR_OK || completions[i].rv == CKR_SESSION_CLOSED);
+			if (completions[i].rv == CKR_SESSION_CLOSED) nrOfClosed++;
+			done[index] = true;
+			nrOfCompleted++;
+		}
+	}
+	CPPUNIT_ASSERT(nrOfClosed > 0);
+
+	// Nothing can be queued on the closed session
+	rv = C_SoftHSM_SignAsync(hSession, &mechanism, hKey, data, sizeof(data),
+				 &signatures[0], &signatureLens[0], NULL_PTR);
+	CPPUNIT_ASSERT(rv == CKR_SESSION_HANDLE_INVALID);
+}
+
+void AsyncTests::testAsyncActiveOperation()
+{
+	const size_t nrOfSigns = 200;
+
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hKey;
+	CK_MECHANISM mechanism = { CKM_SHA256_HMAC, NULL_PTR, 0 };
+	CK_BYTE data[] = { "Some data to sign" };
+	CK_BYTE expected[32];
+	CK_ULONG ulExpectedLen = sizeof(expected);
+	CK_BYTE signature[32];
+	CK_ULONG ulSignatureLen = sizeof(signature);
+	std::vector<CK_BYTE> signatures(nrOfSigns * 32);
+	std::vector<CK_ULONG> signatureLens(nrOfSigns, 32);
+	CK_SOFTHSM_COMPLETION completions[64];
+	CK_ULONG ulCount;
+	int fd;
+
+	reinitialize(true);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession, CKU_USER, m_userPin1, m_userPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateHmacKey(hSession, hKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_SignInit(hSession, &mechanism, hKey) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Sign(hSession, data, sizeof(data), expected, &ulExpectedLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_GetAsyncEventFd(&fd);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// A multi-part operation of the application is active on the session
+	// while the jobs run
+	rv = CRYPTOKI_F_PTR( C_SignInit(hSession, &mechanism, hKey) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	for (size_t i = 0; i < nrOfSigns; i++)
+	{
+		rv = C_SoftHSM_SignAsync(hSession, &mechanism, hKey, data, sizeof(data),
+					 &signatures[i * 32], &signatureLens[i], (CK_VOID_PTR)(i + 1));
+		CPPUNIT_ASSERT(rv == CKR_OK);
+
+		rv = CRYPTOKI_F_PTR( C_SignUpdate(hSession, data, sizeof(data)) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+
+	size_t nrOfCompleted = 0;
+	while (nrOfCompleted < nrOfSigns)
+	{
+		waitForEvent(fd);
+
+		rv = C_SoftHSM_HarvestCompletions(completions, 64, &ulCount);
+		CPPUNIT_ASSERT(rv == CKR_OK);
+
+		for (CK_ULONG i = 0; i < ulCount; i++)
+		{
+			size_t index = (size_t)completions[i].pTag - 1;
+			CPPUNIT_ASSERT(index < nrOfSigns);
+			CPPUNIT_ASSERT(completions[i].rv == CKR_OK);
+			CPPUNIT_ASSERT(signatureLens[index] == 32);
+			CPPUNIT_ASSERT(memcmp(&signatures[index * 32], expected, 32) == 0);
+			nrOfCompleted++;
+		}
+	}
+
+	// The operation of the application is still active and can be finished
+	rv = CRYPTOKI_F_PTR( C_SignFinal(hSession, signature, &ulSignatureLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulSignatureLen == 32);
+}
+
+void AsyncTests::testAsyncFinalize()
+{
+	const size_t nrOfSigns = 1000;
+
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hKey;
+	CK_MECHANISM mechanism = { CKM_SHA256_HMAC, NULL_PTR, 0 };
+	CK_BYTE data[] = { "Some data to sign" };
+	std::vector<CK_BYTE> signatures(nrOfSigns * 32);
+	std::vector<CK_ULONG> signatureLens(nrOfSigns, 32);
+	std::vector<bool> done(nrOfSigns, false);
+	CK_SOFTHSM_COMPLETION completions[64];
+	CK_ULONG ulCount;
+	CK_C_INITIALIZE_ARGS InitArgs;
+
+	reinitialize(true);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession, CKU_USER, m_userPin1, m_userPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateHmacKey(hSession, hKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	for (size_t i = 0; i < nrOfSigns; i++)
+	{
+		rv = C_SoftHSM_SignAsync(hSession, &mechanism, hKey, data, sizeof(data),
+					 &signatures[i * 32], &signatureLens[i], (CK_VOID_PTR)(i + 1));
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+
+	// Every job has a completion after C_Finalize, also the ones that did
+	// not run
+	rv = CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	size_t nrOfCompleted = 0;
+	do
+	{
+		rv = C_SoftHSM_HarvestCompletions(completions, 64, &ulCount);
+		CPPUNIT_ASSERT(rv == CKR_OK);
+
+		for (CK_ULONG i = 0; i < ulCount; i++)
+		{
+			size_t index = (size_t)completions[i].pTag - 1;
+			CPPUNIT_ASSERT(index < nrOfSigns);
+			CPPUNIT_ASSERT(!done[index]);
+			CPPUNIT_ASSERT(completions[i].rv == CKR_OK || completions[i].rv == CKR_CRYPTOKI_NOT_INITIALIZED);
+			done[index] = true;
+			nrOfCompleted++;
+		}
+	}
+	while (ulCount > 0);
+	CPPUNIT_ASSERT(nrOfCompleted == nrOfSigns);
+
+	memset(&InitArgs, 0, sizeof(InitArgs));
+	InitArgs.flags = CKF_OS_LOCKING_OK;
+	rv = CRYPTOKI_F_PTR( C_Initialize(&InitArgs) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+}
+
+void AsyncTests::testScheduler()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hPublicKey;
+	CK_OBJECT_HANDLE hPrivateKey;
+	CK_MECHANISM mechanism = { CKM_RSA_PKCS_KEY_PAIR_GEN, NULL_PTR, 0 };
+	CK_ULONG bits = 1024;
+	CK_BYTE exponent[] = { 0x01, 0x00, 0x01 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+		{ CKA_MODULUS_BITS, &bits, sizeof(bits) },
+		{ CKA_PUBLIC_EXPONENT, exponent, sizeof(exponent) }
+	};
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) }
+	};
+	CK_SOFTHSM_SCHEDULER_INFO info;
+
+	rv = C_SoftHSM_GetSchedulerInfo(NULL_PTR);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+
+	useConfig("softhsm2-sched.conf");
+	reinitialize(true);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession, CKU_USER, m_userPin1, m_userPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// This configuration runs the key pair generation on the scheduler
+	rv = CRYPTOKI_F_PTR( C_GenerateKeyPair(hSession, &mechanism,
+			     pukAttribs, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE),
+			     prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+			     &hPublicKey, &hPrivateKey) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_GetSchedulerInfo(&info);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(info.ulWorkers == 2);
+	CPPUNIT_ASSERT(info.ulQueued == 0);
+	CPPUNIT_ASSERT(info.ulRunning == 0);
+	CPPUNIT_ASSERT(info.ulCompleted >= 1);
+	CPPUNIT_ASSERT(info.ulRejected == 0);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2010 .SE (The Internet Infrastructure Foundation)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ AsyncTests.h
+
+ Contains test cases for the asynchronous vendor functions
+ *****************************************************************************/
+
+#ifndef _SOFTHSM_V2_ASYNCTESTS_H
+#define _SOFTHSM_V2_ASYNCTESTS_H
+
+#include "TestsBase.h"
+#include <cppunit/extensions/HelperMacros.h>
+
+class AsyncTests : public TestsBase
+{
+	CPPUNIT_TEST_SUITE(AsyncTests);
+	CPPUNIT_TEST(testAsyncNeedsLocking);
+	CPPUNIT_TEST(testAsyncOperations);
+	CPPUNIT_TEST(testAsyncCloseSession);
+	CPPUNIT_TEST(testAsyncActiveOperation);
+	CPPUNIT_TEST(testAsyncFinalize);
+	CPPUNIT_TEST(testScheduler);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void testAsyncNeedsLocking();
+	void testAsyncOperations();
+	void testAsyncCloseSession();
+	void testAsyncActiveOperation();
+	void testAsyncFinalize();
+	void testScheduler();
+
+
+protected:
+	CK_RV generateHmacKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hKey);
+	CK_RV generateAesKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hKey);
+	void reinitialize(bool osLocking);
+	void waitForEvent(int fd);
+};
+
+#endif // !_SOFTHSM_V2_ASYNCTESTS_H
@@ -31,9 +31,11 @@
  *****************************************************************************/
 
 #include <config.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include "DigestTests.h"
+#include "softhsm2_vendor.h"
 
 CPPUNIT_TEST_SUITE_REGISTRATION(DigestTests);
 
@@ -324,3 +326,286 @@ void DigestTests::testDigestAll()
 		free(digest);
 	}
 }
+
+void DigestTests::testDigestOperationState()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession1;
+	CK_SESSION_HANDLE hSession2;
+	CK_MECHANISM mechanism = { CKM_SHA256, NULL_PTR, 0 };
+	CK_BYTE data[] = {"Text to digest in two parts"};
+	CK_BYTE digest[32];
+	CK_ULONG digestLen = sizeof(digest);
+	CK_BYTE resumedDigest[32];
+	CK_ULONG resumedDigestLen = sizeof(resumedDigest);
+	CK_BYTE_PTR state;
+	CK_ULONG stateLen;
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	// By default the digest does not run on a context that can be saved
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession1, CKU_SO, m_soPin1, m_soPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_DigestInit(hSession1, &mechanism) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestUpdate(hSession1, data, 10) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSession1, NULL_PTR, &stateLen) );
+	CPPUNIT_ASSERT(rv == CKR_STATE_UNSAVEABLE);
+
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	useConfig("softhsm2-opt.conf");
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession2) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Reference digest
+	rv = CRYPTOKI_F_PTR( C_DigestInit(hSession1, &mechanism) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Digest(hSession1, data, sizeof(data)-1, digest, &digestLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSession1, NULL_PTR, &stateLen) );
+	CPPUNIT_ASSERT(rv == CKR_OPERATION_NOT_INITIALIZED);
+
+	rv = CRYPTOKI_F_PTR( C_DigestInit(hSession1, &mechanism) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestUpdate(hSession1, data, 10) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// The state is sealed under the token key
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSession1, NULL_PTR, &stateLen) );
+	CPPUNIT_ASSERT(rv == CKR_STATE_UNSAVEABLE);
+
+	rv = CRYPTOKI_F_PTR( C_Login(hSession1, CKU_SO, m_soPin1, m_soPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSession1, NULL_PTR, NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSession1, NULL_PTR, &stateLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	state = (CK_BYTE_PTR)malloc(stateLen);
+
+	stateLen -= 1;
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSession1, state, &stateLen) );
+	CPPUNIT_ASSERT(rv == CKR_BUFFER_TOO_SMALL);
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSession1, state, &stateLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Continue the operation in the other session
+	rv = CRYPTOKI_F_PTR( C_SetOperationState(hSession2, state, stateLen, CK_INVALID_HANDLE, CK_INVALID_HANDLE) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestUpdate(hSession2, data + 10, sizeof(data)-1-10) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestFinal(hSession2, resumedDigest, &resumedDigestLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	CPPUNIT_ASSERT(resumedDigestLen == digestLen);
+	CPPUNIT_ASSERT(memcmp(digest, resumedDigest, digestLen) == 0);
+
+	// A modified state is rejected
+	state[stateLen - 1] ^= 0x01;
+	rv = CRYPTOKI_F_PTR( C_SetOperationState(hSession2, state, stateLen, CK_INVALID_HANDLE, CK_INVALID_HANDLE) );
+	CPPUNIT_ASSERT(rv == CKR_SAVED_STATE_INVALID);
+	state[stateLen - 1] ^= 0x01;
+
+	// The saved state can also be continued without the option
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	useConfig("softhsm2.conf");
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession1, CKU_SO, m_soPin1, m_soPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_SetOperationState(hSession1, state, stateLen, CK_INVALID_HANDLE, CK_INVALID_HANDLE) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestUpdate(hSession1, data + 10, sizeof(data)-1-10) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	resumedDigestLen = sizeof(resumedDigest);
+	rv = CRYPTOKI_F_PTR( C_DigestFinal(hSession1, resumedDigest, &resumedDigestLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	CPPUNIT_ASSERT(resumedDigestLen == digestLen);
+	CPPUNIT_ASSERT(memcmp(digest, resumedDigest, digestLen) == 0);
+
+	free(state);
+}
+
+#ifndef P11M
+void DigestTests::testDigestUpdateV()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_MECHANISM mechanism = { CKM_SHA256, NULL_PTR, 0 };
+	CK_BYTE data[] = {"Text to digest in three segments"};
+	CK_BYTE digest[32];
+	CK_ULONG digestLen = sizeof(digest);
+	CK_BYTE segmentsDigest[32];
+	CK_ULONG segmentsDigestLen = sizeof(segmentsDigest);
+	CK_SOFTHSM_SEGMENT segments[] = {
+		{ data, 5 },
+		{ data + 5, 0 },
+		{ data + 5, 11 },
+		{ data + 16, sizeof(data)-1-16 }
+	};
+	CK_ULONG segmentCount = sizeof(segments)/sizeof(CK_SOFTHSM_SEGMENT);
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	rv = C_SoftHSM_DigestUpdateV(CK_INVALID_HANDLE, segments, segmentCount);
+	CPPUNIT_ASSERT(rv == CKR_CRYPTOKI_NOT_INITIALIZED);
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_DigestUpdateV(CK_INVALID_HANDLE, segments, segmentCount);
+	CPPUNIT_ASSERT(rv == CKR_SESSION_HANDLE_INVALID);
+
+	rv = C_SoftHSM_DigestUpdateV(hSession, segments, segmentCount);
+	CPPUNIT_ASSERT(rv == CKR_OPERATION_NOT_INITIALIZED);
+
+	// Reference digest
+	rv = CRYPTOKI_F_PTR( C_DigestInit(hSession, &mechanism) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Digest(hSession, data, sizeof(data)-1, digest, &digestLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_DigestInit(hSession, &mechanism) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_DigestUpdateV(hSession, NULL_PTR, segmentCount);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+
+	// The segments may be mixed with single updates
+	rv = C_SoftHSM_DigestUpdateV(hSession, segments, segmentCount - 1);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestUpdate(hSession, segments[3].pData, segments[3].ulLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestFinal(hSession, segmentsDigest, &segmentsDigestLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	CPPUNIT_ASSERT(segmentsDigestLen == digestLen);
+	CPPUNIT_ASSERT(memcmp(digest, segmentsDigest, digestLen) == 0);
+
+	// All segments in one call
+	segmentsDigestLen = sizeof(segmentsDigest);
+	rv = CRYPTOKI_F_PTR( C_DigestInit(hSession, &mechanism) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = C_SoftHSM_DigestUpdateV(hSession, segments, segmentCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_DigestFinal(hSession, segmentsDigest, &segmentsDigestLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	CPPUNIT_ASSERT(segmentsDigestLen == digestLen);
+	CPPUNIT_ASSERT(memcmp(digest, segmentsDigest, digestLen) == 0);
+}
+
+void DigestTests::testDigestBatch()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_MECHANISM mechanism = { CKM_SHA256, NULL_PTR, 0 };
+	CK_MECHANISM badMechanism = { CKM_VENDOR_DEFINED, NULL_PTR, 0 };
+	// Enough messages for the batch to be spread over threads
+	const CK_ULONG count = 2100;
+	const CK_ULONG digestLen = 32;
+	CK_BYTE data[count + 1];
+	CK_BYTE_PTR ppData[count];
+	CK_ULONG dataLens[count];
+	CK_BYTE_PTR digests;
+	CK_ULONG digestsLen;
+	CK_BYTE digest[digestLen];
+	CK_ULONG singleLen;
+
+	for (CK_ULONG i = 0; i < count; i++)
+	{
+		data[i] = (CK_BYTE)i;
+		ppData[i] = data + i % 64;
+		dataLens[i] = i % 200;
+	}
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	rv = C_SoftHSM_DigestBatch(CK_INVALID_HANDLE, &mechanism, count, ppData, dataLens, NULL_PTR, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_CRYPTOKI_NOT_INITIALIZED);
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_DigestBatch(CK_INVALID_HANDLE, &mechanism, count, ppData, dataLens, NULL_PTR, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_SESSION_HANDLE_INVALID);
+	rv = C_SoftHSM_DigestBatch(hSession, &badMechanism, count, ppData, dataLens, NULL_PTR, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_MECHANISM_INVALID);
+	rv = C_SoftHSM_DigestBatch(hSession, &mechanism, count, NULL_PTR, dataLens, NULL_PTR, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+	// The digests would not fit in one buffer
+	rv = C_SoftHSM_DigestBatch(hSession, &mechanism, ULONG_MAX / digestLen + 1, ppData, dataLens, NULL_PTR, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+
+	// Get the size of the output
+	rv = C_SoftHSM_DigestBatch(hSession, &mechanism, count, ppData, dataLens, NULL_PTR, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(digestsLen == count * digestLen);
+
+	digests = (CK_BYTE_PTR)malloc(digestsLen);
+
+	digestsLen -= 1;
+	rv = C_SoftHSM_DigestBatch(hSession, &mechanism, count, ppData, dataLens, digests, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_BUFFER_TOO_SMALL);
+	CPPUNIT_ASSERT(digestsLen == count * digestLen);
+
+	// An operation that is active in the session is not affected
+	rv = CRYPTOKI_F_PTR( C_DigestInit(hSession, &mechanism) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = C_SoftHSM_DigestBatch(hSession, &mechanism, count, ppData, dataLens, digests, &digestsLen);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(digestsLen == count * digestLen);
+
+	singleLen = sizeof(digest);
+	rv = CRYPTOKI_F_PTR( C_DigestFinal(hSession, digest, &singleLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Every digest matches the one of a single operation
+	for (CK_ULONG i = 0; i < count; i++)
+	{
+		singleLen = sizeof(digest);
+		rv = CRYPTOKI_F_PTR( C_DigestInit(hSession, &mechanism) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+		rv = CRYPTOKI_F_PTR( C_Digest(hSession, ppData[i], dataLens[i], digest, &singleLen) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+		CPPUNIT_ASSERT(singleLen == digestLen);
+		CPPUNIT_ASSERT(memcmp(digests + i * digestLen, digest, digestLen) == 0);
+	}
+
+	free(digests);
+}
+#endif
@@ -45,6 +45,11 @@ class DigestTests : public TestsNoPINInitBase
 	CPPUNIT_TEST(testDigestKey);
 	CPPUNIT_TEST(testDigestFinal);
 	CPPUNIT_TEST(testDigestAll);
+	CPPUNIT_TEST(testDigestOperationState);
+#ifndef P11M
+	CPPUNIT_TEST(testDigestUpdateV);
+	CPPUNIT_TEST(testDigestBatch);
+#endif
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -54,6 +59,9 @@ public:
 	void testDigestKey();
 	void testDigestFinal();
 	void testDigestAll();
+	void testDigestOperationState();
+	void testDigestUpdateV();
+	void testDigestBatch();
 };
 
 #endif // !_SOFTHSM_V2_DIGESTTESTS_H
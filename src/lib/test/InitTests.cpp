@@ -35,7 +35,13 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include "InitTests.h"
 #include "cryptoki.h"
+#include "softhsm2_vendor.h"
 #include "osmutex.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 CPPUNIT_TEST_SUITE_REGISTRATION(InitTests);
 
@@ -245,3 +251,90 @@ void InitTests::testFinal()
 	rv = CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
 	CPPUNIT_ASSERT(rv == CKR_OK);
 }
+
+#ifndef _WIN32
+// Initialise the child of a fork and return where it failed, 0 if it did not
+int InitTests::initChild(CK_C_INITIALIZE_ARGS_PTR pInitArgs, CK_SESSION_HANDLE hParentSession, CK_ULONG ulParentSlots, int parentFd)
+{
+	CK_SLOT_ID slots[64];
+	CK_ULONG ulSlots = 64;
+	CK_SESSION_HANDLE hSession;
+
+	if (CRYPTOKI_F_PTR( C_Initialize((CK_VOID_PTR)pInitArgs) ) != CKR_OK) return 1;
+	if (CRYPTOKI_F_PTR( C_Initialize((CK_VOID_PTR)pInitArgs) ) != CKR_CRYPTOKI_ALREADY_INITIALIZED) return 2;
+
+	// The descriptors of the parent are closed
+	if (parentFd != -1 && fcntl(parentFd, F_GETFD) != -1) return 9;
+
+	// The slots of the parent are there, its sessions are not
+	if (CRYPTOKI_F_PTR( C_GetSlotList(CK_FALSE, slots, &ulSlots) ) != CKR_OK) return 3;
+	if (ulSlots != ulParentSlots) return 4;
+	if (CRYPTOKI_F_PTR( C_CloseSession(hParentSession) ) != CKR_SESSION_HANDLE_INVALID) return 5;
+	if (CRYPTOKI_F_PTR( C_OpenSession(slots[0], CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSession) ) != CKR_OK) return 6;
+	if (CRYPTOKI_F_PTR( C_CloseSession(hSession) ) != CKR_OK) return 7;
+
+	if (CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) ) != CKR_OK) return 8;
+
+	return 0;
+}
+
+void InitTests::testInitFork()
+{
+	CK_C_INITIALIZE_ARGS InitArgs;
+	CK_SLOT_ID slots[64];
+	CK_ULONG ulSlots = 64;
+	CK_SESSION_HANDLE hSession;
+	CK_RV rv;
+	int status;
+
+	InitArgs.CreateMutex = NULL_PTR;
+	InitArgs.DestroyMutex = NULL_PTR;
+	InitArgs.LockMutex = NULL_PTR;
+	InitArgs.UnlockMutex = NULL_PTR;
+	InitArgs.flags = CKF_OS_LOCKING_OK;
+	InitArgs.pReserved = NULL_PTR;
+
+	// Just make sure that we finalize any previous failed tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	rv = CRYPTOKI_F_PTR( C_Initialize((CK_VOID_PTR)&InitArgs) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_GetSlotList(CK_FALSE, slots, &ulSlots) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulSlots > 0);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(slots[0], CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Start the asynchronous workers, if they are supported
+	int fd;
+	if (C_SoftHSM_GetAsyncEventFd(&fd) != CKR_OK) fd = -1;
+
+	// The child loads the tokens again
+	pid_t pid = fork();
+	CPPUNIT_ASSERT(pid >= 0);
+	if (pid == 0) _exit(initChild(&InitArgs, hSession, ulSlots, fd));
+	CPPUNIT_ASSERT(waitpid(pid, &status, 0) == pid);
+	CPPUNIT_ASSERT(WIFEXITED(status));
+	CPPUNIT_ASSERT_EQUAL(0, WEXITSTATUS(status));
+
+	// Also if it locks differently
+	pid = fork();
+	CPPUNIT_ASSERT(pid >= 0);
+	if (pid == 0) _exit(initChild(NULL_PTR, hSession, ulSlots, fd));
+	CPPUNIT_ASSERT(waitpid(pid, &status, 0) == pid);
+	CPPUNIT_ASSERT(WIFEXITED(status));
+	CPPUNIT_ASSERT_EQUAL(0, WEXITSTATUS(status));
+
+	// The parent is not affected
+	rv = CRYPTOKI_F_PTR( C_Initialize((CK_VOID_PTR)&InitArgs) );
+	CPPUNIT_ASSERT(rv == CKR_CRYPTOKI_ALREADY_INITIALIZED);
+
+	rv = CRYPTOKI_F_PTR( C_CloseSession(hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+}
+#endif
@@ -46,6 +46,9 @@ class InitTests : public TestsNoPINInitBase
 	CPPUNIT_TEST(testInit5);
 	CPPUNIT_TEST(testInit6);
 	CPPUNIT_TEST(testFinal);
+#ifndef _WIN32
+	CPPUNIT_TEST(testInitFork);
+#endif
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -56,9 +59,17 @@ public:
 	void testInit5();
 	void testInit6();
 	void testFinal();
+#ifndef _WIN32
+	void testInitFork();
+#endif
 
 	virtual void setUp();
 	virtual void tearDown();
+
+#ifndef _WIN32
+private:
+	int initChild(CK_C_INITIALIZE_ARGS_PTR pInitArgs, CK_SESSION_HANDLE hParentSession, CK_ULONG ulParentSlots, int parentFd);
+#endif
 };
 
 #endif // !_SOFTHSM_V2_INITTESTS_H
@@ -2391,3 +2391,98 @@ void ObjectTests::testCreateSecretKey()
 	CPPUNIT_ASSERT(rv == CKR_OK);
 }
 
+
+void ObjectTests::testSealedPrivateValue()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hObject;
+	CK_OBJECT_HANDLE hCopy;
+	CK_OBJECT_HANDLE hFound;
+	CK_ULONG ulCount;
+	CK_BYTE data[] = "Sample data";
+	CK_UTF8CHAR label[] = "Another label";
+	CK_BYTE value[64];
+	CK_ATTRIBUTE valueTemplate[] = {
+		{ CKA_VALUE, value, sizeof(value) }
+	};
+	CK_ATTRIBUTE setTemplate[] = {
+		{ CKA_LABEL, label, sizeof(label)-1 }
+	};
+	CK_ATTRIBUTE findTemplate[] = {
+		{ CKA_VALUE, data, sizeof(data) }
+	};
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	// Initialize the library and start the test.
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Open read-write session
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Login USER into the sessions so we can create a private objects
+	rv = CRYPTOKI_F_PTR( C_Login(hSession,CKU_USER,m_userPin1,m_userPin1Length) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	// The value of a private object is sealed when it is created
+	rv = createDataObjectNormal(hSession, ON_TOKEN, IS_PRIVATE, hObject);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_GetAttributeValue(hSession, hObject, valueTemplate, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(valueTemplate[0].ulValueLen == sizeof(data));
+	CPPUNIT_ASSERT(memcmp(value, data, sizeof(data)) == 0);
+
+	// Changing other attributes leaves the sealed value intact
+	rv = CRYPTOKI_F_PTR( C_SetAttributeValue(hSession, hObject, setTemplate, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	valueTemplate[0].ulValueLen = sizeof(value);
+	rv = CRYPTOKI_F_PTR( C_GetAttributeValue(hSession, hObject, valueTemplate, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(valueTemplate[0].ulValueLen == sizeof(data));
+	CPPUNIT_ASSERT(memcmp(value, data, sizeof(data)) == 0);
+
+	// A copy carries the sealed value
+	rv = CRYPTOKI_F_PTR( C_CopyObject(hSession, hObject, setTemplate, 1, &hCopy) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	valueTemplate[0].ulValueLen = sizeof(value);
+	rv = CRYPTOKI_F_PTR( C_GetAttributeValue(hSession, hCopy, valueTemplate, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(valueTemplate[0].ulValueLen == sizeof(data));
+	CPPUNIT_ASSERT(memcmp(value, data, sizeof(data)) == 0);
+
+	rv = CRYPTOKI_F_PTR( C_DestroyObject(hSession, hCopy) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// The sealed value survives a restart and can be searched for
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSession,CKU_USER,m_userPin1,m_userPin1Length) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_FindObjectsInit(hSession, findTemplate, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_FindObjects(hSession, &hFound, 1, &ulCount) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == 1);
+	rv = CRYPTOKI_F_PTR( C_FindObjectsFinal(hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	valueTemplate[0].ulValueLen = sizeof(value);
+	rv = CRYPTOKI_F_PTR( C_GetAttributeValue(hSession, hFound, valueTemplate, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(valueTemplate[0].ulValueLen == sizeof(data));
+	CPPUNIT_ASSERT(memcmp(value, data, sizeof(data)) == 0);
+
+	rv = CRYPTOKI_F_PTR( C_DestroyObject(hSession, hFound) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+}
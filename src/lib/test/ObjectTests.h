@@ -61,6 +61,7 @@ class ObjectTests : public TestsBase
 	CPPUNIT_TEST(testReAuthentication);
 	CPPUNIT_TEST(testTemplateAttribute);
 	CPPUNIT_TEST(testCreateSecretKey);
+	CPPUNIT_TEST(testSealedPrivateValue);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -84,6 +85,7 @@ public:
 	void testAllowedMechanisms();
 	void testTemplateAttribute();
 	void testCreateSecretKey();
+	void testSealedPrivateValue();
 
 protected:
 	void checkCommonObjectAttributes
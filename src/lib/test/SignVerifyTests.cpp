@@ -42,7 +42,9 @@
 #include <config.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 #include "SignVerifyTests.h"
+#include "softhsm2_vendor.h"
 
 // CKA_TOKEN
 const CK_BBOOL ON_TOKEN = CK_TRUE;
@@ -590,6 +592,137 @@ void SignVerifyTests::testEdSignVerify()
 }
 #endif
 
+#if defined(WITH_ECC) && !defined(P11M)
+void SignVerifyTests::testEcBatchGenerate()
+{
+	const CK_ULONG nrOfKeys = 40;
+
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRO;
+	CK_SESSION_HANDLE hSessionRW;
+	CK_MECHANISM mechanism = { CKM_EC_KEY_PAIR_GEN, NULL_PTR, 0 };
+	CK_MECHANISM rsaMechanism = { CKM_RSA_PKCS_KEY_PAIR_GEN, NULL_PTR, 0 };
+	CK_BYTE oidP256[] = { 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07 };
+	CK_BYTE label[] = { 0x12, 0x34 }; // dummy
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_EC_PARAMS, oidP256, sizeof(oidP256) },
+		{ CKA_LABEL, &label[0], sizeof(label) },
+		{ CKA_VERIFY, &bTrue, sizeof(bTrue) },
+		{ CKA_TOKEN, &bTrue, sizeof(bTrue) },
+		{ CKA_PRIVATE, &bFalse, sizeof(bFalse) }
+	};
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_LABEL, &label[0], sizeof(label) },
+		{ CKA_SIGN, &bTrue, sizeof(bTrue) },
+		{ CKA_SENSITIVE, &bTrue, sizeof(bTrue) },
+		{ CKA_TOKEN, &bTrue, sizeof(bTrue) },
+		{ CKA_PRIVATE, &bTrue, sizeof(bTrue) },
+		{ CKA_EXTRACTABLE, &bFalse, sizeof(bFalse) }
+	};
+	CK_OBJECT_HANDLE hPuks[nrOfKeys];
+	CK_OBJECT_HANDLE hPrks[nrOfKeys];
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSessionRW) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// The private keys are private objects
+	rv = C_SoftHSM_GenerateKeyPairBatch(hSessionRW, &mechanism,
+					    pukAttribs, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE),
+					    prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+					    nrOfKeys, hPuks, hPrks);
+	CPPUNIT_ASSERT(rv == CKR_USER_NOT_LOGGED_IN);
+
+	rv = CRYPTOKI_F_PTR( C_Login(hSessionRO,CKU_USER,m_userPin1,m_userPin1Length) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	// Only EC and EDDSA key pairs
+	rv = C_SoftHSM_GenerateKeyPairBatch(hSessionRW, &rsaMechanism,
+					    pukAttribs, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE),
+					    prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+					    nrOfKeys, hPuks, hPrks);
+	CPPUNIT_ASSERT(rv == CKR_MECHANISM_INVALID);
+
+	// The curve is needed
+	rv = C_SoftHSM_GenerateKeyPairBatch(hSessionRW, &mechanism,
+					    pukAttribs + 1, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE) - 1,
+					    prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+					    nrOfKeys, hPuks, hPrks);
+	CPPUNIT_ASSERT(rv == CKR_TEMPLATE_INCOMPLETE);
+
+	rv = C_SoftHSM_GenerateKeyPairBatch(hSessionRW, &mechanism,
+					    pukAttribs, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE),
+					    prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+					    0, hPuks, hPrks);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+
+	rv = C_SoftHSM_GenerateKeyPairBatch(hSessionRW, &mechanism,
+					    pukAttribs, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE),
+					    prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+					    nrOfKeys, hPuks, hPrks);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Every key pair is a distinct working pair
+	for (CK_ULONG i = 0; i < nrOfKeys; i++)
+	{
+		CPPUNIT_ASSERT(hPuks[i] != CK_INVALID_HANDLE);
+		CPPUNIT_ASSERT(hPrks[i] != CK_INVALID_HANDLE);
+		for (CK_ULONG j = 0; j < i; j++)
+		{
+			CPPUNIT_ASSERT(hPuks[i] != hPuks[j]);
+			CPPUNIT_ASSERT(hPrks[i] != hPrks[j]);
+		}
+	}
+	signVerifySingle(CKM_ECDSA, hSessionRO, hPuks[0], hPrks[0]);
+	signVerifySingle(CKM_ECDSA, hSessionRO, hPuks[nrOfKeys - 1], hPrks[nrOfKeys - 1]);
+
+	CK_BYTE point0[128];
+	CK_BYTE point1[128];
+	CK_ATTRIBUTE pointAttrib0 = { CKA_EC_POINT, point0, sizeof(point0) };
+	CK_ATTRIBUTE pointAttrib1 = { CKA_EC_POINT, point1, sizeof(point1) };
+	rv = CRYPTOKI_F_PTR( C_GetAttributeValue(hSessionRO, hPuks[0], &pointAttrib0, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_GetAttributeValue(hSessionRO, hPuks[1], &pointAttrib1, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(pointAttrib0.ulValueLen == pointAttrib1.ulValueLen);
+	CPPUNIT_ASSERT(memcmp(point0, point1, pointAttrib0.ulValueLen) != 0);
+
+	for (CK_ULONG i = 0; i < nrOfKeys; i++)
+	{
+		rv = CRYPTOKI_F_PTR( C_DestroyObject(hSessionRW, hPuks[i]) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+		rv = CRYPTOKI_F_PTR( C_DestroyObject(hSessionRW, hPrks[i]) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+
+#ifdef WITH_EDDSA
+	CK_MECHANISM edMechanism = { CKM_EC_EDWARDS_KEY_PAIR_GEN, NULL_PTR, 0 };
+	CK_BYTE oidEd25519[] = { 0x06, 0x03, 0x2B, 0x65, 0x70 };
+	pukAttribs[0].pValue = oidEd25519;
+	pukAttribs[0].ulValueLen = sizeof(oidEd25519);
+
+	rv = C_SoftHSM_GenerateKeyPairBatch(hSessionRW, &edMechanism,
+					    pukAttribs, sizeof(pukAttribs)/sizeof(CK_ATTRIBUTE),
+					    prkAttribs, sizeof(prkAttribs)/sizeof(CK_ATTRIBUTE),
+					    3, hPuks, hPrks);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	for (CK_ULONG i = 0; i < 3; i++)
+	{
+		signVerifySingle(CKM_EDDSA, hSessionRO, hPuks[i], hPrks[i]);
+	}
+#endif
+}
+#endif
+
 CK_RV SignVerifyTests::generateKey(CK_SESSION_HANDLE hSession, CK_KEY_TYPE keyType, CK_BBOOL bToken, CK_BBOOL bPrivate, CK_OBJECT_HANDLE &hKey)
 {
 #ifndef WITH_BOTAN
@@ -938,3 +1071,193 @@ void SignVerifyTests::testMacSignVerify()
 	macSignVerify(CKM_AES_CMAC, hSessionRO, hKey);
 }
 
+
+void SignVerifyTests::testMacOperationState()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRO;
+	CK_SESSION_HANDLE hSessionRW;
+	CK_MECHANISM mechanism = { CKM_SHA256_HMAC, NULL_PTR, 0 };
+	CK_BYTE data[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,0x0C, 0x0D, 0x0F };
+	CK_BYTE signature[256];
+	CK_ULONG ulSignatureLen = sizeof(signature);
+	CK_BYTE state[512];
+	CK_ULONG ulStateLen = sizeof(state);
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	// The HMAC has to run on contexts that can be saved
+	useConfig("softhsm2-opt.conf");
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSessionRW) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_Login(hSessionRO,CKU_USER,m_userPin1,m_userPin1Length) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	CK_OBJECT_HANDLE hKey = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hOtherKey = CK_INVALID_HANDLE;
+	rv = generateKey(hSessionRW,CKK_SHA256_HMAC,IN_SESSION,IS_PRIVATE,hKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateKey(hSessionRW,CKK_SHA256_HMAC,IN_SESSION,IS_PRIVATE,hOtherKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Sign the first half and save the state
+	rv = CRYPTOKI_F_PTR( C_SignInit(hSessionRO,&mechanism,hKey) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_SignUpdate(hSessionRO,data,7) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_GetOperationState(hSessionRO,state,&ulStateLen) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	// Finish in the other session
+	rv = CRYPTOKI_F_PTR( C_SetOperationState(hSessionRW,state,ulStateLen,CK_INVALID_HANDLE,CK_INVALID_HANDLE) );
+	CPPUNIT_ASSERT(rv==CKR_KEY_NEEDED);
+	rv = CRYPTOKI_F_PTR( C_SetOperationState(hSessionRW,state,ulStateLen,CK_INVALID_HANDLE,hOtherKey) );
+	CPPUNIT_ASSERT(rv==CKR_KEY_CHANGED);
+	rv = CRYPTOKI_F_PTR( C_SetOperationState(hSessionRW,state,ulStateLen,CK_INVALID_HANDLE,hKey) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_SignUpdate(hSessionRW,data+7,sizeof(data)-7) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_SignFinal(hSessionRW,signature,&ulSignatureLen) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	// The signature covers all of the data
+	rv = CRYPTOKI_F_PTR( C_VerifyInit(hSessionRW,&mechanism,hKey) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Verify(hSessionRW,data,sizeof(data),signature,ulSignatureLen) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	// A partially updated operation cannot be finished single-part
+	rv = CRYPTOKI_F_PTR( C_SetOperationState(hSessionRW,state,ulStateLen,CK_INVALID_HANDLE,hKey) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+	ulSignatureLen = sizeof(signature);
+	rv = CRYPTOKI_F_PTR( C_Sign(hSessionRW,data,sizeof(data),signature,&ulSignatureLen) );
+	CPPUNIT_ASSERT(rv==CKR_OPERATION_NOT_INITIALIZED);
+}
+
+#ifndef P11M
+void SignVerifyTests::testKeyUsage()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRO;
+	CK_SESSION_HANDLE hSessionRW;
+	CK_MECHANISM mechanism = { CKM_SHA256_HMAC, NULL_PTR, 0 };
+	CK_BYTE data[] = { 0x01, 0x02, 0x03, 0x04 };
+	CK_BYTE signature[64];
+	CK_ULONG ulSignatureLen;
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSessionRW) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Login(hSessionRO,CKU_USER,m_userPin1,m_userPin1Length) );
+	CPPUNIT_ASSERT(rv==CKR_OK);
+
+	CK_OBJECT_HANDLE hHot, hWarm, hCold;
+	rv = generateKey(hSessionRW,CKK_SHA256_HMAC,IN_SESSION,IS_PRIVATE,hHot);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateKey(hSessionRW,CKK_SHA256_HMAC,IN_SESSION,IS_PRIVATE,hWarm);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = generateKey(hSessionRW,CKK_SHA256_HMAC,IN_SESSION,IS_PRIVATE,hCold);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Sign three times and verify once with the hot key, sign once with the warm one
+	for (int i = 0; i < 3; i++)
+	{
+		rv = CRYPTOKI_F_PTR( C_SignInit(hSessionRO,&mechanism,hHot) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+		ulSignatureLen = sizeof(signature);
+		rv = CRYPTOKI_F_PTR( C_Sign(hSessionRO,data,sizeof(data),signature,&ulSignatureLen) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+	rv = CRYPTOKI_F_PTR( C_VerifyInit(hSessionRO,&mechanism,hHot) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Verify(hSessionRO,data,sizeof(data),signature,ulSignatureLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_SignInit(hSessionRO,&mechanism,hWarm) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	ulSignatureLen = sizeof(signature);
+	rv = CRYPTOKI_F_PTR( C_Sign(hSessionRO,data,sizeof(data),signature,&ulSignatureLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// A failed initialisation is not counted
+	rv = CRYPTOKI_F_PTR( C_EncryptInit(hSessionRO,&mechanism,hCold) );
+	CPPUNIT_ASSERT(rv != CKR_OK);
+
+	// Bad arguments
+	CK_ULONG ulCount = 0;
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, 0, NULL_PTR, NULL_PTR);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, 0x80, NULL_PTR, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+
+	// Only the used keys, most used first
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, 0, NULL_PTR, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == 2);
+
+	CK_SOFTHSM_KEY_USAGE usage[2];
+	ulCount = 2;
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, 0, usage, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == 2);
+	CPPUNIT_ASSERT(usage[0].hKey == hHot);
+	CPPUNIT_ASSERT(usage[0].ulSign == 3);
+	CPPUNIT_ASSERT(usage[0].ulVerify == 1);
+	CPPUNIT_ASSERT(usage[0].ulEncrypt == 0);
+	CPPUNIT_ASSERT(usage[0].ulLastUsed != 0);
+	CPPUNIT_ASSERT(usage[1].hKey == hWarm);
+	CPPUNIT_ASSERT(usage[1].ulSign == 1);
+	CPPUNIT_ASSERT(usage[1].ulVerify == 0);
+
+	// Only the top key
+	ulCount = 1;
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, 0, usage, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == 1);
+	CPPUNIT_ASSERT(usage[0].hKey == hHot);
+
+	// The least used keys include the unused ones and end with the hot key
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, CKF_SOFTHSM_USAGE_LEAST_USED, NULL_PTR, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount >= 3);
+
+	std::vector<CK_SOFTHSM_KEY_USAGE> all(ulCount);
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, CKF_SOFTHSM_USAGE_LEAST_USED, &all.front(), &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == all.size());
+	CPPUNIT_ASSERT(all[ulCount - 1].hKey == hHot);
+	CPPUNIT_ASSERT(all[ulCount - 2].hKey == hWarm);
+	bool foundCold = false;
+	for (CK_ULONG i = 0; i < ulCount - 2; i++)
+	{
+		if (all[i].hKey != hCold) continue;
+
+		foundCold = true;
+		CPPUNIT_ASSERT(all[i].ulSign == 0);
+		CPPUNIT_ASSERT(all[i].ulLastUsed == 0);
+	}
+	CPPUNIT_ASSERT(foundCold);
+
+	// The private keys are not seen by a public session
+	rv = CRYPTOKI_F_PTR( C_Logout(hSessionRO) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = C_SoftHSM_GetKeyUsage(hSessionRO, 0, NULL_PTR, &ulCount);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(ulCount == 0);
+}
+#endif
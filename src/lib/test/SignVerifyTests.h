@@ -47,8 +47,15 @@ class SignVerifyTests : public TestsBase
 #endif
 #ifdef WITH_EDDSA
 	CPPUNIT_TEST(testEdSignVerify);
+#endif
+#if defined(WITH_ECC) && !defined(P11M)
+	CPPUNIT_TEST(testEcBatchGenerate);
 #endif
 	CPPUNIT_TEST(testMacSignVerify);
+	CPPUNIT_TEST(testMacOperationState);
+#ifndef P11M
+	CPPUNIT_TEST(testKeyUsage);
+#endif
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -58,8 +65,15 @@ public:
 #endif
 #ifdef WITH_EDDSA
 	void testEdSignVerify();
+#endif
+#if defined(WITH_ECC) && !defined(P11M)
+	void testEcBatchGenerate();
 #endif
 	void testMacSignVerify();
+	void testMacOperationState();
+#ifndef P11M
+	void testKeyUsage();
+#endif
 
 protected:
 	CK_RV generateRSA(CK_SESSION_HANDLE hSession, CK_BBOOL bTokenPuk, CK_BBOOL bPrivatePuk, CK_BBOOL bTokenPrk, CK_BBOOL bPrivatePrk, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
@@ -36,6 +36,7 @@
 #include <climits>
 //#include <iomanip>
 #include "SymmetricAlgorithmTests.h"
+#include "softhsm2_vendor.h"
 
 // CKA_TOKEN
 const CK_BBOOL ON_TOKEN = CK_TRUE;
@@ -526,6 +527,135 @@ void SymmetricAlgorithmTests::aesWrapUnwrapGeneric(CK_MECHANISM_TYPE mechanismTy
 	CPPUNIT_ASSERT(rv == CKR_OK);
 }
 
+#ifndef P11M
+void SymmetricAlgorithmTests::aesWrapUnwrapBatch(CK_MECHANISM_TYPE mechanismType, CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey)
+{
+	CK_MECHANISM mechanism = { mechanismType, NULL_PTR, 0 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_OBJECT_CLASS secretClass = CKO_SECRET_KEY;
+	CK_KEY_TYPE genKeyType = CKK_GENERIC_SECRET;
+	CK_UTF8CHAR label[] = "batch";
+	const CK_ULONG count = 3;
+	CK_BYTE keys[count][32];
+	CK_ULONG keyLens[count] = { 16, 24, 32 };
+	CK_OBJECT_HANDLE hSecrets[count];
+	CK_RV rv;
+
+	for (CK_ULONG i = 0; i < count; i++)
+	{
+		CK_ATTRIBUTE attribs[] = {
+			{ CKA_EXTRACTABLE, &bTrue, sizeof(bTrue) },
+			{ CKA_CLASS, &secretClass, sizeof(secretClass) },
+			{ CKA_KEY_TYPE, &genKeyType, sizeof(genKeyType) },
+			{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+			{ CKA_PRIVATE, &bTrue, sizeof(bTrue) },
+			{ CKA_SENSITIVE, &bTrue, sizeof(bTrue) },
+			{ CKA_VALUE, keys[i], keyLens[i] }
+		};
+
+		rv = CRYPTOKI_F_PTR( C_GenerateRandom(hSession, keys[i], keyLens[i]) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+
+		hSecrets[i] = CK_INVALID_HANDLE;
+		rv = CRYPTOKI_F_PTR( C_CreateObject(hSession, attribs, sizeof(attribs)/sizeof(CK_ATTRIBUTE), &hSecrets[i]) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+
+	// Estimate wrapped lengths
+	CK_BYTE wrapped[count][40];
+	CK_BYTE_PTR wrappedPtrs[count] = { wrapped[0], wrapped[1], wrapped[2] };
+	CK_ULONG wrappedLens[count] = { 0, 0, 0 };
+	rv = C_SoftHSM_WrapKeyBatch(hSession, &mechanism, hKey, count, hSecrets, NULL_PTR, wrappedLens);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	for (CK_ULONG i = 0; i < count; i++)
+		CPPUNIT_ASSERT(wrappedLens[i] == keyLens[i] + 8);
+
+	wrappedLens[1]--;
+	rv = C_SoftHSM_WrapKeyBatch(hSession, &mechanism, hKey, count, hSecrets, wrappedPtrs, wrappedLens);
+	CPPUNIT_ASSERT(rv == CKR_BUFFER_TOO_SMALL);
+	CPPUNIT_ASSERT(wrappedLens[1] == keyLens[1] + 8);
+
+	rv = C_SoftHSM_WrapKeyBatch(hSession, &mechanism, hKey, count, hSecrets, wrappedPtrs, wrappedLens);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// The batch gives the same result as wrapping the keys one by one
+	for (CK_ULONG i = 0; i < count; i++)
+	{
+		CK_BYTE single[40];
+		CK_ULONG singleLen = sizeof(single);
+		rv = CRYPTOKI_F_PTR( C_WrapKey(hSession, &mechanism, hKey, hSecrets[i], single, &singleLen) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+		CPPUNIT_ASSERT(singleLen == wrappedLens[i]);
+		CPPUNIT_ASSERT(memcmp(single, wrapped[i], singleLen) == 0);
+	}
+
+	CK_ATTRIBUTE nattribs[] = {
+		{ CKA_CLASS, &secretClass, sizeof(secretClass) },
+		{ CKA_KEY_TYPE, &genKeyType, sizeof(genKeyType) },
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+		{ CKA_PRIVATE, &bTrue, sizeof(bTrue) },
+		{ CKA_SENSITIVE, &bFalse, sizeof(bFalse) },
+		{ CKA_EXTRACTABLE, &bTrue, sizeof(bTrue) },
+		{ CKA_LABEL, label, sizeof(label) - 1 }
+	};
+	CK_ATTRIBUTE_PTR templates[count] = { nattribs, nattribs, nattribs };
+	CK_ULONG counts[count] = { 7, 7, 7 };
+	CK_OBJECT_HANDLE hNew[count];
+
+	rv = C_SoftHSM_UnwrapKeyBatch(hSession, &mechanism, hKey, count, wrappedPtrs, wrappedLens, templates, counts, hNew);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	for (CK_ULONG i = 0; i < count; i++)
+	{
+		CK_BYTE value[32];
+		CK_ATTRIBUTE valueAttrib = { CKA_VALUE, value, sizeof(value) };
+
+		CPPUNIT_ASSERT(hNew[i] != CK_INVALID_HANDLE);
+		rv = CRYPTOKI_F_PTR( C_GetAttributeValue(hSession, hNew[i], &valueAttrib, 1) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+		CPPUNIT_ASSERT(valueAttrib.ulValueLen == keyLens[i]);
+		CPPUNIT_ASSERT(memcmp(value, keys[i], keyLens[i]) == 0);
+
+		rv = CRYPTOKI_F_PTR( C_DestroyObject(hSession, hNew[i]) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+
+	// No key is created when one of them cannot be
+	CK_ATTRIBUTE battribs[] = {
+		{ CKA_CLASS, &secretClass, sizeof(secretClass) },
+		{ CKA_KEY_TYPE, &genKeyType, sizeof(genKeyType) },
+		{ CKA_TOKEN, &bFalse, sizeof(bFalse) },
+		{ CKA_LABEL, label, sizeof(label) - 1 },
+		{ CKA_MODULUS, keys[0], keyLens[0] }
+	};
+	templates[2] = battribs;
+	counts[2] = 5;
+	rv = C_SoftHSM_UnwrapKeyBatch(hSession, &mechanism, hKey, count, wrappedPtrs, wrappedLens, templates, counts, hNew);
+	CPPUNIT_ASSERT(rv == CKR_ATTRIBUTE_TYPE_INVALID);
+	for (CK_ULONG i = 0; i < count; i++)
+		CPPUNIT_ASSERT(hNew[i] == CK_INVALID_HANDLE);
+
+	CK_ATTRIBUTE findAttribs[] = {
+		{ CKA_LABEL, label, sizeof(label) - 1 }
+	};
+	CK_OBJECT_HANDLE hFound;
+	CK_ULONG found = 0;
+	rv = CRYPTOKI_F_PTR( C_FindObjectsInit(hSession, findAttribs, 1) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_FindObjects(hSession, &hFound, 1, &found) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(found == 0);
+	rv = CRYPTOKI_F_PTR( C_FindObjectsFinal(hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	for (CK_ULONG i = 0; i < count; i++)
+	{
+		rv = CRYPTOKI_F_PTR( C_DestroyObject(hSession, hSecrets[i]) );
+		CPPUNIT_ASSERT(rv == CKR_OK);
+	}
+}
+#endif
+
 void SymmetricAlgorithmTests::aesWrapUnwrapRsa(CK_MECHANISM_TYPE mechanismType, CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey)
 {
 	CK_MECHANISM mechanism = { mechanismType, NULL_PTR, 0 };
@@ -784,6 +914,9 @@ void SymmetricAlgorithmTests::testAesWrapUnwrap()
 
 	aesWrapUnwrapGeneric(CKM_AES_KEY_WRAP, hSession, hKey);
 	aesWrapUnwrapRsa(CKM_AES_KEY_WRAP, hSession, hKey);
+#ifndef P11M
+	aesWrapUnwrapBatch(CKM_AES_KEY_WRAP, hSession, hKey);
+#endif
 #ifdef WITH_GOST
 	aesWrapUnwrapGost(CKM_AES_KEY_WRAP, hSession, hKey);
 #endif
@@ -791,6 +924,9 @@ void SymmetricAlgorithmTests::testAesWrapUnwrap()
 #ifdef HAVE_AES_KEY_WRAP_PAD
 	aesWrapUnwrapGeneric(CKM_AES_KEY_WRAP_PAD, hSession, hKey);
 	aesWrapUnwrapRsa(CKM_AES_KEY_WRAP_PAD, hSession, hKey);
+#ifndef P11M
+	aesWrapUnwrapBatch(CKM_AES_KEY_WRAP_PAD, hSession, hKey);
+#endif
 #ifdef WITH_GOST
 	aesWrapUnwrapGost(CKM_AES_KEY_WRAP_PAD, hSession, hKey);
 #endif
@@ -1194,3 +1330,86 @@ void SymmetricAlgorithmTests::testGenericKey()
 	rv = generateGenericKey(hSession,IN_SESSION,IS_PUBLIC,hKey);
 	CPPUNIT_ASSERT(rv == CKR_OK);
 }
+
+#ifndef P11M
+void SymmetricAlgorithmTests::testAesEncryptUpdateV()
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession;
+	CK_BYTE iv[16] = { 0 };
+	CK_MECHANISM mechanism = { CKM_AES_CBC_PAD, iv, sizeof(iv) };
+	CK_BYTE data[77];
+	CK_BYTE reference[96];
+	CK_ULONG referenceLen = sizeof(reference);
+	CK_BYTE encrypted[96];
+	CK_ULONG encryptedLen;
+	CK_ULONG finalLen;
+
+	// Just make sure that we finalize any previous tests
+	CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) );
+
+	rv = CRYPTOKI_F_PTR( C_Initialize(NULL_PTR) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_OpenSession(m_initializedTokenSlotID, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, &hSession) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_Login(hSession, CKU_USER, m_userPin1, m_userPin1Length) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	CK_OBJECT_HANDLE hKey = CK_INVALID_HANDLE;
+	rv = generateAesKey(hSession, IN_SESSION, IS_PUBLIC, hKey);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	rv = CRYPTOKI_F_PTR( C_GenerateRandom(hSession, data, sizeof(data)) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// Reference encryption of the data in one buffer
+	rv = CRYPTOKI_F_PTR( C_EncryptInit(hSession, &mechanism, hKey) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	rv = CRYPTOKI_F_PTR( C_Encrypt(hSession, data, sizeof(data), reference, &referenceLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	// The same data in segments that do not line up with the blocks
+	CK_SOFTHSM_SEGMENT segments[] = {
+		{ data, 5 },
+		{ NULL_PTR, 0 },
+		{ data + 5, 30 },
+		{ data + 35, sizeof(data) - 35 }
+	};
+	CK_ULONG segmentCount = sizeof(segments)/sizeof(CK_SOFTHSM_SEGMENT);
+
+	rv = C_SoftHSM_EncryptUpdateV(hSession, segments, segmentCount, NULL_PTR, &encryptedLen);
+	CPPUNIT_ASSERT(rv == CKR_OPERATION_NOT_INITIALIZED);
+
+	rv = CRYPTOKI_F_PTR( C_EncryptInit(hSession, &mechanism, hKey) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+
+	CK_SOFTHSM_SEGMENT badSegment = { NULL_PTR, 1 };
+	rv = C_SoftHSM_EncryptUpdateV(hSession, &badSegment, 1, NULL_PTR, &encryptedLen);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+	rv = C_SoftHSM_EncryptUpdateV(hSession, segments, 0, NULL_PTR, &encryptedLen);
+	CPPUNIT_ASSERT(rv == CKR_ARGUMENTS_BAD);
+
+	rv = C_SoftHSM_EncryptUpdateV(hSession, segments, segmentCount, NULL_PTR, &encryptedLen);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(encryptedLen == 64);
+
+	encryptedLen = 63;
+	rv = C_SoftHSM_EncryptUpdateV(hSession, segments, segmentCount, encrypted, &encryptedLen);
+	CPPUNIT_ASSERT(rv == CKR_BUFFER_TOO_SMALL);
+	CPPUNIT_ASSERT(encryptedLen == 64);
+
+	rv = C_SoftHSM_EncryptUpdateV(hSession, segments, segmentCount, encrypted, &encryptedLen);
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	CPPUNIT_ASSERT(encryptedLen == 64);
+
+	finalLen = sizeof(encrypted) - encryptedLen;
+	rv = CRYPTOKI_F_PTR( C_EncryptFinal(hSession, encrypted + encryptedLen, &finalLen) );
+	CPPUNIT_ASSERT(rv == CKR_OK);
+	encryptedLen += finalLen;
+
+	CPPUNIT_ASSERT(encryptedLen == referenceLen);
+	CPPUNIT_ASSERT(memcmp(encrypted, reference, referenceLen) == 0);
+}
+#endif
@@ -49,6 +49,9 @@ class SymmetricAlgorithmTests : public TestsBase
 	CPPUNIT_TEST(testCheckValue);
 	CPPUNIT_TEST(testAesCtrOverflow);
 	CPPUNIT_TEST(testGenericKey);
+#ifndef P11M
+	CPPUNIT_TEST(testAesEncryptUpdateV);
+#endif
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -60,6 +63,7 @@ public:
 	void testCheckValue();
 	void testAesCtrOverflow();
 	void testGenericKey();
+	void testAesEncryptUpdateV();
 
 protected:
 	CK_RV generateGenericKey(CK_SESSION_HANDLE hSession, CK_BBOOL bToken, CK_BBOOL bPrivate, CK_OBJECT_HANDLE &hKey);
@@ -78,6 +82,9 @@ protected:
 			bool isSizeOK=true);
 	void aesWrapUnwrapGeneric(CK_MECHANISM_TYPE mechanismType, CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey);
 	void aesWrapUnwrapRsa(CK_MECHANISM_TYPE mechanismType, CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey);
+#ifndef P11M
+	void aesWrapUnwrapBatch(CK_MECHANISM_TYPE mechanismType, CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey);
+#endif
 	CK_RV generateRsaPrivateKey(CK_SESSION_HANDLE hSession, CK_BBOOL bToken, CK_BBOOL bPrivate, CK_OBJECT_HANDLE &hKey);
 #ifdef WITH_GOST
 	void aesWrapUnwrapGost(CK_MECHANISM_TYPE mechanismType, CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey);
@@ -32,6 +32,8 @@
 
 #include "TestsNoPINInitBase.h"
 #include <cstring>
+#include <stdlib.h>
+#include <string>
 #include <cppunit/extensions/HelperMacros.h>
 #include <vector>
 #include <sstream>
@@ -129,7 +131,16 @@ void TestsNoPINInitBase::setUp() {
 	getSlotIDs();
 }
 
+void TestsNoPINInitBase::useConfig(const char* fileName) {
+#ifndef _WIN32
+	setenv("SOFTHSM2_CONF", (std::string("./") + fileName).c_str(), 1);
+#else
+	setenv("SOFTHSM2_CONF", (std::string(".\\") + fileName).c_str(), 1);
+#endif
+}
+
 void TestsNoPINInitBase::tearDown() {
+	useConfig("softhsm2.conf");
 	const CK_RV result(CRYPTOKI_F_PTR( C_Finalize(NULL_PTR) ) );
 	if ( result==CKR_OK||result==CKR_CRYPTOKI_NOT_INITIALIZED ) {
 		return;
@@ -50,6 +50,10 @@ public:
 
 	virtual void setUp();
 	virtual void tearDown();
+protected:
+	// Use the named configuration file of the test directory from the
+	// next C_Initialize on; tearDown switches back to softhsm2.conf
+	void useConfig(const char* fileName);
 private:
 	void getSlotIDs();
 #ifdef P11M
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ digestbench.cpp
+
+ Compares C_SoftHSM_DigestBatch with a loop of C_DigestInit and C_Digest
+ calls over the same messages. Run it from the test directory, like p11test:
+
+   ./digestbench [count [size [rounds]]]
+
+ The messages have fixed contents, and the best time of the rounds is
+ reported for both.
+ *****************************************************************************/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "cryptoki.h"
+#include "softhsm2_vendor.h"
+
+// Return a monotonic time in seconds
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Open a session on an initialised token, initialising a free one if needed
+static CK_RV openSession(CK_SESSION_HANDLE* phSession)
+{
+	CK_ULONG ulSlots;
+	CK_RV rv = C_GetSlotList(CK_TRUE, NULL_PTR, &ulSlots);
+	if (rv != CKR_OK) return rv;
+
+	std::vector<CK_SLOT_ID> slots(ulSlots);
+	rv = C_GetSlotList(CK_TRUE, &slots.front(), &ulSlots);
+	if (rv != CKR_OK) return rv;
+
+	for (CK_ULONG i = 0; i < ulSlots; i++)
+	{
+		CK_TOKEN_INFO info;
+
+		rv = C_GetTokenInfo(slots[i], &info);
+		if (rv != CKR_OK) return rv;
+
+		if (!(info.flags & CKF_TOKEN_INITIALIZED)) continue;
+
+		return C_OpenSession(slots[i], CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, phSession);
+	}
+
+	CK_UTF8CHAR pin[] = "12345678";
+	CK_UTF8CHAR label[32];
+
+	memset(label, ' ', sizeof(label));
+	memcpy(label, "digestbench", 11);
+
+	rv = C_InitToken(slots[0], pin, sizeof(pin) - 1, label);
+	if (rv != CKR_OK) return rv;
+
+	return C_OpenSession(slots[0], CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, phSession);
+}
+
+int main(int argc, char** argv)
+{
+	CK_ULONG count = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+	CK_ULONG size = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+	int rounds = argc > 3 ? atoi(argv[3]) : 5;
+	CK_MECHANISM mechanism = { CKM_SHA256, NULL_PTR, 0 };
+	const CK_ULONG digestLen = 32;
+	CK_C_INITIALIZE_ARGS initArgs;
+	CK_SESSION_HANDLE hSession;
+	CK_RV rv;
+
+	if (count == 0 || rounds <= 0)
+	{
+		fprintf(stderr, "usage: %s [count [size [rounds]]]\n", argv[0]);
+		return 1;
+	}
+
+	setenv("SOFTHSM2_CONF", "./softhsm2.conf", 1);
+
+	// The batch is only spread over threads with locking
+	memset(&initArgs, 0, sizeof(initArgs));
+	initArgs.flags = CKF_OS_LOCKING_OK;
+
+	rv = C_Initialize(&initArgs);
+	if (rv == CKR_OK) rv = openSession(&hSession);
+	if (rv != CKR_OK)
+	{
+		fprintf(stderr, "Could not open a session: 0x%08lX\n", rv);
+		return 1;
+	}
+
+	std::vector<CK_BYTE> data(count * size);
+	std::vector<CK_BYTE_PTR> ppData(count);
+	std::vector<CK_ULONG> dataLens(count, size);
+	std::vector<CK_BYTE> batchDigests(count * digestLen);
+	std::vector<CK_BYTE> loopDigests(count * digestLen);
+
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] = (CK_BYTE)(i * 31 + 7);
+	}
+
+	for (CK_ULONG i = 0; i < count; i++)
+	{
+		ppData[i] = &data[i * size];
+	}
+
+	double bestBatch = 0;
+	double bestLoop = 0;
+
+	for (int round = 0; round < rounds && rv == CKR_OK; round++)
+	{
+		double start = now();
+
+		CK_ULONG ulDigestsLen = batchDigests.size();
+		rv = C_SoftHSM_DigestBatch(hSession, &mechanism, count, &ppData.front(), &dataLens.front(), &batchDigests.front(), &ulDigestsLen);
+
+		double batch = now() - start;
+
+		start = now();
+
+		for (CK_ULONG i = 0; i < count && rv == CKR_OK; i++)
+		{
+			CK_ULONG ulDigestLen = digestLen;
+
+			rv = C_DigestInit(hSession, &mechanism);
+			if (rv == CKR_OK) rv = C_Digest(hSession, ppData[i], size, &loopDigests[i * digestLen], &ulDigestLen);
+		}
+
+		double loop = now() - start;
+
+		if (round == 0 || batch < bestBatch) bestBatch = batch;
+		if (round == 0 || loop < bestLoop) bestLoop = loop;
+	}
+
+	if (rv != CKR_OK)
+	{
+		fprintf(stderr, "Digesting failed: 0x%08lX\n", rv);
+		return 1;
+	}
+
+	if (batchDigests != loopDigests)
+	{
+		fprintf(stderr, "The digests differ\n");
+		return 1;
+	}
+
+	printf("%lu messages of %lu bytes, SHA-256, best of %d rounds\n", count, size, rounds);
+	printf("C_Digest loop:         %10.3f ms %10.1f ns/message\n", bestLoop * 1e3, bestLoop * 1e9 / count);
+	printf("C_SoftHSM_DigestBatch: %10.3f ms %10.1f ns/message\n", bestBatch * 1e3, bestBatch * 1e9 / count);
+	printf("Speedup:               %10.2f\n", bestLoop / bestBatch);
+
+	C_CloseSession(hSession);
+	C_Finalize(NULL_PTR);
+
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2010 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ parsebench.cpp
+
+ Measures how fast the object files of a token are read and parsed, by timing
+ C_Initialize, which loads every object of every token:
+
+   ./parsebench [count [rounds]]
+
+ The tokens are kept in parsebench-tokens in the current directory, apart
+ from those of p11test. The first run fills a token labelled "parsebench"
+ with count real object files, EC P-256 key pairs; later runs reuse them.
+ The best time of the rounds is reported.
+ *****************************************************************************/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <vector>
+#include "cryptoki.h"
+#include "softhsm2_vendor.h"
+
+// The number of key pairs generated per call
+#define BATCH_SIZE	500
+
+// Use a token directory of our own, so that the objects do not slow down
+// the other tests
+static bool writeConfig()
+{
+	FILE* fp = fopen("./parsebench.conf", "w");
+	if (fp == NULL) return false;
+
+	fprintf(fp, "directories.tokendir = ./parsebench-tokens\n");
+	fprintf(fp, "objectstore.backend = file\n");
+	fprintf(fp, "log.level = ERROR\n");
+	fprintf(fp, "slots.removable = false\n");
+
+	if (fclose(fp) != 0) return false;
+
+	mkdir("./parsebench-tokens", 0700);
+
+	setenv("SOFTHSM2_CONF", "./parsebench.conf", 1);
+
+	return true;
+}
+
+// Return a monotonic time in seconds
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Open a read/write session on the benchmark token, initialising a free token
+// for it if needed
+static CK_RV openSession(CK_SESSION_HANDLE* phSession)
+{
+	CK_UTF8CHAR label[32];
+
+	memset(label, ' ', sizeof(label));
+	memcpy(label, "parsebench", 10);
+
+	CK_ULONG ulSlots;
+	CK_RV rv = C_GetSlotList(CK_TRUE, NULL_PTR, &ulSlots);
+	if (rv != CKR_OK) return rv;
+
+	std::vector<CK_SLOT_ID> slots(ulSlots);
+	rv = C_GetSlotList(CK_TRUE, &slots.front(), &ulSlots);
+	if (rv != CKR_OK) return rv;
+
+	CK_SLOT_ID freeSlot = slots[0];
+	bool haveFree = false;
+
+	for (CK_ULONG i = 0; i < ulSlots; i++)
+	{
+		CK_TOKEN_INFO info;
+
+		rv = C_GetTokenInfo(slots[i], &info);
+		if (rv != CKR_OK) return rv;
+
+		if (!(info.flags & CKF_TOKEN_INITIALIZED))
+		{
+			if (!haveFree) freeSlot = slots[i];
+			haveFree = true;
+
+			continue;
+		}
+
+		if (memcmp(info.label, label, sizeof(label)) == 0)
+		{
+			return C_OpenSession(slots[i], CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, phSession);
+		}
+	}
+
+	if (!haveFree) return CKR_TOKEN_NOT_PRESENT;
+
+	CK_UTF8CHAR pin[] = "12345678";
+
+	rv = C_InitToken(freeSlot, pin, sizeof(pin) - 1, label);
+	if (rv != CKR_OK) return rv;
+
+	return C_OpenSession(freeSlot, CKF_SERIAL_SESSION | CKF_RW_SESSION, NULL_PTR, NULL_PTR, phSession);
+}
+
+// Count the objects of the token of the session
+static CK_RV countObjects(CK_SESSION_HANDLE hSession, CK_ULONG* pulCount)
+{
+	CK_OBJECT_HANDLE handles[1024];
+	CK_ULONG ulFound;
+
+	*pulCount = 0;
+
+	CK_RV rv = C_FindObjectsInit(hSession, NULL_PTR, 0);
+	if (rv != CKR_OK) return rv;
+
+	do
+	{
+		rv = C_FindObjects(hSession, handles, 1024, &ulFound);
+		*pulCount += ulFound;
+	}
+	while (rv == CKR_OK && ulFound > 0);
+
+	C_FindObjectsFinal(hSession);
+
+	return rv;
+}
+
+// Add public EC key pairs to the token until it holds count objects
+static CK_RV fillToken(CK_SESSION_HANDLE hSession, CK_ULONG count, CK_ULONG have)
+{
+	CK_MECHANISM mechanism = { CKM_EC_KEY_PAIR_GEN, NULL_PTR, 0 };
+	CK_BYTE oidP256[] = { 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07 };
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_ATTRIBUTE pubTemplate[] = {
+		{ CKA_EC_PARAMS, oidP256, sizeof(oidP256) },
+		{ CKA_TOKEN, &bTrue, sizeof(bTrue) },
+		{ CKA_PRIVATE, &bFalse, sizeof(bFalse) },
+		{ CKA_VERIFY, &bTrue, sizeof(bTrue) }
+	};
+	CK_ATTRIBUTE privTemplate[] = {
+		{ CKA_TOKEN, &bTrue, sizeof(bTrue) },
+		{ CKA_PRIVATE, &bFalse, sizeof(bFalse) },
+		{ CKA_SENSITIVE, &bTrue, sizeof(bTrue) },
+		{ CKA_SIGN, &bTrue, sizeof(bTrue) }
+	};
+	std::vector<CK_OBJECT_HANDLE> hPublicKeys(BATCH_SIZE);
+	std::vector<CK_OBJECT_HANDLE> hPrivateKeys(BATCH_SIZE);
+	CK_RV rv = CKR_OK;
+
+	while (have < count && rv == CKR_OK)
+	{
+		CK_ULONG pairs = (count - have + 1) / 2;
+		if (pairs > BATCH_SIZE) pairs = BATCH_SIZE;
+
+		rv = C_SoftHSM_GenerateKeyPairBatch(hSession, &mechanism,
+						    pubTemplate, sizeof(pubTemplate) / sizeof(CK_ATTRIBUTE),
+						    privTemplate, sizeof(privTemplate) / sizeof(CK_ATTRIBUTE),
+						    pairs, &hPublicKeys.front(), &hPrivateKeys.front());
+		have += 2 * pairs;
+	}
+
+	return rv;
+}
+
+int main(int argc, char** argv)
+{
+	CK_ULONG count = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+	int rounds = argc > 2 ? atoi(argv[2]) : 7;
+	CK_SESSION_HANDLE hSession;
+	CK_ULONG have;
+	CK_RV rv;
+
+	if (count == 0 || rounds <= 0)
+	{
+		fprintf(stderr, "usage: %s [count [rounds]]\n", argv[0]);
+		return 1;
+	}
+
+	if (!writeConfig())
+	{
+		fprintf(stderr, "Could not write the configuration\n");
+		return 1;
+	}
+
+	rv = C_Initialize(NULL_PTR);
+	if (rv == CKR_OK) rv = openSession(&hSession);
+	if (rv == CKR_OK) rv = countObjects(hSession, &have);
+	if (rv != CKR_OK)
+	{
+		fprintf(stderr, "Could not open a session: 0x%08lX\n", rv);
+		return 1;
+	}
+
+	if (have < count)
+	{
+		printf("Generating %lu objects\n", count - have);
+
+		rv = fillToken(hSession, count, have);
+		if (rv == CKR_OK) rv = countObjects(hSession, &have);
+		if (rv != CKR_OK)
+		{
+			fprintf(stderr, "Could not generate the objects: 0x%08lX\n", rv);
+			return 1;
+		}
+	}
+
+	C_Finalize(NULL_PTR);
+
+	// Load the token once, so that every round runs with a warm cache
+	rv = C_Initialize(NULL_PTR);
+
+	double best = 0;
+
+	for (int round = 0; round < rounds && rv == CKR_OK; round++)
+	{
+		C_Finalize(NULL_PTR);
+
+		double start = now();
+
+		rv = C_Initialize(NULL_PTR);
+
+		double elapsed = now() - start;
+
+		if (round == 0 || elapsed < best) best = elapsed;
+	}
+
+	if (rv != CKR_OK)
+	{
+		fprintf(stderr, "Could not initialise: 0x%08lX\n", rv);
+		return 1;
+	}
+
+	C_Finalize(NULL_PTR);
+
+	printf("%lu objects in the benchmark token, best of %d rounds\n", have, rounds);
+	printf("C_Initialize: %10.3f ms %10.1f objects/s\n", best * 1e3, have / best);
+
+	return 0;
+}